@@ -0,0 +1,160 @@
+/* Archive file format.
+ */
+
+#include "archive_format.hh"
+
+#include <cerrno>
+#include <cstring>
+
+#include <sys/file.h>
+
+#include "crc32c.hh"
+
+/* PNG style: high bit set and line endings to detect text mode transfers. */
+const uint8_t torikuru::kArchiveMagic[kArchiveMagicSize] = { 0x89, 'T', 'K', 'A', '\r', '\n', 0x1a, '\n' };
+
+/* Random, a chance match in compressed data still needs a valid header
+ * checksum to be taken for a block.
+ */
+const uint8_t torikuru::kArchiveSync[kArchiveSyncSize] = { 0xd9, 0x7f, 0x1c, 0x52, 0xa6, 0x3e, 0xe1, 0x94 };
+
+static inline
+void
+EncodeFixed16 (
+	uint16_t value,
+	uint8_t* buf
+	)
+{
+	buf[0] = static_cast<uint8_t> (value);
+	buf[1] = static_cast<uint8_t> (value >> 8);
+}
+
+static inline
+void
+EncodeFixed32 (
+	uint32_t value,
+	uint8_t* buf
+	)
+{
+	buf[0] = static_cast<uint8_t> (value);
+	buf[1] = static_cast<uint8_t> (value >> 8);
+	buf[2] = static_cast<uint8_t> (value >> 16);
+	buf[3] = static_cast<uint8_t> (value >> 24);
+}
+
+static inline
+uint16_t
+DecodeFixed16 (
+	const uint8_t* buf
+	)
+{
+	return static_cast<uint16_t> (buf[0] | (buf[1] << 8));
+}
+
+static inline
+uint32_t
+DecodeFixed32 (
+	const uint8_t* buf
+	)
+{
+	return static_cast<uint32_t> (buf[0]) |
+	       (static_cast<uint32_t> (buf[1]) << 8) |
+	       (static_cast<uint32_t> (buf[2]) << 16) |
+	       (static_cast<uint32_t> (buf[3]) << 24);
+}
+
+void
+torikuru::EncodeFileHeader (
+	const archive_file_header_t& header,
+	uint8_t* buf
+	)
+{
+	memset (buf, 0, kArchiveFileHeaderSize);
+	memcpy (buf, kArchiveMagic, kArchiveMagicSize);
+	EncodeFixed16 (header.version, buf + 8);
+	EncodeFixed16 (header.codec, buf + 10);
+	EncodeFixed32 (header.dictionary_id, buf + 12);
+	EncodeFixed32 (header.flags, buf + 16);
+	EncodeFixed32 (Crc32c (0, buf, kArchiveFileHeaderSize - 4), buf + kArchiveFileHeaderSize - 4);
+}
+
+bool
+torikuru::HasArchiveMagic (
+	const uint8_t* buf
+	)
+{
+	return 0 == memcmp (buf, kArchiveMagic, kArchiveMagicSize);
+}
+
+bool
+torikuru::DecodeFileHeader (
+	const uint8_t* buf,
+	archive_file_header_t* header
+	)
+{
+	if (!HasArchiveMagic (buf) ||
+	    Crc32c (0, buf, kArchiveFileHeaderSize - 4) != DecodeFixed32 (buf + kArchiveFileHeaderSize - 4))
+		return false;
+	header->version = DecodeFixed16 (buf + 8);
+	header->codec = DecodeFixed16 (buf + 10);
+	header->dictionary_id = DecodeFixed32 (buf + 12);
+	header->flags = DecodeFixed32 (buf + 16);
+	return true;
+}
+
+void
+torikuru::EncodeBlockHeader (
+	const archive_block_header_t& header,
+	uint8_t* buf
+	)
+{
+	memcpy (buf, kArchiveSync, kArchiveSyncSize);
+	EncodeFixed32 (header.compressed_size, buf + 8);
+	EncodeFixed32 (header.uncompressed_size, buf + 12);
+	EncodeFixed32 (header.record_count, buf + 16);
+	EncodeFixed32 (0, buf + 20);
+	EncodeFixed32 (header.payload_crc, buf + 24);
+	EncodeFixed32 (Crc32c (0, buf, kArchiveBlockHeaderSize - 4), buf + kArchiveBlockHeaderSize - 4);
+}
+
+bool
+torikuru::DecodeBlockHeader (
+	const uint8_t* buf,
+	archive_block_header_t* header
+	)
+{
+	if (0 != memcmp (buf, kArchiveSync, kArchiveSyncSize) ||
+	    Crc32c (0, buf, kArchiveBlockHeaderSize - 4) != DecodeFixed32 (buf + kArchiveBlockHeaderSize - 4))
+		return false;
+	header->compressed_size = DecodeFixed32 (buf + 8);
+	header->uncompressed_size = DecodeFixed32 (buf + 12);
+	header->record_count = DecodeFixed32 (buf + 16);
+	header->payload_crc = DecodeFixed32 (buf + 24);
+	return header->compressed_size <= kArchiveMaxBlockSize &&
+	       header->uncompressed_size <= kArchiveMaxBlockSize;
+}
+
+bool
+torikuru::LockArchiveWriter (
+	int fd
+	)
+{
+	while (-1 == flock (fd, LOCK_SH)) {
+		if (EINTR != errno)
+			return false;
+	}
+	return true;
+}
+
+bool
+torikuru::IsArchiveWriterActive (
+	int fd
+	)
+{
+	if (-1 == flock (fd, LOCK_EX | LOCK_NB))
+		return true;
+	flock (fd, LOCK_UN);
+	return false;
+}
+
+/* eof */
@@ -0,0 +1,123 @@
+/* Archive file format.
+ *
+ * A file header is followed by blocks, each a block header and an
+ * independently compressed payload of whole varint32 length delimited
+ * archive::Marketfeed records.  Both headers and the payload carry CRC32C
+ * so that damage is detected per block, and every block header begins with
+ * a fixed sync marker so that a reader can find the next intact block after
+ * damage.  Integers are little-endian.
+ *
+ *   file header   magic[8] version:u16 codec:u16 dictionary_id:u32
+ *                 flags:u32 reserved:u32[2] header_crc:u32
+ *   block header  sync[8] compressed_size:u32 uncompressed_size:u32
+ *                 record_count:u32 reserved:u32 payload_crc:u32
+ *                 header_crc:u32
+ *
+ * The codec applies to every block of a file: zlib as captured, or
+ * Zstandard as rewritten by compaction for retention.  A non-zero
+ * dictionary id names the trained Zstandard dictionary every block is
+ * compressed with, without which the archive cannot be read.  Version 2
+ * introduced the dictionary: archives with one are written as version 2 so
+ * that earlier readers refuse them rather than report every block damaged,
+ * all others remain version 1.  Flags are informational, a reader may
+ * ignore any it does not know.
+ *
+ * Files without the magic are legacy archives: zlib streams of the same
+ * records, concatenated at segment boundaries, without any framing.
+ */
+
+#ifndef __ARCHIVE_FORMAT_HH__
+#define __ARCHIVE_FORMAT_HH__
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include <archive.pb.h>
+
+namespace torikuru
+{
+
+	static const size_t kArchiveFileHeaderSize = 32;
+	static const size_t kArchiveBlockHeaderSize = 32;
+	static const size_t kArchiveMagicSize = 8;
+	static const size_t kArchiveSyncSize = 8;
+
+	static const uint16_t kArchiveVersion = 2;
+	static const uint16_t kArchiveBaseVersion = 1;
+/* Lowest version able to read blocks compressed with a dictionary. */
+	static const uint16_t kArchiveDictionaryVersion = 2;
+
+/* Bounds on a block accepted by readers, larger sizes are treated as damage
+ * rather than allocated.
+ */
+	static const uint32_t kArchiveMaxBlockSize = 64 * 1024 * 1024;
+
+	extern const uint8_t kArchiveMagic[kArchiveMagicSize];
+	extern const uint8_t kArchiveSync[kArchiveSyncSize];
+
+	enum archive_codec_t {
+		ARCHIVE_CODEC_ZLIB = 0,
+		ARCHIVE_CODEC_ZSTD = 1
+	};
+
+/* File header flags. */
+	enum {
+		ARCHIVE_FLAG_COMPACTED = 1 << 0		/* rewritten for retention */
+	};
+
+	struct archive_file_header_t {
+		uint16_t version;
+		uint16_t codec;
+		uint32_t dictionary_id;
+		uint32_t flags;
+	};
+
+	struct archive_block_header_t {
+		uint32_t compressed_size;
+		uint32_t uncompressed_size;
+		uint32_t record_count;
+		uint32_t payload_crc;
+	};
+
+	void EncodeFileHeader (const archive_file_header_t& header, uint8_t* buf);
+/* False without the magic, i.e. a legacy archive, or if damaged. */
+	bool DecodeFileHeader (const uint8_t* buf, archive_file_header_t* header);
+	bool HasArchiveMagic (const uint8_t* buf);
+
+	void EncodeBlockHeader (const archive_block_header_t& header, uint8_t* buf);
+/* Checks the sync marker, header checksum and size bounds. */
+	bool DecodeBlockHeader (const uint8_t* buf, archive_block_header_t* header);
+
+/* A writer holds a shared flock(2) on its archive while open so that
+ * followers and compaction can tell a live archive from one whose writer
+ * has gone, whether or not a close was seen.
+ */
+	bool LockArchiveWriter (int fd);
+/* Probes with a non-blocking exclusive lock, an archive is taken as live
+ * when the probe fails for any reason.
+ */
+	bool IsArchiveWriterActive (int fd);
+
+/* Record size for framing, cached for SerializeWithCachedSizesToArray().
+ * ByteSize() is deprecated from Protocol Buffers 3.1 in favour of
+ * ByteSizeLong(), records are bounded far below 4GB.
+ */
+	inline
+	uint32_t
+	RecordByteSize (
+		const archive::Marketfeed& mfeed
+		)
+	{
+#if GOOGLE_PROTOBUF_VERSION >= 3001000
+		return static_cast<uint32_t> (mfeed.ByteSizeLong());
+#else
+		return static_cast<uint32_t> (mfeed.ByteSize());
+#endif
+	}
+
+} /* namespace torikuru */
+
+#endif /* __ARCHIVE_FORMAT_HH__ */
+
+/* eof */
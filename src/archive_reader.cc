@@ -0,0 +1,714 @@
+/* Archive reader.
+ */
+
+#include "archive_reader.hh"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+
+#include <poll.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cerrno>
+
+#include <zlib.h>
+#include <zstd.h>
+
+/* Protocol Buffers */
+#include <google/protobuf/io/coded_stream.h>
+
+#include "chromium/logging.hh"
+#include "chromium/safe_strerror_posix.hh"
+#include "archive_format.hh"
+#include "crc32c.hh"
+#include "trace.hh"
+
+/* Re-check for appended data without a notification, e.g. on network file
+ * systems.
+ */
+static const int kFollowPollMs = 1000;
+
+/* File bytes searched per read for a sync marker. */
+static const size_t kResyncChunkSize = 64 * 1024;
+
+/* Decoded bytes returned per legacy stream buffer. */
+static const int kInflateBufferSize = 64 * 1024;
+
+/* Block for a modification or close of the file, the close is only noted
+ * here and end of file returned once the data before it is drained.  A
+ * writer gone without a notification, e.g. before the watch was added or on
+ * another host, is found by its lock on every quiet poll.
+ */
+static
+void
+WaitForWriter (
+	int fd,
+	int inotify_fd,
+	bool* is_writer_closed
+	)
+{
+	TRACE_EVENT("Archive.Follow");
+	struct pollfd pfd;
+	pfd.fd = inotify_fd, pfd.events = POLLIN, pfd.revents = 0;
+	const int rc = poll (&pfd, 1, kFollowPollMs);
+	if (0 == rc && !torikuru::IsArchiveWriterActive (fd)) {
+		LOG(INFO) << "Followed archive no longer has a writer.";
+		*is_writer_closed = true;
+	}
+	if (rc <= 0)
+		return;
+	char buf[sizeof (struct inotify_event) * 16];
+	const ssize_t len = read (inotify_fd, buf, sizeof (buf));
+	for (ssize_t i = 0; i < len;) {
+		const struct inotify_event* event = reinterpret_cast<const struct inotify_event*> (buf + i);
+		if (event->mask & (IN_CLOSE_WRITE | IN_DELETE_SELF | IN_MOVE_SELF)) {
+			LOG(INFO) << "Followed archive closed by writer.";
+			*is_writer_closed = true;
+		}
+		i += sizeof (struct inotify_event) + event->len;
+	}
+}
+
+namespace torikuru
+{
+
+/* read(2) source that waits at end of file for the writer.  A record
+ * straddling the end of the written data simply blocks its decoder until
+ * the remainder arrives.
+ */
+	class tail_input_stream_t :
+		public google::protobuf::io::CopyingInputStream
+	{
+	public:
+		tail_input_stream_t (int fd, int inotify_fd, bool* is_writer_closed) :
+			fd_ (fd),
+			inotify_fd_ (inotify_fd),
+			is_writer_closed_ (is_writer_closed)
+		{
+		}
+
+		int Read (void* buffer, int size) override {
+			while (true) {
+				const ssize_t rc = read (fd_, buffer, size);
+				if (rc > 0)
+					return static_cast<int> (rc);
+				if (rc < 0) {
+					if (EINTR == errno)
+						continue;
+					LOG(ERROR) << "read: " << safe_strerror (errno);
+					return -1;
+				}
+				if (*is_writer_closed_)
+					return 0;
+				WaitForWriter (fd_, inotify_fd_, is_writer_closed_);
+			}
+		}
+
+	private:
+		int fd_;
+		int inotify_fd_;
+		bool* is_writer_closed_;
+	};
+
+/* zlib decoder of legacy archives.  Unlike GzipInputStream everything
+ * decoded before an error is returned first, and where the input failed is
+ * kept for reporting.  Concatenated zlib streams are decoded in turn.
+ */
+	class inflate_input_stream_t :
+		public google::protobuf::io::ZeroCopyInputStream
+	{
+	public:
+		explicit inflate_input_stream_t (google::protobuf::io::ZeroCopyInputStream* sub_stream) :
+			sub_stream_ (sub_stream),
+			zerror_ (Z_OK),
+			is_in_stream_ (false),
+			is_stream_end_ (false),
+			is_truncated_ (false),
+			error_offset_ (0),
+			output_size_ (0),
+			backup_ (0),
+			byte_count_ (0)
+		{
+			memset (&zstream_, 0, sizeof (zstream_));
+			zerror_ = inflateInit (&zstream_);
+		}
+		~inflate_input_stream_t() {
+			inflateEnd (&zstream_);
+		}
+
+		bool Next (const void** data, int* size) override {
+			if (backup_ > 0) {
+				*data = output_ + output_size_ - backup_;
+				*size = backup_;
+				byte_count_ += backup_;
+				backup_ = 0;
+				return true;
+			}
+			while (Z_OK == zerror_) {
+				if (0 == zstream_.avail_in) {
+					const void* in;
+					int in_size;
+					if (!sub_stream_->Next (&in, &in_size)) {
+						if (is_in_stream_) {
+							is_truncated_ = true;
+							error_offset_ = sub_stream_->ByteCount();
+						}
+						return false;
+					}
+					zstream_.next_in = static_cast<Bytef*> (const_cast<void*> (in));
+					zstream_.avail_in = static_cast<uInt> (in_size);
+					continue;
+				}
+				if (is_stream_end_) {
+					inflateReset (&zstream_);
+					is_stream_end_ = false;
+				}
+				zstream_.next_out = reinterpret_cast<Bytef*> (output_);
+				zstream_.avail_out = sizeof (output_);
+				const int rc = inflate (&zstream_, Z_NO_FLUSH);
+				is_in_stream_ = true;
+				if (Z_STREAM_END == rc) {
+					is_in_stream_ = false;
+					is_stream_end_ = true;
+				} else if (Z_OK != rc && Z_BUF_ERROR != rc) {
+					zerror_ = rc;
+					error_message_.assign (nullptr != zstream_.msg ? zstream_.msg : "zlib error");
+					error_offset_ = sub_stream_->ByteCount() - zstream_.avail_in;
+				}
+				output_size_ = sizeof (output_) - zstream_.avail_out;
+				if (output_size_ > 0) {
+					*data = output_;
+					*size = output_size_;
+					byte_count_ += output_size_;
+					return true;
+				}
+			}
+			return false;
+		}
+		void BackUp (int count) override {
+			backup_ = count;
+			byte_count_ -= count;
+		}
+		bool Skip (int count) override {
+			const void* data;
+			int size;
+			while (count > 0) {
+				if (!Next (&data, &size))
+					return false;
+				if (size > count) {
+					BackUp (size - count);
+					return true;
+				}
+				count -= size;
+			}
+			return true;
+		}
+		google::protobuf::int64 ByteCount() const override {
+			return byte_count_;
+		}
+
+/* Stopped by corrupt input or input ending mid stream, at error_offset()
+ * bytes of input.
+ */
+		bool is_damaged() const {
+			return Z_OK != zerror_ || is_truncated_;
+		}
+		bool is_truncated() const {
+			return is_truncated_;
+		}
+		int64_t error_offset() const {
+			return error_offset_;
+		}
+/* Input consumed by the decoder so far. */
+		int64_t input_offset() const {
+			return sub_stream_->ByteCount() - zstream_.avail_in;
+		}
+		const std::string& error_message() const {
+			return error_message_;
+		}
+
+	private:
+		google::protobuf::io::ZeroCopyInputStream* sub_stream_;
+		z_stream zstream_;
+		int zerror_;
+		bool is_in_stream_;
+		bool is_stream_end_;
+		bool is_truncated_;
+		int64_t error_offset_;
+		std::string error_message_;
+		char output_[kInflateBufferSize];
+		int output_size_;
+		int backup_;
+		int64_t byte_count_;
+	};
+
+} /* namespace torikuru */
+
+torikuru::archive_reader_t::archive_reader_t() :
+	fd_ (-1),
+	is_following_ (false),
+	is_legacy_ (false),
+	codec_ (ARCHIVE_CODEC_ZLIB),
+	dictionary_id_ (0),
+	flags_ (0),
+	inotify_fd_ (-1),
+	is_writer_closed_ (false),
+	segment_ (0),
+	block_start_ (0),
+	offset_ (0),
+	block_offset_ (0),
+	zstd_dctx_ (nullptr),
+	damage_count_ (0),
+	lost_byte_count_ (0),
+	lost_record_count_ (0)
+{
+}
+
+torikuru::archive_reader_t::~archive_reader_t()
+{
+	Close();
+}
+
+bool
+torikuru::archive_reader_t::Open (
+	const std::string& path
+	)
+{
+	DCHECK_EQ (-1, fd_);
+	fd_ = open (path.c_str(), O_RDONLY | O_LARGEFILE | O_NOATIME);
+	if (-1 == fd_) {
+		LOG(ERROR) << "Failed to open file \"" << path << "\".";
+		return false;
+	}
+	if (is_following_) {
+		is_writer_closed_ = false;
+/* inotify_init1 is unavailable on RHEL5 kernels. */
+		inotify_fd_ = inotify_init();
+		int flags = -1;
+		if (-1 == inotify_fd_ ||
+		    -1 == (flags = fcntl (inotify_fd_, F_GETFL, 0)) ||
+		    -1 == fcntl (inotify_fd_, F_SETFL, flags | O_NONBLOCK) ||
+		    -1 == fcntl (inotify_fd_, F_SETFD, FD_CLOEXEC) ||
+		    -1 == inotify_add_watch (inotify_fd_, path.c_str(), IN_MODIFY | IN_CLOSE_WRITE | IN_DELETE_SELF | IN_MOVE_SELF))
+		{
+			LOG(ERROR) << "inotify: " << safe_strerror (errno);
+			Close();
+			return false;
+		}
+/* Tested after the watch is added so that no close goes unseen. */
+		if (!IsArchiveWriterActive (fd_)) {
+			LOG(INFO) << "\"" << path << "\" has no writer, reading to the end.";
+			is_writer_closed_ = true;
+		} else {
+			LOG(INFO) << "Following \"" << path << "\" until the writer closes it.";
+		}
+	}
+	damage_count_ = lost_byte_count_ = lost_record_count_ = 0;
+/* The magic is enough to tell the formats apart, a damaged header is
+ * reported and the blocks read regardless.
+ */
+	uint8_t buf[kArchiveFileHeaderSize];
+	const size_t length = ReadAt (0, buf, sizeof (buf), true);
+	is_legacy_ = length < kArchiveMagicSize || !HasArchiveMagic (buf);
+	codec_ = ARCHIVE_CODEC_ZLIB;
+	dictionary_id_ = 0;
+	flags_ = 0;
+	if (!is_legacy_) {
+		archive_file_header_t header;
+		if (length < sizeof (buf) || !DecodeFileHeader (buf, &header)) {
+			ReportDamage (0, kArchiveFileHeaderSize, 0, "damaged file header");
+		} else if (header.version > kArchiveVersion ||
+			   (ARCHIVE_CODEC_ZLIB != header.codec && ARCHIVE_CODEC_ZSTD != header.codec))
+		{
+			LOG(ERROR) << "Unsupported archive version " << header.version << " codec " << header.codec << ".";
+			Close();
+			return false;
+		} else {
+			codec_ = header.codec;
+			dictionary_id_ = header.dictionary_id;
+			flags_ = header.flags;
+		}
+/* Without an intact header zlib is assumed. */
+		if (ARCHIVE_CODEC_ZSTD == codec_) {
+			zstd_dctx_ = ZSTD_createDCtx();
+			if (nullptr == zstd_dctx_) {
+				LOG(ERROR) << "ZSTD_createDCtx failed.";
+				Close();
+				return false;
+			}
+			if (0 != dictionary_id_) {
+				if (dictionary_id_ != ZSTD_getDictID_fromDict (dictionary_.data(), dictionary_.size())) {
+					LOG(ERROR) << "Archive requires Zstandard dictionary id " << dictionary_id_ << ".";
+					Close();
+					return false;
+				}
+				const size_t rc = ZSTD_DCtx_loadDictionary (zstd_dctx_, dictionary_.data(), dictionary_.size());
+				if (ZSTD_isError (rc)) {
+					LOG(ERROR) << "ZSTD_DCtx_loadDictionary: " << ZSTD_getErrorName (rc);
+					Close();
+					return false;
+				}
+			}
+		} else {
+			zstream_.reset (new z_stream_s());
+			if (Z_OK != inflateInit (zstream_.get())) {
+				LOG(ERROR) << "inflateInit failed.";
+				zstream_.reset();
+				Close();
+				return false;
+			}
+		}
+	} else {
+		LOG(INFO) << "Reading legacy archive format.";
+	}
+	segments_.clear();
+	segments_.emplace_back (0, is_legacy_ ? 0 : kArchiveFileHeaderSize);
+/* Optional side index of segments. */
+	const std::string index_path (path + ".idx");
+	FILE* index = fopen (index_path.c_str(), "r");
+	if (nullptr != index) {
+		long tv_sec;
+		long long offset;
+		while (2 == fscanf (index, "%ld %lld", &tv_sec, &offset)) {
+			if (offset <= segments_.back().second) {
+				LOG(WARNING) << "Ignoring out of order index entry at offset " << offset << ".";
+				continue;
+			}
+			segments_.emplace_back (static_cast<time_t> (tv_sec), static_cast<off_t> (offset));
+		}
+		fclose (index);
+		LOG(INFO) << "Loaded " << (segments_.size() - 1) << " checkpoints from \"" << index_path << "\".";
+	}
+	return OpenSegment (0);
+}
+
+void
+torikuru::archive_reader_t::Close()
+{
+	inflate_stream_.reset();
+	limit_stream_.reset();
+	input_stream_.reset();
+	tail_stream_.reset();
+	if ((bool)zstream_) {
+		inflateEnd (zstream_.get());
+		zstream_.reset();
+	}
+	if (nullptr != zstd_dctx_) {
+		ZSTD_freeDCtx (zstd_dctx_);
+		zstd_dctx_ = nullptr;
+	}
+	if (-1 != inotify_fd_) {
+		close (inotify_fd_);
+		inotify_fd_ = -1;
+	}
+	if (-1 != fd_) {
+		close (fd_);
+		fd_ = -1;
+	}
+}
+
+bool
+torikuru::archive_reader_t::OpenSegment (
+	size_t segment
+	)
+{
+	DCHECK_LT (segment, segments_.size());
+	segment_ = segment;
+/* Blocks are self delimiting, segments only mark where to start. */
+	if (!is_legacy_) {
+		offset_ = segments_[segment].second;
+		block_.clear();
+		block_offset_ = 0;
+		return true;
+	}
+	inflate_stream_.reset();
+	limit_stream_.reset();
+	input_stream_.reset();
+	tail_stream_.reset();
+	const off_t offset = segments_[segment].second;
+	if (offset != lseek (fd_, offset, SEEK_SET)) {
+		LOG(ERROR) << "Failed to seek to offset " << offset << ".";
+		return false;
+	}
+/* Bound each zlib stream so that decoders which continue across
+ * concatenated streams do not read into the next segment.  Segments begun
+ * after Open() are unbounded and a followed archive is read through them.
+ */
+	const int64_t limit = (segment + 1 < segments_.size()) ?
+				(segments_[segment + 1].second - offset) : std::numeric_limits<int64_t>::max();
+	if (is_following_) {
+		tail_stream_.reset (new tail_input_stream_t (fd_, inotify_fd_, &is_writer_closed_));
+		input_stream_.reset (new google::protobuf::io::CopyingInputStreamAdaptor (tail_stream_.get()));
+	} else {
+		input_stream_.reset (new google::protobuf::io::FileInputStream (fd_));
+	}
+	limit_stream_.reset (new google::protobuf::io::LimitingInputStream (input_stream_.get(), limit));
+	inflate_stream_.reset (new inflate_input_stream_t (limit_stream_.get()));
+	return true;
+}
+
+bool
+torikuru::archive_reader_t::Seek (
+	time_t tv_sec
+	)
+{
+	TRACE_EVENT("Archive.Seek");
+	damage_count_ = lost_byte_count_ = lost_record_count_ = 0;
+	size_t segment = 0;
+	for (size_t i = 1; i < segments_.size() && segments_[i].first <= tv_sec; ++i)
+		segment = i;
+	return OpenSegment (segment);
+}
+
+bool
+torikuru::archive_reader_t::Read (
+	archive::Marketfeed* mfeed,
+	bool* is_valid
+	)
+{
+	if (is_legacy_)
+		return ReadLegacy (mfeed, is_valid);
+	while (true) {
+		while (block_offset_ >= block_.size()) {
+			if (!NextBlock())
+				return false;
+		}
+		const size_t remaining = block_.size() - block_offset_;
+		google::protobuf::io::CodedInputStream coded_stream (reinterpret_cast<const uint8_t*> (block_.data() + block_offset_), static_cast<int> (remaining));
+		uint32_t size;
+		if (!coded_stream.ReadVarint32 (&size) || size > remaining - coded_stream.CurrentPosition()) {
+/* Within a checksummed block, so a fault of the writer. */
+			ReportDamage (block_start_, 0, 1, "malformed record in block");
+			block_offset_ = block_.size();
+			continue;
+		}
+		const size_t header = coded_stream.CurrentPosition();
+		*is_valid = mfeed->ParseFromArray (block_.data() + block_offset_ + header, static_cast<int> (size));
+		block_offset_ += header + size;
+		return true;
+	}
+}
+
+bool
+torikuru::archive_reader_t::ReadLegacy (
+	archive::Marketfeed* mfeed,
+	bool* is_valid
+	)
+{
+	uint32_t size = 0;
+	while (true) {
+		bool is_framing_lost = false;
+		uint64_t lost_records = 0;
+		{
+			google::protobuf::io::CodedInputStream coded_stream (inflate_stream_.get());
+			if (coded_stream.ReadVarint32 (&size)) {
+/* An undetected corruption may decode as any length. */
+				if (size <= kArchiveMaxBlockSize) {
+					const int limit = coded_stream.PushLimit (static_cast<int> (size));
+					*is_valid = mfeed->ParseFromCodedStream (&coded_stream);
+/* A parse failure may be the record cut short by the end of the data. */
+					if (*is_valid || coded_stream.Skip (coded_stream.BytesUntilLimit())) {
+						coded_stream.PopLimit (limit);
+						return true;
+					}
+					lost_records = 1;
+				}
+				is_framing_lost = true;
+			}
+		}
+		EndLegacySegment (is_framing_lost, lost_records);
+		if (segment_ + 1 < segments_.size() && OpenSegment (segment_ + 1))
+			continue;
+		return false;
+	}
+}
+
+/* Everything from the point of failure to the next segment is lost, the
+ * record counts of legacy archives are unknown.  Without a zlib error the
+ * record framing itself was lost, at about the current decoder position.
+ */
+void
+torikuru::archive_reader_t::EndLegacySegment (
+	bool is_framing_lost,
+	uint64_t lost_records
+	)
+{
+	if (!inflate_stream_->is_damaged() && !is_framing_lost)
+		return;
+	const bool is_damaged = inflate_stream_->is_damaged();
+	const off_t start = segments_[segment_].second + (is_damaged ? inflate_stream_->error_offset() : inflate_stream_->input_offset());
+	const off_t end = (segment_ + 1 < segments_.size()) ? segments_[segment_ + 1].second : FileSize();
+	const char* reason = inflate_stream_->is_truncated() ? "zlib stream truncated" :
+				(is_damaged ? inflate_stream_->error_message().c_str() : "record framing lost");
+	ReportDamage (start, std::max<off_t> (0, end - start), lost_records, reason);
+}
+
+/* Whole blocks are skipped on a checksum failure, the header checksum
+ * vouching for its size, and a damaged header is passed by scanning.
+ */
+bool
+torikuru::archive_reader_t::NextBlock()
+{
+	TRACE_EVENT("Archive.ReadBlock");
+	uint8_t buf[kArchiveBlockHeaderSize];
+	while (true) {
+		const size_t length = ReadAt (offset_, buf, sizeof (buf), true);
+		if (0 == length)
+			return false;
+		if (length < sizeof (buf)) {
+			ReportDamage (offset_, length, 0, "block header truncated");
+			offset_ += length;
+			return false;
+		}
+		archive_block_header_t header;
+		if (!DecodeBlockHeader (buf, &header)) {
+			const off_t next = Resync (offset_ + 1);
+			if (-1 == next) {
+				ReportDamage (offset_, std::max<off_t> (0, FileSize() - offset_), 0, "damaged block header, no further blocks");
+				offset_ = FileSize();
+				return false;
+			}
+			ReportDamage (offset_, next - offset_, 0, "damaged block header");
+			offset_ = next;
+			continue;
+		}
+		const off_t next = offset_ + kArchiveBlockHeaderSize + header.compressed_size;
+		compressed_.resize (header.compressed_size);
+		const size_t payload = ReadAt (offset_ + kArchiveBlockHeaderSize, &compressed_[0], header.compressed_size, true);
+		if (payload < header.compressed_size) {
+			ReportDamage (offset_, kArchiveBlockHeaderSize + payload, header.record_count, "block truncated");
+			offset_ += kArchiveBlockHeaderSize + payload;
+			return false;
+		}
+		if (Crc32c (0, compressed_.data(), compressed_.size()) != header.payload_crc) {
+			ReportDamage (offset_, next - offset_, header.record_count, "block checksum mismatch");
+			offset_ = next;
+			continue;
+		}
+		if (!Decompress (header.uncompressed_size)) {
+			ReportDamage (offset_, next - offset_, header.record_count, "block failed to decompress");
+			offset_ = next;
+			continue;
+		}
+		block_start_ = offset_;
+		offset_ = next;
+		block_offset_ = 0;
+		while (segment_ + 1 < segments_.size() && block_start_ >= segments_[segment_ + 1].second)
+			++segment_;
+		return true;
+	}
+}
+
+bool
+torikuru::archive_reader_t::Decompress (
+	uint32_t uncompressed_size
+	)
+{
+	block_.resize (uncompressed_size);
+	if (ARCHIVE_CODEC_ZSTD == codec_) {
+		const size_t rc = ZSTD_decompressDCtx (zstd_dctx_, &block_[0], uncompressed_size, compressed_.data(), compressed_.size());
+		return !ZSTD_isError (rc) && uncompressed_size == rc;
+	}
+	z_stream_s* zstream = zstream_.get();
+	inflateReset (zstream);
+	zstream->next_in = reinterpret_cast<Bytef*> (&compressed_[0]);
+	zstream->avail_in = static_cast<uInt> (compressed_.size());
+	zstream->next_out = reinterpret_cast<Bytef*> (&block_[0]);
+	zstream->avail_out = uncompressed_size;
+	return Z_STREAM_END == inflate (zstream, Z_FINISH) && 0 == zstream->avail_out;
+}
+
+/* Offset of the first intact block header at or after offset, -1 at end of
+ * file.  A chance sync marker in compressed data fails the header checksum.
+ */
+off_t
+torikuru::archive_reader_t::Resync (
+	off_t offset
+	)
+{
+	TRACE_EVENT("Archive.Resync");
+	std::vector<char> buf (kResyncChunkSize);
+	while (true) {
+		const size_t length = ReadAt (offset, buf.data(), buf.size(), false);
+		if (length < kArchiveSyncSize) {
+			if (!is_following_ || is_writer_closed_)
+				return -1;
+			WaitForWriter (fd_, inotify_fd_, &is_writer_closed_);
+			continue;
+		}
+		const char* end = buf.data() + length;
+		for (const char* p = buf.data();
+		     nullptr != (p = static_cast<const char*> (memmem (p, end - p, kArchiveSync, kArchiveSyncSize)));
+		     ++p)
+		{
+			const off_t candidate = offset + (p - buf.data());
+			uint8_t header[kArchiveBlockHeaderSize];
+			archive_block_header_t block;
+			if (sizeof (header) == ReadAt (candidate, header, sizeof (header), true) &&
+			    DecodeBlockHeader (header, &block))
+				return candidate;
+		}
+		offset += length - (kArchiveSyncSize - 1);
+	}
+}
+
+/* pread(2) of up to size bytes, when waiting and following a live archive
+ * short reads wait for the writer.
+ */
+size_t
+torikuru::archive_reader_t::ReadAt (
+	off_t offset,
+	void* buffer,
+	size_t size,
+	bool is_waiting
+	)
+{
+	size_t done = 0;
+	while (done < size) {
+		const ssize_t rc = pread (fd_, static_cast<char*> (buffer) + done, size - done, offset + done);
+		if (rc > 0) {
+			done += rc;
+			continue;
+		}
+		if (rc < 0) {
+			if (EINTR == errno)
+				continue;
+			LOG(ERROR) << "pread: " << safe_strerror (errno);
+			break;
+		}
+		if (!is_waiting || !is_following_ || is_writer_closed_)
+			break;
+		WaitForWriter (fd_, inotify_fd_, &is_writer_closed_);
+	}
+	return done;
+}
+
+off_t
+torikuru::archive_reader_t::FileSize() const
+{
+	struct stat st;
+	return (-1 == fstat (fd_, &st)) ? 0 : st.st_size;
+}
+
+void
+torikuru::archive_reader_t::ReportDamage (
+	off_t offset,
+	uint64_t length,
+	uint64_t records,
+	const char* reason
+	)
+{
+	LOG(WARNING) << "Archive damaged at offset " << offset << ", " << reason << ": "
+		<< length << " bytes skipped, "
+		<< records << " records known lost.";
+	++damage_count_;
+	lost_byte_count_ += length;
+	lost_record_count_ += records;
+}
+
+/* eof */
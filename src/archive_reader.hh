@@ -0,0 +1,170 @@
+/* Archive reader.
+ *
+ * Reads the records written by archive_writer_t, segment by segment when a
+ * side index is present so that reading may start at a checkpoint.  When
+ * following, reads block at the end of the file until the writer appends
+ * more or closes it, or no writer holds the archive lock.
+ *
+ * Damage does not end reading.  A block failing its checksum is skipped and
+ * a damaged header is passed by scanning for the next sync marker.  Legacy
+ * archives have no framing, every complete record before the damage is
+ * returned and reading resumes at the next indexed segment.  Each loss is
+ * logged with its offset and size, and totalled.
+ */
+
+#ifndef __ARCHIVE_READER_HH__
+#define __ARCHIVE_READER_HH__
+#pragma once
+
+#include <cstdint>
+#include <ctime>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <sys/types.h>
+
+/* Boost noncopyable base class */
+#include <boost/utility.hpp>
+
+/* Protocol Buffers */
+#include <google/protobuf/io/zero_copy_stream_impl.h>
+
+#include <archive.pb.h>
+
+struct z_stream_s;
+struct ZSTD_DCtx_s;
+
+namespace torikuru
+{
+	class tail_input_stream_t;
+	class inflate_input_stream_t;
+
+	class archive_reader_t :
+		boost::noncopyable
+	{
+	public:
+		archive_reader_t();
+		~archive_reader_t();
+
+		bool Open (const std::string& path);
+		void Close();
+
+/* Follow a file still being written, set before Open(). */
+		void set_following (bool is_following) {
+			is_following_ = is_following;
+		}
+/* Zstandard dictionary for archives written with one, set before Open(). */
+		void set_dictionary (const std::string& dictionary) {
+			dictionary_ = dictionary;
+		}
+
+/* Position at the start of the last segment beginning at or before
+ * tv_sec, i.e. at its checkpoint images.  Resets the damage totals.
+ */
+		bool Seek (time_t tv_sec);
+		bool Rewind() {
+			return OpenSegment (0);
+		}
+
+/* Returns false at end of archive, is_valid is false for records that fail
+ * to parse.
+ */
+		bool Read (archive::Marketfeed* mfeed, bool* is_valid);
+
+		size_t segment_count() const {
+			return segments_.size();
+		}
+/* Index of the segment holding the last record read and segment start
+ * times, zero for the first.
+ */
+		size_t segment() const {
+			return segment_;
+		}
+		time_t segment_time (size_t segment) const {
+			return segments_[segment].first;
+		}
+		bool is_legacy() const {
+			return is_legacy_;
+		}
+/* Block codec, zlib for legacy archives. */
+		uint16_t codec() const {
+			return codec_;
+		}
+/* Zstandard dictionary id, zero for none. */
+		uint32_t dictionary_id() const {
+			return dictionary_id_;
+		}
+/* File header flags, ARCHIVE_FLAG_*. */
+		uint32_t flags() const {
+			return flags_;
+		}
+
+/* Damage found since Open() or the last Seek(): regions skipped, their
+ * size in file bytes and records known to be lost, those counted in
+ * skipped block headers or cut short.  Records in a region without an
+ * intact header cannot be counted.
+ */
+		uint64_t damage_count() const {
+			return damage_count_;
+		}
+		uint64_t lost_byte_count() const {
+			return lost_byte_count_;
+		}
+		uint64_t lost_record_count() const {
+			return lost_record_count_;
+		}
+
+	private:
+		bool OpenSegment (size_t segment);
+		bool ReadLegacy (archive::Marketfeed* mfeed, bool* is_valid);
+		void EndLegacySegment (bool is_framing_lost, uint64_t lost_records);
+		bool NextBlock();
+		bool Decompress (uint32_t uncompressed_size);
+		off_t Resync (off_t offset);
+		size_t ReadAt (off_t offset, void* buffer, size_t size, bool is_waiting);
+		off_t FileSize() const;
+		void ReportDamage (off_t offset, uint64_t length, uint64_t records, const char* reason);
+
+		int fd_;
+		bool is_following_;
+		bool is_legacy_;
+		uint16_t codec_;
+		uint32_t dictionary_id_;
+		uint32_t flags_;
+		std::string dictionary_;
+/* inotify watch on the file and whether the writer has closed it. */
+		int inotify_fd_;
+		bool is_writer_closed_;
+/* Start time and file offset, segment 0 is the first record. */
+		std::vector<std::pair<time_t, off_t>> segments_;
+		size_t segment_;
+
+/* Block format: offsets of the current and next block headers, the current
+ * block decompressed and the read position within it.
+ */
+		off_t block_start_;
+		off_t offset_;
+		std::string compressed_;
+		std::string block_;
+		size_t block_offset_;
+		std::unique_ptr<z_stream_s> zstream_;
+		ZSTD_DCtx_s* zstd_dctx_;
+
+/* Legacy format. */
+		std::unique_ptr<tail_input_stream_t> tail_stream_;
+		std::unique_ptr<google::protobuf::io::ZeroCopyInputStream> input_stream_;
+		std::unique_ptr<google::protobuf::io::LimitingInputStream> limit_stream_;
+		std::unique_ptr<inflate_input_stream_t> inflate_stream_;
+
+		uint64_t damage_count_;
+		uint64_t lost_byte_count_;
+		uint64_t lost_record_count_;
+	};
+
+} /* namespace torikuru */
+
+#endif /* __ARCHIVE_READER_HH__ */
+
+/* eof */
@@ -0,0 +1,605 @@
+/* Archive writer.
+ */
+
+#include "archive_writer.hh"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cerrno>
+
+#include <zlib.h>
+#include <zstd.h>
+
+/* Protocol Buffers */
+#include <google/protobuf/io/coded_stream.h>
+
+#include "chromium/logging.hh"
+#include "chromium/safe_strerror_posix.hh"
+#include "archive_format.hh"
+#include "crc32c.hh"
+#include "histograms.hh"
+#include "trace.hh"
+
+/* Framed records queued before the caller waits for the background thread. */
+static const size_t kMaxPendingBytes = 16 * 1024 * 1024;
+
+/* Uncompressed bytes per block by default, beyond the 32KB deflate window
+ * larger blocks gain little ratio and delay followers.
+ */
+static const size_t kDefaultBlockSize = 256 * 1024;
+
+namespace torikuru
+{
+
+/* write(2) sink timing each system call. */
+	class timed_file_stream_t
+	{
+	public:
+		timed_file_stream_t (int fd, uint64_t* ticks) : fd_ (fd), ticks_ (ticks) {}
+
+		bool Write (const void* buffer, size_t size) {
+			const char* p = static_cast<const char*> (buffer);
+			TRACE_EVENT("Archive.WriteFile");
+			while (size > 0) {
+				const uint64_t start = clock_service_t::ReadTicks();
+				const ssize_t rc = write (fd_, p, size);
+				const uint64_t elapsed = clock_service_t::ReadTicks() - start;
+				*ticks_ += elapsed;
+				HISTOGRAM_NANOSECONDS("Archive.WriteTime", elapsed);
+				if (rc < 0) {
+					if (EINTR == errno)
+						continue;
+					LOG(ERROR) << "write: " << safe_strerror (errno);
+					return false;
+				}
+				p += rc;
+				size -= static_cast<size_t> (rc);
+			}
+			return true;
+		}
+
+	private:
+		int fd_;
+		uint64_t* ticks_;
+	};
+
+} /* namespace torikuru */
+
+torikuru::archive_writer_t::archive_writer_t() :
+	codec_ (ARCHIVE_CODEC_ZLIB),
+	block_size_ (kDefaultBlockSize),
+	flags_ (0),
+	compression_level_ (1),
+	fd_ (-1),
+	index_ (nullptr),
+	zstd_cctx_ (nullptr),
+	block_record_count_ (0),
+	offset_ (0),
+	synced_offset_ (0),
+	write_ticks_ (0),
+	compression_ticks_ (0),
+	record_count_ (0),
+	byte_count_ (0),
+	segment_count_ (0),
+	is_stamping_ (true),
+	is_failed_ (false),
+	flush_interval_ (0),
+	fsync_policy_ (FSYNC_NONE),
+	flush_requested_ (false),
+	stop_requested_ (false),
+	compressed_byte_count_ (0)
+{
+}
+
+torikuru::archive_writer_t::~archive_writer_t()
+{
+	Close();
+}
+
+static const char* kCounterNames[] = {
+	"archive_flushes",
+	"archive_flush_microseconds",
+	"archive_syncs",
+	"archive_sync_microseconds",
+	"archive_queue_full_waits",
+	"archive_write_errors"
+};
+
+static_assert (sizeof (kCounterNames) / sizeof (kCounterNames[0]) == torikuru::WRITER_PC_MAX, "counter name per counter");
+
+const char*
+torikuru::archive_writer_t::GetCounterName (
+	unsigned counter
+	)
+{
+	DCHECK_LT (counter, static_cast<unsigned> (WRITER_PC_MAX));
+	return kCounterNames[counter];
+}
+
+bool
+torikuru::archive_writer_t::Open (
+	const std::string& path,
+	int compression_level
+	)
+{
+	DCHECK(!is_open());
+	DCHECK_GT (block_size_, 0U);
+	DCHECK_LE (block_size_, kArchiveMaxBlockSize / 2);
+	archive_file_header_t header;
+	header.version = kArchiveBaseVersion;
+	header.codec = codec_;
+	header.dictionary_id = 0;
+	header.flags = flags_;
+	if (ARCHIVE_CODEC_ZSTD == codec_) {
+		zstd_cctx_ = ZSTD_createCCtx();
+		size_t rc = (nullptr == zstd_cctx_) ? 0 : ZSTD_CCtx_setParameter (zstd_cctx_, ZSTD_c_compressionLevel, compression_level);
+		if (nullptr == zstd_cctx_ || ZSTD_isError (rc)) {
+			LOG(ERROR) << "ZSTD_CCtx_setParameter: " << (nullptr != zstd_cctx_ ? ZSTD_getErrorName (rc) : "failed");
+			Close();
+			return false;
+		}
+		if (!dictionary_.empty()) {
+/* A raw content dictionary has no id to find it by when reading. */
+			header.dictionary_id = ZSTD_getDictID_fromDict (dictionary_.data(), dictionary_.size());
+			if (0 == header.dictionary_id) {
+				LOG(ERROR) << "Dictionary has no id, not a trained Zstandard dictionary.";
+				Close();
+				return false;
+			}
+			header.version = kArchiveDictionaryVersion;
+			rc = ZSTD_CCtx_loadDictionary (zstd_cctx_, dictionary_.data(), dictionary_.size());
+			if (ZSTD_isError (rc)) {
+				LOG(ERROR) << "ZSTD_CCtx_loadDictionary: " << ZSTD_getErrorName (rc);
+				Close();
+				return false;
+			}
+		}
+	} else if (!dictionary_.empty()) {
+		LOG(ERROR) << "A dictionary requires the Zstandard codec.";
+		return false;
+	} else {
+		zstream_.reset (new z_stream_s());
+		if (Z_OK != deflateInit (zstream_.get(), compression_level)) {
+			LOG(ERROR) << "deflateInit: " << (nullptr != zstream_->msg ? zstream_->msg : "failed");
+			zstream_.reset();
+			return false;
+		}
+	}
+/* Existing records are discarded, not appended to. */
+	struct stat st;
+	if (0 == stat (path.c_str(), &st) && st.st_size > 0)
+		LOG(WARNING) << "Truncating existing file \"" << path << "\" of " << st.st_size << " bytes.";
+	fd_ = open (path.c_str(),
+			O_WRONLY | O_CREAT | O_TRUNC | O_LARGEFILE,
+			S_IREAD | S_IWRITE);
+	if (-1 == fd_) {
+		LOG(ERROR) << "Failed to open file \"" << path << "\".";
+		Close();
+		return false;
+	}
+/* Released with the descriptor. */
+	if (!LockArchiveWriter (fd_))
+		LOG(WARNING) << "flock \"" << path << "\": " << safe_strerror (errno) << ", followers will only stop on a close notification.";
+	path_ = path;
+	compression_level_ = compression_level;
+	is_failed_ = false;
+	file_stream_.reset (new timed_file_stream_t (fd_, &write_ticks_));
+	record_count_ = 0;
+	byte_count_ = 0;
+	segment_count_ = 1;
+	block_.clear();
+	block_.reserve (block_size_ + 64 * 1024);
+	block_record_count_ = 0;
+	uint8_t buf[kArchiveFileHeaderSize];
+	EncodeFileHeader (header, buf);
+	if (!file_stream_->Write (buf, sizeof (buf))) {
+		Close();
+		return false;
+	}
+	offset_ = synced_offset_ = sizeof (buf);
+	return true;
+}
+
+bool
+torikuru::archive_writer_t::Start (
+	unsigned flush_interval,
+	fsync_policy_t fsync_policy
+	)
+{
+	DCHECK(is_open());
+	DCHECK(!(bool)thread_);
+	flush_interval_ = flush_interval;
+	fsync_policy_ = fsync_policy;
+	flush_requested_ = false;
+	stop_requested_ = false;
+	compressed_byte_count_ = offset_;
+	thread_.reset (new boost::thread (boost::bind (&archive_writer_t::Run, this)));
+	return true;
+}
+
+/* The index is opened by the caller so that failure is reported to it, the
+ * segment itself may be begun later on the background thread.
+ */
+bool
+torikuru::archive_writer_t::BeginSegment (
+	time_t tv_sec
+	)
+{
+	TRACE_EVENT("Archive.BeginSegment");
+	DCHECK(is_open());
+	if (nullptr == index_) {
+		const std::string index_path (path_ + ".idx");
+		index_ = fopen (index_path.c_str(), "w");
+		if (nullptr == index_) {
+			LOG(ERROR) << "Failed to open file \"" << index_path << "\".";
+			return false;
+		}
+	}
+	++segment_count_;
+	if ((bool)thread_) {
+		{
+			boost::lock_guard<boost::mutex> lock (lock_);
+			pending_segments_.emplace_back (pending_.size(), tv_sec);
+		}
+		not_empty_.notify_one();
+		return true;
+	}
+	NextSegment (tv_sec);
+	return true;
+}
+
+void
+torikuru::archive_writer_t::NextSegment (
+	time_t tv_sec
+	)
+{
+/* No index entry for a segment that was never written. */
+	if (!EndBlock())
+		return;
+	fprintf (index_, "%ld %lld\n", static_cast<long> (tv_sec), static_cast<long long> (offset_));
+	fflush (index_);
+/* The finished segment is complete in the file. */
+	if (FSYNC_ROTATE == fsync_policy_)
+		Sync();
+}
+
+/* Compress the open block as one zlib stream or Zstandard frame behind its
+ * header and write both with a single write(2), so that a follower sees
+ * either none or all of the block once the call completes.
+ */
+bool
+torikuru::archive_writer_t::EndBlock()
+{
+	if (is_failed_) {
+		block_.clear();
+		block_record_count_ = 0;
+		return false;
+	}
+	if (block_.empty())
+		return true;
+	const uint64_t start = clock_service_t::ReadTicks();
+	archive_block_header_t header;
+	if (!Compress (&header.compressed_size)) {
+		OnWriteError();
+		return false;
+	}
+	header.uncompressed_size = static_cast<uint32_t> (block_.size());
+	header.record_count = block_record_count_;
+	header.payload_crc = Crc32c (0, &output_[kArchiveBlockHeaderSize], header.compressed_size);
+	EncodeBlockHeader (header, reinterpret_cast<uint8_t*> (&output_[0]));
+	const uint64_t elapsed = clock_service_t::ReadTicks() - start;
+	compression_ticks_ += elapsed;
+	HISTOGRAM_NANOSECONDS("Archive.CompressionTime", elapsed);
+	block_.clear();
+	block_record_count_ = 0;
+	const size_t length = kArchiveBlockHeaderSize + header.compressed_size;
+	if (!file_stream_->Write (output_.data(), length)) {
+		OnWriteError();
+		return false;
+	}
+	offset_ += length;
+	return true;
+}
+
+void
+torikuru::archive_writer_t::OnWriteError()
+{
+	cumulative_stats_[WRITER_PC_WRITE_ERRORS]++;
+	is_failed_ = true;
+/* Best effort removal of a partly written block. */
+	if (-1 == ftruncate (fd_, offset_))
+		LOG(WARNING) << "ftruncate: " << safe_strerror (errno);
+	LOG(ERROR) << "Archive \"" << path_ << "\" ends at offset " << offset_ << ", no further records are written.";
+}
+
+/* Into output_ after room for the block header. */
+bool
+torikuru::archive_writer_t::Compress (
+	uint32_t* compressed_size
+	)
+{
+	TRACE_EVENT("Archive.Compress");
+	if (ARCHIVE_CODEC_ZSTD == codec_) {
+		const size_t bound = ZSTD_compressBound (block_.size());
+		output_.resize (kArchiveBlockHeaderSize + bound);
+		const size_t rc = ZSTD_compress2 (zstd_cctx_, &output_[kArchiveBlockHeaderSize], bound, block_.data(), block_.size());
+		if (ZSTD_isError (rc)) {
+			LOG(ERROR) << "ZSTD_compress2: " << ZSTD_getErrorName (rc);
+			return false;
+		}
+		*compressed_size = static_cast<uint32_t> (rc);
+		return true;
+	}
+	z_stream_s* zstream = zstream_.get();
+	deflateReset (zstream);
+	const uLong bound = deflateBound (zstream, static_cast<uLong> (block_.size()));
+	output_.resize (kArchiveBlockHeaderSize + bound);
+	zstream->next_in = reinterpret_cast<Bytef*> (&block_[0]);
+	zstream->avail_in = static_cast<uInt> (block_.size());
+	zstream->next_out = reinterpret_cast<Bytef*> (&output_[kArchiveBlockHeaderSize]);
+	zstream->avail_out = static_cast<uInt> (bound);
+	if (Z_STREAM_END != deflate (zstream, Z_FINISH)) {
+		LOG(ERROR) << "deflate: " << (nullptr != zstream->msg ? zstream->msg : "failed");
+		return false;
+	}
+	*compressed_size = static_cast<uint32_t> (zstream->total_out);
+	return true;
+}
+
+bool
+torikuru::archive_writer_t::Flush()
+{
+	DCHECK(is_open());
+	if ((bool)thread_) {
+		{
+			boost::lock_guard<boost::mutex> lock (lock_);
+			flush_requested_ = true;
+		}
+		not_empty_.notify_one();
+		return true;
+	}
+	return WriteThrough();
+}
+
+bool
+torikuru::archive_writer_t::WriteThrough()
+{
+	if (block_.empty())
+		return true;
+	TRACE_EVENT("Archive.Flush");
+	const uint64_t start = clock_service_t::ReadTicks();
+	const bool rc = EndBlock();
+	const uint64_t elapsed = clock_service_t::ReadTicks() - start;
+	HISTOGRAM_NANOSECONDS("Archive.FlushTime", elapsed);
+	cumulative_stats_[WRITER_PC_FLUSHES]++;
+	cumulative_stats_[WRITER_PC_FLUSH_MICROSECONDS] += static_cast<uint32_t> (clock_service_t::TicksToNanoseconds (elapsed) / 1000);
+	return rc;
+}
+
+void
+torikuru::archive_writer_t::Sync()
+{
+	if (synced_offset_ == offset_)
+		return;
+	TRACE_EVENT("Archive.Sync");
+	const uint64_t start = clock_service_t::ReadTicks();
+	if (-1 == fdatasync (fd_))
+		LOG(ERROR) << "fdatasync: " << safe_strerror (errno);
+	synced_offset_ = offset_;
+	const uint64_t elapsed = clock_service_t::ReadTicks() - start;
+	HISTOGRAM_NANOSECONDS("Archive.SyncTime", elapsed);
+	cumulative_stats_[WRITER_PC_SYNCS]++;
+	cumulative_stats_[WRITER_PC_SYNC_MICROSECONDS] += static_cast<uint32_t> (clock_service_t::TicksToNanoseconds (elapsed) / 1000);
+}
+
+void
+torikuru::archive_writer_t::Close()
+{
+/* Drain the queue. */
+	if ((bool)thread_) {
+		{
+			boost::lock_guard<boost::mutex> lock (lock_);
+			stop_requested_ = true;
+		}
+		not_empty_.notify_one();
+		thread_->join();
+		thread_.reset();
+	}
+	if ((bool)file_stream_) {
+		EndBlock();
+		if (FSYNC_NONE != fsync_policy_)
+			Sync();
+		file_stream_.reset();
+	}
+	if ((bool)zstream_) {
+		deflateEnd (zstream_.get());
+		zstream_.reset();
+	}
+	if (nullptr != zstd_cctx_) {
+		ZSTD_freeCCtx (zstd_cctx_);
+		zstd_cctx_ = nullptr;
+	}
+	if (nullptr != index_) {
+		fclose (index_);
+		index_ = nullptr;
+	}
+	if (-1 != fd_) {
+		close (fd_);
+		fd_ = -1;
+		LOG(INFO) << "Closed output file, " << record_count_ << " records.";
+	}
+}
+
+int64_t
+torikuru::archive_writer_t::compressed_byte_count() const
+{
+	if ((bool)thread_) {
+		boost::lock_guard<boost::mutex> lock (lock_);
+		return compressed_byte_count_;
+	}
+	return offset_;
+}
+
+size_t
+torikuru::archive_writer_t::queue_byte_count() const
+{
+	boost::lock_guard<boost::mutex> lock (lock_);
+	return pending_.size();
+}
+
+bool
+torikuru::archive_writer_t::Write (
+	archive::Marketfeed* mfeed
+	)
+{
+	TRACE_EVENT("Archive.Write");
+	if (is_stamping_ && mfeed->has_tv_nsec()) {
+		struct timespec ts;
+		clock_service_t::GetRealTime (&ts);
+		const int64_t delay = (static_cast<int64_t> (ts.tv_sec) - mfeed->tv_sec()) * 1000000000LL
+					+ ts.tv_nsec - mfeed->tv_nsec();
+		if (delay >= 0)
+			mfeed->set_write_delay_ns (delay > 0xffffffffLL ? 0xffffffff : static_cast<uint32_t> (delay));
+	}
+	if (!mfeed->IsInitialized()) {
+		LOG(ERROR) << "Ignoring message: " << mfeed->InitializationErrorString();
+		return false;
+	}
+	if (is_failed_)
+		return false;
+	const uint64_t start = clock_service_t::ReadTicks();
+	const uint32_t size = RecordByteSize (*mfeed);
+	const size_t length = google::protobuf::io::CodedOutputStream::VarintSize32 (size) + size;
+	if ((bool)thread_) {
+/* Frame into the queue, nothing is compressed here. */
+		boost::unique_lock<boost::mutex> lock (lock_);
+		if (!pending_.empty() && pending_.size() + length > kMaxPendingBytes) {
+			cumulative_stats_[WRITER_PC_QUEUE_FULL_WAITS]++;
+			do {
+				not_full_.wait (lock);
+			} while (!pending_.empty() && pending_.size() + length > kMaxPendingBytes);
+		}
+		const bool was_empty = pending_.empty();
+		const size_t offset = pending_.size();
+		pending_.resize (offset + length);
+		uint8_t* buf = reinterpret_cast<uint8_t*> (&pending_[offset]);
+		buf = google::protobuf::io::CodedOutputStream::WriteVarint32ToArray (size, buf);
+		mfeed->SerializeWithCachedSizesToArray (buf);
+		lock.unlock();
+		if (was_empty)
+			not_empty_.notify_one();
+		HISTOGRAM_NANOSECONDS("Archive.SerializationTime", clock_service_t::ReadTicks() - start);
+	} else {
+		const uint64_t compression_start = compression_ticks_;
+		const uint64_t write_start = write_ticks_;
+		const size_t offset = block_.size();
+		block_.resize (offset + length);
+		uint8_t* buf = reinterpret_cast<uint8_t*> (&block_[offset]);
+		buf = google::protobuf::io::CodedOutputStream::WriteVarint32ToArray (size, buf);
+		mfeed->SerializeWithCachedSizesToArray (buf);
+		++block_record_count_;
+		const bool rc = block_.size() < block_size_ || EndBlock();
+		HISTOGRAM_NANOSECONDS("Archive.SerializationTime",
+			clock_service_t::ReadTicks() - start - (compression_ticks_ - compression_start) - (write_ticks_ - write_start));
+		if (!rc)
+			return false;
+	}
+	++record_count_;
+	byte_count_ += length;
+	return true;
+}
+
+/* Takes the whole queue at each wake, sleeping at most until the next write
+ * through is due while data is unflushed.
+ */
+void
+torikuru::archive_writer_t::Run()
+{
+	std::string batch;
+	std::vector<std::pair<size_t, time_t>> segments;
+	uint64_t last_flush = clock_service_t::ReadTicks();
+	const uint64_t interval_ns = static_cast<uint64_t> (flush_interval_) * 1000000ULL;
+	while (true) {
+		bool is_stopping, is_flush_requested;
+		{
+			boost::unique_lock<boost::mutex> lock (lock_);
+			while (pending_.empty() && pending_segments_.empty() && !stop_requested_ && !flush_requested_) {
+				if (0 == flush_interval_ || block_.empty()) {
+					not_empty_.wait (lock);
+					continue;
+				}
+				const uint64_t elapsed_ns = clock_service_t::TicksToNanoseconds (clock_service_t::ReadTicks() - last_flush);
+				if (elapsed_ns >= interval_ns)
+					break;
+				not_empty_.timed_wait (lock, boost::posix_time::milliseconds ((interval_ns - elapsed_ns) / 1000000 + 1));
+			}
+			batch.swap (pending_);
+			segments.swap (pending_segments_);
+			is_stopping = stop_requested_;
+			is_flush_requested = flush_requested_;
+			flush_requested_ = false;
+		}
+		not_full_.notify_one();
+		if (!batch.empty()) {
+			CONCURRENT_HISTOGRAM_CUSTOM_COUNTS("Archive.QueueBytes", static_cast<int> (batch.size()), 1, static_cast<int> (kMaxPendingBytes), 64);
+		}
+		WriteBatch (batch, segments);
+		batch.clear();
+		segments.clear();
+		if (is_stopping)
+			break;
+		if (is_flush_requested ||
+		    (flush_interval_ > 0 && clock_service_t::TicksToNanoseconds (clock_service_t::ReadTicks() - last_flush) >= interval_ns))
+		{
+			WriteThrough();
+			if (FSYNC_INTERVAL == fsync_policy_)
+				Sync();
+			last_flush = clock_service_t::ReadTicks();
+		}
+		boost::lock_guard<boost::mutex> lock (lock_);
+		compressed_byte_count_ = offset_;
+	}
+}
+
+/* Blocks hold whole records, so the batch is walked record by record to
+ * find where each block ends.
+ */
+void
+torikuru::archive_writer_t::WriteBatch (
+	const std::string& batch,
+	const std::vector<std::pair<size_t, time_t>>& segments
+	)
+{
+	TRACE_EVENT("Archive.WriteBatch");
+	google::protobuf::io::CodedInputStream coded_stream (reinterpret_cast<const uint8_t*> (batch.data()), static_cast<int> (batch.size()));
+	auto segment = segments.begin();
+	size_t offset = 0, copied = 0;
+	while (true) {
+		if (segments.end() != segment && segment->first == offset) {
+			block_.append (batch, copied, offset - copied);
+			copied = offset;
+			NextSegment (segment->second);
+			if (is_failed_)
+				return;
+			++segment;
+			continue;
+		}
+		uint32_t size;
+		if (!coded_stream.ReadVarint32 (&size) || !coded_stream.Skip (size))
+			break;
+		offset = coded_stream.CurrentPosition();
+		++block_record_count_;
+		if (block_.size() + (offset - copied) >= block_size_) {
+			block_.append (batch, copied, offset - copied);
+			copied = offset;
+			if (!EndBlock())
+				return;
+		}
+	}
+	block_.append (batch, copied, offset - copied);
+}
+
+/* eof */
@@ -0,0 +1,212 @@
+/* Archive writer.
+ *
+ * Varint length delimited archive::Marketfeed records in checksummed,
+ * independently compressed blocks, see archive_format.hh.  A flush ends the
+ * current block early.  The archive may be split into segments, each
+ * starting at a block and listed with its start time in a side index
+ * "<path>.idx" of "<tv_sec> <offset>" lines.
+ *
+ * Per stage latency is recorded in the histograms Archive.SerializationTime
+ * per record, Archive.CompressionTime per block and Archive.WriteTime per
+ * write(2), each excluding the nested stages.
+ *
+ * After Start() compression and file I/O move to a background thread: the
+ * caller only frames records into a queue and the thread writes them
+ * through at a fixed interval, optionally followed by fdatasync(2), bounding
+ * what a crash can lose.  Flush cost is recorded in Archive.FlushTime and
+ * Archive.SyncTime and queue depth at each hand-off in Archive.QueueBytes.
+ */
+
+#ifndef __ARCHIVE_WRITER_HH__
+#define __ARCHIVE_WRITER_HH__
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <ctime>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+/* Boost noncopyable base class */
+#include <boost/utility.hpp>
+
+/* Boost threading. */
+#include <boost/thread.hpp>
+
+#include <archive.pb.h>
+
+#include "archive_format.hh"
+#include "counter.hh"
+
+struct z_stream_s;
+struct ZSTD_CCtx_s;
+
+namespace torikuru
+{
+/* When written data is forced to stable storage. */
+	enum fsync_policy_t {
+		FSYNC_NONE,		/* left to the kernel */
+		FSYNC_INTERVAL,		/* after every interval flush */
+		FSYNC_ROTATE		/* at the end of each segment */
+	};
+
+/* Performance counters. */
+	enum {
+		WRITER_PC_FLUSHES,
+		WRITER_PC_FLUSH_MICROSECONDS,
+		WRITER_PC_SYNCS,
+		WRITER_PC_SYNC_MICROSECONDS,
+		WRITER_PC_QUEUE_FULL_WAITS,
+		WRITER_PC_WRITE_ERRORS,
+/* Max */
+		WRITER_PC_MAX
+	};
+
+	class timed_file_stream_t;
+
+	class archive_writer_t :
+		boost::noncopyable
+	{
+	public:
+		archive_writer_t();
+		~archive_writer_t();
+
+/* Truncates any existing file, the level is of the codec. */
+		bool Open (const std::string& path, int compression_level);
+/* Writes through and, unless the policy is none, syncs everything queued. */
+		void Close();
+
+/* Hand compression and file I/O to a background thread which writes
+ * through every flush_interval milliseconds, zero for only full buffers.
+ */
+		bool Start (unsigned flush_interval, fsync_policy_t fsync_policy);
+
+/* Commit one record, stamping the delay since the record receive time,
+ * i.e. until queued when started.  Blocks while the queue is full.
+ */
+		bool Write (archive::Marketfeed* mfeed);
+
+/* Codec and uncompressed bytes per block, set before Open(), by default
+ * zlib and 256KB.
+ */
+		void set_codec (archive_codec_t codec) {
+			codec_ = codec;
+		}
+		void set_block_size (size_t block_size) {
+			block_size_ = block_size;
+		}
+/* Trained Zstandard dictionary, its id is recorded in the file header. */
+		void set_dictionary (const std::string& dictionary) {
+			dictionary_ = dictionary;
+		}
+/* File header flags, ARCHIVE_FLAG_*. */
+		void set_flags (uint32_t flags) {
+			flags_ = flags;
+		}
+
+/* Keep write_delay_ns as given, for records not received in real time. */
+		void set_stamping (bool is_stamping) {
+			is_stamping_ = is_stamping;
+		}
+
+/* End the current block and index the offset of the next by time. */
+		bool BeginSegment (time_t tv_sec);
+
+/* Compress and write every record committed so far as a block so that a
+ * reader following the file can decode them, at some cost in compression.
+ * When started only requests the background thread to do so.
+ */
+		bool Flush();
+
+		bool is_open() const {
+			return -1 != fd_;
+		}
+		uint64_t record_count() const {
+			return record_count_;
+		}
+/* Uncompressed bytes committed. */
+		int64_t byte_count() const {
+			return byte_count_;
+		}
+/* Bytes written to the file, as of the last queue hand-off when started. */
+		int64_t compressed_byte_count() const;
+/* Framed records waiting for the background thread. */
+		size_t queue_byte_count() const;
+		unsigned segment_count() const {
+			return segment_count_;
+		}
+
+/* Safe to read from any thread. */
+		const counter_t* GetCumulativeStats() const {
+			return cumulative_stats_;
+		}
+/* Counter name for reporting, e.g. "archive_flushes". */
+		static const char* GetCounterName (unsigned counter);
+
+	private:
+		void NextSegment (time_t tv_sec);
+		bool EndBlock();
+		void OnWriteError();
+		bool Compress (uint32_t* compressed_size);
+		bool WriteThrough();
+		void Sync();
+		void Run();
+		void WriteBatch (const std::string& batch, const std::vector<std::pair<size_t, time_t>>& segments);
+
+		std::string path_;
+		archive_codec_t codec_;
+		size_t block_size_;
+		std::string dictionary_;
+		uint32_t flags_;
+		int compression_level_;
+		int fd_;
+		FILE* index_;
+		std::unique_ptr<timed_file_stream_t> file_stream_;
+		std::unique_ptr<z_stream_s> zstream_;
+		ZSTD_CCtx_s* zstd_cctx_;
+/* Records of the open block and the header and payload of the last ended,
+ * owned by the thread doing compression.
+ */
+		std::string block_;
+		uint32_t block_record_count_;
+		std::string output_;
+/* File offset of the next block and as of the last sync. */
+		int64_t offset_;
+		int64_t synced_offset_;
+/* Ticks spent in nested stages, shared with the file stream. */
+		uint64_t write_ticks_;
+		uint64_t compression_ticks_;
+		uint64_t record_count_;
+		int64_t byte_count_;
+		unsigned segment_count_;
+		bool is_stamping_;
+/* Set on the first failed block, the file then ends at the last complete
+ * block and later records are discarded.
+ */
+		std::atomic<bool> is_failed_;
+
+/* Background writing. */
+		unsigned flush_interval_;
+		fsync_policy_t fsync_policy_;
+		std::unique_ptr<boost::thread> thread_;
+		mutable boost::mutex lock_;
+		boost::condition_variable not_empty_;
+		boost::condition_variable not_full_;
+		std::string pending_;
+/* Segments begun, by offset into pending_. */
+		std::vector<std::pair<size_t, time_t>> pending_segments_;
+		bool flush_requested_;
+		bool stop_requested_;
+		int64_t compressed_byte_count_;
+
+		counter_t cumulative_stats_[WRITER_PC_MAX];
+	};
+
+} /* namespace torikuru */
+
+#endif /* __ARCHIVE_WRITER_HH__ */
+
+/* eof */
@@ -0,0 +1,219 @@
+/* Asynchronous log sink.
+ */
+
+#include "async_log.hh"
+
+#include <ctime>
+
+/* Repeat detection table entries, collisions only weaken suppression. */
+static const size_t kRepeatTableSize = 256;
+
+/* Identical lines allowed per second before suppression. */
+static const uint32_t kMaxRepeatsPerSecond = 10;
+
+/* Flusher idle wait. */
+static const long kIdleWaitMs = 100;
+
+/* Minimum seconds between drop and suppression reports. */
+static const time_t kReportInterval = 10;
+
+/* Yields waiting on stop for cells claimed but not yet published. */
+static const unsigned kMaxStopYields = 1000;
+
+torikuru::async_log_t::async_log_t() :
+	stream_ (nullptr),
+	mask_ (0),
+	enqueue_pos_ (0),
+	dequeue_pos_ (0),
+	dropped_ (0),
+	suppressed_ (0),
+	reported_dropped_ (0),
+	reported_suppressed_ (0),
+	report_time_ (0),
+	is_sleeping_ (false),
+	is_running_ (false),
+	stop_requested_ (false)
+{
+}
+
+torikuru::async_log_t::~async_log_t()
+{
+	Stop();
+}
+
+bool
+torikuru::async_log_t::Start (
+	FILE* stream,
+	size_t capacity
+	)
+{
+	if (is_running())
+		return false;
+	size_t size = 2;
+	while (size < capacity)
+		size <<= 1;
+	cells_.reset (new cell_t[size]);
+	for (size_t i = 0; i < size; ++i)
+		cells_[i].sequence.store (i, std::memory_order_relaxed);
+	mask_ = size - 1;
+	enqueue_pos_.store (0, std::memory_order_relaxed);
+	dequeue_pos_ = 0;
+	repeats_.reset (new repeat_t[kRepeatTableSize]());
+	stream_ = stream;
+	stop_requested_ = false;
+	is_running_.store (true, std::memory_order_release);
+	thread_.reset (new boost::thread (boost::bind (&async_log_t::Run, this)));
+	return true;
+}
+
+void
+torikuru::async_log_t::Stop()
+{
+	boost::lock_guard<boost::mutex> stop_lock (stop_lock_);
+	if (!(bool)thread_)
+		return;
+/* Later lines are written synchronously by the caller. */
+	is_running_.store (false, std::memory_order_release);
+	{
+		boost::lock_guard<boost::mutex> lock (lock_);
+		stop_requested_ = true;
+	}
+	wakeup_.notify_one();
+	thread_->join();
+	thread_.reset();
+/* Producers that passed the running test before it was cleared publish
+ * their cell shortly, lines behind an unpublished cell would otherwise be
+ * lost to an abort.
+ */
+	for (unsigned yields = 0; dequeue_pos_ != enqueue_pos_.load (std::memory_order_acquire) && yields < kMaxStopYields; ++yields) {
+		if (0 == Drain())
+			boost::this_thread::yield();
+	}
+	Report (true);
+	fflush (stream_);
+}
+
+/* FNV-1a over the message text, excluding the timestamped prefix.
+ */
+bool
+torikuru::async_log_t::IsRepeat (
+	const std::string& line,
+	size_t message_start
+	)
+{
+	uint32_t hash = 2166136261u;
+	for (size_t i = message_start; i < line.size(); ++i) {
+		hash ^= static_cast<uint8_t> (line[i]);
+		hash *= 16777619u;
+	}
+	const uint32_t now = static_cast<uint32_t> (time (nullptr));
+	repeat_t& repeat = repeats_[hash & (kRepeatTableSize - 1)];
+	if (repeat.hash.load (std::memory_order_relaxed) != hash ||
+	    repeat.second.load (std::memory_order_relaxed) != now)
+	{
+		repeat.hash.store (hash, std::memory_order_relaxed);
+		repeat.second.store (now, std::memory_order_relaxed);
+		repeat.count.store (1, std::memory_order_relaxed);
+		return false;
+	}
+	return repeat.count.fetch_add (1, std::memory_order_relaxed) >= kMaxRepeatsPerSecond;
+}
+
+bool
+torikuru::async_log_t::Push (
+	const std::string& line,
+	size_t message_start
+	)
+{
+	if (!is_running())
+		return false;
+	if (IsRepeat (line, message_start)) {
+		suppressed_.fetch_add (1, std::memory_order_relaxed);
+		return true;
+	}
+	size_t pos = enqueue_pos_.load (std::memory_order_relaxed);
+	cell_t* cell;
+	for (;;) {
+		cell = &cells_[pos & mask_];
+		const size_t sequence = cell->sequence.load (std::memory_order_acquire);
+		const intptr_t diff = static_cast<intptr_t> (sequence) - static_cast<intptr_t> (pos);
+		if (0 == diff) {
+			if (enqueue_pos_.compare_exchange_weak (pos, pos + 1, std::memory_order_relaxed))
+				break;
+		} else if (diff < 0) {
+			dropped_.fetch_add (1, std::memory_order_relaxed);
+			return true;
+		} else {
+			pos = enqueue_pos_.load (std::memory_order_relaxed);
+		}
+	}
+/* Assignment reuses the capacity left by earlier lines. */
+	cell->line.assign (line);
+	cell->sequence.store (pos + 1, std::memory_order_release);
+/* Pairs with the flusher setting is_sleeping_ before testing for lines. */
+	if (is_sleeping_.load (std::memory_order_seq_cst)) {
+		boost::lock_guard<boost::mutex> lock (lock_);
+		wakeup_.notify_one();
+	}
+	return true;
+}
+
+/* Single consumer, write every published line then flush once.
+ */
+size_t
+torikuru::async_log_t::Drain()
+{
+	size_t count = 0;
+	for (;;) {
+		cell_t& cell = cells_[dequeue_pos_ & mask_];
+		if (cell.sequence.load (std::memory_order_acquire) != dequeue_pos_ + 1)
+			break;
+		fwrite (cell.line.data(), 1, cell.line.size(), stream_);
+		cell.sequence.store (dequeue_pos_ + mask_ + 1, std::memory_order_release);
+		++dequeue_pos_;
+		++count;
+	}
+	if (count > 0)
+		fflush (stream_);
+	return count;
+}
+
+void
+torikuru::async_log_t::Report (
+	bool is_final
+	)
+{
+	const uint32_t dropped = dropped_count();
+	const uint32_t suppressed = suppressed_count();
+	if (dropped == reported_dropped_ && suppressed == reported_suppressed_)
+		return;
+	const time_t now = time (nullptr);
+	if (!is_final && now - report_time_ < kReportInterval)
+		return;
+	report_time_ = now;
+	fprintf (stream_, "Log sink: %u lines dropped, %u repeated lines suppressed.\n",
+		dropped - reported_dropped_, suppressed - reported_suppressed_);
+	fflush (stream_);
+	reported_dropped_ = dropped;
+	reported_suppressed_ = suppressed;
+}
+
+void
+torikuru::async_log_t::Run()
+{
+	for (;;) {
+		if (0 == Drain()) {
+			boost::unique_lock<boost::mutex> lock (lock_);
+			if (stop_requested_)
+				break;
+			is_sleeping_.store (true, std::memory_order_seq_cst);
+			const cell_t& cell = cells_[dequeue_pos_ & mask_];
+			if (cell.sequence.load (std::memory_order_acquire) != dequeue_pos_ + 1)
+				wakeup_.timed_wait (lock, boost::posix_time::milliseconds (kIdleWaitMs));
+			is_sleeping_.store (false, std::memory_order_relaxed);
+		}
+		Report (false);
+	}
+}
+
+/* eof */
@@ -0,0 +1,105 @@
+/* Asynchronous log sink.
+ *
+ * Formatted log lines are copied into a bounded lock-free ring and written
+ * out in batches by a background thread, so that a burst of logging never
+ * blocks the dispatch thread on terminal or pipe I/O.  When the ring is full
+ * lines are dropped, and identical lines repeated more than a few times per
+ * second are suppressed.  Both are counted and reported by the flusher.
+ */
+
+#ifndef __ASYNC_LOG_HH__
+#define __ASYNC_LOG_HH__
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <ctime>
+#include <memory>
+#include <string>
+
+/* Boost noncopyable base class */
+#include <boost/utility.hpp>
+
+/* Boost threading. */
+#include <boost/thread.hpp>
+
+namespace torikuru
+{
+
+	class async_log_t :
+		boost::noncopyable
+	{
+	public:
+		async_log_t();
+		~async_log_t();
+
+/* capacity is rounded up to a power of two lines. */
+		bool Start (FILE* stream, size_t capacity);
+/* Writes out every queued line before returning.  Concurrent callers, e.g.
+ * fatal messages on several threads, wait for the first to finish.
+ */
+		void Stop();
+
+/* Returns false if not running, the caller should then write the line
+ * itself.  message_start is the offset past the severity and location
+ * prefix, the remainder identifies repeats.
+ */
+		bool Push (const std::string& line, size_t message_start);
+
+		bool is_running() const {
+			return is_running_.load (std::memory_order_acquire);
+		}
+		uint32_t dropped_count() const {
+			return dropped_.load (std::memory_order_relaxed);
+		}
+		uint32_t suppressed_count() const {
+			return suppressed_.load (std::memory_order_relaxed);
+		}
+
+	private:
+/* Bounded multi-producer queue, each cell sequence tells whose turn it is. */
+		struct cell_t {
+			std::atomic<size_t> sequence;
+			std::string line;
+		};
+
+/* Repeat detection by message hash and second. */
+		struct repeat_t {
+			std::atomic<uint32_t> hash;
+			std::atomic<uint32_t> second;
+			std::atomic<uint32_t> count;
+		};
+
+		bool IsRepeat (const std::string& line, size_t message_start);
+		void Run();
+		size_t Drain();
+		void Report (bool is_final);
+
+		FILE* stream_;
+		std::unique_ptr<cell_t[]> cells_;
+		size_t mask_;
+		std::atomic<size_t> enqueue_pos_;
+		size_t dequeue_pos_;
+
+		std::unique_ptr<repeat_t[]> repeats_;
+		std::atomic<uint32_t> dropped_;
+		std::atomic<uint32_t> suppressed_;
+		uint32_t reported_dropped_;
+		uint32_t reported_suppressed_;
+		time_t report_time_;
+
+		std::unique_ptr<boost::thread> thread_;
+		boost::mutex stop_lock_;
+		boost::mutex lock_;
+		boost::condition_variable wakeup_;
+		std::atomic<bool> is_sleeping_;
+		std::atomic<bool> is_running_;
+		bool stop_requested_;
+	};
+
+} /* namespace torikuru */
+
+#endif /* __ASYNC_LOG_HH__ */
+
+/* eof */
@@ -0,0 +1,300 @@
+/* Capture and extraction micro-benchmarks over a synthetic workload.
+ *
+ * usage: torikuru_bench [--records=N] [--symbols=N] [--fields=N]
+ *                       [--update-ratio=R] [--seed=N] [--directory=PATH]
+ *
+ * Every stage runs over the same deterministic record sequence so that
+ * results are comparable between builds and hosts.
+ */
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <new>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+/* Google Protocol Buffers */
+#include <google/protobuf/io/coded_stream.h>
+#include <google/protobuf/io/zero_copy_stream_impl_lite.h>
+
+#include "chromium/command_line.hh"
+#include "chromium/logging.hh"
+#include "chromium/metrics/histogram.hh"
+#include "archive_format.hh"
+#include "archive_reader.hh"
+#include "archive_writer.hh"
+#include "clock.hh"
+#include "csv_format.hh"
+#include "synthetic.hh"
+
+namespace switches {
+
+const char kRecords[]			= "records";
+const char kSymbols[]			= "symbols";
+const char kFields[]			= "fields";
+const char kUpdateRatio[]		= "update-ratio";
+const char kSeed[]			= "seed";
+const char kDirectory[]			= "directory";
+
+}  // namespace switches
+
+/* Distinct records generated up front and cycled through by each stage. */
+static const size_t kPoolSize = 65536;
+
+/* Compression levels exercised by the writer stage. */
+static const int kCompressionLevels[] = { 1, 6, 9 };
+
+/* Heap allocations, the benchmark is single threaded. */
+static uint64_t g_allocation_count = 0;
+
+void*
+operator new (
+	size_t size
+	)
+{
+	++g_allocation_count;
+	void* p = malloc (0 == size ? 1 : size);
+	if (nullptr == p)
+		throw std::bad_alloc();
+	return p;
+}
+
+void*
+operator new[] (
+	size_t size
+	)
+{
+	return operator new (size);
+}
+
+void
+operator delete (
+	void* p
+	) noexcept
+{
+	free (p);
+}
+
+void
+operator delete[] (
+	void* p
+	) noexcept
+{
+	free (p);
+}
+
+namespace
+{
+
+	class stage_t
+	{
+	public:
+		explicit stage_t (const char* name) :
+			name_ (name),
+			allocation_count_ (g_allocation_count)
+		{
+			clock_gettime (CLOCK_MONOTONIC, &start_);
+		}
+
+		void Report (uint64_t records, uint64_t bytes, const std::string& note = std::string()) {
+			struct timespec end;
+			clock_gettime (CLOCK_MONOTONIC, &end);
+			const uint64_t allocations = g_allocation_count - allocation_count_;
+			const double seconds = (end.tv_sec - start_.tv_sec) + (end.tv_nsec - start_.tv_nsec) / 1e9;
+			printf ("%-16s %12.0f %10.2f %10.2f  %s\n",
+				name_,
+				seconds > 0 ? records / seconds : 0.0,
+				seconds > 0 ? bytes / seconds / (1024 * 1024) : 0.0,
+				records > 0 ? static_cast<double> (allocations) / records : 0.0,
+				note.c_str());
+			fflush (stdout);
+		}
+
+	private:
+		const char* name_;
+		uint64_t allocation_count_;
+		struct timespec start_;
+	};
+
+	unsigned GetUnsigned (const CommandLine& command_line, const char* name, unsigned value) {
+		if (command_line.HasSwitch (name))
+			value = static_cast<unsigned> (std::max (1, std::atoi (command_line.GetSwitchValueASCII (name).c_str())));
+		return value;
+	}
+
+/* Varint-delimited serialization into a re-used buffer, as the writer does
+ * ahead of compression.
+ */
+	void BenchEncode (const std::vector<archive::Marketfeed>& pool, uint64_t records) {
+		std::string buffer (64 * 1024, '\0');
+		uint64_t bytes = 0;
+		stage_t stage ("encode");
+		for (uint64_t i = 0; i < records; ++i) {
+			const archive::Marketfeed& mfeed = pool[i % pool.size()];
+			const uint32_t size = torikuru::RecordByteSize (mfeed);
+			google::protobuf::io::ArrayOutputStream array_stream (&buffer[0], static_cast<int> (buffer.size()));
+			google::protobuf::io::CodedOutputStream coded_stream (&array_stream);
+			coded_stream.WriteVarint32 (size);
+			mfeed.SerializeWithCachedSizes (&coded_stream);
+			bytes += coded_stream.ByteCount();
+		}
+		stage.Report (records, bytes);
+	}
+
+	bool BenchWrite (std::vector<archive::Marketfeed>* pool, uint64_t records, const std::string& path, int level) {
+		torikuru::archive_writer_t writer;
+/* No clock read per record, nor write delay stamped into the shared pool. */
+		writer.set_stamping (false);
+		if (!writer.Open (path, level))
+			return false;
+		char name[32];
+		snprintf (name, sizeof (name), "archive-write-%d", level);
+		stage_t stage (name);
+		for (uint64_t i = 0; i < records; ++i)
+			writer.Write (&(*pool)[i % pool->size()]);
+		const int64_t bytes = writer.byte_count();
+		writer.Close();
+		struct stat st;
+		if (-1 == stat (path.c_str(), &st) || 0 == st.st_size)
+			return false;
+		char note[64];
+		snprintf (note, sizeof (note), "ratio %.2f", static_cast<double> (bytes) / st.st_size);
+		stage.Report (records, bytes, note);
+		return true;
+	}
+
+	bool BenchRead (const std::string& path) {
+		torikuru::archive_reader_t reader;
+		if (!reader.Open (path))
+			return false;
+		archive::Marketfeed mfeed;
+		bool is_valid;
+		uint64_t records = 0, bytes = 0;
+		stage_t stage ("archive-read");
+		while (reader.Read (&mfeed, &is_valid)) {
+			if (!is_valid)
+				continue;
+			++records;
+			bytes += torikuru::RecordByteSize (mfeed);
+		}
+		stage.Report (records, bytes);
+		return true;
+	}
+
+	void BenchUnpack (const std::vector<archive::Marketfeed>& pool, uint64_t records) {
+		TibMsg msg;
+		TibField field;
+		uint64_t bytes = 0, fields = 0;
+		stage_t stage ("unpack");
+		for (uint64_t i = 0; i < records; ++i) {
+			const archive::Marketfeed& mfeed = pool[i % pool.size()];
+			if (TIBMSG_OK != msg.UnPack (const_cast<char*> (mfeed.packed_buffer().c_str()), mfeed.packed_buffer().size()))
+				continue;
+			for (field.First (&msg); field.status == TIBMSG_OK; field.Next())
+				++fields;
+			bytes += mfeed.packed_buffer().size();
+		}
+		char note[64];
+		snprintf (note, sizeof (note), "%.1f fields/record", records > 0 ? static_cast<double> (fields) / records : 0.0);
+		stage.Report (records, bytes, note);
+	}
+
+	void BenchFormat (const std::vector<archive::Marketfeed>& pool, uint64_t records, const std::vector<std::string>& fields) {
+		torikuru::csv_format_t format (fields);
+		TibMsg msg;
+		std::string row;
+		uint64_t bytes = 0;
+		stage_t stage ("csv-format");
+		for (uint64_t i = 0; i < records; ++i) {
+			const archive::Marketfeed& mfeed = pool[i % pool.size()];
+			if (TIBMSG_OK != msg.UnPack (const_cast<char*> (mfeed.packed_buffer().c_str()), mfeed.packed_buffer().size()))
+				continue;
+			format.FormatRow (mfeed, &msg, &row);
+			bytes += row.size() + 1;
+		}
+		stage.Report (records, bytes);
+	}
+
+/* Half of the symbols selected, as an extraction with a symbol list. */
+	void BenchFilter (const std::vector<archive::Marketfeed>& pool, uint64_t records, const std::vector<std::string>& symbols) {
+		std::unordered_set<std::string> selected;
+		for (size_t i = 0; i < symbols.size(); i += 2)
+			selected.emplace (symbols[i]);
+		uint64_t bytes = 0, matched = 0;
+		stage_t stage ("symbol-filter");
+		for (uint64_t i = 0; i < records; ++i) {
+			const archive::Marketfeed& mfeed = pool[i % pool.size()];
+			if (selected.end() != selected.find (mfeed.item_name()))
+				++matched;
+			bytes += mfeed.item_name().size();
+		}
+		char note[64];
+		snprintf (note, sizeof (note), "%.1f%% matched", records > 0 ? 100.0 * matched / records : 0.0);
+		stage.Report (records, bytes, note);
+	}
+
+} /* anonymous namespace */
+
+int
+main (
+	int		argc,
+	const char*	argv[]
+	)
+{
+	CommandLine::Init (argc, argv);
+	chromium::StatisticsRecorder recorder;
+	const CommandLine& command_line = *CommandLine::ForCurrentProcess();
+
+	torikuru::synthetic_options_t options;
+	const uint64_t records = GetUnsigned (command_line, switches::kRecords, 1000000);
+	options.symbol_count = GetUnsigned (command_line, switches::kSymbols, options.symbol_count);
+	options.field_count = GetUnsigned (command_line, switches::kFields, options.field_count);
+	options.seed = GetUnsigned (command_line, switches::kSeed, options.seed);
+	if (command_line.HasSwitch (switches::kUpdateRatio))
+		options.update_ratio = std::atof (command_line.GetSwitchValueASCII (switches::kUpdateRatio).c_str());
+	const std::string directory = command_line.HasSwitch (switches::kDirectory) ?
+		command_line.GetSwitchValueASCII (switches::kDirectory) : "/tmp";
+
+	torikuru::clock_service_t::Init (false);
+
+/* Workload generation is not timed. */
+	torikuru::synthetic_workload_t workload (options);
+	std::vector<archive::Marketfeed> pool (std::min (static_cast<uint64_t> (kPoolSize), records));
+	for (auto& mfeed : pool)
+		workload.Next (&mfeed);
+
+	printf ("records=%llu symbols=%u fields=%u update-ratio=%.2f seed=%u\n",
+		static_cast<unsigned long long> (records), options.symbol_count, options.field_count,
+		options.update_ratio, options.seed);
+	printf ("%-16s %12s %10s %10s\n", "stage", "records/s", "MB/s", "allocs/rec");
+
+	BenchEncode (pool, records);
+	std::string read_path;
+	for (const int level : kCompressionLevels) {
+		char path[1024];
+		snprintf (path, sizeof (path), "%s/torikuru_bench.%d.%d.dmp", directory.c_str(), static_cast<int> (getpid()), level);
+		if (!BenchWrite (&pool, records, path, level)) {
+			LOG(ERROR) << "Cannot write benchmark archive \"" << path << "\".";
+			return EXIT_FAILURE;
+		}
+		if (6 == level)
+			read_path.assign (path);
+		else
+			unlink (path);
+	}
+	if (!BenchRead (read_path))
+		LOG(ERROR) << "Cannot read benchmark archive \"" << read_path << "\".";
+	unlink (read_path.c_str());
+	BenchUnpack (pool, records);
+	BenchFormat (pool, records, workload.field_names());
+	BenchFilter (pool, records, workload.symbols());
+	return EXIT_SUCCESS;
+}
+
+/* eof */
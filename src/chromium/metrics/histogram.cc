@@ -628,6 +628,15 @@ void Histogram::SampleSet::Add(const SampleSet& other) {
     counts_[index] += other.counts_[index];
 }
 
+void Histogram::SampleSet::AddCounts(const Counts& counts, int64_t sum) {
+  DCHECK_EQ(counts_.size(), counts.size());
+  sum_ += sum;
+  for (size_t index = 0; index < counts_.size(); ++index) {
+    counts_[index] += counts[index];
+    redundant_count_ += counts[index];
+  }
+}
+
 void Histogram::SampleSet::Subtract(const SampleSet& other) {
   DCHECK_EQ(counts_.size(), other.counts_.size());
   // Note: Race conditions in snapshotting a sum may lead to (temporary)
@@ -327,6 +327,9 @@ class Histogram : boost::noncopyable {
 
     // Arithmetic manipulation of corresponding elements of the set.
     void Add(const SampleSet& other);
+    // Merge tallies kept outside of a SampleSet, e.g. the per-thread counts
+    // of a lock-free histogram.
+    void AddCounts(const Counts& counts, int64_t sum);
     void Subtract(const SampleSet& other);
 
    protected:
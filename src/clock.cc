@@ -0,0 +1,152 @@
+/* Shared clock service.
+ */
+
+#include "clock.hh"
+
+#include <cpuid.h>
+
+#include "chromium/logging.hh"
+
+/* Interval over which the TSC rate is first measured. */
+static const long kCalibrationNs = 20 * 1000 * 1000;
+
+/* Re-anchor the TSC mapping once per second to follow NTP slew. */
+static const uint64_t kAnchorIntervalNs = 1000 * 1000 * 1000;
+
+/* Reject re-measured TSC rates deviating by more than this ratio, e.g. after
+ * the wall clock is stepped.
+ */
+static const double kMaxRateDeviation = 0.001;
+
+std::atomic<uint32_t> torikuru::clock_service_t::coarse_seconds_ (0);
+std::atomic<uint32_t> torikuru::clock_service_t::coarse_milliseconds_ (0);
+std::atomic<long> torikuru::clock_service_t::coarse_time_ (0);
+struct timespec torikuru::clock_service_t::monotonic_start_ = { 0, 0 };
+time_t torikuru::clock_service_t::start_time_ = 0;
+bool torikuru::clock_service_t::use_tsc_ = false;
+uint64_t torikuru::clock_service_t::anchor_tsc_ = 0;
+uint64_t torikuru::clock_service_t::anchor_ns_ = 0;
+double torikuru::clock_service_t::ns_per_tick_ = 0.0;
+double torikuru::clock_service_t::calibrated_ns_per_tick_ = 0.0;
+
+static inline
+uint64_t
+to_ns (
+	const struct timespec& ts
+	)
+{
+	return static_cast<uint64_t> (ts.tv_sec) * 1000000000ULL + ts.tv_nsec;
+}
+
+bool
+torikuru::clock_service_t::Init (
+	bool use_tsc
+	)
+{
+	struct timespec now;
+	clock_gettime (CLOCK_MONOTONIC, &monotonic_start_);
+	clock_gettime (CLOCK_REALTIME, &now);
+	start_time_ = now.tv_sec;
+	coarse_seconds_.store (0, std::memory_order_relaxed);
+	coarse_milliseconds_.store (0, std::memory_order_relaxed);
+	coarse_time_.store (now.tv_sec, std::memory_order_relaxed);
+	use_tsc_ = false;
+	if (!use_tsc)
+		return true;
+
+	if (!HasInvariantTsc()) {
+		LOG(WARNING) << "Invariant TSC not available, using CLOCK_REALTIME for record timestamps.";
+		return false;
+	}
+	struct timespec t0, t1;
+	clock_gettime (CLOCK_REALTIME, &t0);
+	const uint64_t c0 = ReadTsc();
+	const struct timespec interval = { 0, kCalibrationNs };
+	nanosleep (&interval, nullptr);
+	clock_gettime (CLOCK_REALTIME, &t1);
+	const uint64_t c1 = ReadTsc();
+	if (c1 <= c0 || to_ns (t1) <= to_ns (t0)) {
+		LOG(WARNING) << "TSC calibration failed, using CLOCK_REALTIME for record timestamps.";
+		return false;
+	}
+	ns_per_tick_ = static_cast<double> (to_ns (t1) - to_ns (t0)) / static_cast<double> (c1 - c0);
+	calibrated_ns_per_tick_ = ns_per_tick_;
+	anchor_tsc_ = c1;
+	anchor_ns_ = to_ns (t1);
+	use_tsc_ = true;
+	LOG(INFO) << "TSC clock: { \"ticksPerMicrosecond\": " << (1000.0 / ns_per_tick_) << " }";
+	return true;
+}
+
+void
+torikuru::clock_service_t::Update()
+{
+	struct timespec now;
+	clock_gettime (CLOCK_MONOTONIC, &now);
+	time_t seconds = now.tv_sec - monotonic_start_.tv_sec;
+	long nsec = now.tv_nsec - monotonic_start_.tv_nsec;
+	if (nsec < 0) {
+		--seconds;
+		nsec += 1000000000L;
+	}
+	coarse_milliseconds_.store (static_cast<uint32_t> (seconds) * 1000u + static_cast<uint32_t> (nsec / 1000000), std::memory_order_relaxed);
+	coarse_seconds_.store (static_cast<uint32_t> (seconds), std::memory_order_relaxed);
+	coarse_time_.store (start_time_ + seconds, std::memory_order_relaxed);
+	if (use_tsc_)
+		Anchor();
+}
+
+void
+torikuru::clock_service_t::GetRealTime (
+	struct timespec* ts
+	)
+{
+	if (use_tsc_) {
+		const uint64_t ns = anchor_ns_ + static_cast<uint64_t> (static_cast<double> (ReadTsc() - anchor_tsc_) * ns_per_tick_);
+		ts->tv_sec = static_cast<time_t> (ns / 1000000000ULL);
+		ts->tv_nsec = static_cast<long> (ns % 1000000000ULL);
+		return;
+	}
+	clock_gettime (CLOCK_REALTIME, ts);
+}
+
+uint64_t
+torikuru::clock_service_t::ReadTsc()
+{
+	uint32_t lo, hi;
+	__asm__ __volatile__ ("rdtsc" : "=a" (lo), "=d" (hi));
+	return (static_cast<uint64_t> (hi) << 32) | lo;
+}
+
+/* CPUID.80000007H:EDX[8], TSC rate is constant across P-, C- and T-states.
+ */
+bool
+torikuru::clock_service_t::HasInvariantTsc()
+{
+	unsigned eax, ebx, ecx, edx;
+	if (!__get_cpuid (0x80000000, &eax, &ebx, &ecx, &edx) || eax < 0x80000007)
+		return false;
+	if (!__get_cpuid (0x80000007, &eax, &ebx, &ecx, &edx))
+		return false;
+	return 0 != (edx & (1 << 8));
+}
+
+void
+torikuru::clock_service_t::Anchor()
+{
+	const uint64_t tsc = ReadTsc();
+	if (static_cast<double> (tsc - anchor_tsc_) * ns_per_tick_ < kAnchorIntervalNs)
+		return;
+	struct timespec now;
+	clock_gettime (CLOCK_REALTIME, &now);
+	const uint64_t ns = to_ns (now);
+	if (ns > anchor_ns_) {
+		const double rate = static_cast<double> (ns - anchor_ns_) / static_cast<double> (tsc - anchor_tsc_);
+		if (rate > ns_per_tick_ * (1.0 - kMaxRateDeviation) && rate < ns_per_tick_ * (1.0 + kMaxRateDeviation))
+			ns_per_tick_ = rate;
+	}
+	anchor_tsc_ = tsc;
+	anchor_ns_ = ns;
+}
+
+/* eof */
@@ -0,0 +1,103 @@
+/* Shared clock service.
+ *
+ * A coarse monotonic clock is refreshed once per event loop iteration for
+ * item bookkeeping, per-item times are stored as 32-bit seconds since the
+ * service started.  Record timestamps take a precise wall clock reading,
+ * either clock_gettime(CLOCK_REALTIME) or the invariant TSC calibrated
+ * against it.
+ */
+
+#ifndef __CLOCK_HH__
+#define __CLOCK_HH__
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <ctime>
+
+namespace torikuru
+{
+
+	class clock_service_t
+	{
+	public:
+/* Returns false if the TSC was requested but unusable, the realtime clock
+ * is then used instead.
+ */
+		static bool Init (bool use_tsc);
+
+/* Refresh the coarse clock, call once per event loop iteration from the
+ * dispatch thread.
+ */
+		static void Update();
+
+/* Seconds since Init(), monotonic. */
+		static uint32_t coarse_seconds() {
+			return coarse_seconds_.load (std::memory_order_relaxed);
+		}
+
+/* Milliseconds since Init() as of the last Update(), wraps after 49 days so
+ * compare by unsigned difference.
+ */
+		static uint32_t coarse_milliseconds() {
+			return coarse_milliseconds_.load (std::memory_order_relaxed);
+		}
+
+/* Wall clock seconds as of the last Update(). */
+		static time_t coarse_time() {
+			return static_cast<time_t> (coarse_time_.load (std::memory_order_relaxed));
+		}
+
+/* Convert coarse seconds back to wall clock, e.g. for reporting. */
+		static time_t ToTime (uint32_t seconds) {
+			return start_time_ + static_cast<time_t> (seconds);
+		}
+
+/* Precise wall clock for record timestamps.  The TSC source is re-anchored
+ * by Update() and therefore only valid on the dispatch thread.
+ */
+		static void GetRealTime (struct timespec* ts);
+
+		static bool is_tsc() {
+			return use_tsc_;
+		}
+
+/* Interval timing for instrumentation, safe on any thread.  Ticks are TSC
+ * cycles at the rate calibrated by Init() or CLOCK_MONOTONIC nanoseconds.
+ */
+		static uint64_t ReadTicks() {
+			if (use_tsc_)
+				return ReadTsc();
+			struct timespec ts;
+			clock_gettime (CLOCK_MONOTONIC, &ts);
+			return static_cast<uint64_t> (ts.tv_sec) * 1000000000ULL + ts.tv_nsec;
+		}
+		static uint64_t TicksToNanoseconds (uint64_t ticks) {
+			return use_tsc_ ? static_cast<uint64_t> (static_cast<double> (ticks) * calibrated_ns_per_tick_) : ticks;
+		}
+
+	private:
+		static uint64_t ReadTsc();
+		static bool HasInvariantTsc();
+		static void Anchor();
+
+		static std::atomic<uint32_t> coarse_seconds_;
+		static std::atomic<uint32_t> coarse_milliseconds_;
+		static std::atomic<long> coarse_time_;
+		static struct timespec monotonic_start_;
+		static time_t start_time_;
+
+/* TSC to CLOCK_REALTIME mapping. */
+		static bool use_tsc_;
+		static uint64_t anchor_tsc_;
+		static uint64_t anchor_ns_;
+		static double ns_per_tick_;
+/* Rate fixed at Init() for use off the dispatch thread. */
+		static double calibrated_ns_per_tick_;
+	};
+
+} /* namespace torikuru */
+
+#endif /* __CLOCK_HH__ */
+
+/* eof */
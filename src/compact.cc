@@ -0,0 +1,300 @@
+/* Archive compaction.
+ */
+
+#include "compact.hh"
+
+#include <cerrno>
+#include <cstdio>
+
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "chromium/logging.hh"
+#include "chromium/safe_strerror_posix.hh"
+#include "archive_format.hh"
+#include "archive_reader.hh"
+#include "archive_writer.hh"
+#include "clock.hh"
+#include "trace.hh"
+
+/* Zstandard gains ratio with block size up to its window, 8MB at high
+ * levels, at the cost of memory per reader.
+ */
+static const size_t kCompactBlockSize = 4 * 1024 * 1024;
+
+/* Suffix of the rewrite beside the original, on the same file system so
+ * that rename(2) is atomic.
+ */
+static const char kCompactSuffix[] = ".compact";
+
+/* ioprio_set(2) has no glibc wrapper, see linux/ioprio.h. */
+static const int kIoprioWhoProcess = 1;
+static const int kIoprioClassIdle = 3;
+static const int kIoprioClassShift = 13;
+
+void
+torikuru::LowerThreadPriority()
+{
+	const pid_t tid = static_cast<pid_t> (syscall (SYS_gettid));
+	if (-1 == setpriority (PRIO_PROCESS, static_cast<id_t> (tid), 19))
+		LOG(WARNING) << "setpriority: " << safe_strerror (errno);
+	if (-1 == syscall (SYS_ioprio_set, kIoprioWhoProcess, tid, kIoprioClassIdle << kIoprioClassShift))
+		LOG(WARNING) << "ioprio_set: " << safe_strerror (errno);
+}
+
+static
+bool
+SyncPath (
+	const std::string& path,
+	int flags
+	)
+{
+	const int fd = open (path.c_str(), O_RDONLY | flags);
+	if (-1 == fd) {
+		LOG(ERROR) << "Failed to open \"" << path << "\": " << safe_strerror (errno);
+		return false;
+	}
+	const bool rc = (0 == fsync (fd));
+	if (!rc)
+		LOG(ERROR) << "fsync: " << safe_strerror (errno);
+	close (fd);
+	return rc;
+}
+
+/* Rewrite every record into compacted_path, beginning a segment wherever
+ * the original does.  Empty segments of the original are not repeated.
+ */
+static
+bool
+CopyArchive (
+	torikuru::archive_reader_t* reader,
+	const std::string& compacted_path,
+	int compression_level,
+	const std::string& dictionary,
+	torikuru::compact_result_t* result
+	)
+{
+	TRACE_EVENT("Compact.Copy");
+	torikuru::archive_writer_t writer;
+	writer.set_codec (torikuru::ARCHIVE_CODEC_ZSTD);
+	writer.set_block_size (kCompactBlockSize);
+	writer.set_dictionary (dictionary);
+	writer.set_flags (torikuru::ARCHIVE_FLAG_COMPACTED);
+	writer.set_stamping (false);
+	if (!writer.Open (compacted_path, compression_level))
+		return false;
+	archive::Marketfeed mfeed;
+	bool is_valid;
+	size_t segment = 0;
+	while (reader->Read (&mfeed, &is_valid)) {
+		if (!is_valid) {
+			LOG(ERROR) << "Unparseable record " << writer.record_count() << ", not compacting.";
+			return false;
+		}
+		if (reader->segment() != segment) {
+			segment = reader->segment();
+			if (!writer.BeginSegment (reader->segment_time (segment)))
+				return false;
+		}
+		if (!writer.Write (&mfeed))
+			return false;
+	}
+	if (reader->damage_count() > 0) {
+		LOG(ERROR) << "Archive damaged, " << reader->lost_record_count() << " records lost, not compacting.";
+		return false;
+	}
+	writer.Close();
+	result->record_count = writer.record_count();
+	result->segment_count = writer.segment_count();
+	return true;
+}
+
+/* Records must match in order, content and the start time of the segment
+ * holding them, and the rewrite must read without damage.
+ */
+static
+bool
+VerifyArchive (
+	const std::string& path,
+	const std::string& compacted_path,
+	const std::string& dictionary
+	)
+{
+	TRACE_EVENT("Compact.Verify");
+	torikuru::archive_reader_t original, compacted;
+	original.set_dictionary (dictionary);
+	compacted.set_dictionary (dictionary);
+	if (!original.Open (path) || !compacted.Open (compacted_path))
+		return false;
+	archive::Marketfeed lhs, rhs;
+	bool is_lhs_valid, is_rhs_valid;
+	for (uint64_t i = 0;; ++i) {
+		const bool has_lhs = original.Read (&lhs, &is_lhs_valid);
+		const bool has_rhs = compacted.Read (&rhs, &is_rhs_valid);
+		if (!has_lhs && !has_rhs)
+			break;
+		if (has_lhs != has_rhs) {
+			LOG(ERROR) << "Verify: record count differs at record " << i << ".";
+			return false;
+		}
+		if (!is_lhs_valid || !is_rhs_valid ||
+		    lhs.SerializeAsString() != rhs.SerializeAsString())
+		{
+			LOG(ERROR) << "Verify: record " << i << " differs.";
+			return false;
+		}
+		if (original.segment_time (original.segment()) != compacted.segment_time (compacted.segment())) {
+			LOG(ERROR) << "Verify: record " << i << " in segment of a different time.";
+			return false;
+		}
+	}
+	if (original.damage_count() > 0 || compacted.damage_count() > 0) {
+		LOG(ERROR) << "Verify: damage found reading back.";
+		return false;
+	}
+	return true;
+}
+
+/* The old index is removed before the archive is replaced: an archive
+ * without an index is read whole, one with a stale index would be sought
+ * to the wrong offsets.
+ */
+static
+bool
+ReplaceArchive (
+	const std::string& path,
+	const std::string& compacted_path,
+	mode_t mode
+	)
+{
+	TRACE_EVENT("Compact.Replace");
+	const std::string index_path (path + ".idx");
+	const std::string compacted_index_path (compacted_path + ".idx");
+	const bool has_index = (0 == access (compacted_index_path.c_str(), F_OK));
+	if (-1 == chmod (compacted_path.c_str(), mode)) {
+		LOG(ERROR) << "chmod: " << safe_strerror (errno);
+		return false;
+	}
+	if (!SyncPath (compacted_path, 0) ||
+	    (has_index && !SyncPath (compacted_index_path, 0)))
+		return false;
+	if (-1 == unlink (index_path.c_str()) && ENOENT != errno) {
+		LOG(ERROR) << "Failed to remove \"" << index_path << "\": " << safe_strerror (errno);
+		return false;
+	}
+	if (-1 == rename (compacted_path.c_str(), path.c_str())) {
+		LOG(ERROR) << "Failed to rename \"" << compacted_path << "\": " << safe_strerror (errno);
+		return false;
+	}
+	if (has_index && -1 == rename (compacted_index_path.c_str(), index_path.c_str())) {
+		LOG(ERROR) << "Failed to rename \"" << compacted_index_path << "\": " << safe_strerror (errno);
+		return false;
+	}
+	const size_t slash = path.rfind ('/');
+	const std::string directory (std::string::npos == slash ? "." : (0 == slash ? "/" : path.substr (0, slash)));
+	return SyncPath (directory, O_DIRECTORY);
+}
+
+/* A live writer is checked for both before the copy and before the
+ * rename, records appended in between would otherwise be lost.
+ */
+static
+bool
+IsArchiveClosed (
+	int fd,
+	const std::string& path
+	)
+{
+	if (!torikuru::IsArchiveWriterActive (fd))
+		return true;
+	LOG(ERROR) << "\"" << path << "\" is still open for writing, not compacting.";
+	return false;
+}
+
+static
+bool
+CompactOpenArchive (
+	int fd,
+	const std::string& path,
+	int compression_level,
+	const std::string& dictionary,
+	torikuru::compact_result_t* result
+	)
+{
+	struct stat st;
+	if (-1 == fstat (fd, &st)) {
+		LOG(ERROR) << "Failed to stat \"" << path << "\": " << safe_strerror (errno);
+		return false;
+	}
+	result->original_bytes = st.st_size;
+	if (!IsArchiveClosed (fd, path))
+		return false;
+	const std::string compacted_path (path + kCompactSuffix);
+	uint64_t start = torikuru::clock_service_t::ReadTicks();
+	{
+		torikuru::archive_reader_t reader;
+		reader.set_dictionary (dictionary);
+		if (!reader.Open (path))
+			return false;
+		if (0 != (reader.flags() & torikuru::ARCHIVE_FLAG_COMPACTED)) {
+			LOG(INFO) << "\"" << path << "\" is already compacted.";
+			result->is_skipped = true;
+			result->compacted_bytes = st.st_size;
+			return true;
+		}
+		if (!CopyArchive (&reader, compacted_path, compression_level, dictionary, result)) {
+			unlink (compacted_path.c_str());
+			unlink ((compacted_path + ".idx").c_str());
+			return false;
+		}
+	}
+	result->compact_seconds = torikuru::clock_service_t::TicksToNanoseconds (torikuru::clock_service_t::ReadTicks() - start) / 1e9;
+	start = torikuru::clock_service_t::ReadTicks();
+	const bool is_verified = VerifyArchive (path, compacted_path, dictionary);
+	result->verify_seconds = torikuru::clock_service_t::TicksToNanoseconds (torikuru::clock_service_t::ReadTicks() - start) / 1e9;
+	struct stat compacted_st;
+	if (!is_verified ||
+	    -1 == stat (compacted_path.c_str(), &compacted_st) ||
+	    !IsArchiveClosed (fd, path) ||
+	    !ReplaceArchive (path, compacted_path, st.st_mode & 07777))
+	{
+		unlink (compacted_path.c_str());
+		unlink ((compacted_path + ".idx").c_str());
+		return false;
+	}
+	result->compacted_bytes = compacted_st.st_size;
+	return true;
+}
+
+bool
+torikuru::CompactArchive (
+	const std::string& path,
+	int compression_level,
+	const std::string& dictionary,
+	compact_result_t* result
+	)
+{
+	TRACE_EVENT("Compact.Archive");
+	result->is_skipped = false;
+	result->record_count = 0;
+	result->segment_count = 0;
+	result->original_bytes = result->compacted_bytes = 0;
+	result->compact_seconds = result->verify_seconds = 0.0;
+/* Held open to probe the writer lock of this file, not of a later one at
+ * the same path.
+ */
+	const int fd = open (path.c_str(), O_RDONLY | O_LARGEFILE);
+	if (-1 == fd) {
+		LOG(ERROR) << "Failed to open \"" << path << "\": " << safe_strerror (errno);
+		return false;
+	}
+	const bool rc = CompactOpenArchive (fd, path, compression_level, dictionary, result);
+	close (fd);
+	return rc;
+}
+
+/* eof */
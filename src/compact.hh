@@ -0,0 +1,48 @@
+/* Archive compaction.
+ *
+ * Finished archives are rewritten for retention with Zstandard at a high
+ * level in larger blocks, keeping every record, and the side index is
+ * rebuilt for the new block offsets.  The rewrite is read back and compared
+ * record for record with the original before replacing it by rename(2), so
+ * that a failed or interrupted compaction leaves the original in place.
+ * Legacy archives are converted to the block format on the way.
+ */
+
+#ifndef __COMPACT_HH__
+#define __COMPACT_HH__
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+namespace torikuru
+{
+
+	struct compact_result_t {
+/* Already compacted and left untouched. */
+		bool is_skipped;
+		uint64_t record_count;
+		unsigned segment_count;
+		int64_t original_bytes;
+		int64_t compacted_bytes;
+		double compact_seconds;
+		double verify_seconds;
+	};
+
+/* Idle CPU and I/O scheduling for the calling thread, so that compaction
+ * yields to capture on the same host.
+ */
+	void LowerThreadPriority();
+
+/* Compact the archive at path in place, false leaving it untouched if it
+ * is still open for writing, cannot be read, holds damage or unparseable
+ * records, or fails to verify.
+ * A non-empty dictionary is used for reading and for the rewrite.
+ */
+	bool CompactArchive (const std::string& path, int compression_level, const std::string& dictionary, compact_result_t* result);
+
+} /* namespace torikuru */
+
+#endif /* __COMPACT_HH__ */
+
+/* eof */
@@ -0,0 +1,216 @@
+/* Lock-free histogram.
+ */
+
+#include "concurrent_histogram.hh"
+
+#include <algorithm>
+#include <vector>
+
+#include "chromium/logging.hh"
+
+namespace
+{
+
+/* Thread indices released by exited threads, lowest reused first.  Leaked
+ * as threads may exit after static destruction.
+ */
+	struct thread_indices_t
+	{
+		thread_indices_t() : next_index (0) {}
+
+		chromium::Lock lock;
+		std::vector<unsigned> free_indices;
+		unsigned next_index;
+	};
+
+	thread_indices_t*
+	GetThreadIndices()
+	{
+		static thread_indices_t* indices = new thread_indices_t();
+		return indices;
+	}
+
+/* Zero until assigned, otherwise the thread index plus one.  Releasing
+ * under the lock orders the exiting thread's last writes to its shards
+ * before those of the next thread given the index.
+ */
+	struct thread_slot_t
+	{
+		thread_slot_t() : index (0) {}
+		~thread_slot_t() {
+			if (0 == index)
+				return;
+			thread_indices_t* indices = GetThreadIndices();
+			chromium::AutoLock locked (indices->lock);
+			indices->free_indices.push_back (index - 1);
+		}
+
+		unsigned index;
+	};
+
+	thread_local thread_slot_t t_thread_slot;
+
+} /* anonymous namespace */
+
+unsigned
+torikuru::concurrent_histogram_t::thread_index()
+{
+	if (0 == t_thread_slot.index) {
+		thread_indices_t* indices = GetThreadIndices();
+		chromium::AutoLock locked (indices->lock);
+		if (indices->free_indices.empty()) {
+			t_thread_slot.index = ++indices->next_index;
+		} else {
+			auto lowest = std::min_element (indices->free_indices.begin(), indices->free_indices.end());
+			t_thread_slot.index = *lowest + 1;
+			indices->free_indices.erase (lowest);
+		}
+	}
+	return t_thread_slot.index - 1;
+}
+
+torikuru::concurrent_histogram_t::shard_t::shard_t (
+	size_t bucket_count
+	) :
+	sequence (0),
+	sum_low (0),
+	sum_high (0),
+	counts (new std::atomic<Count>[bucket_count]())
+{
+}
+
+chromium::Histogram*
+torikuru::concurrent_histogram_t::FactoryGet (
+	const std::string& name,
+	Sample minimum,
+	Sample maximum,
+	size_t bucket_count,
+	Flags flags
+	)
+{
+	chromium::Histogram* histogram = nullptr;
+
+/* Defensive code, as base class. */
+	if (minimum < 1)
+		minimum = 1;
+	if (maximum > kSampleType_MAX - 1)
+		maximum = kSampleType_MAX - 1;
+
+	DCHECK_GT(maximum, minimum);
+	DCHECK_GT((Sample) bucket_count, 2);
+	DCHECK_LE((Sample) bucket_count, maximum - minimum + 2);
+
+	if (!chromium::StatisticsRecorder::FindHistogram (name, &histogram)) {
+/* Leaked to avoid racy destruction at shutdown. */
+		concurrent_histogram_t* tentative_histogram =
+			new concurrent_histogram_t (name, minimum, maximum, bucket_count);
+		tentative_histogram->InitializeBucketRange();
+		tentative_histogram->SetFlags (flags);
+		histogram = chromium::StatisticsRecorder::RegisterOrDeleteDuplicate (tentative_histogram);
+	}
+
+	DCHECK_EQ(HISTOGRAM, histogram->histogram_type());
+	DCHECK(histogram->HasConstructorArguments (minimum, maximum, bucket_count));
+	return histogram;
+}
+
+torikuru::concurrent_histogram_t::concurrent_histogram_t (
+	const std::string& name,
+	Sample minimum,
+	Sample maximum,
+	size_t bucket_count
+	) :
+	chromium::Histogram (name, minimum, maximum, bucket_count)
+{
+	for (auto& shard : shards_)
+		shard.store (nullptr, std::memory_order_relaxed);
+}
+
+torikuru::concurrent_histogram_t::~concurrent_histogram_t()
+{
+	for (auto& shard : shards_)
+		delete shard.load (std::memory_order_relaxed);
+}
+
+/* Only the owning thread publishes its shard so no compare-and-swap is
+ * required.
+ */
+torikuru::concurrent_histogram_t::shard_t*
+torikuru::concurrent_histogram_t::GetShard()
+{
+	const unsigned index = thread_index();
+	if (index >= kMaxThreads)
+		return nullptr;
+	shard_t* shard = shards_[index].load (std::memory_order_relaxed);
+	if (nullptr == shard) {
+		shard = new shard_t (bucket_count());
+		shards_[index].store (shard, std::memory_order_release);
+	}
+	return shard;
+}
+
+void
+torikuru::concurrent_histogram_t::Accumulate (
+	Sample value,
+	Count count,
+	size_t index
+	)
+{
+	shard_t* shard = GetShard();
+	if (nullptr == shard) {
+		chromium::AutoLock locked (overflow_lock_);
+		chromium::Histogram::Accumulate (value, count, index);
+		return;
+	}
+	const uint32_t sequence = shard->sequence.load (std::memory_order_relaxed);
+	shard->sequence.store (sequence + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence (std::memory_order_release);
+	std::atomic<Count>& bucket = shard->counts[index];
+	bucket.store (bucket.load (std::memory_order_relaxed) + count, std::memory_order_relaxed);
+	const uint64_t sum = ((static_cast<uint64_t> (shard->sum_high.load (std::memory_order_relaxed)) << 32)
+				| shard->sum_low.load (std::memory_order_relaxed))
+				+ static_cast<int64_t> (count) * value;
+	shard->sum_low.store (static_cast<uint32_t> (sum), std::memory_order_relaxed);
+	shard->sum_high.store (static_cast<uint32_t> (sum >> 32), std::memory_order_relaxed);
+	shard->sequence.store (sequence + 2, std::memory_order_release);
+}
+
+void
+torikuru::concurrent_histogram_t::SnapshotSample (
+	SampleSet* sample
+	) const
+{
+	{
+		chromium::AutoLock locked (overflow_lock_);
+		chromium::Histogram::SnapshotSample (sample);
+	}
+	const size_t bucket_count = this->bucket_count();
+	Counts totals (bucket_count, 0), counts (bucket_count);
+	int64_t total_sum = 0;
+	for (const auto& slot : shards_) {
+		const shard_t* shard = slot.load (std::memory_order_acquire);
+		if (nullptr == shard)
+			continue;
+		uint64_t sum;
+		for (;;) {
+			const uint32_t sequence = shard->sequence.load (std::memory_order_acquire);
+			if (0 == (sequence & 1)) {
+				for (size_t i = 0; i < bucket_count; ++i)
+					counts[i] = shard->counts[i].load (std::memory_order_relaxed);
+				sum = (static_cast<uint64_t> (shard->sum_high.load (std::memory_order_relaxed)) << 32)
+					| shard->sum_low.load (std::memory_order_relaxed);
+				std::atomic_thread_fence (std::memory_order_acquire);
+				if (sequence == shard->sequence.load (std::memory_order_relaxed))
+					break;
+			}
+/* Writer mid-update, back off the cache line. */
+			__builtin_ia32_pause();
+		}
+		for (size_t i = 0; i < bucket_count; ++i)
+			totals[i] += counts[i];
+		total_sum += static_cast<int64_t> (sum);
+	}
+	sample->AddCounts (totals, total_sum);
+}
+
+/* eof */
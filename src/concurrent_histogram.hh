@@ -0,0 +1,80 @@
+/* Lock-free histogram.
+ *
+ * A chromium::Histogram whose samples are tallied in per-thread bucket
+ * arrays, each written only by its owning thread under a sequence lock so
+ * that recording takes no lock and no locked instruction.  The arrays are
+ * merged when a snapshot is taken, e.g. by StatisticsRecorder::WriteGraph().
+ * Thread indices are returned on thread exit and reused, the tallies of
+ * exited threads are kept, so only threads beyond kMaxThreads running at
+ * once share a locked overflow tally.
+ */
+
+#ifndef __CONCURRENT_HISTOGRAM_HH__
+#define __CONCURRENT_HISTOGRAM_HH__
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include "chromium/metrics/histogram.hh"
+#include "chromium/synchronization/lock.hh"
+
+#define CONCURRENT_HISTOGRAM_CUSTOM_COUNTS(name, sample, min, max, bucket_count) \
+    STATIC_HISTOGRAM_POINTER_BLOCK(name, Add(sample), \
+        torikuru::concurrent_histogram_t::FactoryGet(name, min, max, bucket_count, \
+                                    chromium::Histogram::kNoFlags))
+
+namespace torikuru
+{
+
+	class concurrent_histogram_t :
+		public chromium::Histogram
+	{
+	public:
+/* As Histogram::FactoryGet(), an existing histogram of the same name is
+ * returned whichever backend it uses.
+ */
+		static chromium::Histogram* FactoryGet (const std::string& name, Sample minimum, Sample maximum, size_t bucket_count, Flags flags);
+
+		virtual void SnapshotSample (SampleSet* sample) const override;
+
+	protected:
+		concurrent_histogram_t (const std::string& name, Sample minimum, Sample maximum, size_t bucket_count);
+		virtual ~concurrent_histogram_t();
+
+		virtual void Accumulate (Sample value, Count count, size_t index) override;
+
+	private:
+		static const unsigned kMaxThreads = 64;
+
+		struct shard_t
+		{
+			explicit shard_t (size_t bucket_count);
+
+			std::atomic<uint32_t> sequence;
+/* 64-bit sum as halves, atomic 64-bit stores are not native with -m32. */
+			std::atomic<uint32_t> sum_low;
+			std::atomic<uint32_t> sum_high;
+			std::unique_ptr<std::atomic<Count>[]> counts;
+		};
+
+/* Dense per-process thread index assigned on first use, released on
+ * thread exit.
+ */
+		static unsigned thread_index();
+
+		shard_t* GetShard();
+
+		std::atomic<shard_t*> shards_[kMaxThreads];
+
+/* Guards the base class tally used by overflow threads. */
+		mutable chromium::Lock overflow_lock_;
+	};
+
+} /* namespace torikuru */
+
+#endif /* __CONCURRENT_HISTOGRAM_HH__ */
+
+/* eof */
@@ -3,11 +3,37 @@
 
 #include "config.hh"
 
+torikuru::session_config_t::session_config_t() :
+/* default values */
+	sim_rate (0),
+	sim_symbol_count (1000),
+	sim_field_count (16),
+	sim_update_ratio (0.95),
+	sim_seed (1)
+{
+}
+
 torikuru::config_t::config_t() :
 /* default values */
 	disable_update (false),
 	disable_refresh (false),
 	terminate_on_sync (false),
+	reload_batch_size (500),
+	conflate_interval (0),
+	checkpoint_interval (0),
+	flush_interval (1000),
+	fsync_policy ("none"),
+	shm_fields_per_slot (64),
+	metrics_interval (10),
+	metrics_port (0),
+	trace_buffer_size (262144),
+	follow (false),
+	replay_speed (1.0),
+	inspect (false),
+	inspect_top (10),
+	compact (false),
+	compact_level (19),
+	clock_source ("realtime"),
 /* boiler plate naming */
 	monitor_name ("ApplicationLoggerMonitorName"),
 	event_queue_name ("EventQueueName")
@@ -16,6 +16,8 @@ namespace torikuru
 
 	struct session_config_t
 	{
+		session_config_t();
+
 //  RFA session name, one session contains a horizontal scaling set of connections.
 		std::string session_name;
 
@@ -25,7 +27,7 @@ namespace torikuru
 //  RFA consumer name.
 		std::string consumer_name;
 
-//  Protocol name, RSSL or SSL.
+//  Protocol name, RSSL, SSL or SIM for a simulated source.
 		std::string protocol;
 
 //  TREP-RT service name, e.g. IDN_RDF.
@@ -61,6 +63,24 @@ namespace torikuru
  * Range: "" (None) or "<IPv4 address>/hostname" or "<IPv4 address>/net"
  */
 		std::string position;
+
+//  Simulated source events per second, zero for as fast as possible.
+		unsigned sim_rate;
+
+//  Simulated symbols created when no symbol list is given.
+		unsigned sim_symbol_count;
+
+//  Simulated fields per image, updates carry a quarter of them.
+		unsigned sim_field_count;
+
+//  Fraction of simulated events after the initial images that are updates.
+		double sim_update_ratio;
+
+//  Simulated workload seed.
+		unsigned sim_seed;
+
+//  Archive replayed by the simulated source instead of a synthetic workload.
+		std::string sim_replay_path;
 	};
 
 	struct config_t
@@ -86,15 +106,113 @@ namespace torikuru
 //  File containing list of symbols
 		std::string symbol_path;
 
+//  Maximum count of item streams opened or closed per event loop iteration
+//  when applying a reloaded symbol list.
+		unsigned reload_batch_size;
+
+//  Marketfeed field names recorded at capture, empty to record entire payloads.
+		std::vector<std::string> fields;
+
+//  Interval in milliseconds at which conflated updates are recorded, zero
+//  to record every update.
+		unsigned conflate_interval;
+
+//  Interval in seconds between checkpoints of every item image written to
+//  the archive, zero to disable.
+		unsigned checkpoint_interval;
+
+//  Interval in milliseconds at which records are compressed and written
+//  through so that a following reader sees them, zero to write only full
+//  buffers.
+		unsigned flush_interval;
+
+//  When the archive is forced to disk: "none", "interval" after every flush
+//  or "rotate" at the end of each checkpoint segment, and in all but "none"
+//  on exit.
+		std::string fsync_policy;
+
+//  Trained Zstandard dictionary from torikuru_dict.  Capture writes
+//  Zstandard blocks with it instead of zlib, compaction uses it, and it
+//  is required to read archives written with it.
+		std::string dictionary_path;
+
+//  Shared memory last value cache name under /dev/shm, "$1" is replaced
+//  with the service name, empty to disable.
+		std::string shm_cache;
+
+//  Maximum fields held per item in the shared memory cache.
+		unsigned shm_fields_per_slot;
+
+//  Unix domain socket for control requests, empty to disable.
+		std::string control_path;
+
+//  Interval in seconds between performance counter snapshots.
+		unsigned metrics_interval;
+
+//  Loopback TCP port serving counters in Prometheus text format, zero to
+//  disable.
+		int metrics_port;
+
+//  JSON-lines file appended with counters and rates each interval, empty
+//  to disable.
+		std::string stats_path;
+
+//  Chrome trace event file written at exit, tracing runs from startup when
+//  set.
+		std::string trace_path;
+
+//  Trace events buffered per thread, later events are dropped.
+		unsigned trace_buffer_size;
+
 //  Where to record images
 		std::string output_path;
 
+//  CSV files exported during capture, "$1" is replaced with the service name,
+//  empty to disable.
+		std::string csv_path;
+
+//  Marketfeed field columns of CSV files exported during capture, apart from
+//  the recording fields so that the archive may still record entire payloads.
+		std::vector<std::string> csv_fields;
+
 //  Where to read images from
 		std::string input_path;
 
+//  Extract from an input file still being written until the writer closes
+//  it, with the recording fields as columns.
+		bool follow;
+
+//  Re-emit the input archive to subscribers of "tcp://host:port" or
+//  "unix://path" instead of extracting, empty to disable.
+		std::string replay_endpoint;
+
+//  Replay speed relative to recorded pacing, zero for as fast as possible.
+		double replay_speed;
+
+//  Report statistics of the input files, comma separated, scanned in
+//  parallel, instead of extracting.
+		bool inspect;
+
+//  Most active symbols listed per inspected archive.
+		unsigned inspect_top;
+
+//  Rewrite the input files, comma separated, in place with Zstandard in
+//  larger blocks on idle priority threads, verifying before replacing.
+		bool compact;
+
+//  Zstandard level of compaction.
+		int compact_level;
+
 //  Time period to capture data, in seconds.
 		std::string time_limit;
 
+//  Extraction start time, seconds since the epoch or ISO 8601 local time.
+		std::string start_time;
+
+//  Record timestamp source: "realtime" for clock_gettime(CLOCK_REALTIME) or
+//  "tsc" for the invariant TSC calibrated against it.
+		std::string clock_source;
+
 //// API boiler plate nomenclature
 //  RFA application logger monitor name.
 		std::string monitor_name;
@@ -116,13 +234,19 @@ namespace torikuru
 			", \"instance_id\": \"" << session.instance_id << "\""
 			", \"user_name\": \"" << session.user_name << "\""
 			", \"position\": \"" << session.position << "\""
+			", \"sim_rate\": " << session.sim_rate <<
+			", \"sim_symbol_count\": " << session.sim_symbol_count <<
+			", \"sim_field_count\": " << session.sim_field_count <<
+			", \"sim_update_ratio\": " << session.sim_update_ratio <<
+			", \"sim_seed\": " << session.sim_seed <<
+			", \"sim_replay_path\": \"" << session.sim_replay_path << "\""
 			" }";
 		return o;
 	}
 
 	inline
 	std::ostream& operator<< (std::ostream& o, const config_t& config) {
-		std::ostringstream sessions, instruments;
+		std::ostringstream sessions, instruments, fields, csv_fields;
 		for (auto it = config.sessions.begin(); it != config.sessions.end(); ++it) {
 			if (it != config.sessions.begin())
 				sessions << ", ";
@@ -133,6 +257,16 @@ namespace torikuru
 				instruments << ", ";
 			instruments << '"' << *it << '"';
 		}		
+		for (auto it = config.fields.begin(); it != config.fields.end(); ++it) {
+			if (it != config.fields.begin())
+				fields << ", ";
+			fields << '"' << *it << '"';
+		}
+		for (auto it = config.csv_fields.begin(); it != config.csv_fields.end(); ++it) {
+			if (it != config.csv_fields.begin())
+				csv_fields << ", ";
+			csv_fields << '"' << *it << '"';
+		}
 		o << "\"config_t\": { "
 			  "\"sessions\": [" << sessions.str() << "]"
 			", \"instruments\": \"" << instruments.str() << "\""
@@ -140,9 +274,35 @@ namespace torikuru
 			", \"disable_refresh\": " << (config.disable_refresh?"true":"false") << ""
 			", \"terminate_on_sync\": " << (config.terminate_on_sync?"true":"false") << ""
 			", \"symbol_path\": \"" << config.symbol_path << "\""
+			", \"reload_batch_size\": " << config.reload_batch_size <<
+			", \"fields\": [" << fields.str() << "]"
+			", \"conflate_interval\": " << config.conflate_interval <<
+			", \"checkpoint_interval\": " << config.checkpoint_interval <<
+			", \"flush_interval\": " << config.flush_interval <<
+			", \"fsync_policy\": \"" << config.fsync_policy << "\""
+			", \"dictionary_path\": \"" << config.dictionary_path << "\""
+			", \"shm_cache\": \"" << config.shm_cache << "\""
+			", \"shm_fields_per_slot\": " << config.shm_fields_per_slot <<
+			", \"control_path\": \"" << config.control_path << "\""
+			", \"metrics_interval\": " << config.metrics_interval <<
+			", \"metrics_port\": " << config.metrics_port <<
+			", \"stats_path\": \"" << config.stats_path << "\""
+			", \"trace_path\": \"" << config.trace_path << "\""
+			", \"trace_buffer_size\": " << config.trace_buffer_size <<
 			", \"output_path\": \"" << config.output_path << "\""
+			", \"csv_path\": \"" << config.csv_path << "\""
+			", \"csv_fields\": [" << csv_fields.str() << "]"
 			", \"input_path\": \"" << config.input_path << "\""
+			", \"follow\": " << (config.follow?"true":"false") << ""
+			", \"replay_endpoint\": \"" << config.replay_endpoint << "\""
+			", \"replay_speed\": " << config.replay_speed <<
+			", \"inspect\": " << (config.inspect?"true":"false") << ""
+			", \"inspect_top\": " << config.inspect_top <<
+			", \"compact\": " << (config.compact?"true":"false") << ""
+			", \"compact_level\": " << config.compact_level <<
 			", \"time_limit\": \"" << config.time_limit << "\""
+			", \"start_time\": \"" << config.start_time << "\""
+			", \"clock_source\": \"" << config.clock_source << "\""
 			", \"monitor_name\": \"" << config.monitor_name << "\""
 			", \"event_queue_name\": \"" << config.event_queue_name << "\""
 			" }";
@@ -18,15 +18,13 @@
 #include <algorithm>
 #include <utility>
 
-/* Protocol Buffers */
-#include <google/protobuf/io/zero_copy_stream_impl.h>
-#include <google/protobuf/io/coded_stream.h>
-#include <google/protobuf/io/gzip_stream.h>
-
 #include "chromium/logging.hh"
 #include "chromium/string_util.hh"
+#include "clock.hh"
 #include "error.hh"
+#include "histograms.hh"
 #include "rfaostream.hh"
+#include "trace.hh"
 
 #include <archive.pb.h>
 
@@ -40,13 +38,16 @@ torikuru::consumer_t::consumer_t (
 	const torikuru::session_config_t& config,
 	std::shared_ptr<torikuru::rfa_t> rfa,
 	std::shared_ptr<rfa::common::EventQueue> event_queue,
-	google::protobuf::io::CodedOutputStream* coded_stream
+	archive_writer_t* writer
 	) :
-	last_activity_ (boost::posix_time::microsec_clock::universal_time()),
+	last_activity_ (clock_service_t::coarse_seconds()),
 	config_ (config),
 	rfa_ (rfa),
 	event_queue_ (event_queue),
-	coded_stream_ (coded_stream),
+	writer_ (writer),
+	etl_ (nullptr),
+	is_conflating_ (false),
+	is_caching_ (false),
 	disable_update_ (false),
 	disable_refresh_ (false),
 	refresh_count_ (0),
@@ -55,7 +56,6 @@ torikuru::consumer_t::consumer_t (
 	rwf_minor_version_ (0),
 	is_muted_ (true)
 {
-	memset (cumulative_stats_, 0, sizeof (cumulative_stats_));
 	memset (snap_stats_, 0, sizeof (snap_stats_));
 }
 
@@ -69,6 +69,64 @@ torikuru::consumer_t::~consumer_t()
 	session_.reset();
 }
 
+static const char* kCounterNames[] = {
+	"rfa_events_received",
+	"rfa_events_discarded",
+	"omm_item_events_received",
+	"omm_item_events_discarded",
+	"response_msgs_received",
+	"response_msgs_discarded",
+	"mmt_login_response_received",
+	"mmt_login_response_discarded",
+	"mmt_login_success",
+	"mmt_login_suspect",
+	"mmt_login_closed",
+	"omm_cmd_errors",
+	"mmt_login_validated",
+	"mmt_login_malformed",
+	"mmt_login_exception",
+	"mmt_login_sent",
+	"mmt_market_price_received",
+	"mmt_market_price_request_validated",
+	"mmt_market_price_request_malformed",
+	"mmt_market_price_request_exception",
+	"mmt_market_price_request_sent",
+	"market_data_svc_events_received",
+	"connection_events_received",
+	"entitlement_events_received",
+	"license_events_received",
+	"market_data_item_events_received",
+	"market_data_item_events_filtered",
+	"market_data_item_events_conflated",
+	"conflated_updates_sent",
+	"checkpoint_images_sent",
+	"stale_item_events_discarded",
+};
+
+static_assert (sizeof (kCounterNames) / sizeof (kCounterNames[0]) == torikuru::CONSUMER_PC_MAX, "counter name per counter");
+
+const char*
+torikuru::consumer_t::GetCounterName (
+	unsigned counter
+	)
+{
+	DCHECK_LT (counter, static_cast<unsigned> (CONSUMER_PC_MAX));
+	return kCounterNames[counter];
+}
+
+bool
+torikuru::consumer_t::GetItemStream (
+	const std::string& name,
+	item_stream_t* item_stream
+	) const
+{
+	const item_id_t id = directory_.Find (name);
+	if (kInvalidItemId == id)
+		return false;
+	*item_stream = directory_[id];
+	return true;
+}
+
 bool
 torikuru::consumer_t::Init (
 	bool disable_update,
@@ -78,7 +136,7 @@ torikuru::consumer_t::Init (
 	)
 throw (rfa::common::InvalidConfigurationException, rfa::common::InvalidUsageException)
 {
-	last_activity_ = boost::posix_time::microsec_clock::universal_time();
+	last_activity_ = clock_service_t::coarse_seconds();
 
 	disable_update_ = disable_update;
 	disable_refresh_ = disable_refresh;
@@ -86,6 +144,10 @@ throw (rfa::common::InvalidConfigurationException, rfa::common::InvalidUsageExce
 
 	on_sync_ = on_sync;
 
+/* Events are injected by a simulator_t on the dispatch thread. */
+	if (LowerCaseEqualsASCII (config_.protocol, connections::kSIM))
+		return true;
+
 /* 7.2.1 Configuring the Session Layer Package.
  */
 	VLOG(3) << "Acquiring RFA session.";
@@ -257,7 +319,7 @@ throw (rfa::common::InvalidUsageException)
 
 bool
 torikuru::consumer_t::SendItemRequest (
-	std::shared_ptr<item_stream_t> item_stream	
+	item_id_t id
 	)
 throw (rfa::common::InvalidUsageException)
 {
@@ -275,8 +337,10 @@ throw (rfa::common::InvalidUsageException)
 
 	rfa::message::AttribInfo attribInfo;
 	attribInfo.setNameType (rfa::rdm::INSTRUMENT_NAME_RIC);
-	attribInfo.setName (item_stream->rfa_item_name);
-	attribInfo.setServiceName (item_stream->rfa_service_name);
+	const RFA_String itemName (directory_.name (id), 0, false);
+	attribInfo.setName (itemName);
+	const RFA_String serviceName (config_.service_name.c_str(), 0, false);
+	attribInfo.setServiceName (serviceName);
 
 	request.setAttribInfo (attribInfo);
 
@@ -310,7 +374,8 @@ throw (rfa::common::InvalidUsageException)
 	VLOG(3) << "Registering OMM item interest for MMT_MARKET_PRICE.";
 	rfa::sessionLayer::OMMItemIntSpec ommItemIntSpec;
 	ommItemIntSpec.setMsg (&request);
-	item_stream->item_handle = omm_consumer_->registerClient (event_queue_.get(), &ommItemIntSpec, *this, item_stream.get() /* closure */);
+	item_stream_t* item_stream = &directory_[id];
+	item_stream->item_handle = omm_consumer_->registerClient (event_queue_.get(), &ommItemIntSpec, *this, directory_.ToClosure (id));
 	cumulative_stats_[CONSUMER_PC_MMT_MARKET_PRICE_REQUEST_SENT]++;
 	if (nullptr == item_stream->item_handle)
 		return false;
@@ -319,21 +384,133 @@ throw (rfa::common::InvalidUsageException)
 
 bool
 torikuru::consumer_t::AddSubscription (
-	std::shared_ptr<item_stream_t> item_stream	
+	item_id_t id
 	)
 throw (rfa::common::InvalidUsageException)
 {
 	VLOG(2) << "Adding market data subscription.";
 
 	rfa::sessionLayer::MarketDataItemSub marketDataItemSub;
-	marketDataItemSub.setServiceName (item_stream->rfa_service_name);
-	marketDataItemSub.setItemName (item_stream->rfa_item_name);
-	item_stream->item_handle = market_data_subscriber_->subscribe (*event_queue_.get(), marketDataItemSub, *this, item_stream.get() /* closure */);
+	const RFA_String serviceName (config_.service_name.c_str(), 0, false);
+	marketDataItemSub.setServiceName (serviceName);
+	const RFA_String itemName (directory_.name (id), 0, false);
+	marketDataItemSub.setItemName (itemName);
+	item_stream_t* item_stream = &directory_[id];
+	item_stream->item_handle = market_data_subscriber_->subscribe (*event_queue_.get(), marketDataItemSub, *this, directory_.ToClosure (id));
 	if (nullptr == item_stream->item_handle)
 		return false;
 	return true;
 }
 
+void
+torikuru::consumer_t::SetFieldProjection (
+	const std::vector<std::string>& fields
+	)
+{
+	if (fields.empty())
+		projection_.reset();
+	else
+		projection_.reset (new field_projection_t (fields));
+}
+
+/* Record one merged update per pending item, stamped with the receive time
+ * of the last update merged.
+ */
+void
+torikuru::consumer_t::FlushConflatedUpdates()
+{
+	for (const item_id_t id : pending_ids_)
+		WritePendingUpdate (id);
+	pending_ids_.clear();
+}
+
+/* The item stays listed in pending_ids_ until the next flush, which skips
+ * it unless updates are merged again.
+ */
+void
+torikuru::consumer_t::WritePendingUpdate (
+	item_id_t id
+	)
+{
+	pending_update_t& pending = pending_[id];
+	if (!pending.is_pending)
+		return;
+	pending.is_pending = false;
+	if (!directory_.IsValid (id) || pending.fields.empty())
+		return;
+	pending_msg_.ReUse();
+	if (pending.fields.Pack (field_names_, &pending_msg_)) {
+		pending_mfeed_.Clear();
+		pending_mfeed_.set_tv_sec (pending.last_update.tv_sec);
+		pending_mfeed_.set_tv_usec (pending.last_update.tv_nsec / 1000);
+		pending_mfeed_.set_tv_nsec (pending.last_update.tv_nsec);
+		pending_mfeed_.set_message_type (rfa::sessionLayer::MarketDataItemEvent::Update);
+		pending_mfeed_.set_service_name (config_.service_name);
+		pending_mfeed_.set_item_name (directory_.name (id));
+		pending_mfeed_.set_packed_buffer (pending_msg_.Packed(), pending_msg_.PackSize());
+		if (nullptr != writer_)
+			writer_->Write (&pending_mfeed_);
+		if (nullptr != etl_)
+			etl_->Push (pending_mfeed_);
+		cumulative_stats_[CONSUMER_PC_CONFLATED_UPDATES_SENT]++;
+	}
+	pending.fields.Clear();
+}
+
+bool
+torikuru::consumer_t::SetSharedCache (
+	const std::string& name,
+	uint32_t slot_count,
+	uint32_t fields_per_slot
+	)
+{
+	std::unique_ptr<shm_cache_t> shm_cache (new shm_cache_t());
+	if (!shm_cache->Create (name, config_.service_name, slot_count, fields_per_slot))
+		return false;
+	shm_cache_ = std::move (shm_cache);
+	return true;
+}
+
+/* Checkpoint images are stamped with the time they are recorded rather than
+ * the time of the last event cached.
+ */
+bool
+torikuru::consumer_t::WriteCheckpoint (
+	const struct timespec& ts,
+	item_id_t* next_id,
+	unsigned* budget
+	)
+{
+	if (nullptr == writer_)
+		return true;
+	const item_id_t end_id = std::min (directory_.end_id(), static_cast<item_id_t> (image_cache_.size()));
+	for (item_id_t id = *next_id; id < end_id; ++id) {
+		if (!directory_.IsValid (id) || image_cache_[id].empty())
+			continue;
+		if (0 == *budget) {
+			*next_id = id;
+			return false;
+		}
+		--*budget;
+		msg_.ReUse();
+		if (!image_cache_[id].Pack (field_names_, &msg_))
+			continue;
+		mfeed_.Clear();
+		mfeed_.set_tv_sec (ts.tv_sec);
+		mfeed_.set_tv_usec (ts.tv_nsec / 1000);
+		mfeed_.set_tv_nsec (ts.tv_nsec);
+		mfeed_.set_message_type (rfa::sessionLayer::MarketDataItemEvent::Image);
+		mfeed_.set_service_name (config_.service_name);
+		mfeed_.set_item_name (directory_.name (id));
+		mfeed_.set_packed_buffer (msg_.Packed(), msg_.PackSize());
+		mfeed_.set_checkpoint (true);
+		writer_->Write (&mfeed_);
+		cumulative_stats_[CONSUMER_PC_CHECKPOINT_IMAGES_SENT]++;
+	}
+	*next_id = end_id;
+	return true;
+}
+
 /* Re-register entire directory for new handles.
  */
 bool
@@ -346,11 +523,10 @@ torikuru::consumer_t::Resubscribe()
 			return false;
 		}
 
-		for (auto& it : directory_)
-			if (auto sp = it.second.lock())
+		for (item_id_t id = 0; id < directory_.end_id(); ++id)
 /* only non-fulfilled items */
-				if (nullptr == sp->item_handle)
-					SendItemRequest (sp);
+			if (directory_.IsValid (id) && nullptr == directory_[id].item_handle)
+				SendItemRequest (id);
 
 		return true;
 	}
@@ -361,11 +537,18 @@ torikuru::consumer_t::Resubscribe()
 			return false;
 		}
 
-		for (auto& it : directory_)
-			if (auto sp = it.second.lock())
+		for (item_id_t id = 0; id < directory_.end_id(); ++id)
 /* only non-fulfilled items */
-				if (nullptr == sp->item_handle)
-					AddSubscription (sp);
+			if (directory_.IsValid (id) && nullptr == directory_[id].item_handle)
+				AddSubscription (id);
+/* no login phase, subsequent item streams may subscribe immediately. */
+		is_muted_ = false;
+		return true;
+	}
+	else if (LowerCaseEqualsASCII (config_.protocol, connections::kSIM))
+	{
+/* no subscriptions, every item in the directory is simulated. */
+		is_muted_ = false;
 		return true;
 	}
 	
@@ -373,41 +556,121 @@ torikuru::consumer_t::Resubscribe()
 	return false;
 }
 
+/* Subscribe a single item stream on the active transport.
+ */
+bool
+torikuru::consumer_t::Subscribe (
+	item_id_t id
+	)
+throw (rfa::common::InvalidUsageException)
+{
+	if (LowerCaseEqualsASCII (config_.protocol, connections::kRSSL))
+		return SendItemRequest (id);
+	else if (LowerCaseEqualsASCII (config_.protocol, connections::kSSLED))
+		return AddSubscription (id);
+	else if (LowerCaseEqualsASCII (config_.protocol, connections::kSIM))
+		return true;
+	return false;
+}
+
+/* Close an open item stream, the handle is invalid after the stream has been
+ * closed by the infrastructure or unregistered on image.
+ */
+void
+torikuru::consumer_t::Unsubscribe (
+	item_id_t id
+	)
+{
+	item_stream_t* item_stream = &directory_[id];
+	if (nullptr == item_stream->item_handle || item_stream->is_closed)
+		return;
+	if (LowerCaseEqualsASCII (config_.protocol, connections::kRSSL)) {
+		if ((bool)omm_consumer_)
+			omm_consumer_->unregisterClient (item_stream->item_handle);
+	} else if (LowerCaseEqualsASCII (config_.protocol, connections::kSSLED)) {
+		if ((bool)market_data_subscriber_)
+			market_data_subscriber_->unregisterClient (*item_stream->item_handle);
+	}
+	item_stream->item_handle = nullptr;
+	item_stream->is_closed = true;
+}
+
 /* Create an item stream for a given symbol name.  The Item Stream maintains
  * the provider state on behalf of the application.
  */
 bool
 torikuru::consumer_t::CreateItemStream (
-	const char* item_name,
-	std::shared_ptr<item_stream_t> item_stream
+	const char* item_name
 	)
 throw (rfa::common::InvalidUsageException)
 {
 	VLOG(4) << "Creating item stream for RIC \"" << item_name << "\" on service \"" << config_.service_name << "\".";
-	item_stream->rfa_item_name.set (item_name, 0, true);
-	item_stream->rfa_service_name.set (config_.service_name.c_str(), 0, true);
+	const item_id_t id = directory_.Insert (item_name);
+	if (kInvalidItemId == id)
+		return false;
+	directory_[id].last_activity = clock_service_t::coarse_seconds();
 	if (!is_muted_) {
-		if (!SendItemRequest (item_stream))
+		if (!Subscribe (id)) {
+			directory_.Erase (id);
 			return false;
+		}
 	} else {
 /* no-op */
 	}
-	const std::string key (item_name);
-	auto status = directory_.emplace (std::make_pair (key, item_stream));
-	if (!status.second)
+	DVLOG(4) << "Directory size: " << directory_.size();
+	last_activity_ = clock_service_t::coarse_seconds();
+	return true;
+}
+
+/* Remove an item stream from the directory, closing the subscription if
+ * still open.
+ */
+bool
+torikuru::consumer_t::DestroyItemStream (
+	const char* item_name
+	)
+{
+	VLOG(4) << "Destroying item stream for RIC \"" << item_name << "\" on service \"" << config_.service_name << "\".";
+	const item_id_t id = directory_.Find (item_name);
+	if (kInvalidItemId == id)
 		return false;
-	CHECK (true == status.second);
-	CHECK (directory_.end() != directory_.find (key));
+	const item_stream_t& item_stream = directory_[id];
+/* remove from synchronisation accounting */
+	if ((item_stream.refresh_received > 0 || item_stream.is_closed) && refresh_count_ > 0)
+		refresh_count_--;
+	Unsubscribe (id);
+/* item ids are recycled, never emit pending updates under a new name. */
+	if (id < pending_.size()) {
+		pending_[id].is_pending = false;
+		pending_[id].fields.Clear();
+	}
+	if (id < image_cache_.size())
+		image_cache_[id].Clear();
+	if ((bool)shm_cache_)
+		shm_cache_->Erase (id);
+	directory_.Erase (id);
 	DVLOG(4) << "Directory size: " << directory_.size();
-	last_activity_ = boost::posix_time::microsec_clock::universal_time();
+	last_activity_ = clock_service_t::coarse_seconds();
 	return true;
 }
 
+void
+torikuru::consumer_t::GetItemNames (
+	std::vector<std::string>* names
+	) const
+{
+	names->reserve (names->size() + directory_.size());
+	for (item_id_t id = 0; id < directory_.end_id(); ++id)
+		if (directory_.IsValid (id))
+			names->emplace_back (directory_.name (id));
+}
+
 void
 torikuru::consumer_t::processEvent (
 	const rfa::common::Event& event_
 	)
 {
+	TRACE_EVENT("Consumer.processEvent");
 	VLOG(1) << event_;
 	cumulative_stats_[CONSUMER_PC_RFA_EVENTS_RECEIVED]++;
 	switch (event_.getType()) {
@@ -431,9 +694,12 @@ torikuru::consumer_t::processEvent (
 		OnEntitlementsAuthenticationEvent (static_cast<const rfa::sessionLayer::EntitlementsAuthenticationEvent&>(event_));
 		break;
 
-	case rfa::sessionLayer::MarketDataItemEventEnum:
+	case rfa::sessionLayer::MarketDataItemEventEnum: {
+		const uint64_t start = clock_service_t::ReadTicks();
 		OnMarketDataItemEvent (static_cast<const rfa::sessionLayer::MarketDataItemEvent&>(event_));
+		HISTOGRAM_NANOSECONDS("Consumer.HandlerTime", clock_service_t::ReadTicks() - start);
 		break;
+	}
 
 /* Licensing was removed in the RFA 5.0.1 C++ Edition release. */
         default:
@@ -534,10 +800,15 @@ torikuru::consumer_t::OnMarketPrice (
 	)
 {
 	cumulative_stats_[CONSUMER_PC_MMT_MARKET_PRICE_RECEIVED]++;
-	item_stream_t* item_stream = reinterpret_cast<item_stream_t*> (closure);
-	CHECK (nullptr != item_stream);
+	const item_id_t id = directory_.FromClosure (closure);
+/* Queued before the item was removed. */
+	if (kInvalidItemId == id) {
+		cumulative_stats_[CONSUMER_PC_STALE_ITEM_EVENTS_DISCARDED]++;
+		return;
+	}
+	item_stream_t* item_stream = &directory_[id];
 
-	const auto now (boost::posix_time::second_clock::universal_time());
+	const uint32_t now = clock_service_t::coarse_seconds();
 	item_stream->last_activity = now;
 	item_stream->msg_count++;
 
@@ -662,16 +933,56 @@ torikuru::consumer_t::OnMarketDataItemEvent (
 	const rfa::sessionLayer::MarketDataItemEvent&	item_event
 	)
 {
-	timeval tv;
-	gettimeofday (&tv, nullptr);
+	market_data_event_t event;
+	event.id = directory_.FromClosure (item_event.getClosure());
+	event.msg_type = item_event.getMarketDataMsgType();
+	event.data_format = item_event.getDataFormat();
+	event.is_stream_closed = item_event.isEventStreamClosed();
+	event.service_name.set (item_event.getServiceName().data(), item_event.getServiceName().size());
+	event.item_name.set (item_event.getItemName().data(), item_event.getItemName().size());
+	event.new_item_name.set (item_event.getNewItemName().data(), item_event.getNewItemName().size());
+	if (!item_event.getBuffer().isEmpty())
+		event.buffer.set (reinterpret_cast<const char*> (item_event.getBuffer().c_buf()), item_event.getBuffer().size());
+	OnMarketDataEvent (event);
+}
+
+void
+torikuru::consumer_t::ProcessMarketDataEvent (
+	const market_data_event_t& event
+	)
+{
+	TRACE_EVENT("Consumer.ProcessMarketDataEvent");
+	cumulative_stats_[CONSUMER_PC_RFA_EVENTS_RECEIVED]++;
+	const uint64_t start = clock_service_t::ReadTicks();
+	OnMarketDataEvent (event);
+	HISTOGRAM_NANOSECONDS("Consumer.HandlerTime", clock_service_t::ReadTicks() - start);
+}
+
+void
+torikuru::consumer_t::OnMarketDataEvent (
+	const market_data_event_t&	item_event
+	)
+{
+	struct timespec ts;
+	clock_service_t::GetRealTime (&ts);
+	bool is_recorded = true;
+	bool is_unpacked = false;
 
 	cumulative_stats_[CONSUMER_PC_MARKET_DATA_ITEM_EVENTS_RECEIVED]++;
-	item_stream_t* item_stream = reinterpret_cast<item_stream_t*> (item_event.getClosure());
-	CHECK (nullptr != item_stream);
+	const item_id_t id = item_event.id;
+/* Queued before the item was removed, or replayed for a removed item. */
+	if (!directory_.IsValid (id)) {
+		cumulative_stats_[CONSUMER_PC_STALE_ITEM_EVENTS_DISCARDED]++;
+		return;
+	}
+	item_stream_t* item_stream = &directory_[id];
+	const uint32_t now = clock_service_t::coarse_seconds();
+	item_stream->last_activity = now;
+	item_stream->msg_count++;
 
 /* Sanity check on stream state */
-	if (item_event.isEventStreamClosed()) {
-		VLOG(2) << "Stream closed for \"" << item_event.getItemName().c_str() << "\".";
+	if (item_event.is_stream_closed) {
+		VLOG(2) << "Stream closed for \"" << item_event.item_name << "\".";
 		if (!item_stream->is_closed) {
 			refresh_count_++;
 			item_stream->is_closed = true;
@@ -682,20 +993,25 @@ torikuru::consumer_t::OnMarketDataItemEvent (
 //	localtime_r (&tv.tv_sec, &local_time);
 //	struct tm* tm_time = &local_time;
 
-	switch (item_event.getMarketDataMsgType()) {
+	switch (item_event.msg_type) {
 	case rfa::sessionLayer::MarketDataItemEvent::Image:
+		item_stream->last_refresh = now;
 		if (0 == item_stream->refresh_received++) {
 			refresh_count_++;
-			if (disable_refresh_)
-				goto check_sync;
-			if (!interest_after_refresh_) {
+			if (disable_refresh_) {
+				if (!is_caching_ && !(bool)shm_cache_)
+					goto check_sync;
+/* cache but do not record */
+				is_recorded = false;
+			} else if (!interest_after_refresh_) {
+				Unsubscribe (id);
 				item_stream->is_closed = true;
-				market_data_subscriber_->unregisterClient (*item_stream->item_handle);
 			}
 		}
 		break;
 
 	case rfa::sessionLayer::MarketDataItemEvent::Update:
+		item_stream->last_update = now;
 		item_stream->update_received++;
 		if (disable_update_)
 			goto check_sync;
@@ -707,6 +1023,7 @@ torikuru::consumer_t::OnMarketDataItemEvent (
 
 	case rfa::sessionLayer::MarketDataItemEvent::Status:
 		VLOG(1) << "Ignoring status";
+		item_stream->last_status = now;
 		item_stream->status_received++;
 		goto check_sync;
 
@@ -731,13 +1048,13 @@ torikuru::consumer_t::OnMarketDataItemEvent (
 		goto check_sync;
 
 	default:
-		LOG(WARNING) << "Unhandled market data message type (" << item_event.getMarketDataMsgType() << ")";
+		LOG(WARNING) << "Unhandled market data message type (" << item_event.msg_type << ")";
 		break;
 	}
 
-	if (rfa::sessionLayer::MarketDataEnums::Marketfeed != item_event.getDataFormat()) {
+	if (rfa::sessionLayer::MarketDataEnums::Marketfeed != item_event.data_format) {
 		std::ostringstream format;
-		switch (item_event.getDataFormat()) {
+		switch (item_event.data_format) {
 		case rfa::sessionLayer::MarketDataEnums::Unknown:
 			format << "Unknown";
 			break;
@@ -754,45 +1071,98 @@ torikuru::consumer_t::OnMarketDataItemEvent (
 			format << "TibMsg";
 			break;
 		default:
-			format << item_event.getDataFormat();
+			format << item_event.data_format;
 			break;
 		}
 		
 		LOG(WARNING) << "Unsupported data format (" << format.str() << ") in market data item event.";
-		market_data_subscriber_->unregisterClient (*item_stream->item_handle);
+		Unsubscribe (id);
 		goto check_sync;
 	}
 
 	mfeed_.Clear();
 
 /* meta-data */
-	mfeed_.set_tv_sec (tv.tv_sec);
-	mfeed_.set_tv_usec (tv.tv_usec);
-	mfeed_.set_message_type (item_event.getMarketDataMsgType());
-	mfeed_.set_service_name (item_event.getServiceName().data(), item_event.getServiceName().size());
-	mfeed_.set_item_name (item_event.getItemName().data(), item_event.getItemName().size());
-	if (!item_event.getNewItemName().empty())
-		mfeed_.set_new_item_name (item_event.getNewItemName().data(), item_event.getNewItemName().size());
+	mfeed_.set_tv_sec (ts.tv_sec);
+	mfeed_.set_tv_usec (ts.tv_nsec / 1000);
+	mfeed_.set_tv_nsec (ts.tv_nsec);
+	mfeed_.set_message_type (item_event.msg_type);
+	mfeed_.set_service_name (item_event.service_name.data(), item_event.service_name.size());
+	mfeed_.set_item_name (item_event.item_name.data(), item_event.item_name.size());
+	if (!item_event.new_item_name.empty())
+		mfeed_.set_new_item_name (item_event.new_item_name.data(), item_event.new_item_name.size());
 
 /* payload */
-	if (!item_event.getBuffer().isEmpty())
-		mfeed_.set_packed_buffer (item_event.getBuffer().c_buf(), item_event.getBuffer().size());
+	if ((bool)projection_) {
+		if (item_event.buffer.empty() ||
+		    !projection_->Project (item_event.buffer.data(), item_event.buffer.size(), mfeed_.mutable_packed_buffer()))
+		{
+			cumulative_stats_[CONSUMER_PC_MARKET_DATA_ITEM_EVENTS_FILTERED]++;
+			goto check_sync;
+		}
+	} else if (!item_event.buffer.empty()) {
+		mfeed_.set_packed_buffer (item_event.buffer.data(), item_event.buffer.size());
+	}
 
-	if (nullptr != coded_stream_) {
-		if (!mfeed_.IsInitialized()) {
-			LOG(ERROR) << "Ignoring message: " << mfeed_.InitializationErrorString();
-		} else {
-			const uint32_t size = mfeed_.ByteSize();
-			coded_stream_->WriteVarint32 (size);
-			mfeed_.SerializeWithCachedSizes (coded_stream_);
+/* Unpack once for the last value caches and conflation. */
+	if (is_caching_ || is_conflating_ || (bool)shm_cache_)
+		is_unpacked = (TIBMSG_OK == msg_.UnPack (const_cast<char*> (mfeed_.packed_buffer().c_str()), mfeed_.packed_buffer().size()));
+
+/* Last value cache */
+	if (is_unpacked && is_caching_) {
+		if (id >= image_cache_.size())
+			image_cache_.resize (directory_.capacity());
+		field_set_t& image = image_cache_[id];
+		if (rfa::sessionLayer::MarketDataItemEvent::Image == item_event.msg_type)
+			image.Clear();
+		image.Merge (&msg_, &field_names_);
+	}
+	if (is_unpacked && (bool)shm_cache_) {
+		shm_cache_->Publish (id, directory_.name (id), item_event.msg_type, ts, &msg_, &field_names_,
+				     rfa::sessionLayer::MarketDataItemEvent::Image == item_event.msg_type);
+	}
+	if (!is_recorded)
+		goto check_sync;
+
+	if (is_conflating_) {
+		if (id >= pending_.size())
+			pending_.resize (directory_.end_id());
+		pending_update_t& pending = pending_[id];
+		switch (item_event.msg_type) {
+		case rfa::sessionLayer::MarketDataItemEvent::Update:
+			if (!is_unpacked)
+				break;
+			pending.fields.Merge (&msg_, &field_names_);
+			pending.last_update = ts;
+			if (!pending.is_pending) {
+				pending.is_pending = true;
+				pending_ids_.push_back (id);
+			}
+			cumulative_stats_[CONSUMER_PC_MARKET_DATA_ITEM_EVENTS_CONFLATED]++;
+			goto check_sync;
+		case rfa::sessionLayer::MarketDataItemEvent::Image:
+			pending.is_pending = false;
+			pending.fields.Clear();
+			break;
+		default:
+			break;
 		}
+/* Corrections, status and updates that cannot be merged follow the
+ * updates already merged, not overtake them.
+ */
+		WritePendingUpdate (id);
 	}
 
+	if (nullptr != writer_)
+		writer_->Write (&mfeed_);
+	if (nullptr != etl_)
+		etl_->Push (mfeed_);
+
 check_sync:
 /* Refresh state check */
 	if (!in_sync_ && refresh_count_ == directory_.size()) {
 		in_sync_ = true;
-		LOG(INFO) << "Service "  << item_event.getServiceName().c_str() << " synchronised.";
+		LOG(INFO) << "Service "  << item_event.service_name << " synchronised.";
 		if ((bool)on_sync_)
 			on_sync_();
 	}
@@ -11,12 +11,6 @@
 /* Boost Chrono. */
 #include <boost/chrono.hpp>
 
-/* Boost Posix Time */
-#include <boost/date_time/posix_time/posix_time.hpp>
-
-/* Boost unordered map: bypass 2^19 limit in MSVC std::unordered_map */
-#include <boost/unordered_map.hpp>
-
 /* Boost noncopyable base class */
 #include <boost/utility.hpp>
 
@@ -26,13 +20,18 @@
 /* RFA 7.2 */
 #include <rfa/rfa.hh>
 
-/* Protocol Buffers */
-#include <google/protobuf/io/gzip_stream.h>
-
 #include "chromium/debug/leak_tracker.hh"
+#include "chromium/string_piece.hh"
 #include "rfa.hh"
+#include "archive_writer.hh"
 #include "config.hh"
+#include "counter.hh"
 #include "deleter.hh"
+#include "etl_stage.hh"
+#include "field_projection.hh"
+#include "field_set.hh"
+#include "item_store.hh"
+#include "shm_cache.hh"
 
 #include <archive.pb.h>
 
@@ -66,44 +65,28 @@ namespace torikuru
 		CONSUMER_PC_ENTITLEMENT_EVENTS_RECEIVED,
 		CONSUMER_PC_LICENSE_EVENTS_RECEIVED,
 		CONSUMER_PC_MARKET_DATA_ITEM_EVENTS_RECEIVED,
+		CONSUMER_PC_MARKET_DATA_ITEM_EVENTS_FILTERED,
+		CONSUMER_PC_MARKET_DATA_ITEM_EVENTS_CONFLATED,
+		CONSUMER_PC_CONFLATED_UPDATES_SENT,
+		CONSUMER_PC_CHECKPOINT_IMAGES_SENT,
+		CONSUMER_PC_STALE_ITEM_EVENTS_DISCARDED,
 /* marker */
 		CONSUMER_PC_MAX
 	};
 
-	class item_stream_t : boost::noncopyable
+/* Market data item event independent of the RFA event source, views are
+ * only valid for the duration of the handler.
+ */
+	struct market_data_event_t
 	{
-	public:
-		item_stream_t()
-			: item_handle (nullptr),
-			  msg_count (0),
-			  last_activity (boost::posix_time::second_clock::universal_time()),
-			  refresh_received (0),
-			  status_received (0),
-			  update_received (0),
-			  is_closed (false)
-		{
-		}
-
-/* Fixed name for this stream. */
-		rfa::common::RFA_String rfa_item_name;
-
-/* Service origin, e.g. IDN_RDF */
-		rfa::common::RFA_String rfa_service_name;
-
-/* Subscription handle which is valid from login success to login close. */
-		rfa::common::Handle* item_handle;
-
-/* Performance counters */
-		boost::posix_time::ptime last_activity;
-		boost::posix_time::ptime last_refresh;
-		boost::posix_time::ptime last_status;
-		boost::posix_time::ptime last_update;
-		uint32_t msg_count;		/* including unknown message types */
-		uint32_t refresh_received;
-		uint32_t status_received;
-		uint32_t update_received;
-
-		bool is_closed;
+		item_id_t id;
+		int msg_type;				/* MarketDataItemEvent::MarketDataMsgType */
+		int data_format;			/* MarketDataEnums::DataFormat */
+		bool is_stream_closed;
+		chromium::StringPiece service_name;
+		chromium::StringPiece item_name;
+		chromium::StringPiece new_item_name;
+		chromium::StringPiece buffer;
 	};
 
 	class session_t;
@@ -113,17 +96,98 @@ namespace torikuru
 		boost::noncopyable
 	{
 	public:
-		consumer_t (const session_config_t& config, std::shared_ptr<rfa_t> rfa, std::shared_ptr<rfa::common::EventQueue> event_queue, google::protobuf::io::CodedOutputStream* coded_stream);
+		consumer_t (const session_config_t& config, std::shared_ptr<rfa_t> rfa, std::shared_ptr<rfa::common::EventQueue> event_queue, archive_writer_t* writer);
 		~consumer_t();
 
 		bool Init (bool disable_update, bool disable_refresh, bool interest_after_refresh, std::function<void()>& on_sync) throw (rfa::common::InvalidConfigurationException, rfa::common::InvalidUsageException);
 
-		bool CreateItemStream (const char* name, std::shared_ptr<item_stream_t> item_stream) throw (rfa::common::InvalidUsageException);
+		bool CreateItemStream (const char* name) throw (rfa::common::InvalidUsageException);
+		bool DestroyItemStream (const char* name);
+		bool HasItemStream (const std::string& name) const {
+			return kInvalidItemId != directory_.Find (name);
+		}
+		item_id_t FindItemStream (const chromium::StringPiece& name) const {
+			return directory_.Find (name);
+		}
+		void GetItemNames (std::vector<std::string>* names) const;
 		bool Resubscribe();
 
+/* Record only the listed Marketfeed fields, empty to record entire payloads. */
+		void SetFieldProjection (const std::vector<std::string>& fields);
+
+/* Merge updates per item until the next flush, images are recorded as
+ * received and discard pending updates, any other event is recorded after
+ * the pending update of its item.
+ */
+		void SetConflation (bool is_conflating) {
+			is_conflating_ = is_conflating;
+		}
+		void FlushConflatedUpdates();
+
+/* Maintain a last value cache of every item for checkpoints, images are
+ * cached even when refresh recording is disabled.
+ */
+		void SetImageCache (bool is_caching) {
+			is_caching_ = is_caching;
+		}
+/* Record synthesized images of cached items from *next_id onward, at most
+ * *budget of them.  Returns true once the last item has been recorded.
+ */
+		bool WriteCheckpoint (const struct timespec& ts, item_id_t* next_id, unsigned* budget);
+
+/* Publish item state to a shared memory region for local readers, items
+ * with ids beyond the slot count are not published.
+ */
+		bool SetSharedCache (const std::string& name, uint32_t slot_count, uint32_t fields_per_slot);
+
+/* Also export every record committed to the archive, checkpoints aside,
+ * through an inline extraction stage.
+ */
+		void SetExtraction (etl_stage_t* etl) {
+			etl_ = etl;
+		}
+
+/* Pre-size the item directory for an expected symbol count. */
+		void ReserveItemStreams (size_t count) {
+			directory_.Reserve (count);
+		}
+		size_t GetItemStreamCount() const {
+			return directory_.size();
+		}
+		size_t GetDirectoryMemoryUsage() const {
+			return directory_.memory_usage();
+		}
+
 /* RFA event callback. */
 		void processEvent (const rfa::common::Event& event) override;
 
+/* Simulated event source entry, as for a RFA market data item event. */
+		void ProcessMarketDataEvent (const market_data_event_t& event);
+
+/* State queries, dispatch thread only. */
+		const std::string& GetServiceName() const {
+			return config_.service_name;
+		}
+		bool GetItemStream (const std::string& name, item_stream_t* item_stream) const;
+		bool IsInSync() const {
+			return in_sync_;
+		}
+		unsigned GetRefreshCount() const {
+			return refresh_count_;
+		}
+		uint32_t GetLastActivity() const {
+			return last_activity_;
+		}
+/* Safe to read from any thread. */
+		uint32_t GetCumulativeStat (unsigned counter) const {
+			return cumulative_stats_[counter].load();
+		}
+		const counter_t* GetCumulativeStats() const {
+			return cumulative_stats_;
+		}
+/* Counter name for reporting, e.g. "rfa_events_received". */
+		static const char* GetCounterName (unsigned counter);
+
 		uint8_t GetRwfMajorVersion() const {
 			return rwf_major_version_;
 		}
@@ -145,10 +209,14 @@ namespace torikuru
 		void OnConnectionEvent (const rfa::sessionLayer::ConnectionEvent &event);
 		void OnEntitlementsAuthenticationEvent (const rfa::sessionLayer::EntitlementsAuthenticationEvent &event);
 		void OnMarketDataItemEvent (const rfa::sessionLayer::MarketDataItemEvent &Event);
+		void OnMarketDataEvent (const market_data_event_t& event);
 
 		bool SendLoginRequest() throw (rfa::common::InvalidUsageException);
-		bool SendItemRequest (std::shared_ptr<item_stream_t> item_stream) throw (rfa::common::InvalidUsageException);
-		bool AddSubscription (std::shared_ptr<item_stream_t> item_stream) throw (rfa::common::InvalidUsageException);
+		bool SendItemRequest (item_id_t id) throw (rfa::common::InvalidUsageException);
+		bool AddSubscription (item_id_t id) throw (rfa::common::InvalidUsageException);
+		bool Subscribe (item_id_t id) throw (rfa::common::InvalidUsageException);
+		void Unsubscribe (item_id_t id);
+		void WritePendingUpdate (item_id_t id);
 
 		const session_config_t& config_;
 
@@ -173,7 +241,32 @@ namespace torikuru
 		std::shared_ptr<rfa::common::Handle> item_handle_;
 
 		archive::Marketfeed mfeed_;
-		google::protobuf::io::CodedOutputStream* coded_stream_;
+		archive_writer_t* writer_;
+		etl_stage_t* etl_;
+		std::unique_ptr<field_projection_t> projection_;
+
+/* Conflation state indexed by item id. */
+		struct pending_update_t {
+			pending_update_t() : is_pending (false) {}
+			field_set_t fields;
+			struct timespec last_update;
+			bool is_pending;
+		};
+		bool is_conflating_;
+		std::vector<pending_update_t> pending_;
+		std::vector<item_id_t> pending_ids_;
+/* Merged updates are packed apart from the event being handled. */
+		archive::Marketfeed pending_mfeed_;
+		TibMsg pending_msg_;
+		field_names_t field_names_;
+		TibMsg msg_;
+
+/* Last value cache indexed by item id, sized with the directory. */
+		bool is_caching_;
+		std::vector<field_set_t> image_cache_;
+
+/* Shared memory last value cache. */
+		std::unique_ptr<shm_cache_t> shm_cache_;
 
 		bool disable_update_;
 		bool disable_refresh_;
@@ -198,13 +291,15 @@ namespace torikuru
 		int stream_state_;
 		int data_state_;
 
-/* Container of all item streams keyed by symbol name. */
-		boost::unordered_map<std::string, std::weak_ptr<item_stream_t>> directory_;
+/* Container of all item streams keyed by symbol name, item ids are used as
+ * the RFA subscription closure.
+ */
+		item_store_t directory_;
 		boost::shared_mutex directory_lock_;
 
 /** Performance Counters **/
-		boost::posix_time::ptime last_activity_;
-		uint32_t cumulative_stats_[CONSUMER_PC_MAX];
+		uint32_t last_activity_;		/* clock_service_t coarse seconds */
+		counter_t cumulative_stats_[CONSUMER_PC_MAX];
 		uint32_t snap_stats_[CONSUMER_PC_MAX];
 
 		chromium::debug::LeakTracker<consumer_t> leak_tracker_;
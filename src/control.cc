@@ -0,0 +1,330 @@
+/* Local control socket.
+ */
+
+#include "control.hh"
+
+#include <cerrno>
+#include <cstring>
+#include <vector>
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "chromium/logging.hh"
+#include "chromium/safe_strerror_posix.hh"
+
+/* Clients sending longer lines are disconnected. */
+static const size_t kMaxRequestLength = 4096;
+
+/* Clients not reading responses are disconnected. */
+static const size_t kMaxPendingOutput = 16 * 1024 * 1024;
+
+static const unsigned kMaxClients = 16;
+
+static
+bool
+SetNonBlocking (
+	int fd
+	)
+{
+	const int flags = fcntl (fd, F_GETFL, 0);
+	return -1 != flags && -1 != fcntl (fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+/* Remove a socket left by a previous run, anything else at the path is
+ * kept and fails the open.
+ */
+static
+bool
+UnlinkStaleSocket (
+	const std::string& path
+	)
+{
+	struct stat st;
+	if (-1 == lstat (path.c_str(), &st)) {
+		if (ENOENT == errno)
+			return true;
+		LOG(ERROR) << "lstat \"" << path << "\": " << safe_strerror (errno);
+		return false;
+	}
+	if (!S_ISSOCK (st.st_mode)) {
+		LOG(ERROR) << "\"" << path << "\" exists and is not a socket.";
+		return false;
+	}
+	if (-1 == unlink (path.c_str())) {
+		LOG(ERROR) << "unlink \"" << path << "\": " << safe_strerror (errno);
+		return false;
+	}
+	return true;
+}
+
+torikuru::control_server_t::control_server_t() :
+	listen_fd_ (-1),
+	is_running_ (false),
+	next_client_id_ (0)
+{
+	wake_fds_[0] = wake_fds_[1] = -1;
+}
+
+torikuru::control_server_t::~control_server_t()
+{
+	Close();
+}
+
+bool
+torikuru::control_server_t::Open (
+	const std::string& path
+	)
+{
+	struct sockaddr_un addr;
+	memset (&addr, 0, sizeof (addr));
+	if (path.size() >= sizeof (addr.sun_path)) {
+		LOG(ERROR) << "Control socket path \"" << path << "\" too long.";
+		return false;
+	}
+	addr.sun_family = AF_UNIX;
+	strncpy (addr.sun_path, path.c_str(), sizeof (addr.sun_path) - 1);
+	if (!UnlinkStaleSocket (path))
+		return false;
+
+	listen_fd_ = socket (AF_UNIX, SOCK_STREAM, 0);
+	if (-1 == listen_fd_) {
+		LOG(ERROR) << "socket: " << safe_strerror (errno);
+		return false;
+	}
+	if (-1 == bind (listen_fd_, reinterpret_cast<struct sockaddr*> (&addr), sizeof (addr)) ||
+	    -1 == listen (listen_fd_, 8) ||
+	    !SetNonBlocking (listen_fd_))
+	{
+		LOG(ERROR) << "Control socket \"" << path << "\": " << safe_strerror (errno);
+		close (listen_fd_), listen_fd_ = -1;
+		return false;
+	}
+	if (-1 == pipe (wake_fds_) || !SetNonBlocking (wake_fds_[0]) || !SetNonBlocking (wake_fds_[1])) {
+		LOG(ERROR) << "pipe: " << safe_strerror (errno);
+		close (listen_fd_), listen_fd_ = -1;
+		unlink (path.c_str());
+		return false;
+	}
+	path_ = path;
+	is_running_ = true;
+	thread_.reset (new boost::thread (boost::bind (&control_server_t::Run, this)));
+	LOG(INFO) << "Listening for control requests on \"" << path_ << "\".";
+	return true;
+}
+
+void
+torikuru::control_server_t::Close()
+{
+	if ((bool)thread_) {
+		{
+			boost::lock_guard<boost::mutex> lock (lock_);
+			is_running_ = false;
+		}
+		Wake();
+		thread_->join();
+		thread_.reset();
+	}
+	for (auto& client : clients_)
+		close (client.second.fd);
+	clients_.clear();
+	if (-1 != listen_fd_) {
+		close (listen_fd_), listen_fd_ = -1;
+		unlink (path_.c_str());
+	}
+	for (int i = 0; i < 2; ++i) {
+		if (-1 != wake_fds_[i])
+			close (wake_fds_[i]), wake_fds_[i] = -1;
+	}
+}
+
+void
+torikuru::control_server_t::Wake()
+{
+	const char c = 0;
+	if (-1 == write (wake_fds_[1], &c, sizeof (c)) && EAGAIN != errno)
+		LOG(WARNING) << "write: " << safe_strerror (errno);
+}
+
+void
+torikuru::control_server_t::ProcessRequests (
+	const handler_t& handler
+	)
+{
+	std::deque<message_t> requests;
+	{
+		boost::lock_guard<boost::mutex> lock (lock_);
+		if (requests_.empty())
+			return;
+		requests.swap (requests_);
+	}
+	for (auto& request : requests) {
+		request.line = handler (request.line);
+		request.line.push_back ('\n');
+	}
+	{
+		boost::lock_guard<boost::mutex> lock (lock_);
+		for (auto& request : requests)
+			responses_.emplace_back (std::move (request));
+	}
+	Wake();
+}
+
+void
+torikuru::control_server_t::Run()
+{
+	std::vector<struct pollfd> fds;
+	std::vector<uint64_t> ids;
+	while (true) {
+/* Collect responses from the dispatch thread. */
+		{
+			boost::lock_guard<boost::mutex> lock (lock_);
+			if (!is_running_)
+				break;
+			for (auto& response : responses_) {
+				auto it = clients_.find (response.client_id);
+				if (clients_.end() == it)
+					continue;
+				--it->second.pending_count;
+				it->second.output.append (response.line);
+				if (it->second.output.size() > kMaxPendingOutput) {
+					LOG(WARNING) << "Disconnecting control client not reading responses.";
+					it->second.is_closed = true;
+				}
+			}
+			responses_.clear();
+		}
+
+/* Reap closed clients, and those that finished sending once answered. */
+		for (auto it = clients_.begin(); it != clients_.end();) {
+			const client_t& client = it->second;
+			if (client.is_closed ||
+			    (client.is_eof && 0 == client.pending_count && client.output.empty()))
+			{
+				close (it->second.fd);
+				it = clients_.erase (it);
+				VLOG(1) << "Control client disconnected.";
+			} else {
+				++it;
+			}
+		}
+
+		fds.clear();
+		ids.clear();
+		struct pollfd pfd;
+		pfd.fd = wake_fds_[0], pfd.events = POLLIN, pfd.revents = 0;
+		fds.push_back (pfd);
+		pfd.fd = listen_fd_;
+		fds.push_back (pfd);
+		for (const auto& client : clients_) {
+			pfd.fd = client.second.fd;
+			pfd.events = (client.second.is_eof ? 0 : POLLIN) | (client.second.output.empty() ? 0 : POLLOUT);
+			fds.push_back (pfd);
+			ids.push_back (client.first);
+		}
+		if (-1 == poll (fds.data(), fds.size(), -1)) {
+			if (EINTR == errno)
+				continue;
+			LOG(ERROR) << "poll: " << safe_strerror (errno);
+			break;
+		}
+
+		if (fds[0].revents & POLLIN) {
+			char buf[64];
+			while (read (wake_fds_[0], buf, sizeof (buf)) > 0);
+		}
+		for (size_t i = 2; i < fds.size(); ++i) {
+			client_t& client = clients_[ids[i - 2]];
+			if (fds[i].revents & POLLOUT)
+				OnWritable (&client);
+			if (client.is_closed)
+				continue;
+/* A hang up after a half close leaves nobody to answer. */
+			if (client.is_eof) {
+				if (fds[i].revents & (POLLHUP | POLLERR))
+					client.is_closed = true;
+			} else if (fds[i].revents & (POLLIN | POLLHUP | POLLERR)) {
+				OnReadable (ids[i - 2], &client);
+			}
+		}
+		if (fds[1].revents & POLLIN) {
+			const int fd = accept (listen_fd_, nullptr, nullptr);
+			if (-1 != fd) {
+				if (clients_.size() >= kMaxClients || !SetNonBlocking (fd)) {
+					close (fd);
+				} else {
+					client_t& client = clients_[next_client_id_++];
+					client.fd = fd;
+					client.is_closed = false;
+					client.is_eof = false;
+					client.pending_count = 0;
+					VLOG(1) << "Control client connected.";
+				}
+			}
+		}
+	}
+}
+
+/* Queue each complete request line for the dispatch thread.  At end of
+ * input, as after a half close by "echo stats | socat", a final line
+ * without terminator counts as complete and reading stops, the connection
+ * stays open until the responses are sent.
+ */
+void
+torikuru::control_server_t::OnReadable (
+	uint64_t client_id,
+	client_t* client
+	)
+{
+	char buf[4096];
+	ssize_t bytes;
+	while ((bytes = read (client->fd, buf, sizeof (buf))) > 0)
+		client->input.append (buf, bytes);
+	if (-1 == bytes && EAGAIN != errno) {
+		client->is_closed = true;
+		return;
+	}
+	if (0 == bytes) {
+		client->is_eof = true;
+		if (!client->input.empty() && '\n' != client->input[client->input.size() - 1])
+			client->input.push_back ('\n');
+	}
+	std::string::size_type pos;
+	boost::lock_guard<boost::mutex> lock (lock_);
+	while (std::string::npos != (pos = client->input.find ('\n'))) {
+		message_t request;
+		request.client_id = client_id;
+		request.line.assign (client->input, 0, pos);
+		if (!request.line.empty() && '\r' == request.line[request.line.size() - 1])
+			request.line.resize (request.line.size() - 1);
+		client->input.erase (0, pos + 1);
+		if (!request.line.empty()) {
+			requests_.emplace_back (std::move (request));
+			++client->pending_count;
+		}
+	}
+	if (client->input.size() > kMaxRequestLength) {
+		LOG(WARNING) << "Disconnecting control client, request too long.";
+		client->is_closed = true;
+	}
+}
+
+void
+torikuru::control_server_t::OnWritable (
+	client_t* client
+	)
+{
+	const ssize_t bytes = send (client->fd, client->output.data(), client->output.size(), MSG_NOSIGNAL);
+	if (-1 == bytes) {
+		if (EAGAIN != errno)
+			client->is_closed = true;
+		return;
+	}
+	client->output.erase (0, bytes);
+}
+
+/* eof */
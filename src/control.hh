@@ -0,0 +1,87 @@
+/* Local control socket.
+ *
+ * A Unix domain stream socket served by its own thread.  Each request line
+ * is queued for the dispatch thread which answers from consistent state in
+ * ProcessRequests(), so request handlers need no locking of their own.
+ * Responses are single line JSON objects.
+ */
+
+#ifndef __CONTROL_HH__
+#define __CONTROL_HH__
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+/* Boost noncopyable base class */
+#include <boost/utility.hpp>
+
+/* Boost threading. */
+#include <boost/thread.hpp>
+
+namespace torikuru
+{
+
+	class control_server_t :
+		boost::noncopyable
+	{
+	public:
+		typedef std::function<std::string (const std::string&)> handler_t;
+
+		control_server_t();
+		~control_server_t();
+
+/* Replaces any stale socket at path and starts the I/O thread. */
+		bool Open (const std::string& path);
+		void Close();
+
+/* Answer queued requests, call from the dispatch thread. */
+		void ProcessRequests (const handler_t& handler);
+
+	private:
+		struct client_t {
+			int fd;
+			bool is_closed;
+/* Peer finished sending, closed once every request is answered. */
+			bool is_eof;
+/* Requests queued for the dispatch thread and not yet answered. */
+			unsigned pending_count;
+			std::string input;
+			std::string output;
+		};
+/* Clients are identified by a sequence number as descriptors are reused. */
+		struct message_t {
+			uint64_t client_id;
+			std::string line;
+		};
+
+		void Run();
+		void Wake();
+		void OnReadable (uint64_t client_id, client_t* client);
+		void OnWritable (client_t* client);
+
+		std::string path_;
+		int listen_fd_;
+/* Self-pipe to wake the I/O thread for responses and shutdown. */
+		int wake_fds_[2];
+		bool is_running_;
+		std::unique_ptr<boost::thread> thread_;
+
+/* Owned by the I/O thread. */
+		std::unordered_map<uint64_t, client_t> clients_;
+		uint64_t next_client_id_;
+
+		boost::mutex lock_;
+		std::deque<message_t> requests_;
+		std::deque<message_t> responses_;
+	};
+
+} /* namespace torikuru */
+
+#endif /* __CONTROL_HH__ */
+
+/* eof */
@@ -0,0 +1,50 @@
+/* Performance counter.
+ *
+ * Incremented by a single thread with a relaxed load and store, avoiding
+ * the locked read-modify-write of an atomic increment, and read from any
+ * thread.  32-bit counters wrap, so rates are computed from the unsigned
+ * difference of two readings.
+ */
+
+#ifndef __COUNTER_HH__
+#define __COUNTER_HH__
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+namespace torikuru
+{
+
+	class counter_t
+	{
+	public:
+		counter_t() : value_ (0) {}
+
+/* Owning thread only. */
+		void operator++ (int) {
+			value_.store (value_.load (std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+		}
+		void operator+= (uint32_t delta) {
+			value_.store (value_.load (std::memory_order_relaxed) + delta, std::memory_order_relaxed);
+		}
+		void reset() {
+			value_.store (0, std::memory_order_relaxed);
+		}
+
+		uint32_t load() const {
+			return value_.load (std::memory_order_relaxed);
+		}
+
+	private:
+		counter_t (const counter_t&);
+		counter_t& operator= (const counter_t&);
+
+		std::atomic<uint32_t> value_;
+	};
+
+} /* namespace torikuru */
+
+#endif /* __COUNTER_HH__ */
+
+/* eof */
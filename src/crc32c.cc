@@ -0,0 +1,98 @@
+/* CRC-32C (Castagnoli).
+ */
+
+#include "crc32c.hh"
+
+#include <cstring>
+
+#include <cpuid.h>
+
+/* Reflected polynomial 0x1edc6f41. */
+static const uint32_t kPolynomial = 0x82f63b78;
+
+namespace
+{
+
+	struct crc32c_table_t {
+		crc32c_table_t() {
+			for (uint32_t i = 0; i < 256; ++i) {
+				uint32_t crc = i;
+				for (int bit = 0; bit < 8; ++bit)
+					crc = (crc >> 1) ^ (kPolynomial & (0 - (crc & 1)));
+				entries[i] = crc;
+			}
+		}
+		uint32_t entries[256];
+	};
+
+} /* anonymous namespace */
+
+static
+uint32_t
+Crc32cSoftware (
+	uint32_t crc,
+	const uint8_t* p,
+	size_t length
+	)
+{
+	static const crc32c_table_t table;
+	while (length-- > 0)
+		crc = table.entries[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+	return crc;
+}
+
+/* Byte steps until aligned, then one instruction per word.  Written as
+ * inline assembly so that the rest of the build needs no -msse4.2.
+ */
+static
+uint32_t
+Crc32cHardware (
+	uint32_t crc,
+	const uint8_t* p,
+	size_t length
+	)
+{
+	for (; length > 0 && 0 != (reinterpret_cast<uintptr_t> (p) & 3); --length, ++p)
+		__asm__ ("crc32b %1, %0" : "+r" (crc) : "rm" (*p));
+#if defined(__x86_64__)
+	for (; length >= 8; length -= 8, p += 8) {
+		uint64_t word, crc64 = crc;
+		memcpy (&word, p, sizeof (word));
+		__asm__ ("crc32q %1, %0" : "+r" (crc64) : "rm" (word));
+		crc = static_cast<uint32_t> (crc64);
+	}
+#endif
+	for (; length >= 4; length -= 4, p += 4) {
+		uint32_t word;
+		memcpy (&word, p, sizeof (word));
+		__asm__ ("crc32l %1, %0" : "+r" (crc) : "rm" (word));
+	}
+	for (; length > 0; --length, ++p)
+		__asm__ ("crc32b %1, %0" : "+r" (crc) : "rm" (*p));
+	return crc;
+}
+
+bool
+torikuru::HasHardwareCrc32c()
+{
+	unsigned eax, ebx, ecx, edx;
+	if (!__get_cpuid (1, &eax, &ebx, &ecx, &edx))
+		return false;
+	return 0 != (ecx & (1 << 20));
+}
+
+uint32_t
+torikuru::Crc32c (
+	uint32_t crc,
+	const void* data,
+	size_t length
+	)
+{
+	static const bool is_hardware = HasHardwareCrc32c();
+	const uint8_t* p = static_cast<const uint8_t*> (data);
+	crc = ~crc;
+	crc = is_hardware ? Crc32cHardware (crc, p, length) : Crc32cSoftware (crc, p, length);
+	return ~crc;
+}
+
+/* eof */
@@ -0,0 +1,28 @@
+/* CRC-32C (Castagnoli).
+ *
+ * The SSE4.2 crc32 instruction is used when the processor has it, a byte
+ * table otherwise.  Both produce the standard iSCSI checksum, e.g.
+ * 0xe3069283 for "123456789".
+ */
+
+#ifndef __CRC32C_HH__
+#define __CRC32C_HH__
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace torikuru
+{
+
+/* Extend crc, zero to start, over length bytes of data. */
+	uint32_t Crc32c (uint32_t crc, const void* data, size_t length);
+
+/* CPUID.01H:ECX[20]. */
+	bool HasHardwareCrc32c();
+
+} /* namespace torikuru */
+
+#endif /* __CRC32C_HH__ */
+
+/* eof */
@@ -0,0 +1,146 @@
+/* Extraction CSV formatting.
+ */
+
+#include "csv_format.hh"
+
+#include <cstring>
+#include <iomanip>
+#include <sstream>
+
+static const char* kFixedColumns[] = { "service", "symbol", "time", "type" };
+static const size_t kFixedColumnCount = sizeof (kFixedColumns) / sizeof (kFixedColumns[0]);
+
+/* Trails the field columns so that every earlier column keeps its
+ * position.
+ */
+static const char kWriteTimeColumn[] = "write_time";
+
+/* Converted field value limit. */
+static const size_t kMaxValueLength = 256;
+
+torikuru::csv_format_t::csv_format_t (
+	const std::vector<std::string>& fields
+	)
+{
+	for (const auto& field : fields) {
+		if (IsFixedColumn (field) || columns_.end() != columns_.find (field))
+			continue;
+		columns_.emplace (field, kFixedColumnCount + fields_.size());
+		fields_.emplace_back (field);
+	}
+	values_.resize (kFixedColumnCount + fields_.size() + 1);
+}
+
+bool
+torikuru::csv_format_t::IsFixedColumn (
+	const std::string& name
+	)
+{
+	for (size_t i = 0; i < kFixedColumnCount; ++i)
+		if (name == kFixedColumns[i])
+			return true;
+	return name == kWriteTimeColumn;
+}
+
+std::string
+torikuru::csv_format_t::Header() const
+{
+	std::string header;
+	for (size_t i = 0; i < kFixedColumnCount; ++i) {
+		header.append (kFixedColumns[i]);
+		header.push_back (',');
+	}
+	for (size_t i = 0; i < fields_.size(); ++i) {
+		header.append (fields_[i]);
+		header.push_back (',');
+	}
+	header.append (kWriteTimeColumn);
+	return header;
+}
+
+void
+torikuru::csv_format_t::FormatRow (
+	const archive::Marketfeed& mfeed,
+	TibMsg* msg,
+	std::string* row
+	)
+{
+	for (auto& value : values_)
+		value.clear();
+	values_[0] = mfeed.service_name();
+	values_[1] = mfeed.item_name();
+	{
+/* Receive time, nanosecond precision from archives that carry it. */
+		const time_t tv_sec = mfeed.has_tv_sec() ? mfeed.tv_sec() : 0;
+		const uint32_t nsec = mfeed.has_tv_nsec() ? mfeed.tv_nsec() :
+				(mfeed.has_tv_usec() ? mfeed.tv_usec() * 1000 : 0);
+		values_[2] = FormatTimestamp (tv_sec, nsec, mfeed.has_tv_nsec());
+		values_[3] = std::to_string (mfeed.message_type());
+/* Commit time, blank for archives that predate write_delay_ns. */
+		if (mfeed.has_write_delay_ns()) {
+			const uint64_t ns = static_cast<uint64_t> (nsec) + mfeed.write_delay_ns();
+			values_.back() = FormatTimestamp (tv_sec + static_cast<time_t> (ns / 1000000000ULL),
+							  static_cast<uint32_t> (ns % 1000000000ULL),
+							  true);
+		}
+	}
+
+	char buf[kMaxValueLength];
+	for (field_.First (msg); field_.status == TIBMSG_OK; field_.Next()) {
+		name_.assign (field_.Name(), field_.NameSize() == 0 ? 0 : strlen (field_.Name()));
+		auto it = columns_.find (name_);
+		if (columns_.end() == it)
+			continue;
+		memset (buf, 0, sizeof (buf));
+		if (field_.Convert (buf, sizeof (buf)) != TIBMSG_OK)
+			continue;
+/* Quote values containing the delimiter. */
+		std::string& value = values_[it->second];
+		if (nullptr != strchr (buf, ',')) {
+			value.assign (1, '"');
+			value.append (buf);
+			value.push_back ('"');
+		} else {
+			value.assign (buf);
+		}
+	}
+
+	row->clear();
+	for (size_t i = 0; i < values_.size(); ++i) {
+		if (i > 0)
+			row->push_back (',');
+		row->append (values_[i]);
+	}
+}
+
+std::string
+torikuru::csv_format_t::FormatTimestamp (
+	time_t tv_sec,
+	uint32_t nsec,
+	bool has_nsec
+	)
+{
+	struct tm local_time = {0};
+	localtime_r (&tv_sec, &local_time);
+	std::ostringstream oss;
+	oss << std::setfill('0')
+	    << std::setw(4) << 1900 + local_time.tm_year
+	    << '-'
+	    << std::setw(2) << 1 + local_time.tm_mon
+	    << '-'
+	    << std::setw(2) << local_time.tm_mday
+	    << 'T'
+	    << std::setw(2) << local_time.tm_hour
+	    << ':'
+	    << std::setw(2) << local_time.tm_min
+	    << ':'
+	    << std::setw(2) << local_time.tm_sec
+	    << '.';
+	if (has_nsec)
+		oss << std::setw(9) << nsec;
+	else
+		oss << std::setw(6) << (nsec / 1000);
+	return oss.str();
+}
+
+/* eof */
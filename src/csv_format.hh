@@ -0,0 +1,64 @@
+/* Extraction CSV formatting.
+ *
+ * One row per Marketfeed record: service, symbol, receive time and message
+ * type, one column per field name, fields absent from the record left
+ * blank, and last the commit time.
+ */
+
+#ifndef __CSV_FORMAT_HH__
+#define __CSV_FORMAT_HH__
+#pragma once
+
+#include <cstdint>
+#include <ctime>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/* Boost noncopyable base class */
+#include <boost/utility.hpp>
+
+/* RFA 7.2 */
+#include <rfa/rfa.hh>
+
+#include <archive.pb.h>
+
+namespace torikuru
+{
+
+	class csv_format_t :
+		boost::noncopyable
+	{
+	public:
+/* Field columns in output order, names of the fixed columns are ignored. */
+		explicit csv_format_t (const std::vector<std::string>& fields);
+
+/* Header line without line terminator. */
+		std::string Header() const;
+
+/* msg must hold the unpacked payload of mfeed, which must carry service
+ * name, item name and message type.  row is replaced, without line
+ * terminator.
+ */
+		void FormatRow (const archive::Marketfeed& mfeed, TibMsg* msg, std::string* row);
+
+/* ISO 8601 local time with 6 or 9 fraction digits. */
+		static std::string FormatTimestamp (time_t tv_sec, uint32_t nsec, bool has_nsec);
+
+		static bool IsFixedColumn (const std::string& name);
+
+	private:
+		std::vector<std::string> fields_;
+		std::unordered_map<std::string, size_t> columns_;
+
+/* Scratch state re-used between rows. */
+		std::vector<std::string> values_;
+		TibField field_;
+		std::string name_;
+	};
+
+} /* namespace torikuru */
+
+#endif /* __CSV_FORMAT_HH__ */
+
+/* eof */
@@ -0,0 +1,404 @@
+/* Train a Zstandard dictionary for archive blocks from sample archives.
+ *
+ * usage: torikuru_dict --input-path=PATH[,PATH...] --output-path=PATH
+ *                      [--dictionary-path=PATH]
+ *                      [--dictionary-size=BYTES] [--sample-size=BYTES]
+ *                      [--compression-level=N] [--block-size=BYTES]
+ *                      [--seed=N]
+ *
+ * Samples are framed records, as compressed in archive blocks, drawn
+ * uniformly from the input up to --sample-size bytes.  The dictionary is
+ * then measured over the whole input cut into blocks of --block-size as
+ * written: ratio and compression and decompression speed of zlib at the
+ * capture level, of Zstandard, and of Zstandard with the dictionary.
+ * Inputs written with an earlier dictionary are read with the one given
+ * in --dictionary-path.
+ */
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <zlib.h>
+#include <zstd.h>
+#include <zdict.h>
+
+/* Google Protocol Buffers */
+#include <google/protobuf/io/coded_stream.h>
+
+#include "chromium/command_line.hh"
+#include "chromium/file_util.hh"
+#include "chromium/logging.hh"
+#include "chromium/metrics/histogram.hh"
+#include "chromium/string_split.hh"
+#include "archive_format.hh"
+#include "archive_reader.hh"
+#include "clock.hh"
+
+namespace switches {
+
+const char kInputPath[]			= "input-path";
+const char kOutputPath[]		= "output-path";
+const char kDictionaryPath[]		= "dictionary-path";
+const char kDictionarySize[]		= "dictionary-size";
+const char kSampleSize[]		= "sample-size";
+const char kCompressionLevel[]		= "compression-level";
+const char kBlockSize[]			= "block-size";
+const char kSeed[]			= "seed";
+
+}  // namespace switches
+
+/* Zstandard's own default, gains flatten beyond about 100KB. */
+static const size_t kDefaultDictionarySize = 112640;
+
+/* Training wants about a hundred times the dictionary size. */
+static const size_t kDefaultSampleSize = 16 * 1024 * 1024;
+
+/* As captured. */
+static const size_t kDefaultBlockSize = 256 * 1024;
+static const int kCaptureZlibLevel = 1;
+
+/* Compressed size and time of one codec over every block. */
+struct codec_result_t {
+	const char* name;
+	uint64_t compressed_bytes;
+	uint64_t compress_ticks;
+	uint64_t decompress_ticks;
+	uint64_t failure_count;
+};
+
+class block_codecs_t
+{
+public:
+	block_codecs_t() :
+		zstd_cctx_ (ZSTD_createCCtx()),
+		zstd_dict_cctx_ (ZSTD_createCCtx()),
+		zstd_dctx_ (ZSTD_createDCtx()),
+		zstd_dict_dctx_ (ZSTD_createDCtx())
+	{
+		memset (&deflate_, 0, sizeof (deflate_));
+		memset (&inflate_, 0, sizeof (inflate_));
+	}
+	~block_codecs_t() {
+		deflateEnd (&deflate_);
+		inflateEnd (&inflate_);
+		ZSTD_freeCCtx (zstd_cctx_);
+		ZSTD_freeCCtx (zstd_dict_cctx_);
+		ZSTD_freeDCtx (zstd_dctx_);
+		ZSTD_freeDCtx (zstd_dict_dctx_);
+	}
+
+/* False if any context cannot be set up, a codec without its level or
+ * dictionary would be measured as another.
+ */
+	bool Init (int compression_level, const std::string& dictionary) {
+		if (Z_OK != deflateInit (&deflate_, kCaptureZlibLevel) ||
+		    Z_OK != inflateInit (&inflate_))
+		{
+			LOG(ERROR) << "zlib initialization failed.";
+			return false;
+		}
+		if (nullptr == zstd_cctx_ || nullptr == zstd_dict_cctx_ ||
+		    nullptr == zstd_dctx_ || nullptr == zstd_dict_dctx_)
+		{
+			LOG(ERROR) << "Zstandard context creation failed.";
+			return false;
+		}
+		size_t rc = ZSTD_CCtx_setParameter (zstd_cctx_, ZSTD_c_compressionLevel, compression_level);
+		if (!ZSTD_isError (rc))
+			rc = ZSTD_CCtx_setParameter (zstd_dict_cctx_, ZSTD_c_compressionLevel, compression_level);
+		if (ZSTD_isError (rc)) {
+			LOG(ERROR) << "ZSTD_CCtx_setParameter: " << ZSTD_getErrorName (rc);
+			return false;
+		}
+		rc = ZSTD_CCtx_loadDictionary (zstd_dict_cctx_, dictionary.data(), dictionary.size());
+		if (ZSTD_isError (rc)) {
+			LOG(ERROR) << "ZSTD_CCtx_loadDictionary: " << ZSTD_getErrorName (rc);
+			return false;
+		}
+		rc = ZSTD_DCtx_loadDictionary (zstd_dict_dctx_, dictionary.data(), dictionary.size());
+		if (ZSTD_isError (rc)) {
+			LOG(ERROR) << "ZSTD_DCtx_loadDictionary: " << ZSTD_getErrorName (rc);
+			return false;
+		}
+		return true;
+	}
+
+/* Each codec compresses the block and restores it, counted a failure
+ * unless the round trip is exact.
+ */
+	void Measure (const std::string& block, codec_result_t* results) {
+		MeasureZlib (block, &results[0]);
+		MeasureZstd (block, zstd_cctx_, zstd_dctx_, &results[1]);
+		MeasureZstd (block, zstd_dict_cctx_, zstd_dict_dctx_, &results[2]);
+	}
+
+private:
+	void MeasureZlib (const std::string& block, codec_result_t* result) {
+		uint64_t start = torikuru::clock_service_t::ReadTicks();
+		deflateReset (&deflate_);
+		const uLong bound = deflateBound (&deflate_, static_cast<uLong> (block.size()));
+		compressed_.resize (bound);
+		deflate_.next_in = reinterpret_cast<Bytef*> (const_cast<char*> (block.data()));
+		deflate_.avail_in = static_cast<uInt> (block.size());
+		deflate_.next_out = reinterpret_cast<Bytef*> (&compressed_[0]);
+		deflate_.avail_out = static_cast<uInt> (bound);
+		const bool is_compressed = (Z_STREAM_END == deflate (&deflate_, Z_FINISH));
+		result->compress_ticks += torikuru::clock_service_t::ReadTicks() - start;
+		if (!is_compressed) {
+			++result->failure_count;
+			return;
+		}
+		const size_t compressed_size = deflate_.total_out;
+		result->compressed_bytes += compressed_size;
+		start = torikuru::clock_service_t::ReadTicks();
+		decompressed_.resize (block.size());
+		inflateReset (&inflate_);
+		inflate_.next_in = reinterpret_cast<Bytef*> (&compressed_[0]);
+		inflate_.avail_in = static_cast<uInt> (compressed_size);
+		inflate_.next_out = reinterpret_cast<Bytef*> (&decompressed_[0]);
+		inflate_.avail_out = static_cast<uInt> (block.size());
+		const bool is_decompressed = (Z_STREAM_END == inflate (&inflate_, Z_FINISH));
+		result->decompress_ticks += torikuru::clock_service_t::ReadTicks() - start;
+		if (!is_decompressed || decompressed_ != block)
+			++result->failure_count;
+	}
+
+	void MeasureZstd (const std::string& block, ZSTD_CCtx* cctx, ZSTD_DCtx* dctx, codec_result_t* result) {
+		uint64_t start = torikuru::clock_service_t::ReadTicks();
+		compressed_.resize (ZSTD_compressBound (block.size()));
+		const size_t compressed_size = ZSTD_compress2 (cctx, &compressed_[0], compressed_.size(), block.data(), block.size());
+		result->compress_ticks += torikuru::clock_service_t::ReadTicks() - start;
+		if (ZSTD_isError (compressed_size)) {
+			++result->failure_count;
+			return;
+		}
+		result->compressed_bytes += compressed_size;
+		start = torikuru::clock_service_t::ReadTicks();
+		decompressed_.resize (block.size());
+		const size_t rc = ZSTD_decompressDCtx (dctx, &decompressed_[0], decompressed_.size(), compressed_.data(), compressed_size);
+		result->decompress_ticks += torikuru::clock_service_t::ReadTicks() - start;
+		if (ZSTD_isError (rc) || decompressed_ != block)
+			++result->failure_count;
+	}
+
+	z_stream deflate_;
+	z_stream inflate_;
+	ZSTD_CCtx* zstd_cctx_;
+	ZSTD_CCtx* zstd_dict_cctx_;
+	ZSTD_DCtx* zstd_dctx_;
+	ZSTD_DCtx* zstd_dict_dctx_;
+	std::string compressed_;
+	std::string decompressed_;
+};
+
+/* Every parseable record of the inputs framed as in an archive block.  The
+ * dictionary is that of inputs written with one, may be empty.
+ */
+template <typename Visitor>
+static
+bool
+ForEachRecord (
+	const std::vector<std::string>& paths,
+	const std::string& dictionary,
+	Visitor visitor
+	)
+{
+	archive::Marketfeed mfeed;
+	std::string record;
+	bool is_valid;
+	for (const auto& path : paths) {
+		torikuru::archive_reader_t reader;
+		reader.set_dictionary (dictionary);
+		if (!reader.Open (path))
+			return false;
+		while (reader.Read (&mfeed, &is_valid)) {
+			if (!is_valid)
+				continue;
+			const uint32_t size = torikuru::RecordByteSize (mfeed);
+			record.resize (google::protobuf::io::CodedOutputStream::VarintSize32 (size) + size);
+			uint8_t* buf = reinterpret_cast<uint8_t*> (&record[0]);
+			buf = google::protobuf::io::CodedOutputStream::WriteVarint32ToArray (size, buf);
+			mfeed.SerializeWithCachedSizesToArray (buf);
+			visitor (record);
+		}
+	}
+	return true;
+}
+
+static
+double
+MegabytesPerSecond (
+	uint64_t bytes,
+	uint64_t ticks
+	)
+{
+	const uint64_t ns = torikuru::clock_service_t::TicksToNanoseconds (ticks);
+	return ns > 0 ? bytes * 1e9 / ns / (1024 * 1024) : 0.0;
+}
+
+int
+main (
+	int		argc,
+	const char*	argv[]
+	)
+{
+	CommandLine::Init (argc, argv);
+	chromium::StatisticsRecorder recorder;
+	const CommandLine& command_line = *CommandLine::ForCurrentProcess();
+
+	const std::string input_path = command_line.GetSwitchValueASCII (switches::kInputPath);
+	const std::string output_path = command_line.GetSwitchValueASCII (switches::kOutputPath);
+	if (input_path.empty() || output_path.empty()) {
+		fprintf (stderr, "usage: %s --input-path=PATH[,PATH...] --output-path=PATH [--dictionary-path=PATH]\n"
+				 "        [--dictionary-size=BYTES] [--sample-size=BYTES] [--compression-level=N] [--block-size=BYTES]\n"
+				 "        [--seed=N]\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	size_t dictionary_size = kDefaultDictionarySize;
+	size_t sample_size = kDefaultSampleSize;
+	size_t block_size = kDefaultBlockSize;
+	int compression_level = 1;
+	uint64_t state = 0x9e3779b97f4a7c15ULL;
+	if (command_line.HasSwitch (switches::kDictionarySize))
+		dictionary_size = std::max (1024LL, std::atoll (command_line.GetSwitchValueASCII (switches::kDictionarySize).c_str()));
+	if (command_line.HasSwitch (switches::kSampleSize))
+		sample_size = std::max (1024LL, std::atoll (command_line.GetSwitchValueASCII (switches::kSampleSize).c_str()));
+	if (command_line.HasSwitch (switches::kBlockSize))
+		block_size = std::max (1024LL, std::min (static_cast<long long> (torikuru::kArchiveMaxBlockSize / 2),
+							 std::atoll (command_line.GetSwitchValueASCII (switches::kBlockSize).c_str())));
+	if (command_line.HasSwitch (switches::kCompressionLevel))
+		compression_level = std::atoi (command_line.GetSwitchValueASCII (switches::kCompressionLevel).c_str());
+	if (command_line.HasSwitch (switches::kSeed))
+		state = std::max (1ULL, std::strtoull (command_line.GetSwitchValueASCII (switches::kSeed).c_str(), nullptr, 10));
+	std::vector<std::string> paths;
+	chromium::SplitString (input_path, ',', &paths);
+	paths.erase (std::remove (paths.begin(), paths.end(), std::string()), paths.end());
+	std::string input_dictionary;
+	if (command_line.HasSwitch (switches::kDictionaryPath) &&
+	    !file_util::ReadFileToString (command_line.GetSwitchValueASCII (switches::kDictionaryPath), &input_dictionary))
+	{
+		LOG(ERROR) << "Cannot read dictionary \"" << command_line.GetSwitchValueASCII (switches::kDictionaryPath) << "\".";
+		return EXIT_FAILURE;
+	}
+
+	torikuru::clock_service_t::Init (false);
+
+/* Reservoir of records once the sample size is reached. */
+	std::vector<std::string> samples;
+	size_t sample_bytes = 0, capacity = 0;
+	uint64_t record_count = 0;
+	LOG(INFO) << "Sampling up to " << sample_size << " bytes of records.";
+	if (!ForEachRecord (paths, input_dictionary, [&] (const std::string& record) {
+		++record_count;
+		if (0 == capacity) {
+			samples.push_back (record);
+			sample_bytes += record.size();
+			if (sample_bytes >= sample_size)
+				capacity = samples.size();
+			return;
+		}
+/* xorshift64 */
+		state ^= state << 13;
+		state ^= state >> 7;
+		state ^= state << 17;
+		const uint64_t slot = state % record_count;
+		if (slot < capacity) {
+			sample_bytes += record.size() - samples[slot].size();
+			samples[slot] = record;
+		}
+	}))
+		return EXIT_FAILURE;
+
+	std::string buffer;
+	std::vector<size_t> sizes;
+	buffer.reserve (sample_bytes);
+	sizes.reserve (samples.size());
+	for (const auto& sample : samples) {
+		buffer.append (sample);
+		sizes.push_back (sample.size());
+	}
+	samples.clear();
+	samples.shrink_to_fit();
+
+	LOG(INFO) << "Training on " << sizes.size() << " of " << record_count << " records.";
+	std::string dictionary (dictionary_size, '\0');
+	uint64_t start = torikuru::clock_service_t::ReadTicks();
+	const size_t rc = ZDICT_trainFromBuffer (&dictionary[0], dictionary.size(), buffer.data(), sizes.data(), static_cast<unsigned> (sizes.size()));
+	const double train_seconds = torikuru::clock_service_t::TicksToNanoseconds (torikuru::clock_service_t::ReadTicks() - start) / 1e9;
+	if (ZDICT_isError (rc)) {
+		LOG(ERROR) << "ZDICT_trainFromBuffer: " << ZDICT_getErrorName (rc);
+		return EXIT_FAILURE;
+	}
+	dictionary.resize (rc);
+	buffer.clear();
+	buffer.shrink_to_fit();
+
+	FILE* fp = fopen (output_path.c_str(), "wb");
+	if (nullptr == fp) {
+		LOG(ERROR) << "Failed to open file \"" << output_path << "\".";
+		return EXIT_FAILURE;
+	}
+	const bool is_written = (dictionary.size() == fwrite (dictionary.data(), 1, dictionary.size(), fp));
+	if (0 != fclose (fp) || !is_written) {
+		LOG(ERROR) << "Failed to write file \"" << output_path << "\".";
+		return EXIT_FAILURE;
+	}
+
+/* Blocks of consecutive records as the writer cuts them. */
+	char zstd_name[32], zstd_dict_name[32];
+	snprintf (zstd_name, sizeof (zstd_name), "zstd-%d", compression_level);
+	snprintf (zstd_dict_name, sizeof (zstd_dict_name), "zstd-%d-dict", compression_level);
+	codec_result_t results[] = {
+		{ "zlib-1", 0, 0, 0, 0 },
+		{ zstd_name, 0, 0, 0, 0 },
+		{ zstd_dict_name, 0, 0, 0, 0 }
+	};
+	block_codecs_t codecs;
+	if (!codecs.Init (compression_level, dictionary))
+		return EXIT_FAILURE;
+	std::string block;
+	uint64_t block_count = 0, uncompressed_bytes = 0;
+	block.reserve (block_size + 64 * 1024);
+	const auto measure = [&]() {
+		codecs.Measure (block, results);
+		uncompressed_bytes += block.size();
+		++block_count;
+		block.clear();
+	};
+	if (!ForEachRecord (paths, input_dictionary, [&] (const std::string& record) {
+		block.append (record);
+		if (block.size() >= block_size)
+			measure();
+	}))
+		return EXIT_FAILURE;
+	if (!block.empty())
+		measure();
+
+	printf ("dictionary=%s bytes=%zu id=%u samples=%zu sample-bytes=%zu train-seconds=%.2f\n",
+		output_path.c_str(), dictionary.size(), ZDICT_getDictID (dictionary.data(), dictionary.size()),
+		sizes.size(), sample_bytes, train_seconds);
+	printf ("records=%llu blocks=%llu block-size=%zu bytes=%llu\n",
+		static_cast<unsigned long long> (record_count), static_cast<unsigned long long> (block_count),
+		block_size, static_cast<unsigned long long> (uncompressed_bytes));
+	printf ("%-16s %12s %8s %12s %12s\n", "codec", "bytes", "ratio", "comp MB/s", "decomp MB/s");
+	bool is_exact = true;
+	for (const auto& result : results) {
+		printf ("%-16s %12llu %8.2f %12.1f %12.1f%s\n",
+			result.name,
+			static_cast<unsigned long long> (result.compressed_bytes),
+			result.compressed_bytes > 0 ? static_cast<double> (uncompressed_bytes) / result.compressed_bytes : 0.0,
+			MegabytesPerSecond (uncompressed_bytes, result.compress_ticks),
+			MegabytesPerSecond (uncompressed_bytes, result.decompress_ticks),
+			result.failure_count > 0 ? "  round trip failed" : "");
+		if (result.failure_count > 0)
+			is_exact = false;
+	}
+	return is_exact ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/* eof */
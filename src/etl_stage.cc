@@ -0,0 +1,171 @@
+/* Inline extraction stage.
+ */
+
+#include "etl_stage.hh"
+
+#include <algorithm>
+
+/* Google Protocol Buffers */
+#include <google/protobuf/io/coded_stream.h>
+
+#include "chromium/logging.hh"
+#include "chromium/string_util.hh"
+#include "archive_format.hh"
+#include "trace.hh"
+
+/* Framed records queued before the dispatch thread waits for the worker. */
+static const size_t kMaxPendingBytes = 16 * 1024 * 1024;
+
+torikuru::etl_stage_t::etl_stage_t() :
+	stop_requested_ (false),
+	row_count_ (0),
+	skipped_count_ (0),
+	batch_count_ (0),
+	full_count_ (0),
+	max_pending_ (0)
+{
+}
+
+torikuru::etl_stage_t::~etl_stage_t()
+{
+	Stop();
+}
+
+bool
+torikuru::etl_stage_t::Start (
+	const std::string& path,
+	const std::vector<std::string>& services,
+	const std::vector<std::string>& fields
+	)
+{
+	DCHECK(!(bool)thread_);
+	format_.reset (new csv_format_t (fields));
+	const std::string header (format_->Header());
+	for (const auto& service : services) {
+		std::vector<std::string> subst;
+		subst.emplace_back (service);
+		const std::string filename = ReplaceStringPlaceholders (path, subst, nullptr);
+		std::unique_ptr<std::ofstream> fs (new std::ofstream (filename, std::ios::out | std::ios::trunc));
+		if (!fs->is_open()) {
+			LOG(ERROR) << "Failed to open file \"" << filename << "\".";
+			outputs_.clear();
+			return false;
+		}
+		*fs << header << std::endl;
+		LOG(INFO) << "Exporting service \"" << service << "\" as \"" << filename << "\" during capture.";
+		outputs_.emplace (service, std::move (fs));
+	}
+	stop_requested_ = false;
+	thread_.reset (new boost::thread (boost::bind (&etl_stage_t::Run, this)));
+	return true;
+}
+
+void
+torikuru::etl_stage_t::Stop()
+{
+	if (!(bool)thread_)
+		return;
+	{
+		boost::lock_guard<boost::mutex> lock (lock_);
+		stop_requested_ = true;
+	}
+	not_empty_.notify_one();
+	thread_->join();
+	thread_.reset();
+	outputs_.clear();
+	LOG(INFO) << "ETL stage: { "
+		  "\"rows\": " << row_count_ <<
+		", \"skipped\": " << skipped_count_ <<
+		", \"batches\": " << batch_count_ <<
+		", \"queueFullWaits\": " << full_count_ <<
+		", \"maxQueueBytes\": " << max_pending_ <<
+		" }";
+}
+
+void
+torikuru::etl_stage_t::Push (
+	const archive::Marketfeed& mfeed
+	)
+{
+	TRACE_EVENT("ETL.Push");
+	const uint32_t size = RecordByteSize (mfeed);
+	const size_t length = google::protobuf::io::CodedOutputStream::VarintSize32 (size) + size;
+	boost::unique_lock<boost::mutex> lock (lock_);
+	if (!pending_.empty() && pending_.size() + length > kMaxPendingBytes) {
+		++full_count_;
+		do {
+			not_full_.wait (lock);
+		} while (!pending_.empty() && pending_.size() + length > kMaxPendingBytes);
+	}
+	const bool was_empty = pending_.empty();
+	const size_t offset = pending_.size();
+	pending_.resize (offset + length);
+	uint8_t* buf = reinterpret_cast<uint8_t*> (&pending_[offset]);
+	buf = google::protobuf::io::CodedOutputStream::WriteVarint32ToArray (size, buf);
+	mfeed.SerializeWithCachedSizesToArray (buf);
+	max_pending_ = std::max (max_pending_, pending_.size());
+	lock.unlock();
+	if (was_empty)
+		not_empty_.notify_one();
+}
+
+void
+torikuru::etl_stage_t::Run()
+{
+	std::string batch;
+	while (true) {
+		{
+			boost::unique_lock<boost::mutex> lock (lock_);
+			while (pending_.empty() && !stop_requested_)
+				not_empty_.wait (lock);
+			if (pending_.empty())
+				break;
+			batch.swap (pending_);
+		}
+		not_full_.notify_one();
+		Export (batch);
+		batch.clear();
+	}
+}
+
+/* As extraction of an archive, without the symbol filter as only subscribed
+ * items are captured.
+ */
+void
+torikuru::etl_stage_t::Export (
+	const std::string& batch
+	)
+{
+	TRACE_EVENT("ETL.Export");
+	google::protobuf::io::CodedInputStream coded_stream (reinterpret_cast<const uint8_t*> (batch.data()), static_cast<int> (batch.size()));
+	uint32_t size;
+	while (coded_stream.ReadVarint32 (&size)) {
+		const int limit = coded_stream.PushLimit (size);
+		const bool is_valid = mfeed_.ParseFromCodedStream (&coded_stream);
+		coded_stream.PopLimit (limit);
+		if (!is_valid ||
+		    !mfeed_.has_service_name() ||
+		    !mfeed_.has_item_name() ||
+		    !mfeed_.has_message_type() ||
+		    msg_.UnPack (const_cast<char*> (mfeed_.packed_buffer().c_str()), mfeed_.packed_buffer().size()) != TIBMSG_OK)
+		{
+			++skipped_count_;
+			continue;
+		}
+		auto it = outputs_.find (mfeed_.service_name());
+		if (outputs_.end() == it) {
+			++skipped_count_;
+			continue;
+		}
+		format_->FormatRow (mfeed_, &msg_, &row_);
+		row_.push_back ('\n');
+		it->second->write (row_.data(), row_.size());
+		++row_count_;
+	}
+/* Rows are visible to readers of the output at batch granularity. */
+	for (auto& output : outputs_)
+		output.second->flush();
+	++batch_count_;
+}
+
+/* eof */
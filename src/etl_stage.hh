@@ -0,0 +1,83 @@
+/* Inline extraction stage.
+ *
+ * Records committed at capture are framed into a shared buffer by the
+ * dispatch thread and exported by a worker thread through the same
+ * unpacking and CSV formatting as extraction of an archive, one file per
+ * service.  The buffer is swapped out whole so the dispatch thread pays one
+ * serialization and an uncontended lock per record.  A full buffer blocks
+ * the dispatch thread as a slow archive write would, no record is dropped.
+ */
+
+#ifndef __ETL_STAGE_HH__
+#define __ETL_STAGE_HH__
+#pragma once
+
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/* Boost noncopyable base class */
+#include <boost/utility.hpp>
+
+/* Boost threading. */
+#include <boost/thread.hpp>
+
+#include <archive.pb.h>
+
+#include "csv_format.hh"
+
+namespace torikuru
+{
+
+	class etl_stage_t :
+		boost::noncopyable
+	{
+	public:
+		etl_stage_t();
+		~etl_stage_t();
+
+/* Open one output per service, "$1" in path is replaced by the service
+ * name, with the given field columns and start the worker.
+ */
+		bool Start (const std::string& path, const std::vector<std::string>& services, const std::vector<std::string>& fields);
+/* Exports every queued record before returning. */
+		void Stop();
+
+/* Queue a committed record, dispatch thread only. */
+		void Push (const archive::Marketfeed& mfeed);
+
+	private:
+		void Run();
+		void Export (const std::string& batch);
+
+		std::unordered_map<std::string, std::unique_ptr<std::ofstream>> outputs_;
+		std::unique_ptr<csv_format_t> format_;
+		std::unique_ptr<boost::thread> thread_;
+
+		boost::mutex lock_;
+		boost::condition_variable not_empty_;
+		boost::condition_variable not_full_;
+		std::string pending_;
+		bool stop_requested_;
+
+/* Worker state. */
+		archive::Marketfeed mfeed_;
+		TibMsg msg_;
+		std::string row_;
+
+/* Diagnostics, logged on stop. */
+		uint64_t row_count_;
+		uint64_t skipped_count_;
+		uint64_t batch_count_;
+		uint64_t full_count_;
+		size_t max_pending_;
+	};
+
+} /* namespace torikuru */
+
+#endif /* __ETL_STAGE_HH__ */
+
+/* eof */
@@ -0,0 +1,45 @@
+/* Capture-side field projection.
+ */
+
+#include "field_projection.hh"
+
+#include <cstring>
+
+#include "chromium/logging.hh"
+
+torikuru::field_projection_t::field_projection_t (
+	const std::vector<std::string>& fields
+	) :
+	fields_ (fields.begin(), fields.end())
+{
+}
+
+bool
+torikuru::field_projection_t::Project (
+	const char* buffer,
+	size_t length,
+	std::string* out
+	)
+{
+	DCHECK(nullptr != out);
+	if (TIBMSG_OK != in_msg_.UnPack (const_cast<char*> (buffer), length))
+		return false;
+	out_msg_.ReUse();
+	unsigned count = 0;
+	for (field_.First (&in_msg_); field_.status == TIBMSG_OK; field_.Next()) {
+		name_.assign (field_.Name(), field_.NameSize() == 0 ? 0 : strlen (field_.Name()));
+		if (fields_.end() == fields_.find (name_))
+			continue;
+		if (TIBMSG_OK != out_msg_.Append (field_.Name(), field_.Data(), field_.Size(), field_.Type(), field_.Hint())) {
+			LOG(WARNING) << "Failed to append field \"" << name_ << "\".";
+			continue;
+		}
+		++count;
+	}
+	if (0 == count)
+		return false;
+	out->assign (out_msg_.Packed(), out_msg_.PackSize());
+	return true;
+}
+
+/* eof */
@@ -0,0 +1,55 @@
+/* Capture-side field projection.
+ *
+ * Marketfeed payloads are unpacked and re-packed as a TibMsg holding only
+ * the selected fields, events carrying none of them are dropped.
+ */
+
+#ifndef __FIELD_PROJECTION_HH__
+#define __FIELD_PROJECTION_HH__
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+/* Boost noncopyable base class */
+#include <boost/utility.hpp>
+
+/* RFA 7.2 */
+#include <rfa/rfa.hh>
+
+namespace torikuru
+{
+
+	class field_projection_t :
+		boost::noncopyable
+	{
+	public:
+/* Field names as listed in the Marketfeed dictionary, e.g. BID, TRDPRC_1. */
+		explicit field_projection_t (const std::vector<std::string>& fields);
+
+/* Returns false if the payload is malformed or holds none of the selected
+ * fields, otherwise the re-packed payload is written to out.
+ */
+		bool Project (const char* buffer, size_t length, std::string* out);
+
+		size_t size() const {
+			return fields_.size();
+		}
+
+	private:
+		std::unordered_set<std::string> fields_;
+
+/* Scratch state re-used between events. */
+		TibMsg in_msg_;
+		TibMsg out_msg_;
+		TibField field_;
+		std::string name_;
+	};
+
+} /* namespace torikuru */
+
+#endif /* __FIELD_PROJECTION_HH__ */
+
+/* eof */
@@ -0,0 +1,122 @@
+/* Per-item field state.
+ */
+
+#include "field_set.hh"
+
+#include <algorithm>
+#include <cstring>
+
+#include "chromium/logging.hh"
+
+/* Rewrite the value buffer once replaced values exceed this and half the
+ * buffer.
+ */
+static const size_t kMinimumWastedBytes = 256;
+
+torikuru::field_index_t
+torikuru::field_names_t::Intern (
+	const char* name,
+	size_t length
+	)
+{
+	key_.assign (name, length);
+	auto it = index_.find (key_);
+	if (index_.end() != it)
+		return it->second;
+	if (names_.size() >= kInvalidFieldIndex)
+		return kInvalidFieldIndex;
+	const field_index_t index = static_cast<field_index_t> (names_.size());
+	names_.emplace_back (key_);
+	index_.emplace (key_, index);
+	return index;
+}
+
+unsigned
+torikuru::field_set_t::Merge (
+	TibMsg* msg,
+	field_names_t* names
+	)
+{
+	TibField field;
+	unsigned count = 0;
+	for (field.First (msg); field.status == TIBMSG_OK; field.Next()) {
+		const char* name = field.Name();
+		const field_index_t index = names->Intern (name, field.NameSize() == 0 ? 0 : strlen (name));
+		if (kInvalidFieldIndex == index) {
+			LOG(WARNING) << "Field name table full, ignoring \"" << name << "\".";
+			continue;
+		}
+		Set (index, field.Type(), field.Hint(), field.Data(), field.Size());
+		++count;
+	}
+	return count;
+}
+
+void
+torikuru::field_set_t::Set (
+	field_index_t index,
+	uint8_t type,
+	uint8_t hint,
+	const void* data,
+	size_t size
+	)
+{
+	auto it = std::lower_bound (fields_.begin(), fields_.end(), index,
+			[](const field_t& field, field_index_t value) { return field.index < value; });
+	if (fields_.end() == it || it->index != index) {
+		field_t field;
+		field.index = index;
+		field.offset = 0;
+		field.size = 0;
+		it = fields_.insert (it, field);
+	}
+	it->type = type;
+	it->hint = hint;
+/* Overwrite in place when the value fits, typical for numeric fields. */
+	if (size <= it->size) {
+		wasted_bytes_ += it->size - size;
+	} else {
+		wasted_bytes_ += it->size;
+		it->offset = static_cast<uint32_t> (data_.size());
+		data_.resize (data_.size() + size);
+	}
+	it->size = static_cast<uint32_t> (size);
+	if (size > 0)
+		memcpy (&data_[it->offset], data, size);
+	if (wasted_bytes_ > kMinimumWastedBytes && wasted_bytes_ * 2 > data_.size())
+		Compact();
+}
+
+bool
+torikuru::field_set_t::Pack (
+	const field_names_t& names,
+	TibMsg* msg
+	) const
+{
+	for (const auto& field : fields_) {
+		if (TIBMSG_OK != msg->Append (names.name (field.index).c_str(),
+					      const_cast<char*> (data (field)),
+					      field.size, field.type, field.hint))
+		{
+			LOG(WARNING) << "Failed to append field \"" << names.name (field.index) << "\".";
+			return false;
+		}
+	}
+	return true;
+}
+
+void
+torikuru::field_set_t::Compact()
+{
+	std::string data;
+	data.reserve (data_.size() - wasted_bytes_);
+	for (auto& field : fields_) {
+		const uint32_t offset = static_cast<uint32_t> (data.size());
+		data.append (data_, field.offset, field.size);
+		field.offset = offset;
+	}
+	data_.swap (data);
+	wasted_bytes_ = 0;
+}
+
+/* eof */
@@ -0,0 +1,95 @@
+/* Per-item field state.
+ *
+ * Marketfeed field names are interned to a dense index, a field set holds
+ * the last value of each field keyed by that index with values packed in a
+ * single buffer.  Sets are merged from and packed back to TibMsg payloads.
+ */
+
+#ifndef __FIELD_SET_HH__
+#define __FIELD_SET_HH__
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/* RFA 7.2 */
+#include <rfa/rfa.hh>
+
+namespace torikuru
+{
+	typedef uint16_t field_index_t;
+
+	static const field_index_t kInvalidFieldIndex = 0xffff;
+
+	class field_names_t
+	{
+	public:
+/* Returns kInvalidFieldIndex when the table is full. */
+		field_index_t Intern (const char* name, size_t length);
+		const std::string& name (field_index_t index) const {
+			return names_[index];
+		}
+		size_t size() const {
+			return names_.size();
+		}
+
+	private:
+		std::unordered_map<std::string, field_index_t> index_;
+		std::vector<std::string> names_;
+		std::string key_;
+	};
+
+	class field_set_t
+	{
+	public:
+		struct field_t {
+			field_index_t index;
+			uint8_t type;
+			uint8_t hint;
+			uint32_t offset;
+			uint32_t size;
+		};
+
+		field_set_t() : wasted_bytes_ (0) {}
+
+/* Merge every field of an unpacked message, last value wins.  Returns the
+ * count of fields merged.
+ */
+		unsigned Merge (TibMsg* msg, field_names_t* names);
+		void Set (field_index_t index, uint8_t type, uint8_t hint, const void* data, size_t size);
+
+/* Append every field to a message, the caller resets the message. */
+		bool Pack (const field_names_t& names, TibMsg* msg) const;
+
+		void Clear() {
+			fields_.clear();
+			data_.clear();
+			wasted_bytes_ = 0;
+		}
+		bool empty() const {
+			return fields_.empty();
+		}
+
+/* Fields in index order. */
+		const std::vector<field_t>& fields() const {
+			return fields_;
+		}
+		const char* data (const field_t& field) const {
+			return data_.data() + field.offset;
+		}
+
+	private:
+		void Compact();
+
+		std::vector<field_t> fields_;
+		std::string data_;
+		size_t wasted_bytes_;
+	};
+
+} /* namespace torikuru */
+
+#endif /* __FIELD_SET_HH__ */
+
+/* eof */
@@ -0,0 +1,138 @@
+/* Write a synthetic archive for tests and benchmarks.
+ *
+ * usage: torikuru_generate --output-path=PATH [--records=N] [--symbols=N]
+ *                          [--symbol-path=PATH] [--fields=N]
+ *                          [--update-ratio=R] [--zipf=S] [--seed=N]
+ *                          [--start-time=SECONDS] [--time-span=SECONDS]
+ *                          [--service=NAME] [--compression-level=N]
+ *
+ * Records are in the capture archive format with Marketfeed payloads and
+ * the same options and seed always produce the same archive.
+ */
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include "chromium/command_line.hh"
+#include "chromium/file_util.hh"
+#include "chromium/logging.hh"
+#include "chromium/metrics/histogram.hh"
+#include "chromium/string_split.hh"
+#include "archive_writer.hh"
+#include "clock.hh"
+#include "synthetic.hh"
+
+namespace switches {
+
+const char kOutputPath[]		= "output-path";
+const char kRecords[]			= "records";
+const char kSymbols[]			= "symbols";
+const char kSymbolPath[]		= "symbol-path";
+const char kFields[]			= "fields";
+const char kUpdateRatio[]		= "update-ratio";
+const char kZipf[]			= "zipf";
+const char kSeed[]			= "seed";
+const char kStartTime[]			= "start-time";
+const char kTimeSpan[]			= "time-span";
+const char kService[]			= "service";
+const char kCompressionLevel[]		= "compression-level";
+
+}  // namespace switches
+
+/* Synthetic receive to commit delay range. */
+static const uint32_t kMinWriteDelayNs = 2000;
+static const uint32_t kMaxWriteDelayNs = 50000;
+
+/* Records between progress reports. */
+static const uint64_t kProgressInterval = 1000000;
+
+int
+main (
+	int		argc,
+	const char*	argv[]
+	)
+{
+	CommandLine::Init (argc, argv);
+	chromium::StatisticsRecorder recorder;
+	const CommandLine& command_line = *CommandLine::ForCurrentProcess();
+
+	const std::string output_path = command_line.GetSwitchValueASCII (switches::kOutputPath);
+	if (output_path.empty()) {
+		fprintf (stderr, "usage: %s --output-path=PATH [--records=N] [--symbols=N] [--symbol-path=PATH]\n"
+				 "        [--fields=N] [--update-ratio=R] [--zipf=S] [--seed=N] [--start-time=SECONDS]\n"
+				 "        [--time-span=SECONDS] [--service=NAME] [--compression-level=N]\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	torikuru::synthetic_options_t options;
+	uint64_t records = 1000000;
+	unsigned time_span = 3600;
+	int compression_level = 6;
+	if (command_line.HasSwitch (switches::kRecords))
+		records = std::max (1LL, std::atoll (command_line.GetSwitchValueASCII (switches::kRecords).c_str()));
+	if (command_line.HasSwitch (switches::kSymbols))
+		options.symbol_count = std::max (1, std::atoi (command_line.GetSwitchValueASCII (switches::kSymbols).c_str()));
+	if (command_line.HasSwitch (switches::kSymbolPath)) {
+		std::string contents;
+		if (!file_util::ReadFileToString (command_line.GetSwitchValueASCII (switches::kSymbolPath), &contents)) {
+			LOG(ERROR) << "Cannot read symbol list \"" << command_line.GetSwitchValueASCII (switches::kSymbolPath) << "\".";
+			return EXIT_FAILURE;
+		}
+		chromium::SplitStringAlongWhitespace (contents, &options.symbols);
+	}
+	if (command_line.HasSwitch (switches::kFields))
+		options.field_count = std::max (1, std::atoi (command_line.GetSwitchValueASCII (switches::kFields).c_str()));
+	if (command_line.HasSwitch (switches::kUpdateRatio))
+		options.update_ratio = std::atof (command_line.GetSwitchValueASCII (switches::kUpdateRatio).c_str());
+	if (command_line.HasSwitch (switches::kZipf))
+		options.zipf_exponent = std::max (0.0, std::atof (command_line.GetSwitchValueASCII (switches::kZipf).c_str()));
+	if (command_line.HasSwitch (switches::kSeed))
+		options.seed = static_cast<uint32_t> (std::atoi (command_line.GetSwitchValueASCII (switches::kSeed).c_str()));
+	if (command_line.HasSwitch (switches::kStartTime))
+		options.start_time = static_cast<time_t> (std::atoll (command_line.GetSwitchValueASCII (switches::kStartTime).c_str()));
+	if (command_line.HasSwitch (switches::kTimeSpan))
+		time_span = std::max (1, std::atoi (command_line.GetSwitchValueASCII (switches::kTimeSpan).c_str()));
+	if (command_line.HasSwitch (switches::kService))
+		options.service_name = command_line.GetSwitchValueASCII (switches::kService);
+	if (command_line.HasSwitch (switches::kCompressionLevel))
+		compression_level = std::atoi (command_line.GetSwitchValueASCII (switches::kCompressionLevel).c_str());
+	const uint64_t interval = time_span * 1000000000ULL / records;
+	options.mean_interval_ns = interval > 0xffffffff ? 0xffffffff : static_cast<uint32_t> (interval);
+
+	torikuru::clock_service_t::Init (false);
+	torikuru::synthetic_workload_t workload (options);
+	torikuru::archive_writer_t writer;
+	if (!writer.Open (output_path, compression_level))
+		return EXIT_FAILURE;
+	writer.set_stamping (false);
+
+	LOG(INFO) << "Generating " << records << " records for " << workload.symbols().size()
+		  << " symbols over " << time_span << " seconds into \"" << output_path << "\".";
+	archive::Marketfeed mfeed;
+	uint32_t state = 0 == options.seed ? 0x9e3779b9 : options.seed;
+	for (uint64_t i = 1; i <= records; ++i) {
+		workload.Next (&mfeed);
+/* xorshift32, separate from the workload sequence. */
+		state ^= state << 13;
+		state ^= state >> 17;
+		state ^= state << 5;
+		mfeed.set_write_delay_ns (kMinWriteDelayNs + state % (kMaxWriteDelayNs - kMinWriteDelayNs));
+		if (!writer.Write (&mfeed))
+			return EXIT_FAILURE;
+		if (0 == i % kProgressInterval)
+			LOG(INFO) << i << " records.";
+	}
+	const int64_t byte_count = writer.byte_count();
+	writer.Close();
+	LOG(INFO) << "Archive: { "
+		  "\"records\": " << records <<
+		", \"symbols\": " << workload.symbols().size() <<
+		", \"bytes\": " << byte_count <<
+		" }";
+	return EXIT_SUCCESS;
+}
+
+/* eof */
@@ -0,0 +1,35 @@
+/* Latency histograms.
+ *
+ * Intervals are measured in clock_service_t ticks and recorded as
+ * nanoseconds into chromium histograms, exponential buckets from 1ns to 1s.
+ * Recording is lock-free through concurrent_histogram_t so that any thread
+ * may be instrumented.  Report with chromium::StatisticsRecorder::WriteGraph().
+ */
+
+#ifndef __HISTOGRAMS_HH__
+#define __HISTOGRAMS_HH__
+#pragma once
+
+#include "clock.hh"
+#include "concurrent_histogram.hh"
+
+namespace torikuru
+{
+/* Histogram samples are int, clamp rather than wrap. */
+	static inline
+	int
+	ticks_to_sample (
+		uint64_t ticks
+		)
+	{
+		const uint64_t ns = clock_service_t::TicksToNanoseconds (ticks);
+		return ns > 0x7fffffffULL ? 0x7fffffff : static_cast<int> (ns);
+	}
+} /* namespace torikuru */
+
+#define HISTOGRAM_NANOSECONDS(name, ticks) CONCURRENT_HISTOGRAM_CUSTOM_COUNTS( \
+    name, torikuru::ticks_to_sample (ticks), 1, 1000000000, 64)
+
+#endif /* __HISTOGRAMS_HH__ */
+
+/* eof */
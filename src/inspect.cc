@@ -0,0 +1,203 @@
+/* Archive inspection.
+ */
+
+#include "inspect.hh"
+
+#include <algorithm>
+#include <limits>
+
+#include <sys/stat.h>
+
+/* RFA 7.2 */
+#include <rfa/rfa.hh>
+
+/* Google Protocol Buffers */
+#include <google/protobuf/io/coded_stream.h>
+
+#include "chromium/logging.hh"
+#include "archive_format.hh"
+#include "archive_reader.hh"
+#include "clock.hh"
+#include "trace.hh"
+
+/* Payloads are bounded by the 16-bit Marketfeed length. */
+static const size_t kMaxPayloadSize = 0xffff;
+
+torikuru::archive_stats_t::archive_stats_t() :
+	file_count (0),
+	legacy_count (0),
+	record_count (0),
+	invalid_count (0),
+	checkpoint_count (0),
+	first_ns (std::numeric_limits<uint64_t>::max()),
+	last_ns (0),
+	payload_sizes (kMaxPayloadSize + 2, 0),
+	payload_bytes (0),
+	uncompressed_bytes (0),
+	file_bytes (0),
+	damage_count (0),
+	lost_byte_count (0),
+	lost_record_count (0),
+	scan_seconds (0.0)
+{
+}
+
+void
+torikuru::archive_stats_t::Add (
+	const archive::Marketfeed& mfeed
+	)
+{
+	++record_count;
+	if (mfeed.checkpoint())
+		++checkpoint_count;
+	++message_types[mfeed.message_type()];
+	++services[mfeed.service_name()];
+	const uint64_t ns = static_cast<uint64_t> (mfeed.tv_sec()) * 1000000000ULL
+			  + (mfeed.has_tv_nsec() ? mfeed.tv_nsec() : mfeed.tv_usec() * 1000ULL);
+	first_ns = std::min (first_ns, ns);
+	last_ns = std::max (last_ns, ns);
+	const size_t payload = mfeed.packed_buffer().size();
+	++payload_sizes[std::min (payload, kMaxPayloadSize + 1)];
+	payload_bytes += payload;
+	const uint32_t size = RecordByteSize (mfeed);
+	uncompressed_bytes += google::protobuf::io::CodedOutputStream::VarintSize32 (size) + size;
+/* Windows restart when records move to another second, checkpoints and
+ * out of order delivery merely split a window.
+ */
+	symbol_key.first.assign (mfeed.service_name());
+	symbol_key.second.assign (mfeed.item_name());
+	auto it = symbols.find (symbol_key);
+	if (symbols.end() == it) {
+		const symbol_stats_t initial = { 0, mfeed.tv_sec(), 0, 0 };
+		it = symbols.emplace (symbol_key, initial).first;
+	}
+	symbol_stats_t& symbol = it->second;
+	++symbol.record_count;
+	if (symbol.second != mfeed.tv_sec()) {
+		symbol.second = mfeed.tv_sec();
+		symbol.second_count = 0;
+	}
+	symbol.peak_count = std::max (symbol.peak_count, ++symbol.second_count);
+}
+
+void
+torikuru::archive_stats_t::Merge (
+	const archive_stats_t& other
+	)
+{
+	file_count += other.file_count;
+	legacy_count += other.legacy_count;
+	record_count += other.record_count;
+	invalid_count += other.invalid_count;
+	checkpoint_count += other.checkpoint_count;
+	for (const auto& message_type : other.message_types)
+		message_types[message_type.first] += message_type.second;
+	for (const auto& service : other.services)
+		services[service.first] += service.second;
+	for (const auto& other_symbol : other.symbols) {
+		auto it = symbols.find (other_symbol.first);
+		if (symbols.end() == it) {
+			symbols.emplace (other_symbol);
+			continue;
+		}
+		it->second.record_count += other_symbol.second.record_count;
+		it->second.peak_count = std::max (it->second.peak_count, other_symbol.second.peak_count);
+	}
+	first_ns = std::min (first_ns, other.first_ns);
+	last_ns = std::max (last_ns, other.last_ns);
+	for (size_t i = 0; i < payload_sizes.size(); ++i)
+		payload_sizes[i] += other.payload_sizes[i];
+	payload_bytes += other.payload_bytes;
+	uncompressed_bytes += other.uncompressed_bytes;
+	file_bytes += other.file_bytes;
+	damage_count += other.damage_count;
+	lost_byte_count += other.lost_byte_count;
+	lost_record_count += other.lost_record_count;
+	scan_seconds += other.scan_seconds;
+}
+
+uint32_t
+torikuru::archive_stats_t::PayloadPercentile (
+	double fraction
+	) const
+{
+	const uint64_t target = static_cast<uint64_t> (fraction * record_count);
+	uint64_t count = 0;
+	for (size_t size = 0; size < payload_sizes.size(); ++size) {
+		count += payload_sizes[size];
+		if (count > target || count == record_count)
+			return static_cast<uint32_t> (size);
+	}
+	return 0;
+}
+
+std::vector<std::pair<torikuru::symbol_key_t, torikuru::symbol_stats_t>>
+torikuru::archive_stats_t::TopSymbols (
+	size_t count
+	) const
+{
+	std::vector<std::pair<symbol_key_t, symbol_stats_t>> top (symbols.begin(), symbols.end());
+	count = std::min (count, top.size());
+	std::partial_sort (top.begin(), top.begin() + count, top.end(),
+		[] (const std::pair<symbol_key_t, symbol_stats_t>& lhs, const std::pair<symbol_key_t, symbol_stats_t>& rhs) {
+			return lhs.second.record_count > rhs.second.record_count ||
+			       (lhs.second.record_count == rhs.second.record_count && lhs.first < rhs.first);
+		});
+	top.resize (count);
+	return top;
+}
+
+bool
+torikuru::InspectArchive (
+	const std::string& path,
+	const std::string& dictionary,
+	archive_stats_t* stats
+	)
+{
+	TRACE_EVENT("Inspect.Archive");
+	archive_reader_t reader;
+	reader.set_dictionary (dictionary);
+	if (!reader.Open (path))
+		return false;
+	const uint64_t start = clock_service_t::ReadTicks();
+	archive::Marketfeed mfeed;
+	bool is_valid;
+	while (reader.Read (&mfeed, &is_valid)) {
+		if (is_valid)
+			stats->Add (mfeed);
+		else
+			++stats->invalid_count;
+	}
+	stats->scan_seconds += clock_service_t::TicksToNanoseconds (clock_service_t::ReadTicks() - start) / 1e9;
+	++stats->file_count;
+	if (reader.is_legacy())
+		++stats->legacy_count;
+	struct stat st;
+	if (0 == stat (path.c_str(), &st))
+		stats->file_bytes += st.st_size;
+	stats->damage_count += reader.damage_count();
+	stats->lost_byte_count += reader.lost_byte_count();
+	stats->lost_record_count += reader.lost_record_count();
+	return true;
+}
+
+const char*
+torikuru::MessageTypeName (
+	uint32_t message_type
+	)
+{
+	switch (message_type) {
+	case rfa::sessionLayer::MarketDataItemEvent::Image:		return "Image";
+	case rfa::sessionLayer::MarketDataItemEvent::UnsolicitedImage:	return "UnsolicitedImage";
+	case rfa::sessionLayer::MarketDataItemEvent::Update:		return "Update";
+	case rfa::sessionLayer::MarketDataItemEvent::Correction:	return "Correction";
+	case rfa::sessionLayer::MarketDataItemEvent::ClosingRun:	return "ClosingRun";
+	case rfa::sessionLayer::MarketDataItemEvent::Rename:		return "Rename";
+	case rfa::sessionLayer::MarketDataItemEvent::PermissionData:	return "PermissionData";
+	case rfa::sessionLayer::MarketDataItemEvent::GroupChange:	return "GroupChange";
+	case rfa::sessionLayer::MarketDataItemEvent::Status:		return "Status";
+	default:							return nullptr;
+	}
+}
+
+/* eof */
@@ -0,0 +1,92 @@
+/* Archive inspection.
+ *
+ * Statistics of an archive gathered by streaming it through the reader
+ * without unpacking payloads, so that a scan runs at decompression speed.
+ * Statistics of several archives, each scanned on its own thread, are
+ * merged for a total.
+ */
+
+#ifndef __INSPECT_HH__
+#define __INSPECT_HH__
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <archive.pb.h>
+
+namespace torikuru
+{
+
+/* Symbols are distinct per service. */
+	typedef std::pair<std::string, std::string> symbol_key_t;
+
+	struct symbol_key_hash_t {
+		size_t operator() (const symbol_key_t& key) const {
+			const size_t seed = std::hash<std::string>() (key.first);
+			return seed ^ (std::hash<std::string>() (key.second) + 0x9e3779b9 + (seed << 6) + (seed >> 2));
+		}
+	};
+
+	struct symbol_stats_t {
+		uint64_t record_count;
+/* Records in the current and the busiest one second window. */
+		uint32_t second;
+		uint32_t second_count;
+		uint32_t peak_count;
+	};
+
+	struct archive_stats_t {
+		archive_stats_t();
+
+		void Add (const archive::Marketfeed& mfeed);
+		void Merge (const archive_stats_t& other);
+
+/* Smallest payload size at or above the given fraction of records. */
+		uint32_t PayloadPercentile (double fraction) const;
+/* Symbols by descending record count. */
+		std::vector<std::pair<symbol_key_t, symbol_stats_t>> TopSymbols (size_t count) const;
+
+		unsigned file_count;
+		unsigned legacy_count;
+		uint64_t record_count;
+		uint64_t invalid_count;
+		uint64_t checkpoint_count;
+		std::map<uint32_t, uint64_t> message_types;
+		std::map<std::string, uint64_t> services;
+		std::unordered_map<symbol_key_t, symbol_stats_t, symbol_key_hash_t> symbols;
+/* Reused lookup key, saves an allocation per record. */
+		symbol_key_t symbol_key;
+/* Receive time range, nanoseconds since the epoch. */
+		uint64_t first_ns;
+		uint64_t last_ns;
+/* Record count by payload size, the last entry counts all larger. */
+		std::vector<uint64_t> payload_sizes;
+		uint64_t payload_bytes;
+/* Framed record bytes before compression and bytes on disk. */
+		uint64_t uncompressed_bytes;
+		uint64_t file_bytes;
+		uint64_t damage_count;
+		uint64_t lost_byte_count;
+		uint64_t lost_record_count;
+		double scan_seconds;
+	};
+
+/* Scan one archive into stats, false if it cannot be opened.  The
+ * dictionary is that of archives written with one, may be empty.
+ */
+	bool InspectArchive (const std::string& path, const std::string& dictionary, archive_stats_t* stats);
+
+/* Name of a MarketDataItemEvent message type, nullptr if unknown. */
+	const char* MessageTypeName (uint32_t message_type);
+
+} /* namespace torikuru */
+
+#endif /* __INSPECT_HH__ */
+
+/* eof */
@@ -0,0 +1,227 @@
+/* Compact item directory.
+ */
+
+#include "item_store.hh"
+
+#include <cstring>
+
+#include "chromium/logging.hh"
+
+/* Maximum index occupancy including deleted buckets, in tenths. */
+static const size_t kMaxLoadFactor = 7;
+
+static const size_t kMinimumBucketCount = 16;
+
+/* Reclaim erased names once the arena is at least half waste. */
+static const size_t kMinimumWastedNameBytes = 64 * 1024;
+
+const unsigned torikuru::item_store_t::kClosureIdBits;
+const uint32_t torikuru::item_store_t::kClosureIdMask;
+const size_t torikuru::item_store_t::kMaxItemCount;
+const uint32_t torikuru::item_store_t::kFreeSlot;
+const uint32_t torikuru::item_store_t::kEmptyBucket;
+const uint32_t torikuru::item_store_t::kDeletedBucket;
+
+torikuru::item_store_t::item_store_t() :
+	wasted_name_bytes_ (0),
+	size_ (0),
+	deleted_buckets_ (0)
+{
+	index_.assign (kMinimumBucketCount, kEmptyBucket);
+}
+
+void
+torikuru::item_store_t::Reserve (
+	size_t count,
+	size_t average_name_length
+	)
+{
+	slots_.reserve (count);
+	generations_.reserve (count);
+	names_.reserve (count * (average_name_length + 1));
+	size_t bucket_count = kMinimumBucketCount;
+	while (bucket_count * kMaxLoadFactor < count * 10)
+		bucket_count <<= 1;
+	if (bucket_count > index_.size())
+		Rehash (bucket_count);
+}
+
+/* FNV-1a, 32-bit.
+ */
+uint32_t
+torikuru::item_store_t::Hash (
+	const chromium::StringPiece& name
+	)
+{
+	uint32_t hash = 2166136261u;
+	for (size_t i = 0; i < name.size(); ++i) {
+		hash ^= static_cast<uint8_t> (name[i]);
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+/* Returns the bucket referencing name, or index_.size() if not present.
+ */
+size_t
+torikuru::item_store_t::FindBucket (
+	const chromium::StringPiece& name,
+	uint32_t hash
+	) const
+{
+	const size_t mask = index_.size() - 1;
+	for (size_t i = hash & mask;; i = (i + 1) & mask) {
+		const item_id_t id = index_[i];
+		if (kEmptyBucket == id)
+			return index_.size();
+		if (kDeletedBucket == id)
+			continue;
+		const item_stream_t& slot = slots_[id];
+		if (slot.name_hash != hash)
+			continue;
+		const char* p = &names_[slot.name_offset];
+		if (0 == memcmp (p, name.data(), name.size()) && '\0' == p[name.size()])
+			return i;
+	}
+}
+
+torikuru::item_id_t
+torikuru::item_store_t::Find (
+	const chromium::StringPiece& name
+	) const
+{
+	const size_t bucket = FindBucket (name, Hash (name));
+	if (index_.size() == bucket)
+		return kInvalidItemId;
+	return index_[bucket];
+}
+
+torikuru::item_id_t
+torikuru::item_store_t::Insert (
+	const chromium::StringPiece& name
+	)
+{
+	const uint32_t hash = Hash (name);
+	if (index_.size() != FindBucket (name, hash))
+		return kInvalidItemId;
+	if (free_ids_.empty() && slots_.size() >= kMaxItemCount) {
+		LOG(ERROR) << "Item directory full at " << kMaxItemCount << " items.";
+		return kInvalidItemId;
+	}
+
+/* Grow to at most half the maximum load, which also purges deleted buckets. */
+	if ((size_ + deleted_buckets_ + 1) * 10 > index_.size() * kMaxLoadFactor) {
+		size_t bucket_count = kMinimumBucketCount;
+		while (bucket_count * kMaxLoadFactor < (size_ + 1) * 20)
+			bucket_count <<= 1;
+		Rehash (bucket_count);
+	}
+
+	const uint32_t offset = static_cast<uint32_t> (names_.size());
+	names_.insert (names_.end(), name.data(), name.data() + name.size());
+	names_.push_back ('\0');
+
+	item_id_t id;
+	if (!free_ids_.empty()) {
+		id = free_ids_.back();
+		free_ids_.pop_back();
+	} else {
+		id = static_cast<item_id_t> (slots_.size());
+		slots_.emplace_back();
+		generations_.push_back (0);
+	}
+	item_stream_t& slot = slots_[id];
+	slot = item_stream_t();
+	slot.name_offset = offset;
+	slot.name_hash = hash;
+
+	const size_t mask = index_.size() - 1;
+	size_t i = hash & mask;
+	while (kEmptyBucket != index_[i] && kDeletedBucket != index_[i])
+		i = (i + 1) & mask;
+	if (kDeletedBucket == index_[i])
+		--deleted_buckets_;
+	index_[i] = id;
+	++size_;
+	return id;
+}
+
+bool
+torikuru::item_store_t::Erase (
+	item_id_t id
+	)
+{
+	if (!IsValid (id))
+		return false;
+	item_stream_t& slot = slots_[id];
+	const char* p = &names_[slot.name_offset];
+	const chromium::StringPiece name (p, strlen (p));
+	const size_t bucket = FindBucket (name, slot.name_hash);
+	DCHECK_NE (index_.size(), bucket);
+	index_[bucket] = kDeletedBucket;
+	++deleted_buckets_;
+	wasted_name_bytes_ += name.size() + 1;
+	slot.name_offset = kFreeSlot;
+	slot.item_handle = nullptr;
+/* An id whose generation wraps is retired rather than reused, a closure
+ * still queued from 256 subscriptions ago would otherwise match again.
+ */
+	if (0 != ++generations_[id])
+		free_ids_.push_back (id);
+	--size_;
+	if (wasted_name_bytes_ > kMinimumWastedNameBytes && wasted_name_bytes_ * 2 > names_.size())
+		CompactNames();
+	return true;
+}
+
+void
+torikuru::item_store_t::Rehash (
+	size_t bucket_count
+	)
+{
+	DCHECK_EQ (0, bucket_count & (bucket_count - 1));
+	std::vector<item_id_t> index (bucket_count, kEmptyBucket);
+	const size_t mask = bucket_count - 1;
+	for (item_id_t id = 0; id < slots_.size(); ++id) {
+		if (kFreeSlot == slots_[id].name_offset)
+			continue;
+		size_t i = slots_[id].name_hash & mask;
+		while (kEmptyBucket != index[i])
+			i = (i + 1) & mask;
+		index[i] = id;
+	}
+	index_.swap (index);
+	deleted_buckets_ = 0;
+}
+
+/* Rewrite the name arena without erased names, the index references ids
+ * not offsets so it is unaffected.
+ */
+void
+torikuru::item_store_t::CompactNames()
+{
+	std::vector<char> names;
+	names.reserve (names_.size() - wasted_name_bytes_);
+	for (auto& slot : slots_) {
+		if (kFreeSlot == slot.name_offset)
+			continue;
+		const char* p = &names_[slot.name_offset];
+		const uint32_t offset = static_cast<uint32_t> (names.size());
+		names.insert (names.end(), p, p + strlen (p) + 1);
+		slot.name_offset = offset;
+	}
+	names_.swap (names);
+	wasted_name_bytes_ = 0;
+}
+
+size_t
+torikuru::item_store_t::memory_usage() const
+{
+	return slots_.capacity() * sizeof (item_stream_t)
+		+ generations_.capacity()
+		+ free_ids_.capacity() * sizeof (item_id_t)
+		+ names_.capacity()
+		+ index_.capacity() * sizeof (item_id_t);
+}
+
+/* eof */
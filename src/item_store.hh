@@ -0,0 +1,157 @@
+/* Compact item directory.
+ *
+ * Item stream state is held in a contiguous slot array indexed by a dense
+ * item id, the id is passed to RFA as the subscription closure.  Item names
+ * are interned into a single arena and located through an open-addressing
+ * hash index, so a subscription costs no heap allocations of its own.
+ */
+
+#ifndef __ITEM_STORE_HH__
+#define __ITEM_STORE_HH__
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/* Boost noncopyable base class */
+#include <boost/utility.hpp>
+
+#include "chromium/string_piece.hh"
+
+namespace rfa
+{
+namespace common
+{
+	class Handle;
+}
+}
+
+namespace torikuru
+{
+	typedef uint32_t item_id_t;
+
+	static const item_id_t kInvalidItemId = 0xffffffff;
+
+/* Per item subscription state, one slot per item id. */
+	struct item_stream_t
+	{
+/* Subscription handle which is valid from login success to login close. */
+		rfa::common::Handle* item_handle;
+
+/* Interned name, offset into the store name arena. */
+		uint32_t name_offset;
+		uint32_t name_hash;
+
+/* Performance counters, times in clock_service_t coarse seconds. */
+		uint32_t last_activity;
+		uint32_t last_refresh;
+		uint32_t last_status;
+		uint32_t last_update;
+		uint32_t msg_count;		/* including unknown message types */
+		uint32_t refresh_received;
+		uint32_t status_received;
+		uint32_t update_received;
+
+		bool is_closed;
+	};
+
+	class item_store_t :
+		boost::noncopyable
+	{
+	public:
+		item_store_t();
+
+/* Pre-size slots, names and index for an expected item count. */
+		void Reserve (size_t count, size_t average_name_length = 16);
+
+/* Returns the new item id, or kInvalidItemId if the name already exists. */
+		item_id_t Insert (const chromium::StringPiece& name);
+		item_id_t Find (const chromium::StringPiece& name) const;
+		bool Erase (item_id_t id);
+
+		bool IsValid (item_id_t id) const {
+			return id < slots_.size() && kFreeSlot != slots_[id].name_offset;
+		}
+		item_stream_t& operator[] (item_id_t id) {
+			return slots_[id];
+		}
+		const item_stream_t& operator[] (item_id_t id) const {
+			return slots_[id];
+		}
+/* NB: pointer is invalidated by subsequent inserts. */
+		const char* name (item_id_t id) const {
+			return &names_[slots_[id].name_offset];
+		}
+
+/* Count of live items. */
+		size_t size() const {
+			return size_;
+		}
+/* Upper bound of item ids for iteration, test each id with IsValid(). */
+		item_id_t end_id() const {
+			return static_cast<item_id_t> (slots_.size());
+		}
+/* Ids allocated without growing the store, for sizing per-item state. */
+		size_t capacity() const {
+			return slots_.capacity();
+		}
+
+/* Heap bytes held by the store including unused capacity. */
+		size_t memory_usage() const;
+
+/* RFA closure encoding: the id offset by one in the low bits, so that a
+ * null closure is never a valid item, and the slot generation in the top
+ * bits.  Ids are reused as soon as erased, the generation bumped on each
+ * erase tells an event still queued for an erased item from one for the
+ * item now holding its id.  An id is retired once its generation would
+ * wrap, so that no generation is ever handed out twice for one id.
+ * Returns kInvalidItemId for a stale closure.
+ */
+		void* ToClosure (item_id_t id) const {
+			return reinterpret_cast<void*> (static_cast<uintptr_t> ((static_cast<uint32_t> (generations_[id]) << kClosureIdBits) | (id + 1)));
+		}
+		item_id_t FromClosure (const void* closure) const {
+			const uint32_t value = static_cast<uint32_t> (reinterpret_cast<uintptr_t> (closure));
+			const item_id_t id = (value & kClosureIdMask) - 1;
+			if (!IsValid (id) || generations_[id] != (value >> kClosureIdBits))
+				return kInvalidItemId;
+			return id;
+		}
+
+	private:
+/* Closures are 32 bits wide on 32-bit hosts: 24 bits of id and 8 of
+ * generation.
+ */
+		static const unsigned kClosureIdBits = 24;
+		static const uint32_t kClosureIdMask = (1U << kClosureIdBits) - 1;
+		static const size_t kMaxItemCount = kClosureIdMask;
+
+		static const uint32_t kFreeSlot = 0xffffffff;
+		static const uint32_t kEmptyBucket = 0xffffffff;
+		static const uint32_t kDeletedBucket = 0xfffffffe;
+
+		static uint32_t Hash (const chromium::StringPiece& name);
+		size_t FindBucket (const chromium::StringPiece& name, uint32_t hash) const;
+		void Rehash (size_t bucket_count);
+		void CompactNames();
+
+		std::vector<item_stream_t> slots_;
+		std::vector<uint8_t> generations_;
+		std::vector<item_id_t> free_ids_;
+
+/* NUL terminated names, erased names are reclaimed by compaction. */
+		std::vector<char> names_;
+		size_t wasted_name_bytes_;
+
+/* Open addressing with linear probing, power of two bucket count. */
+		std::vector<item_id_t> index_;
+		size_t size_;
+		size_t deleted_buckets_;
+	};
+
+} /* namespace torikuru */
+
+#endif /* __ITEM_STORE_HH__ */
+
+/* eof */
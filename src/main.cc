@@ -11,6 +11,18 @@
 #include "chromium/chromium_switches.hh"
 #include "chromium/command_line.hh"
 #include "chromium/logging.hh"
+#include "chromium/metrics/histogram.hh"
+#include "async_log.hh"
+
+namespace switches {
+
+//  Write log lines on the calling thread instead of a background thread.
+const char kSyncLogging[]		    = "sync-logging";
+
+}  // namespace switches
+
+/* Log lines queued for the background flusher. */
+static const size_t kLogBufferSize = 8192;
 
 class env_t
 {
@@ -28,9 +40,19 @@ public:
 			logging::ENABLE_DCHECK_FOR_NON_OFFICIAL_RELEASE_BUILDS
 			);
 		logging::SetLogMessageHandler (log_handler);
+		if (!CommandLine::ForCurrentProcess()->HasSwitch (switches::kSyncLogging))
+			async_log_.Start (stdout, kLogBufferSize);
+	}
+
+	~env_t()
+	{
+		async_log_.Stop();
 	}
 
 protected:
+/* Histograms are only collected while a recorder exists. */
+	chromium::StatisticsRecorder recorder_;
+
 	std::string GetLogFileName() {
 		const std::string log_filename ("/Torikuru.log");
 		return log_filename;
@@ -55,13 +77,24 @@ protected:
 
 	static bool log_handler (int severity, const char* file, int line, size_t message_start, const std::string& str)
 	{
-		fprintf (stdout, "%s", str.c_str());
-		fflush (stdout);
+/* A fatal message precedes abort, write out everything queued first, Stop()
+ * runs once however many threads fail together.
+ */
+		if (logging::LOG_FATAL == severity)
+			async_log_.Stop();
+		if (!async_log_.Push (str, message_start)) {
+			fprintf (stdout, "%s", str.c_str());
+			fflush (stdout);
+		}
 /* allow additional log targets */
 		return false;
 	}
+
+	static torikuru::async_log_t async_log_;
 };
 
+torikuru::async_log_t env_t::async_log_;
+
 int
 main (
 	int		argc,
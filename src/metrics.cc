@@ -0,0 +1,288 @@
+/* Performance counter export.
+ */
+
+#include "metrics.hh"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <sstream>
+#include <unordered_map>
+#include <utility>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "chromium/logging.hh"
+#include "chromium/safe_strerror_posix.hh"
+#include "clock.hh"
+
+/* Bound the time a slow HTTP client may hold the metrics thread. */
+static const int kHttpTimeoutSeconds = 1;
+
+static
+double
+MonotonicSeconds()
+{
+	struct timespec ts;
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+torikuru::metrics_t::metrics_t() :
+	interval_ (0),
+	snapshot_time_ (0),
+	listen_fd_ (-1),
+	stats_file_ (nullptr),
+	is_running_ (false)
+{
+	wake_fds_[0] = wake_fds_[1] = -1;
+}
+
+torikuru::metrics_t::~metrics_t()
+{
+	Stop();
+}
+
+void
+torikuru::metrics_t::AddSource (
+	const std::string& service_name,
+	const counter_t* counters,
+	unsigned count,
+	name_function_t name
+	)
+{
+	DCHECK(!(bool)thread_);
+	source_t source;
+	source.service_name = service_name;
+	source.counters = counters;
+	source.count = count;
+	source.name = name;
+	source.values.resize (count);
+	source.rates.resize (count);
+	for (unsigned i = 0; i < count; ++i)
+		source.values[i] = counters[i].load();
+	sources_.emplace_back (std::move (source));
+}
+
+bool
+torikuru::metrics_t::Start (
+	unsigned interval,
+	int http_port,
+	const std::string& stats_path
+	)
+{
+	interval_ = std::max (1u, interval);
+	if (!stats_path.empty()) {
+		stats_file_ = fopen (stats_path.c_str(), "a");
+		if (nullptr == stats_file_) {
+			LOG(ERROR) << "Failed to open file \"" << stats_path << "\".";
+			return false;
+		}
+	}
+	if (http_port > 0) {
+		listen_fd_ = socket (AF_INET, SOCK_STREAM, 0);
+		if (-1 == listen_fd_) {
+			LOG(ERROR) << "socket: " << safe_strerror (errno);
+			Stop();
+			return false;
+		}
+		const int on = 1;
+		setsockopt (listen_fd_, SOL_SOCKET, SO_REUSEADDR, &on, sizeof (on));
+		struct sockaddr_in addr;
+		memset (&addr, 0, sizeof (addr));
+		addr.sin_family = AF_INET;
+		addr.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+		addr.sin_port = htons (http_port);
+		if (-1 == bind (listen_fd_, reinterpret_cast<struct sockaddr*> (&addr), sizeof (addr)) ||
+		    -1 == listen (listen_fd_, 8))
+		{
+			LOG(ERROR) << "Metrics listener on port " << http_port << ": " << safe_strerror (errno);
+			Stop();
+			return false;
+		}
+	}
+	if (-1 == pipe (wake_fds_)) {
+		LOG(ERROR) << "pipe: " << safe_strerror (errno);
+		Stop();
+		return false;
+	}
+	is_running_ = true;
+	thread_.reset (new boost::thread (boost::bind (&metrics_t::Run, this)));
+	LOG(INFO) << "Metrics: { "
+		  "\"interval\": " << interval_ <<
+		", \"httpPort\": " << http_port <<
+		", \"statsPath\": \"" << stats_path << "\""
+		" }";
+	return true;
+}
+
+void
+torikuru::metrics_t::Stop()
+{
+	if ((bool)thread_) {
+		{
+			boost::lock_guard<boost::mutex> lock (lock_);
+			is_running_ = false;
+		}
+		const char c = 0;
+		if (-1 == write (wake_fds_[1], &c, sizeof (c)))
+			LOG(WARNING) << "write: " << safe_strerror (errno);
+		thread_->join();
+		thread_.reset();
+	}
+	if (-1 != listen_fd_)
+		close (listen_fd_), listen_fd_ = -1;
+	for (int i = 0; i < 2; ++i) {
+		if (-1 != wake_fds_[i])
+			close (wake_fds_[i]), wake_fds_[i] = -1;
+	}
+	if (nullptr != stats_file_) {
+		fclose (stats_file_);
+		stats_file_ = nullptr;
+	}
+}
+
+void
+torikuru::metrics_t::Run()
+{
+	double last = MonotonicSeconds();
+	double next = last + interval_;
+	while (true) {
+		{
+			boost::lock_guard<boost::mutex> lock (lock_);
+			if (!is_running_)
+				break;
+		}
+		const double now = MonotonicSeconds();
+		if (now >= next) {
+			Snapshot (now - last);
+			AppendStats();
+			last = now;
+			next += interval_;
+			if (next <= now)
+				next = now + interval_;
+			continue;
+		}
+		struct pollfd fds[2];
+		fds[0].fd = wake_fds_[0], fds[0].events = POLLIN, fds[0].revents = 0;
+		fds[1].fd = listen_fd_, fds[1].events = POLLIN, fds[1].revents = 0;
+		const int timeout = static_cast<int> ((next - now) * 1000) + 1;
+		if (-1 == poll (fds, -1 == listen_fd_ ? 1 : 2, timeout) && EINTR != errno) {
+			LOG(ERROR) << "poll: " << safe_strerror (errno);
+			break;
+		}
+		if (fds[1].revents & POLLIN)
+			ServeHttp();
+	}
+}
+
+void
+torikuru::metrics_t::Snapshot (
+	double elapsed
+	)
+{
+	boost::lock_guard<boost::mutex> lock (lock_);
+	snapshot_time_ = clock_service_t::coarse_time();
+	for (auto& source : sources_) {
+		for (unsigned i = 0; i < source.count; ++i) {
+			const uint32_t value = source.counters[i].load();
+			source.rates[i] = static_cast<uint32_t> (value - source.values[i]) / elapsed;
+			source.values[i] = value;
+		}
+	}
+}
+
+void
+torikuru::metrics_t::AppendStats()
+{
+	if (nullptr == stats_file_)
+		return;
+	std::ostringstream oss;
+	oss << "{ \"time\": " << snapshot_time_ << ", \"interval\": " << interval_ << ", \"services\": [";
+	for (auto it = sources_.begin(); it != sources_.end(); ++it) {
+		oss << (it == sources_.begin() ? " " : ", ") << "{ \"service\": \"" << it->service_name << "\", \"counters\": {";
+		for (unsigned i = 0; i < it->count; ++i)
+			oss << (0 == i ? " " : ", ") << '"' << it->name (i) << "\": " << it->values[i];
+		oss << " }, \"rates\": {";
+		for (unsigned i = 0; i < it->count; ++i)
+			oss << (0 == i ? " " : ", ") << '"' << it->name (i) << "\": " << it->rates[i];
+		oss << " } }";
+	}
+	oss << " ] }\n";
+	const std::string line (oss.str());
+	fwrite (line.data(), 1, line.size(), stats_file_);
+	fflush (stats_file_);
+}
+
+/* Counters as "torikuru_<name>_total" and the last interval rate as the
+ * gauge "torikuru_<name>_rate", labelled by service.  Sources differ in
+ * their counters, samples are grouped under each distinct name in order of
+ * first appearance.
+ */
+std::string
+torikuru::metrics_t::FormatPrometheus()
+{
+	boost::lock_guard<boost::mutex> lock (lock_);
+	std::vector<std::pair<const char*, std::vector<std::pair<const source_t*, unsigned>>>> metrics;
+	std::unordered_map<std::string, size_t> positions;
+	for (const auto& source : sources_) {
+		for (unsigned i = 0; i < source.count; ++i) {
+			const char* name = source.name (i);
+			auto it = positions.find (name);
+			if (positions.end() == it) {
+				it = positions.emplace (name, metrics.size()).first;
+				metrics.emplace_back (name, std::vector<std::pair<const source_t*, unsigned>>());
+			}
+			metrics[it->second].second.emplace_back (&source, i);
+		}
+	}
+	std::ostringstream oss;
+	for (const auto& metric : metrics) {
+		oss << "# TYPE torikuru_" << metric.first << "_total counter\n";
+		for (const auto& sample : metric.second)
+			oss << "torikuru_" << metric.first << "_total{service=\"" << sample.first->service_name << "\"} " << sample.first->counters[sample.second].load() << '\n';
+		oss << "# TYPE torikuru_" << metric.first << "_rate gauge\n";
+		for (const auto& sample : metric.second)
+			oss << "torikuru_" << metric.first << "_rate{service=\"" << sample.first->service_name << "\"} " << sample.first->rates[sample.second] << '\n';
+	}
+	return oss.str();
+}
+
+/* Minimal HTTP/1.0, every request is answered with the metrics page.
+ */
+void
+torikuru::metrics_t::ServeHttp()
+{
+	const int fd = accept (listen_fd_, nullptr, nullptr);
+	if (-1 == fd)
+		return;
+	struct timeval tv = { kHttpTimeoutSeconds, 0 };
+	setsockopt (fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof (tv));
+	setsockopt (fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof (tv));
+	std::string request;
+	char buf[1024];
+	ssize_t bytes;
+	while (std::string::npos == request.find ("\r\n\r\n") && request.size() < 8192 &&
+	       (bytes = recv (fd, buf, sizeof (buf), 0)) > 0)
+		request.append (buf, bytes);
+	const std::string body (FormatPrometheus());
+	std::ostringstream oss;
+	oss << "HTTP/1.0 200 OK\r\n"
+	       "Content-Type: text/plain; version=0.0.4\r\n"
+	       "Content-Length: " << body.size() << "\r\n"
+	       "Connection: close\r\n"
+	       "\r\n" << body;
+	const std::string response (oss.str());
+	size_t offset = 0;
+	while (offset < response.size() &&
+	       (bytes = send (fd, response.data() + offset, response.size() - offset, MSG_NOSIGNAL)) > 0)
+		offset += bytes;
+	close (fd);
+}
+
+/* eof */
@@ -0,0 +1,79 @@
+/* Performance counter export.
+ *
+ * A background thread snapshots registered counters at a fixed interval,
+ * computes per-interval rates, appends them to a JSON-lines stats file and
+ * serves the latest snapshot in Prometheus text format over HTTP on the
+ * loopback interface.
+ */
+
+#ifndef __METRICS_HH__
+#define __METRICS_HH__
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <vector>
+
+/* Boost noncopyable base class */
+#include <boost/utility.hpp>
+
+/* Boost threading. */
+#include <boost/thread.hpp>
+
+#include "counter.hh"
+
+namespace torikuru
+{
+
+	class metrics_t :
+		boost::noncopyable
+	{
+	public:
+		typedef const char* (*name_function_t)(unsigned);
+
+		metrics_t();
+		~metrics_t();
+
+/* Register before Start(), counters must outlive Stop(). */
+		void AddSource (const std::string& service_name, const counter_t* counters, unsigned count, name_function_t name);
+
+/* http_port zero or empty stats_path disables that export. */
+		bool Start (unsigned interval, int http_port, const std::string& stats_path);
+		void Stop();
+
+	private:
+		struct source_t {
+			std::string service_name;
+			const counter_t* counters;
+			unsigned count;
+			name_function_t name;
+			std::vector<uint32_t> values;
+			std::vector<double> rates;
+		};
+
+		void Run();
+		void Snapshot (double elapsed);
+		void AppendStats();
+		void ServeHttp();
+		std::string FormatPrometheus();
+
+		std::vector<source_t> sources_;
+		unsigned interval_;
+		time_t snapshot_time_;
+
+		int listen_fd_;
+		int wake_fds_[2];
+		FILE* stats_file_;
+		std::unique_ptr<boost::thread> thread_;
+/* Guards snapshot values and rates against HTTP formatting. */
+		boost::mutex lock_;
+		bool is_running_;
+	};
+
+} /* namespace torikuru */
+
+#endif /* __METRICS_HH__ */
+
+/* eof */
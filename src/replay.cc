@@ -0,0 +1,354 @@
+/* Replay publisher.
+ */
+
+#include "replay.hh"
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+/* Google Protocol Buffers */
+#include <google/protobuf/io/coded_stream.h>
+
+#include "chromium/logging.hh"
+#include "chromium/safe_strerror_posix.hh"
+#include "chromium/string_piece.hh"
+#include "archive_format.hh"
+
+/* Subscribers further behind are disconnected, or stall a blocking replay. */
+static const size_t kMaxPendingOutput = 16 * 1024 * 1024;
+
+/* Records are queued and sent once this much is pending, or on poll. */
+static const size_t kSendBatchSize = 64 * 1024;
+
+static const unsigned kMaxClients = 16;
+
+static
+bool
+SetNonBlocking (
+	int fd
+	)
+{
+	const int flags = fcntl (fd, F_GETFL, 0);
+	return -1 != flags && -1 != fcntl (fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+/* Remove a socket left by a previous run, anything else at the path is
+ * kept and fails the open.
+ */
+static
+bool
+UnlinkStaleSocket (
+	const std::string& path
+	)
+{
+	struct stat st;
+	if (-1 == lstat (path.c_str(), &st)) {
+		if (ENOENT == errno)
+			return true;
+		LOG(ERROR) << "lstat \"" << path << "\": " << safe_strerror (errno);
+		return false;
+	}
+	if (!S_ISSOCK (st.st_mode)) {
+		LOG(ERROR) << "\"" << path << "\" exists and is not a socket.";
+		return false;
+	}
+	if (-1 == unlink (path.c_str())) {
+		LOG(ERROR) << "unlink \"" << path << "\": " << safe_strerror (errno);
+		return false;
+	}
+	return true;
+}
+
+torikuru::replay_server_t::replay_server_t() :
+	listen_fd_ (-1),
+	is_blocking_ (false),
+	byte_count_ (0),
+	dropped_count_ (0)
+{
+}
+
+torikuru::replay_server_t::~replay_server_t()
+{
+	Close();
+}
+
+bool
+torikuru::replay_server_t::Open (
+	const std::string& endpoint
+	)
+{
+	const chromium::StringPiece tcp ("tcp://"), unix_domain ("unix://");
+	const chromium::StringPiece url (endpoint);
+	if (url.starts_with (unix_domain)) {
+		struct sockaddr_un addr;
+		memset (&addr, 0, sizeof (addr));
+		const std::string path (url.substr (unix_domain.size()).as_string());
+		if (path.empty() || path.size() >= sizeof (addr.sun_path)) {
+			LOG(ERROR) << "Invalid replay socket path \"" << path << "\".";
+			return false;
+		}
+		addr.sun_family = AF_UNIX;
+		strncpy (addr.sun_path, path.c_str(), sizeof (addr.sun_path) - 1);
+		if (!UnlinkStaleSocket (path))
+			return false;
+		listen_fd_ = socket (AF_UNIX, SOCK_STREAM, 0);
+		if (-1 == listen_fd_) {
+			LOG(ERROR) << "socket: " << safe_strerror (errno);
+			return false;
+		}
+		if (-1 == bind (listen_fd_, reinterpret_cast<struct sockaddr*> (&addr), sizeof (addr))) {
+			LOG(ERROR) << "Replay socket \"" << path << "\": " << safe_strerror (errno);
+			close (listen_fd_), listen_fd_ = -1;
+			return false;
+		}
+		unix_path_ = path;
+	} else if (url.starts_with (tcp)) {
+/* host:port, the host defaults to loopback. */
+		const chromium::StringPiece address (url.substr (tcp.size()));
+		const size_t pos = address.rfind (':');
+		if (chromium::StringPiece::npos == pos) {
+			LOG(ERROR) << "Replay endpoint \"" << endpoint << "\" requires a port.";
+			return false;
+		}
+		std::string host (address.substr (0, pos).as_string());
+		const int port = std::atoi (address.substr (pos + 1).as_string().c_str());
+		if (host.empty() || "localhost" == host)
+			host.assign ("127.0.0.1");
+		struct sockaddr_in addr;
+		memset (&addr, 0, sizeof (addr));
+		addr.sin_family = AF_INET;
+		addr.sin_port = htons (static_cast<uint16_t> (port));
+		if (port <= 0 || port > 0xffff || 1 != inet_pton (AF_INET, host.c_str(), &addr.sin_addr)) {
+			LOG(ERROR) << "Invalid replay endpoint \"" << endpoint << "\".";
+			return false;
+		}
+		listen_fd_ = socket (AF_INET, SOCK_STREAM, 0);
+		if (-1 == listen_fd_) {
+			LOG(ERROR) << "socket: " << safe_strerror (errno);
+			return false;
+		}
+		const int on = 1;
+		setsockopt (listen_fd_, SOL_SOCKET, SO_REUSEADDR, &on, sizeof (on));
+		if (-1 == bind (listen_fd_, reinterpret_cast<struct sockaddr*> (&addr), sizeof (addr))) {
+			LOG(ERROR) << "Replay socket \"" << endpoint << "\": " << safe_strerror (errno);
+			close (listen_fd_), listen_fd_ = -1;
+			return false;
+		}
+	} else {
+		LOG(ERROR) << "Unsupported replay endpoint \"" << endpoint << "\", expecting tcp://host:port or unix://path.";
+		return false;
+	}
+	if (-1 == listen (listen_fd_, 8) || !SetNonBlocking (listen_fd_)) {
+		LOG(ERROR) << "Replay socket \"" << endpoint << "\": " << safe_strerror (errno);
+		Close();
+		return false;
+	}
+	endpoint_ = endpoint;
+	LOG(INFO) << "Listening for replay subscribers on \"" << endpoint_ << "\".";
+	return true;
+}
+
+void
+torikuru::replay_server_t::Close()
+{
+	if (-1 == listen_fd_)
+		return;
+/* Best effort delivery of records already queued. */
+	for (auto& client : clients_) {
+		if (!client.is_closed && client.output.size() > client.offset) {
+			const int flags = fcntl (client.fd, F_GETFL, 0);
+			fcntl (client.fd, F_SETFL, flags & ~O_NONBLOCK);
+			Flush (&client);
+		}
+		close (client.fd);
+	}
+	clients_.clear();
+	close (listen_fd_), listen_fd_ = -1;
+	if (!unix_path_.empty()) {
+		unlink (unix_path_.c_str());
+		unix_path_.clear();
+	}
+	LOG(INFO) << "Replay publisher: { "
+		  "\"endpoint\": \"" << endpoint_ << "\""
+		", \"bytes\": " << byte_count_ <<
+		", \"droppedSubscribers\": " << dropped_count_ <<
+		" }";
+}
+
+void
+torikuru::replay_server_t::Accept()
+{
+	while (true) {
+		const int fd = accept (listen_fd_, nullptr, nullptr);
+		if (-1 == fd) {
+			if (EAGAIN != errno && EWOULDBLOCK != errno && EINTR != errno)
+				LOG(WARNING) << "accept: " << safe_strerror (errno);
+			return;
+		}
+		if (clients_.size() >= kMaxClients || !SetNonBlocking (fd)) {
+			LOG(WARNING) << "Rejecting replay subscriber.";
+			close (fd);
+			continue;
+		}
+/* Records are already batched, do not hold batches back for coalescing. */
+		if (unix_path_.empty()) {
+			const int on = 1;
+			setsockopt (fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof (on));
+		}
+		client_t client;
+		client.fd = fd;
+		client.is_closed = false;
+		client.offset = 0;
+		clients_.emplace_back (std::move (client));
+		LOG(INFO) << "Replay subscriber connected, " << clients_.size() << " total.";
+	}
+}
+
+void
+torikuru::replay_server_t::Flush (
+	client_t* client
+	)
+{
+	while (client->offset < client->output.size()) {
+		const ssize_t bytes = send (client->fd, client->output.data() + client->offset, client->output.size() - client->offset, MSG_NOSIGNAL);
+		if (bytes < 0) {
+			if (EINTR == errno)
+				continue;
+			if (EAGAIN != errno && EWOULDBLOCK != errno)
+				client->is_closed = true;
+			break;
+		}
+		client->offset += bytes;
+		byte_count_ += bytes;
+	}
+	if (client->offset == client->output.size()) {
+		client->output.clear();
+		client->offset = 0;
+	} else if (client->offset > client->output.size() / 2) {
+		client->output.erase (0, client->offset);
+		client->offset = 0;
+	}
+}
+
+void
+torikuru::replay_server_t::FlushClients()
+{
+	bool is_reaping = false;
+	for (auto& client : clients_) {
+		if (!client.is_closed)
+			Flush (&client);
+		if (client.is_closed)
+			is_reaping = true;
+	}
+	if (is_reaping)
+		Reap();
+}
+
+void
+torikuru::replay_server_t::Reap()
+{
+	for (auto it = clients_.begin(); it != clients_.end();) {
+		if (it->is_closed) {
+			close (it->fd);
+			it = clients_.erase (it);
+			LOG(INFO) << "Replay subscriber disconnected, " << clients_.size() << " remaining.";
+		} else {
+			++it;
+		}
+	}
+}
+
+void
+torikuru::replay_server_t::Poll (
+	const struct timespec& timeout
+	)
+{
+	std::vector<struct pollfd> fds;
+	fds.reserve (1 + clients_.size());
+	struct pollfd pfd;
+	pfd.fd = listen_fd_, pfd.events = POLLIN, pfd.revents = 0;
+	fds.push_back (pfd);
+	for (const auto& client : clients_) {
+		pfd.fd = client.fd;
+		pfd.events = POLLIN | (client.output.size() > client.offset ? POLLOUT : 0);
+		fds.push_back (pfd);
+	}
+/* Nanosecond timeout resolution for the pacing loop. */
+	if (-1 == ppoll (fds.data(), fds.size(), &timeout, nullptr)) {
+		if (EINTR != errno)
+			LOG(ERROR) << "ppoll: " << safe_strerror (errno);
+		return;
+	}
+	for (size_t i = 1; i < fds.size(); ++i) {
+		client_t& client = clients_[i - 1];
+		if (fds[i].revents & POLLIN) {
+/* Subscribers send nothing, a read of zero is an orderly close. */
+			char buf[256];
+			const ssize_t bytes = recv (client.fd, buf, sizeof (buf), 0);
+			if (0 == bytes || (bytes < 0 && EAGAIN != errno && EINTR != errno))
+				client.is_closed = true;
+		}
+		if (fds[i].revents & (POLLERR | POLLHUP))
+			client.is_closed = true;
+		if (!client.is_closed && (fds[i].revents & POLLOUT))
+			Flush (&client);
+	}
+	Reap();
+	if (fds[0].revents & POLLIN)
+		Accept();
+}
+
+void
+torikuru::replay_server_t::Publish (
+	const archive::Marketfeed& mfeed
+	)
+{
+	const uint32_t size = RecordByteSize (mfeed);
+	record_.resize (google::protobuf::io::CodedOutputStream::VarintSize32 (size) + size);
+	uint8_t* buf = reinterpret_cast<uint8_t*> (&record_[0]);
+	buf = google::protobuf::io::CodedOutputStream::WriteVarint32ToArray (size, buf);
+	mfeed.SerializeWithCachedSizesToArray (buf);
+
+	bool is_reaping = false;
+	for (auto& client : clients_) {
+		client.output.append (record_);
+		if (client.output.size() - client.offset < kSendBatchSize)
+			continue;
+		Flush (&client);
+		while (!client.is_closed && client.output.size() - client.offset > kMaxPendingOutput) {
+			if (!is_blocking_) {
+				LOG(WARNING) << "Disconnecting replay subscriber not keeping up.";
+				client.is_closed = true;
+				++dropped_count_;
+				break;
+			}
+			struct pollfd pfd;
+			pfd.fd = client.fd, pfd.events = POLLOUT, pfd.revents = 0;
+			if (-1 == poll (&pfd, 1, -1) && EINTR != errno) {
+				client.is_closed = true;
+				break;
+			}
+			if (pfd.revents & (POLLERR | POLLHUP))
+				client.is_closed = true;
+			else
+				Flush (&client);
+		}
+		if (client.is_closed)
+			is_reaping = true;
+	}
+	if (is_reaping)
+		Reap();
+}
+
+/* eof */
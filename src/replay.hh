@@ -0,0 +1,93 @@
+/* Replay publisher.
+ *
+ * Archived records are re-emitted to subscribers of a local TCP or Unix
+ * domain stream socket, each record a varint32 length followed by the
+ * serialized archive::Marketfeed, i.e. the archive record framing without
+ * compression.  Subscribers send nothing.  Served from the calling thread so
+ * that publishing adds no hand-off to the pacing loop.
+ */
+
+#ifndef __REPLAY_HH__
+#define __REPLAY_HH__
+#pragma once
+
+#include <cstdint>
+#include <ctime>
+#include <string>
+#include <vector>
+
+/* Boost noncopyable base class */
+#include <boost/utility.hpp>
+
+#include <archive.pb.h>
+
+namespace torikuru
+{
+
+	class replay_server_t :
+		boost::noncopyable
+	{
+	public:
+		replay_server_t();
+		~replay_server_t();
+
+/* Listen on "tcp://host:port" or "unix://path", replacing any stale socket. */
+		bool Open (const std::string& endpoint);
+		void Close();
+
+/* Accept subscribers and drain pending output for up to timeout, zero to
+ * return immediately.
+ */
+		void Poll (const struct timespec& timeout);
+
+/* Queue a record to every subscriber, sent in batches or on the next poll.
+ * When blocking a full subscriber stalls the caller, otherwise it is
+ * disconnected.
+ */
+		void Publish (const archive::Marketfeed& mfeed);
+
+/* Send queued records without waiting, e.g. before a paced wait. */
+		void FlushClients();
+
+		void set_blocking (bool is_blocking) {
+			is_blocking_ = is_blocking;
+		}
+		size_t client_count() const {
+			return clients_.size();
+		}
+		uint64_t byte_count() const {
+			return byte_count_;
+		}
+		uint64_t dropped_count() const {
+			return dropped_count_;
+		}
+
+	private:
+		struct client_t {
+			int fd;
+			bool is_closed;
+			std::string output;
+			size_t offset;
+		};
+
+		void Accept();
+		void Flush (client_t* client);
+		void Reap();
+
+		std::string endpoint_;
+		std::string unix_path_;
+		int listen_fd_;
+		bool is_blocking_;
+		std::vector<client_t> clients_;
+		std::string record_;
+
+/* Diagnostics, logged on close. */
+		uint64_t byte_count_;
+		uint64_t dropped_count_;
+	};
+
+} /* namespace torikuru */
+
+#endif /* __REPLAY_HH__ */
+
+/* eof */
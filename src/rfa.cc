@@ -17,6 +17,7 @@ static const char* kAppName = "Torikuru";
 namespace connections {
 const char kSSLED[] = "ssled";
 const char kRSSL[] = "rssl";
+const char kSIM[] = "sim";
 }
 
 static const RFA_String kContextName ("RFA");
@@ -144,6 +145,10 @@ throw (rfa::common::InvalidUsageException)
 	bool load_mfeed_dictionary = false;
 	for (const auto& session_config : config_.sessions)
 	{
+/* Simulated sessions have no RFA configuration. */
+		if (LowerCaseEqualsASCII (session_config.protocol, connections::kSIM))
+			continue;
+
 		const RFA_String session_name (session_config.session_name.c_str(), 0, false),
 			connection_name (session_config.connection_name.c_str(), 0, false);
 
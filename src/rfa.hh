@@ -18,6 +18,7 @@
 namespace connections {
 extern const char kSSLED[];
 extern const char kRSSL[];
+extern const char kSIM[];
 }
 
 namespace torikuru
@@ -0,0 +1,211 @@
+/* Shared memory last value cache writer.
+ */
+
+#include "shm_cache.hh"
+
+#include <algorithm>
+#include <cstring>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "chromium/logging.hh"
+#include "chromium/safe_strerror_posix.hh"
+
+/* Distinct field names across the service. */
+static const uint32_t kNameCapacity = 2048;
+
+torikuru::shm_cache_t::shm_cache_t() :
+	base_ (nullptr),
+	size_ (0),
+	header_ (nullptr),
+	overflow_count_ (0),
+	truncated_count_ (0)
+{
+}
+
+torikuru::shm_cache_t::~shm_cache_t()
+{
+	Close();
+}
+
+bool
+torikuru::shm_cache_t::Create (
+	const std::string& name,
+	const std::string& service_name,
+	uint32_t slot_count,
+	uint32_t fields_per_slot
+	)
+{
+	DCHECK(nullptr == base_);
+	name_ = ('/' == name[0]) ? name : ("/" + name);
+	size_ = shm::region_size (slot_count, fields_per_slot, kNameCapacity);
+	const int fd = shm_open (name_.c_str(), O_RDWR | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+	if (-1 == fd) {
+		LOG(ERROR) << "shm_open: " << safe_strerror (errno);
+		return false;
+	}
+	if (-1 == ftruncate (fd, size_)) {
+		LOG(ERROR) << "ftruncate: " << safe_strerror (errno);
+		close (fd);
+		shm_unlink (name_.c_str());
+		return false;
+	}
+	void* p = mmap (nullptr, size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close (fd);
+	if (MAP_FAILED == p) {
+		LOG(ERROR) << "mmap: " << safe_strerror (errno);
+		shm_unlink (name_.c_str());
+		return false;
+	}
+	base_ = static_cast<char*> (p);
+/* Truncated region is zero filled, so every slot starts empty. */
+	header_ = reinterpret_cast<shm::header_t*> (base_);
+	header_->slot_count = slot_count;
+	header_->fields_per_slot = fields_per_slot;
+	header_->slot_size = sizeof (shm::slot_t) + fields_per_slot * sizeof (shm::field_t);
+	header_->name_capacity = kNameCapacity;
+	header_->name_count.store (0, std::memory_order_relaxed);
+	header_->names_offset = sizeof (shm::header_t);
+	header_->slots_offset = header_->names_offset + kNameCapacity * shm::kNameSize;
+	header_->pid = getpid();
+	LOG_IF(WARNING, service_name.size() >= shm::kNameSize) << "Service name \"" << service_name << "\" truncated to " << (shm::kNameSize - 1) << " bytes in shared cache.";
+	strncpy (header_->service_name, service_name.c_str(), shm::kNameSize - 1);
+	header_->version = shm::kVersion;
+/* Readers validate the magic last. */
+	std::atomic_thread_fence (std::memory_order_release);
+	header_->magic = shm::kMagic;
+	LOG(INFO) << "Shared cache: { "
+		  "\"name\": \"" << name_ << "\""
+		", \"slots\": " << slot_count <<
+		", \"fieldsPerSlot\": " << fields_per_slot <<
+		", \"bytes\": " << size_ <<
+		" }";
+	return true;
+}
+
+/* The region is unlinked so that readers cannot mistake it for live data,
+ * existing mappings remain valid.
+ */
+void
+torikuru::shm_cache_t::Close()
+{
+	if (nullptr == base_)
+		return;
+	LOG_IF(WARNING, overflow_count_ > 0) << overflow_count_ << " shared cache events dropped as item or field capacity exceeded.";
+	LOG_IF(INFO, truncated_count_ > 0) << truncated_count_ << " shared cache values truncated.";
+	munmap (base_, size_);
+	shm_unlink (name_.c_str());
+	base_ = nullptr;
+	header_ = nullptr;
+}
+
+void
+torikuru::shm_cache_t::PublishNames (
+	const field_names_t& names
+	)
+{
+	uint32_t count = header_->name_count.load (std::memory_order_relaxed);
+	const uint32_t end = std::min (static_cast<uint32_t> (names.size()), header_->name_capacity);
+	if (count == end)
+		return;
+	char* table = base_ + header_->names_offset;
+	for (; count < end; ++count) {
+		const std::string& name = names.name (static_cast<field_index_t> (count));
+		LOG_IF(WARNING, name.size() >= shm::kNameSize) << "Field name \"" << name << "\" truncated to " << (shm::kNameSize - 1) << " bytes in shared cache.";
+		strncpy (table + count * shm::kNameSize, name.c_str(), shm::kNameSize - 1);
+	}
+	header_->name_count.store (count, std::memory_order_release);
+}
+
+void
+torikuru::shm_cache_t::Publish (
+	item_id_t id,
+	const char* item_name,
+	uint32_t message_type,
+	const struct timespec& ts,
+	TibMsg* msg,
+	field_names_t* names,
+	bool is_image
+	)
+{
+	if (nullptr == header_)
+		return;
+	if (id >= header_->slot_count) {
+		++overflow_count_;
+		return;
+	}
+	shm::slot_t* s = slot (id);
+	shm::field_t* fields = reinterpret_cast<shm::field_t*> (s + 1);
+	char buf[256];
+
+	const uint32_t sequence = s->sequence.load (std::memory_order_relaxed);
+	s->sequence.store (sequence + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence (std::memory_order_release);
+
+	const bool is_renamed = (0 != strncmp (s->item_name, item_name, shm::kItemNameSize - 1));
+	LOG_IF(WARNING, is_renamed && strlen (item_name) >= shm::kItemNameSize) << "Item name \"" << item_name << "\" truncated to " << (shm::kItemNameSize - 1) << " bytes in shared cache.";
+	if (is_image || is_renamed) {
+		strncpy (s->item_name, item_name, shm::kItemNameSize - 1);
+		s->field_count = 0;
+		s->update_count = 0;
+	}
+	for (field_.First (msg); field_.status == TIBMSG_OK; field_.Next()) {
+		const char* name = field_.Name();
+		const field_index_t index = names->Intern (name, field_.NameSize() == 0 ? 0 : strlen (name));
+		if (index >= header_->name_capacity) {
+			++overflow_count_;
+			continue;
+		}
+		memset (buf, 0, sizeof (buf));
+		if (field_.Convert (buf, sizeof (buf)) != TIBMSG_OK)
+			continue;
+		uint32_t i = 0;
+		while (i < s->field_count && fields[i].index != index)
+			++i;
+		if (i == s->field_count) {
+			if (s->field_count == header_->fields_per_slot) {
+				++overflow_count_;
+				continue;
+			}
+			fields[i].index = index;
+			++s->field_count;
+		}
+		size_t length = strlen (buf);
+		if (length > shm::kValueSize) {
+			length = shm::kValueSize;
+			++truncated_count_;
+		}
+		memcpy (fields[i].value, buf, length);
+		fields[i].length = static_cast<uint8_t> (length);
+	}
+	s->message_type = message_type;
+	s->tv_sec = static_cast<uint32_t> (ts.tv_sec);
+	s->tv_nsec = static_cast<uint32_t> (ts.tv_nsec);
+	++s->update_count;
+
+/* Names before the slot so that readers never see an unnamed index. */
+	PublishNames (*names);
+	s->sequence.store (sequence + 2, std::memory_order_release);
+}
+
+void
+torikuru::shm_cache_t::Erase (
+	item_id_t id
+	)
+{
+	if (nullptr == header_ || id >= header_->slot_count)
+		return;
+	shm::slot_t* s = slot (id);
+	const uint32_t sequence = s->sequence.load (std::memory_order_relaxed);
+	s->sequence.store (sequence + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence (std::memory_order_release);
+	memset (s->item_name, 0, sizeof (s->item_name));
+	s->field_count = 0;
+	s->update_count = 0;
+	s->sequence.store (sequence + 2, std::memory_order_release);
+}
+
+/* eof */
@@ -0,0 +1,65 @@
+/* Shared memory last value cache writer.
+ */
+
+#ifndef __SHM_CACHE_HH__
+#define __SHM_CACHE_HH__
+#pragma once
+
+#include <cstdint>
+#include <ctime>
+#include <string>
+
+/* Boost noncopyable base class */
+#include <boost/utility.hpp>
+
+/* RFA 7.2 */
+#include <rfa/rfa.hh>
+
+#include "field_set.hh"
+#include "item_store.hh"
+#include "shm_layout.hh"
+
+namespace torikuru
+{
+
+	class shm_cache_t :
+		boost::noncopyable
+	{
+	public:
+		shm_cache_t();
+		~shm_cache_t();
+
+/* Creates or replaces the named region under /dev/shm. */
+		bool Create (const std::string& name, const std::string& service_name, uint32_t slot_count, uint32_t fields_per_slot);
+		void Close();
+
+/* Apply an unpacked event to the item slot, images replace all fields. */
+		void Publish (item_id_t id, const char* item_name, uint32_t message_type, const struct timespec& ts, TibMsg* msg, field_names_t* names, bool is_image);
+		void Erase (item_id_t id);
+
+		uint32_t slot_count() const {
+			return nullptr == header_ ? 0 : header_->slot_count;
+		}
+
+	private:
+		shm::slot_t* slot (item_id_t id) {
+			return reinterpret_cast<shm::slot_t*> (base_ + header_->slots_offset + static_cast<size_t> (id) * header_->slot_size);
+		}
+		void PublishNames (const field_names_t& names);
+
+		std::string name_;
+		char* base_;
+		size_t size_;
+		shm::header_t* header_;
+		TibField field_;
+
+/* Diagnostics, logged on close. */
+		uint64_t overflow_count_;
+		uint64_t truncated_count_;
+	};
+
+} /* namespace torikuru */
+
+#endif /* __SHM_CACHE_HH__ */
+
+/* eof */
@@ -0,0 +1,84 @@
+/* Shared memory last value cache layout.
+ *
+ * One region per service: a header, a table of interned field names and a
+ * fixed array of slots indexed by item id.  Each slot is guarded by a
+ * sequence lock, the single writer increments the sequence to odd before
+ * modifying the slot and to even afterwards, readers retry on an odd or
+ * changed sequence.  Field values are held as converted strings so that
+ * readers need no Marketfeed dictionary.
+ */
+
+#ifndef __SHM_LAYOUT_HH__
+#define __SHM_LAYOUT_HH__
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+namespace torikuru
+{
+namespace shm
+{
+	static const uint32_t kMagic = 0x564c4b54;	/* "TKLV" */
+	static const uint32_t kVersion = 1;
+
+/* Including NUL terminator. */
+	static const size_t kNameSize = 32;
+	static const size_t kItemNameSize = 32;
+/* Longer values are truncated. */
+	static const size_t kValueSize = 28;
+
+	struct header_t
+	{
+		uint32_t magic;
+		uint32_t version;
+		uint32_t slot_count;
+		uint32_t fields_per_slot;
+		uint32_t slot_size;
+		uint32_t name_capacity;
+/* Published with release semantics after the name is written. */
+		std::atomic<uint32_t> name_count;
+		uint32_t names_offset;
+		uint32_t slots_offset;
+		uint32_t pid;
+		char service_name[kNameSize];
+	};
+
+	struct field_t
+	{
+		uint16_t index;		/* into the name table */
+		uint8_t length;
+		uint8_t reserved;
+		char value[kValueSize];
+	};
+
+/* Followed by fields_per_slot field_t entries. */
+	struct slot_t
+	{
+		std::atomic<uint32_t> sequence;
+		uint32_t field_count;
+		uint32_t message_type;
+		uint32_t tv_sec;
+		uint32_t tv_nsec;
+		uint32_t update_count;
+/* Empty for an unused slot. */
+		char item_name[kItemNameSize];
+		uint32_t reserved[2];
+	};
+
+	static_assert (sizeof (field_t) == 32, "field_t layout");
+	static_assert (sizeof (slot_t) == 64, "slot_t layout");
+
+	inline size_t region_size (uint32_t slot_count, uint32_t fields_per_slot, uint32_t name_capacity) {
+		return sizeof (header_t)
+			+ static_cast<size_t> (name_capacity) * kNameSize
+			+ static_cast<size_t> (slot_count) * (sizeof (slot_t) + fields_per_slot * sizeof (field_t));
+	}
+
+} /* namespace shm */
+} /* namespace torikuru */
+
+#endif /* __SHM_LAYOUT_HH__ */
+
+/* eof */
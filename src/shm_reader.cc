@@ -0,0 +1,135 @@
+/* Shared memory last value cache reader.
+ */
+
+#include "shm_reader.hh"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+torikuru::shm_reader_t::shm_reader_t() :
+	base_ (nullptr),
+	size_ (0),
+	header_ (nullptr)
+{
+}
+
+torikuru::shm_reader_t::~shm_reader_t()
+{
+	Close();
+}
+
+bool
+torikuru::shm_reader_t::Open (
+	const std::string& name
+	)
+{
+	const std::string path = ('/' == name[0]) ? name : ("/" + name);
+	const int fd = shm_open (path.c_str(), O_RDONLY, 0);
+	if (-1 == fd) {
+		perror ("shm_open");
+		return false;
+	}
+	struct stat st;
+	if (-1 == fstat (fd, &st) || static_cast<size_t> (st.st_size) < sizeof (shm::header_t)) {
+		fprintf (stderr, "Shared cache \"%s\" is incomplete.\n", path.c_str());
+		close (fd);
+		return false;
+	}
+	size_ = st.st_size;
+	void* p = mmap (nullptr, size_, PROT_READ, MAP_SHARED, fd, 0);
+	close (fd);
+	if (MAP_FAILED == p) {
+		perror ("mmap");
+		return false;
+	}
+	base_ = static_cast<const char*> (p);
+	header_ = reinterpret_cast<const shm::header_t*> (base_);
+	if (shm::kMagic != header_->magic || shm::kVersion != header_->version ||
+	    size_ < shm::region_size (header_->slot_count, header_->fields_per_slot, header_->name_capacity))
+	{
+		fprintf (stderr, "Shared cache \"%s\" has an unsupported layout.\n", path.c_str());
+		Close();
+		return false;
+	}
+	std::atomic_thread_fence (std::memory_order_acquire);
+	return true;
+}
+
+void
+torikuru::shm_reader_t::Close()
+{
+	if (nullptr == base_)
+		return;
+	munmap (const_cast<char*> (base_), size_);
+	base_ = nullptr;
+	header_ = nullptr;
+}
+
+std::string
+torikuru::shm_reader_t::service_name() const
+{
+	if (nullptr == header_)
+		return std::string();
+	return std::string (header_->service_name, strnlen (header_->service_name, shm::kNameSize));
+}
+
+bool
+torikuru::shm_reader_t::Read (
+	uint32_t slot,
+	snapshot_t* snapshot
+	) const
+{
+	if (nullptr == header_ || slot >= header_->slot_count)
+		return false;
+	const shm::slot_t* s = reinterpret_cast<const shm::slot_t*> (base_ + header_->slots_offset + static_cast<size_t> (slot) * header_->slot_size);
+	const shm::field_t* fields = reinterpret_cast<const shm::field_t*> (s + 1);
+	std::vector<shm::field_t> copy (header_->fields_per_slot);
+	shm::slot_t head;
+	uint32_t field_count;
+	while (true) {
+		const uint32_t sequence = s->sequence.load (std::memory_order_acquire);
+		if (sequence & 1) {
+			sched_yield();
+			continue;
+		}
+		memcpy (head.item_name, s->item_name, sizeof (head.item_name));
+		head.message_type = s->message_type;
+		head.tv_sec = s->tv_sec;
+		head.tv_nsec = s->tv_nsec;
+		head.update_count = s->update_count;
+		field_count = std::min (s->field_count, header_->fields_per_slot);
+		memcpy (copy.data(), fields, field_count * sizeof (shm::field_t));
+		std::atomic_thread_fence (std::memory_order_acquire);
+		if (sequence == s->sequence.load (std::memory_order_relaxed))
+			break;
+	}
+	if ('\0' == head.item_name[0])
+		return false;
+
+	const char* names = base_ + header_->names_offset;
+	const uint32_t name_count = header_->name_count.load (std::memory_order_acquire);
+	snapshot->item_name.assign (head.item_name, strnlen (head.item_name, sizeof (head.item_name)));
+	snapshot->message_type = head.message_type;
+	snapshot->tv_sec = head.tv_sec;
+	snapshot->tv_nsec = head.tv_nsec;
+	snapshot->update_count = head.update_count;
+	snapshot->fields.clear();
+	for (uint32_t i = 0; i < field_count; ++i) {
+		const shm::field_t& field = copy[i];
+		if (field.index >= name_count)
+			continue;
+		const char* name = names + field.index * shm::kNameSize;
+		snapshot->fields.emplace_back (std::string (name, strnlen (name, shm::kNameSize)),
+					       std::string (field.value, std::min<size_t> (field.length, shm::kValueSize)));
+	}
+	return true;
+}
+
+/* eof */
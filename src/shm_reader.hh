@@ -0,0 +1,62 @@
+/* Shared memory last value cache reader.
+ *
+ * Depends only on the region layout so that local applications may link it
+ * without RFA.
+ */
+
+#ifndef __SHM_READER_HH__
+#define __SHM_READER_HH__
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "shm_layout.hh"
+
+namespace torikuru
+{
+
+	class shm_reader_t
+	{
+	public:
+		struct snapshot_t
+		{
+			std::string item_name;
+			uint32_t message_type;
+			uint32_t tv_sec;
+			uint32_t tv_nsec;
+			uint32_t update_count;
+/* Field name and value. */
+			std::vector<std::pair<std::string, std::string>> fields;
+		};
+
+		shm_reader_t();
+		~shm_reader_t();
+
+		bool Open (const std::string& name);
+		void Close();
+
+/* Consistent copy of a slot, returns false for an empty slot. */
+		bool Read (uint32_t slot, snapshot_t* snapshot) const;
+
+		uint32_t slot_count() const {
+			return nullptr == header_ ? 0 : header_->slot_count;
+		}
+		std::string service_name() const;
+
+	private:
+		shm_reader_t (const shm_reader_t&);
+		shm_reader_t& operator= (const shm_reader_t&);
+
+		const char* base_;
+		size_t size_;
+		const shm::header_t* header_;
+	};
+
+} /* namespace torikuru */
+
+#endif /* __SHM_READER_HH__ */
+
+/* eof */
@@ -0,0 +1,56 @@
+/* Dump the shared memory last value cache of a running capture.
+ *
+ * usage: torikuru_shmdump <name> [item ...]
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <unordered_set>
+
+#include "shm_reader.hh"
+
+int
+main (
+	int	argc,
+	char*	argv[]
+	)
+{
+	if (argc < 2) {
+		fprintf (stderr, "usage: %s <name> [item ...]\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+	torikuru::shm_reader_t reader;
+	if (!reader.Open (argv[1]))
+		return EXIT_FAILURE;
+	std::unordered_set<std::string> items (argv + 2, argv + argc);
+	const std::string service_name (reader.service_name());
+
+/* One JSON object per line per item. */
+	torikuru::shm_reader_t::snapshot_t snapshot;
+	for (uint32_t slot = 0; slot < reader.slot_count(); ++slot) {
+		if (!reader.Read (slot, &snapshot))
+			continue;
+		if (!items.empty() && items.end() == items.find (snapshot.item_name))
+			continue;
+		printf ("{ \"service\": \"%s\", \"item\": \"%s\", \"time\": %u.%09u, \"type\": %u, \"updates\": %u, \"fields\": { ",
+			service_name.c_str(), snapshot.item_name.c_str(),
+			snapshot.tv_sec, snapshot.tv_nsec,
+			snapshot.message_type, snapshot.update_count);
+		for (auto it = snapshot.fields.begin(); it != snapshot.fields.end(); ++it) {
+			if (it != snapshot.fields.begin())
+				fputs (", ", stdout);
+			printf ("\"%s\": \"", it->first.c_str());
+			for (const char c : it->second) {
+				if ('"' == c || '\\' == c)
+					putchar ('\\');
+				putchar (c);
+			}
+			putchar ('"');
+		}
+		puts (" } }");
+	}
+	return EXIT_SUCCESS;
+}
+
+/* eof */
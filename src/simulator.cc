@@ -0,0 +1,238 @@
+/* Simulated market data source.
+ */
+
+#include "simulator.hh"
+
+#include <algorithm>
+#include <cstring>
+
+#include "chromium/logging.hh"
+#include "concurrent_histogram.hh"
+#include "trace.hh"
+
+/* Share of synthetic events after the initial images, per million, that are
+ * replaced by a status, a rename or a stream close.
+ */
+static const uint32_t kStatusPerMillion = 1000;
+static const uint32_t kRenamePerMillion = 100;
+static const uint32_t kClosePerMillion = 10;
+
+/* Consecutive events skipped for closed or removed items before yielding. */
+static const unsigned kMaxSkippedEvents = 1000;
+
+torikuru::simulator_t::simulator_t (
+	const session_config_t& config,
+	std::shared_ptr<consumer_t> consumer
+	) :
+	config_ (config),
+	consumer_ (consumer),
+	is_filtered_ (false),
+	state_ (0 == config.sim_seed ? 0x9e3779b9 : config.sim_seed),
+	sent_ (0),
+	max_backlog_ (0),
+	is_done_ (false)
+{
+	memset (&start_, 0, sizeof (start_));
+}
+
+torikuru::simulator_t::~simulator_t()
+{
+	const double seconds = GetElapsedNs() / 1e9;
+	LOG(INFO) << "Simulator: { "
+		  "\"service\": \"" << config_.service_name << "\""
+		", \"events\": " << sent_ <<
+		", \"seconds\": " << seconds <<
+		", \"eventsPerSecond\": " << (seconds > 0 ? static_cast<uint64_t> (sent_ / seconds) : 0) <<
+		", \"maxBacklog\": " << max_backlog_ <<
+		" }";
+}
+
+bool
+torikuru::simulator_t::Init (
+	const std::vector<std::string>& symbols,
+	const std::string& dictionary
+	)
+{
+	if (!config_.sim_replay_path.empty()) {
+		reader_.reset (new archive_reader_t());
+		reader_->set_dictionary (dictionary);
+		if (!reader_->Open (config_.sim_replay_path))
+			return false;
+		is_filtered_ = !symbols.empty();
+		LOG(INFO) << "Replaying \"" << config_.sim_replay_path << "\" on service \"" << config_.service_name << "\".";
+	} else {
+		synthetic_options_t options;
+		options.symbol_count = std::max (1U, config_.sim_symbol_count);
+		options.field_count = std::max (1U, config_.sim_field_count);
+		options.update_ratio = config_.sim_update_ratio;
+		options.seed = config_.sim_seed;
+		options.start_time = time (nullptr);
+		options.service_name = config_.service_name;
+		options.symbols = symbols;
+		workload_.reset (new synthetic_workload_t (options));
+/* Generated names join the directory before subscriptions are submitted. */
+		if (symbols.empty()) {
+			consumer_->ReserveItemStreams (workload_->symbols().size());
+			for (const auto& symbol : workload_->symbols()) {
+				if (!consumer_->CreateItemStream (symbol.c_str()))
+					LOG(WARNING) << "Cannot create stream for \"" << symbol << "\".";
+			}
+		}
+		LOG(INFO) << "Simulating " << workload_->symbols().size() << " items on service \"" << config_.service_name << "\".";
+	}
+	event_.data_format = rfa::sessionLayer::MarketDataEnums::Marketfeed;
+	event_.service_name = config_.service_name;
+	clock_gettime (CLOCK_MONOTONIC, &start_);
+	return true;
+}
+
+uint64_t
+torikuru::simulator_t::GetElapsedNs() const
+{
+	struct timespec now;
+	clock_gettime (CLOCK_MONOTONIC, &now);
+	return static_cast<uint64_t> (now.tv_sec - start_.tv_sec) * 1000000000ULL + now.tv_nsec - start_.tv_nsec;
+}
+
+long
+torikuru::simulator_t::GetWaitMs() const
+{
+	if (0 == config_.sim_rate || is_done_)
+		return 0;
+/* Due time of the next event relative to start. */
+	const double next_ns = (sent_ + 1) * 1e9 / config_.sim_rate;
+	const double elapsed_ns = static_cast<double> (GetElapsedNs());
+	if (next_ns <= elapsed_ns)
+		return 0;
+	return static_cast<long> ((next_ns - elapsed_ns) / 1e6) + 1;
+}
+
+/* Events fall due at the configured rate from start, a consumer unable to
+ * keep up accumulates a backlog which is reported at exit.  Time from the
+ * due time to the handler is recorded in Consumer.QueueTime, standing in
+ * for time in the RFA event queue which RFA events do not timestamp.
+ */
+unsigned
+torikuru::simulator_t::Dispatch (
+	unsigned max_events
+	)
+{
+	if (is_done_)
+		return 0;
+	uint64_t due = max_events;
+	if (config_.sim_rate > 0) {
+		const uint64_t target = static_cast<uint64_t> (GetElapsedNs() / 1e9 * config_.sim_rate);
+		if (target <= sent_)
+			return 0;
+		const uint64_t backlog = target - sent_;
+		max_backlog_ = std::max (max_backlog_, backlog);
+		due = std::min (due, backlog);
+	}
+	TRACE_EVENT("Simulator.Dispatch");
+	unsigned count = 0;
+	while (count < due && Next()) {
+		if (config_.sim_rate > 0) {
+			const uint64_t due_ns = static_cast<uint64_t> ((sent_ + count + 1) * 1e9 / config_.sim_rate);
+			const uint64_t elapsed_ns = GetElapsedNs();
+			const uint64_t queue_ns = elapsed_ns > due_ns ? elapsed_ns - due_ns : 0;
+			CONCURRENT_HISTOGRAM_CUSTOM_COUNTS("Consumer.QueueTime",
+				queue_ns > 0x7fffffffULL ? 0x7fffffff : static_cast<int> (queue_ns), 1, 1000000000, 64);
+		}
+		consumer_->ProcessMarketDataEvent (event_);
+		++count;
+	}
+	sent_ += count;
+	return count;
+}
+
+bool
+torikuru::simulator_t::Next()
+{
+	for (unsigned skipped = 0; skipped < kMaxSkippedEvents; ++skipped) {
+		if (!((bool)reader_ ? NextReplay() : NextSynthetic()))
+			return false;
+		if (kInvalidItemId != event_.id)
+			return true;
+	}
+	return false;
+}
+
+/* Synthetic record with the event type occasionally replaced, the stream
+ * of a closed item is never re-opened.
+ */
+bool
+torikuru::simulator_t::NextSynthetic()
+{
+	workload_->Next (&mfeed_);
+	event_.id = consumer_->FindItemStream (mfeed_.item_name());
+	if (kInvalidItemId == event_.id)
+		return true;
+	if (event_.id < closed_.size() && closed_[event_.id]) {
+		event_.id = kInvalidItemId;
+		return true;
+	}
+	event_.msg_type = mfeed_.message_type();
+	event_.is_stream_closed = false;
+	event_.item_name = mfeed_.item_name();
+	event_.new_item_name.clear();
+	event_.buffer = mfeed_.packed_buffer();
+	if (rfa::sessionLayer::MarketDataItemEvent::Update != event_.msg_type)
+		return true;
+
+	state_ ^= state_ << 13;
+	state_ ^= state_ >> 17;
+	state_ ^= state_ << 5;
+	const uint32_t r = state_ % 1000000;
+	if (r < kClosePerMillion) {
+		event_.msg_type = rfa::sessionLayer::MarketDataItemEvent::Status;
+		event_.is_stream_closed = true;
+		event_.buffer.clear();
+		if (event_.id >= closed_.size())
+			closed_.resize (event_.id + 1);
+		closed_[event_.id] = true;
+	} else if (r < kClosePerMillion + kRenamePerMillion) {
+		event_.msg_type = rfa::sessionLayer::MarketDataItemEvent::Rename;
+		new_item_name_.assign (mfeed_.item_name());
+		new_item_name_.append ("-R");
+		event_.new_item_name = new_item_name_;
+		event_.buffer.clear();
+	} else if (r < kClosePerMillion + kRenamePerMillion + kStatusPerMillion) {
+		event_.msg_type = rfa::sessionLayer::MarketDataItemEvent::Status;
+		event_.buffer.clear();
+	}
+	return true;
+}
+
+/* Archived events under the simulated service name, checkpoint images are
+ * synthesized at capture and skipped.
+ */
+bool
+torikuru::simulator_t::NextReplay()
+{
+	bool is_valid;
+	if (!reader_->Read (&mfeed_, &is_valid)) {
+		LOG(INFO) << "Replay of \"" << config_.sim_replay_path << "\" complete.";
+		is_done_ = true;
+		return false;
+	}
+	event_.id = kInvalidItemId;
+	if (!is_valid || (mfeed_.has_checkpoint() && mfeed_.checkpoint()))
+		return true;
+	event_.id = consumer_->FindItemStream (mfeed_.item_name());
+	if (kInvalidItemId == event_.id && !is_filtered_) {
+		if (consumer_->CreateItemStream (mfeed_.item_name().c_str()))
+			event_.id = consumer_->FindItemStream (mfeed_.item_name());
+	}
+	event_.msg_type = mfeed_.message_type();
+	event_.is_stream_closed = false;
+	event_.item_name = mfeed_.item_name();
+	event_.new_item_name.clear();
+	if (mfeed_.has_new_item_name())
+		event_.new_item_name = mfeed_.new_item_name();
+	event_.buffer.clear();
+	if (mfeed_.has_packed_buffer())
+		event_.buffer = mfeed_.packed_buffer();
+	return true;
+}
+
+/* eof */
@@ -0,0 +1,95 @@
+/* Simulated market data source.
+ *
+ * Stands in for a RFA session so that the capture path can be loaded
+ * offline: market data item events are generated from a synthetic workload,
+ * with occasional statuses, renames and stream closes, or replayed from an
+ * existing archive, and handed to the consumer on the dispatch thread at a
+ * configured rate.
+ */
+
+#ifndef __SIMULATOR_HH__
+#define __SIMULATOR_HH__
+#pragma once
+
+#include <cstdint>
+#include <ctime>
+#include <memory>
+#include <string>
+#include <vector>
+
+/* Boost noncopyable base class */
+#include <boost/utility.hpp>
+
+#include "archive_reader.hh"
+#include "config.hh"
+#include "consumer.hh"
+#include "synthetic.hh"
+
+#include <archive.pb.h>
+
+namespace torikuru
+{
+
+	class simulator_t :
+		boost::noncopyable
+	{
+	public:
+		simulator_t (const session_config_t& config, std::shared_ptr<consumer_t> consumer);
+		~simulator_t();
+
+/* Synthetic events are generated for symbols, or for the configured count
+ * of generated symbols when empty, and item streams are created for them.
+ * A replay is limited to symbols when not empty, otherwise item streams are
+ * created as names are first seen.  The dictionary is that of a replayed
+ * archive written with one, may be empty.
+ */
+		bool Init (const std::vector<std::string>& symbols, const std::string& dictionary);
+
+/* Hand at most max_events due events to the consumer, returns the count. */
+		unsigned Dispatch (unsigned max_events);
+
+/* Milliseconds until the next event is due, zero if one is due now. */
+		long GetWaitMs() const;
+
+/* Replay reached the end of the archive. */
+		bool is_done() const {
+			return is_done_;
+		}
+		uint64_t event_count() const {
+			return sent_;
+		}
+
+	private:
+		bool Next();
+		bool NextSynthetic();
+		bool NextReplay();
+		uint64_t GetElapsedNs() const;
+
+		const session_config_t& config_;
+		std::shared_ptr<consumer_t> consumer_;
+
+		std::unique_ptr<synthetic_workload_t> workload_;
+		std::unique_ptr<archive_reader_t> reader_;
+		bool is_filtered_;
+
+/* Record behind the current event. */
+		archive::Marketfeed mfeed_;
+		market_data_event_t event_;
+		std::string new_item_name_;
+
+/* Closed streams by item id, no further events are generated. */
+		std::vector<bool> closed_;
+		uint32_t state_;
+
+/* Pacing. */
+		struct timespec start_;
+		uint64_t sent_;
+		uint64_t max_backlog_;
+		bool is_done_;
+	};
+
+} /* namespace torikuru */
+
+#endif /* __SIMULATOR_HH__ */
+
+/* eof */
@@ -0,0 +1,258 @@
+/* Synthetic market data workload.
+ */
+
+#include "synthetic.hh"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+#include "chromium/logging.hh"
+
+/* Common Marketfeed fields in image order, further fields are numbered. */
+static const char* kFieldNames[] = {
+	"BID", "ASK", "BIDSIZE", "ASKSIZE", "TRDPRC_1", "TRDVOL_1", "ACVOL_1", "HIGH_1",
+	"LOW_1", "OPEN_PRC", "HST_CLOSE", "NETCHNG_1", "PCTCHNG", "TRADE_DATE", "TRDTIM_1", "QUOTIM"
+};
+static const size_t kFieldNameCount = sizeof (kFieldNames) / sizeof (kFieldNames[0]);
+
+enum {
+	kBid, kAsk, kBidSize, kAskSize, kTradePrice, kTradeVolume, kVolume, kHigh,
+	kLow, kOpen, kClose, kNetChange, kPercentChange, kTradeDate, kTradeTime, kQuoteTime
+};
+
+/* Fields sent with each update type, as a feed would. */
+static const unsigned kQuoteFields[] = { kBid, kAsk, kBidSize, kAskSize, kQuoteTime };
+static const unsigned kTradeFields[] = { kTradePrice, kTradeVolume, kVolume, kHigh, kLow, kNetChange, kPercentChange, kTradeTime };
+
+/* Share of updates that are trades, per thousand. */
+static const uint32_t kTradesPerThousand = 300;
+
+static const char* kMonthNames[] = {
+	"JAN", "FEB", "MAR", "APR", "MAY", "JUN", "JUL", "AUG", "SEP", "OCT", "NOV", "DEC"
+};
+
+torikuru::synthetic_workload_t::synthetic_workload_t (
+	const synthetic_options_t& options
+	) :
+	options_ (options)
+{
+	char name[32];
+	if (!options_.symbols.empty()) {
+		symbols_.swap (options_.symbols);
+		options_.symbol_count = static_cast<unsigned> (symbols_.size());
+	} else {
+		symbols_.reserve (options_.symbol_count);
+		for (unsigned i = 0; i < options_.symbol_count; ++i) {
+			snprintf (name, sizeof (name), "SYM%06u.X", i);
+			symbols_.emplace_back (name);
+		}
+	}
+	DCHECK_GT(options_.symbol_count, 0U);
+	DCHECK_GT(options_.field_count, 0U);
+	field_names_.reserve (options_.field_count);
+	for (unsigned i = 0; i < options_.field_count; ++i) {
+		if (i < kFieldNameCount) {
+			field_names_.emplace_back (kFieldNames[i]);
+		} else {
+			snprintf (name, sizeof (name), "FLD%03u", i);
+			field_names_.emplace_back (name);
+		}
+	}
+/* Update field sets limited to the fields present in images. */
+	for (const unsigned index : kQuoteFields)
+		if (index < options_.field_count)
+			quote_fields_.push_back (index);
+	for (const unsigned index : kTradeFields)
+		if (index < options_.field_count)
+			trade_fields_.push_back (index);
+/* Weight of the symbol at rank k is 1/k^s. */
+	if (options_.zipf_exponent > 0) {
+		cdf_.resize (symbols_.size());
+		double sum = 0;
+		for (size_t k = 0; k < cdf_.size(); ++k) {
+			sum += 1.0 / std::pow (static_cast<double> (k + 1), options_.zipf_exponent);
+			cdf_[k] = sum;
+		}
+	}
+	Reset();
+}
+
+void
+torikuru::synthetic_workload_t::Reset()
+{
+	state_ = 0 == options_.seed ? 0x9e3779b9 : options_.seed;
+	time_ns_ = static_cast<uint64_t> (options_.start_time) * 1000000000ULL;
+	imaged_count_ = 0;
+	market_.resize (symbols_.size());
+	for (auto& symbol : market_) {
+		symbol.price = 100 + Random() % 99900;
+		symbol.open = symbol.high = symbol.low = symbol.close = symbol.price;
+		symbol.trade_volume = 0;
+		symbol.volume = 0;
+	}
+}
+
+/* Initial images in symbol order, afterwards by Zipf rank.
+ */
+unsigned
+torikuru::synthetic_workload_t::NextSymbol()
+{
+	if (imaged_count_ < symbols_.size())
+		return imaged_count_++;
+	if (cdf_.empty())
+		return Random() % options_.symbol_count;
+/* Random() is never zero, u in [0, 1). */
+	const double u = (Random() - 1) / 4294967295.0 * cdf_.back();
+	const size_t k = std::upper_bound (cdf_.begin(), cdf_.end(), u) - cdf_.begin();
+	return static_cast<unsigned> (std::min (k, cdf_.size() - 1));
+}
+
+/* Random walk of up to three ticks per trade.
+ */
+void
+torikuru::synthetic_workload_t::Trade (
+	symbol_state_t* symbol
+	)
+{
+	const int delta = static_cast<int> (Random() % 7) - 3;
+	symbol->price = std::max (1, static_cast<int> (symbol->price) + delta);
+	symbol->high = std::max (symbol->high, symbol->price);
+	symbol->low = std::min (symbol->low, symbol->price);
+	symbol->trade_volume = 100 * (1 + Random() % 50);
+	symbol->volume += symbol->trade_volume;
+}
+
+static
+int
+FormatPrice (
+	char* buf,
+	size_t size,
+	int64_t ticks
+	)
+{
+	const uint64_t magnitude = ticks < 0 ? -ticks : ticks;
+	return snprintf (buf, size, "%s%u.%02u", ticks < 0 ? "-" : "",
+		static_cast<unsigned> (magnitude / 100), static_cast<unsigned> (magnitude % 100));
+}
+
+/* Values formatted as the Marketfeed string encoding of each field.
+ */
+void
+torikuru::synthetic_workload_t::AppendField (
+	unsigned index,
+	const symbol_state_t& symbol,
+	const struct tm& tm
+	)
+{
+	int length;
+	switch (index) {
+	case kBid:
+		length = FormatPrice (value_, sizeof (value_), symbol.price > 1 ? symbol.price - 1 : 1);
+		break;
+	case kAsk:
+		length = FormatPrice (value_, sizeof (value_), symbol.price + 1);
+		break;
+	case kTradePrice:
+		length = FormatPrice (value_, sizeof (value_), symbol.price);
+		break;
+	case kHigh:
+		length = FormatPrice (value_, sizeof (value_), symbol.high);
+		break;
+	case kLow:
+		length = FormatPrice (value_, sizeof (value_), symbol.low);
+		break;
+	case kOpen:
+		length = FormatPrice (value_, sizeof (value_), symbol.open);
+		break;
+	case kClose:
+		length = FormatPrice (value_, sizeof (value_), symbol.close);
+		break;
+	case kNetChange:
+		length = FormatPrice (value_, sizeof (value_), static_cast<int64_t> (symbol.price) - symbol.close);
+		break;
+	case kPercentChange:
+		length = FormatPrice (value_, sizeof (value_), (static_cast<int64_t> (symbol.price) - symbol.close) * 10000 / symbol.close);
+		break;
+	case kBidSize:
+	case kAskSize:
+		length = snprintf (value_, sizeof (value_), "%u", 100 * (1 + Random() % 100));
+		break;
+	case kTradeVolume:
+		length = snprintf (value_, sizeof (value_), "%u", symbol.trade_volume);
+		break;
+	case kVolume:
+		length = snprintf (value_, sizeof (value_), "%u", symbol.volume);
+		break;
+	case kTradeDate:
+		length = snprintf (value_, sizeof (value_), "%02d %s %04d", tm.tm_mday, kMonthNames[tm.tm_mon], 1900 + tm.tm_year);
+		break;
+	case kTradeTime:
+	case kQuoteTime:
+		length = snprintf (value_, sizeof (value_), "%02d:%02d:%02d", tm.tm_hour, tm.tm_min, tm.tm_sec);
+		break;
+	default:
+		length = snprintf (value_, sizeof (value_), "%u", Random() % 1000000);
+		break;
+	}
+	msg_.Append (field_names_[index].c_str(), value_, length, TIBMSG_STRING);
+}
+
+void
+torikuru::synthetic_workload_t::AppendFields (
+	const std::vector<unsigned>& indices,
+	const symbol_state_t& symbol,
+	const struct tm& tm
+	)
+{
+	for (const unsigned index : indices)
+		AppendField (index, symbol, tm);
+}
+
+void
+torikuru::synthetic_workload_t::Next (
+	archive::Marketfeed* mfeed
+	)
+{
+	const bool is_initial = imaged_count_ < symbols_.size();
+	const unsigned index = NextSymbol();
+	const bool is_image = is_initial ||
+		(Random() % 1000000) >= static_cast<uint32_t> (options_.update_ratio * 1000000);
+
+/* Uniform gap in [1, 2 * mean]. */
+	time_ns_ += 1 + ((static_cast<uint64_t> (Random()) * 2 * options_.mean_interval_ns) >> 32);
+	const time_t tv_sec = static_cast<time_t> (time_ns_ / 1000000000ULL);
+	const uint32_t tv_nsec = static_cast<uint32_t> (time_ns_ % 1000000000ULL);
+	struct tm tm;
+	gmtime_r (&tv_sec, &tm);
+
+	symbol_state_t& symbol = market_[index];
+	msg_.ReUse();
+	if (is_image) {
+		for (unsigned i = 0; i < options_.field_count; ++i)
+			AppendField (i, symbol, tm);
+	} else {
+		if (!trade_fields_.empty() && Random() % 1000 < kTradesPerThousand) {
+			Trade (&symbol);
+			AppendFields (trade_fields_, symbol, tm);
+		} else {
+			AppendFields (quote_fields_, symbol, tm);
+		}
+/* Occasionally one of the remaining fields. */
+		if (options_.field_count > kFieldNameCount && 0 == Random() % 4)
+			AppendField (kFieldNameCount + Random() % (options_.field_count - kFieldNameCount), symbol, tm);
+	}
+
+	mfeed->Clear();
+	mfeed->set_tv_sec (static_cast<uint32_t> (tv_sec));
+	mfeed->set_tv_usec (tv_nsec / 1000);
+	mfeed->set_tv_nsec (tv_nsec);
+	mfeed->set_message_type (is_image ? rfa::sessionLayer::MarketDataItemEvent::Image
+					  : rfa::sessionLayer::MarketDataItemEvent::Update);
+	mfeed->set_service_name (options_.service_name);
+	mfeed->set_item_name (symbols_[index]);
+	mfeed->set_packed_buffer (msg_.Packed(), msg_.PackSize());
+}
+
+/* eof */
@@ -0,0 +1,130 @@
+/* Synthetic market data workload.
+ *
+ * A deterministic stream of archive::Marketfeed records for benchmarks,
+ * simulation and test archives: each symbol starts with an image of every
+ * field, followed by quote and trade updates carrying the fields a feed
+ * would send for each, and occasional re-images.  Symbol activity follows a
+ * Zipf distribution over the symbol list and prices follow a per-symbol
+ * random walk.  The same options and seed always produce the same records.
+ */
+
+#ifndef __SYNTHETIC_HH__
+#define __SYNTHETIC_HH__
+#pragma once
+
+#include <cstdint>
+#include <ctime>
+#include <string>
+#include <vector>
+
+/* Boost noncopyable base class */
+#include <boost/utility.hpp>
+
+/* RFA 7.2 */
+#include <rfa/rfa.hh>
+
+#include <archive.pb.h>
+
+namespace torikuru
+{
+
+	struct synthetic_options_t
+	{
+		synthetic_options_t() :
+			symbol_count (1000),
+			field_count (16),
+			update_ratio (0.95),
+			zipf_exponent (1.0),
+			seed (1),
+			start_time (1500000000),
+			mean_interval_ns (50000),
+			service_name ("SYNTHETIC")
+		{
+		}
+
+		unsigned symbol_count;
+/* Fields per image, beyond the common Marketfeed set fields are numbered. */
+		unsigned field_count;
+/* Fraction of records after the initial images that are updates. */
+		double update_ratio;
+/* Skew of symbol activity by list position, zero for uniform. */
+		double zipf_exponent;
+		uint32_t seed;
+		time_t start_time;
+/* Mean gap between record receive times. */
+		uint32_t mean_interval_ns;
+		std::string service_name;
+/* Item names used instead of generated names when not empty, busiest
+ * first.
+ */
+		std::vector<std::string> symbols;
+	};
+
+	class synthetic_workload_t :
+		boost::noncopyable
+	{
+	public:
+		explicit synthetic_workload_t (const synthetic_options_t& options);
+
+/* Replace mfeed with the next record of the sequence. */
+		void Next (archive::Marketfeed* mfeed);
+
+/* Restart the sequence from the beginning. */
+		void Reset();
+
+		const std::vector<std::string>& symbols() const {
+			return symbols_;
+		}
+		const std::vector<std::string>& field_names() const {
+			return field_names_;
+		}
+
+	private:
+/* Market state per symbol, prices in ticks of 0.01. */
+		struct symbol_state_t {
+			uint32_t price;
+			uint32_t open;
+			uint32_t high;
+			uint32_t low;
+			uint32_t close;
+			uint32_t trade_volume;
+			uint32_t volume;
+		};
+
+/* xorshift32, never zero. */
+		uint32_t Random() {
+			state_ ^= state_ << 13;
+			state_ ^= state_ >> 17;
+			state_ ^= state_ << 5;
+			return state_;
+		}
+		unsigned NextSymbol();
+		void Trade (symbol_state_t* symbol);
+		void AppendField (unsigned index, const symbol_state_t& symbol, const struct tm& tm);
+		void AppendFields (const std::vector<unsigned>& indices, const symbol_state_t& symbol, const struct tm& tm);
+
+		synthetic_options_t options_;
+		std::vector<std::string> symbols_;
+		std::vector<std::string> field_names_;
+/* Cumulative Zipf weights by symbol index, empty for uniform. */
+		std::vector<double> cdf_;
+/* Field indices carried by each update type. */
+		std::vector<unsigned> quote_fields_;
+		std::vector<unsigned> trade_fields_;
+
+		uint32_t state_;
+		uint64_t time_ns_;
+/* Symbols already sent their initial image, in order. */
+		unsigned imaged_count_;
+		std::vector<symbol_state_t> market_;
+
+/* Scratch state re-used between records. */
+		TibMsg msg_;
+		char value_[32];
+	};
+
+} /* namespace torikuru */
+
+#endif /* __SYNTHETIC_HH__ */
+
+/* eof */
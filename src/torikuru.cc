@@ -6,25 +6,43 @@
 #define __STDC_FORMAT_MACROS
 #include <cstdint>
 #include <inttypes.h>
+#include <algorithm>
+#include <atomic>
 #include <functional>
 #include <fstream>
 #include <unordered_map>
 #include <unordered_set>
 
+#include <signal.h>
+#include <sys/inotify.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <unistd.h>
 
 #include "chromium/command_line.hh"
 #include "chromium/file_util.hh"
 #include "chromium/logging.hh"
+#include "chromium/metrics/histogram.hh"
+#include "chromium/safe_strerror_posix.hh"
 #include "chromium/string_piece.hh"
 #include "chromium/string_split.hh"
 #include "chromium/string_util.hh"
+#include "chromium/stringprintf.hh"
 #include "googleurl/url_parse.h"
+#include "archive_reader.hh"
+#include "clock.hh"
+#include "compact.hh"
+#include "concurrent_histogram.hh"
+#include "csv_format.hh"
 #include "error.hh"
+#include "field_set.hh"
+#include "inspect.hh"
+#include "replay.hh"
 #include "rfa_logging.hh"
 #include "rfaostream.hh"
+#include "shm_cache.hh"
+#include "trace.hh"
 
 /* RDM Usage Guide: Section 6.5: Enterprise Platform
  * For future compatibility, the DictionaryId should be set to 1 by providers.
@@ -35,6 +53,24 @@ static const int kDictionaryId = 1;
 /* RDM: Absolutely no idea. */
 static const int kFieldListId = 3;
 
+/* Maximum events dispatched between clock updates and housekeeping. */
+static const unsigned kMaxDispatchBurst = 1000;
+
+/* Checkpoint images recorded per event loop iteration. */
+static const unsigned kCheckpointBudget = 1000;
+
+/* Shared cache slots allocated for small symbol lists. */
+static const uint32_t kMinimumShmSlotCount = 1024;
+
+/* Replay waits sleep until this long before the due time, then spin. */
+static const uint64_t kReplaySpinNs = 100000;
+
+/* Records replayed between subscriber polls when not waiting. */
+static const uint64_t kReplayPollInterval = 1024;
+
+/* Seconds between replay progress reports. */
+static const uint64_t kReplayReportInterval = 10;
+
 
 namespace switches {
 
@@ -50,9 +86,36 @@ const char kSymbolPath[]		    = "symbol-path";
 //  Output file for recording.
 const char kOutputPath[]                    = "output-path";
 
+//  CSV files exported during capture.
+const char kCsvPath[]			    = "csv-path";
+
+//  Comma separated Marketfeed field columns of CSV files exported during capture.
+const char kCsvFields[]			    = "csv-fields";
+
 //  Input file for unpacking.
 const char kInputPath[]			    = "input-path";
 
+//  Extract from an input file still being written.
+const char kFollow[]			    = "follow";
+
+//  Re-emit the input file to subscribers of a tcp:// or unix:// endpoint.
+const char kReplay[]			    = "replay";
+
+//  Replay speed relative to recorded pacing, zero for as fast as possible.
+const char kReplaySpeed[]		    = "replay-speed";
+
+//  Report statistics of the input files, comma separated, instead of extracting.
+const char kInspect[]			    = "inspect";
+
+//  Most active symbols listed per inspected archive.
+const char kInspectTop[]		    = "inspect-top";
+
+//  Rewrite the finished input files, comma separated, with Zstandard in place.
+const char kCompact[]			    = "compact";
+
+//  Zstandard level of compaction.
+const char kCompactLevel[]		    = "compact-level";
+
 //  Retrieve initial image only.
 const char kDisableUpdate[]		    = "disable-update";
 
@@ -62,6 +125,57 @@ const char kDisableRefresh[]		    = "disable-refresh";
 //  Finish capture when all symbols return a refresh or status close.
 const char kTerminateOnSync[]		    = "terminate-on-sync";
 
+//  Item streams opened or closed per event loop iteration on symbol list reload.
+const char kReloadBatchSize[]		    = "reload-batch-size";
+
+//  Record timestamp source, "realtime" or "tsc".
+const char kClockSource[]		    = "clock-source";
+
+//  Comma separated Marketfeed field names to record, default all.
+const char kFields[]			    = "fields";
+
+//  Record at most one merged update per item per interval in milliseconds.
+const char kConflate[]			    = "conflate";
+
+//  Interval in seconds between checkpoints of every item image.
+const char kCheckpointInterval[]	    = "checkpoint-interval";
+
+//  Interval in milliseconds at which the archive is written through.
+const char kFlushInterval[]		    = "flush-interval";
+
+//  Archive sync to disk, "none", "interval" or "rotate".
+const char kFsyncPolicy[]		    = "fsync-policy";
+
+//  Zstandard dictionary for writing and reading archive blocks.
+const char kDictionaryPath[]		    = "dictionary-path";
+
+//  Extract from the nearest checkpoint at or before this time.
+const char kStartTime[]			    = "start-time";
+
+//  Publish item state to a shared memory region of this name.
+const char kShmCache[]			    = "shm-cache";
+
+//  Maximum fields per item in the shared memory region.
+const char kShmFieldsPerSlot[]		    = "shm-fields-per-slot";
+
+//  Unix domain socket for control requests.
+const char kControlPath[]		    = "control-path";
+
+//  Seconds between performance counter snapshots.
+const char kMetricsInterval[]		    = "metrics-interval";
+
+//  Loopback port serving performance counters to Prometheus.
+const char kMetricsPort[]		    = "metrics-port";
+
+//  File appended with performance counters and rates as JSON lines.
+const char kStatsPath[]			    = "stats-path";
+
+//  Record trace events from startup and write them here at exit.
+const char kTracePath[]			    = "trace-path";
+
+//  Trace events buffered per thread.
+const char kTraceBufferSize[]		    = "trace-buffer-size";
+
 }  // namespace switches
 
 std::list<torikuru::torikuru_t*> torikuru::torikuru_t::global_list_;
@@ -69,15 +183,38 @@ boost::shared_mutex torikuru::torikuru_t::global_list_lock_;
 
 static std::weak_ptr<rfa::common::EventQueue> g_event_queue;
 
+/* Set by SIGHUP to request re-reading the symbol list. */
+static volatile sig_atomic_t g_reload_symbol_list = 0;
+
+static
+void
+on_sighup (
+	int	signum
+	)
+{
+	g_reload_symbol_list = 1;
+}
+
+/* Set by SIGUSR1 to request a histogram dump. */
+static volatile sig_atomic_t g_dump_histograms = 0;
+
+static
+void
+on_sigusr1 (
+	int	signum
+	)
+{
+	g_dump_histograms = 1;
+}
+
 
 using rfa::common::RFA_String;
 
 torikuru::torikuru_t::torikuru_t() :
 	consumers_in_sync_ (0),
-	output_fd_ (-1),
-	output_stream_ (nullptr),
-	gzip_stream_ (nullptr),
-	coded_stream_ (nullptr)
+	inotify_fd_ (-1),
+	is_checkpointing_ (false),
+	checkpoint_next_id_ (0)
 {
 	boost::unique_lock<boost::shared_mutex> (global_list_lock_);
 	global_list_.push_back (this);
@@ -165,6 +302,24 @@ torikuru::torikuru_t::Init ()
 						} else if (key == "position") {
 							session_config.position.assign (url.c_str() + value_range.begin, value_range.len);
 							VLOG(2) << "position: " << session_config.position;
+						} else if (key == "rate") {
+							session_config.sim_rate = std::max (0, std::atoi (std::string (url.c_str() + value_range.begin, value_range.len).c_str()));
+							VLOG(2) << "rate: " << session_config.sim_rate;
+						} else if (key == "symbols") {
+							session_config.sim_symbol_count = std::max (1, std::atoi (std::string (url.c_str() + value_range.begin, value_range.len).c_str()));
+							VLOG(2) << "symbols: " << session_config.sim_symbol_count;
+						} else if (key == "fields") {
+							session_config.sim_field_count = std::max (1, std::atoi (std::string (url.c_str() + value_range.begin, value_range.len).c_str()));
+							VLOG(2) << "fields: " << session_config.sim_field_count;
+						} else if (key == "update-ratio") {
+							session_config.sim_update_ratio = std::atof (std::string (url.c_str() + value_range.begin, value_range.len).c_str());
+							VLOG(2) << "update-ratio: " << session_config.sim_update_ratio;
+						} else if (key == "seed") {
+							session_config.sim_seed = static_cast<unsigned> (std::atoi (std::string (url.c_str() + value_range.begin, value_range.len).c_str()));
+							VLOG(2) << "seed: " << session_config.sim_seed;
+						} else if (key == "replay") {
+							session_config.sim_replay_path.assign (url.c_str() + value_range.begin, value_range.len);
+							VLOG(2) << "replay: " << session_config.sim_replay_path;
 						}
 					}
 				}
@@ -196,18 +351,131 @@ torikuru::torikuru_t::Init ()
 			config_.disable_refresh = true;
 		if (command_line->HasSwitch (switches::kTerminateOnSync))
 			config_.terminate_on_sync = true;
+/* Symbol list reload pacing */
+		if (command_line->HasSwitch (switches::kReloadBatchSize))
+			config_.reload_batch_size = std::max (1, std::atoi (command_line->GetSwitchValueASCII (switches::kReloadBatchSize).c_str()));
+/* Capture projection */
+		if (command_line->HasSwitch (switches::kFields)) {
+			std::vector<std::string> fields;
+			chromium::SplitString (command_line->GetSwitchValueASCII (switches::kFields), ',', &fields);
+			for (auto& field : fields) {
+				if (!field.empty())
+					config_.fields.emplace_back (field);
+			}
+		}
+		if (command_line->HasSwitch (switches::kConflate))
+			config_.conflate_interval = std::max (0, std::atoi (command_line->GetSwitchValueASCII (switches::kConflate).c_str()));
+/* Checkpoints */
+		if (command_line->HasSwitch (switches::kCheckpointInterval))
+			config_.checkpoint_interval = std::max (0, std::atoi (command_line->GetSwitchValueASCII (switches::kCheckpointInterval).c_str()));
+		if (command_line->HasSwitch (switches::kFlushInterval))
+			config_.flush_interval = std::max (0, std::atoi (command_line->GetSwitchValueASCII (switches::kFlushInterval).c_str()));
+		if (command_line->HasSwitch (switches::kFsyncPolicy))
+			config_.fsync_policy = command_line->GetSwitchValueASCII (switches::kFsyncPolicy);
+		if (command_line->HasSwitch (switches::kDictionaryPath))
+			config_.dictionary_path = command_line->GetSwitchValueASCII (switches::kDictionaryPath);
+		if (command_line->HasSwitch (switches::kStartTime))
+			config_.start_time = command_line->GetSwitchValueASCII (switches::kStartTime);
+/* Shared memory cache */
+		if (command_line->HasSwitch (switches::kShmCache))
+			config_.shm_cache = command_line->GetSwitchValueASCII (switches::kShmCache);
+		if (command_line->HasSwitch (switches::kShmFieldsPerSlot))
+			config_.shm_fields_per_slot = std::max (1, std::atoi (command_line->GetSwitchValueASCII (switches::kShmFieldsPerSlot).c_str()));
+/* Control socket */
+		if (command_line->HasSwitch (switches::kControlPath))
+			config_.control_path = command_line->GetSwitchValueASCII (switches::kControlPath);
+/* Performance counters */
+		if (command_line->HasSwitch (switches::kMetricsInterval))
+			config_.metrics_interval = std::max (1, std::atoi (command_line->GetSwitchValueASCII (switches::kMetricsInterval).c_str()));
+		if (command_line->HasSwitch (switches::kMetricsPort))
+			config_.metrics_port = std::atoi (command_line->GetSwitchValueASCII (switches::kMetricsPort).c_str());
+		if (command_line->HasSwitch (switches::kStatsPath))
+			config_.stats_path = command_line->GetSwitchValueASCII (switches::kStatsPath);
+/* Tracing */
+		if (command_line->HasSwitch (switches::kTracePath))
+			config_.trace_path = command_line->GetSwitchValueASCII (switches::kTracePath);
+		if (command_line->HasSwitch (switches::kTraceBufferSize))
+			config_.trace_buffer_size = std::max (1, std::atoi (command_line->GetSwitchValueASCII (switches::kTraceBufferSize).c_str()));
 /* Output stream */
 		if (command_line->HasSwitch (switches::kOutputPath))
 			config_.output_path = command_line->GetSwitchValueASCII (switches::kOutputPath);
+		if (command_line->HasSwitch (switches::kCsvPath))
+			config_.csv_path = command_line->GetSwitchValueASCII (switches::kCsvPath);
+		if (command_line->HasSwitch (switches::kCsvFields)) {
+			std::vector<std::string> fields;
+			chromium::SplitString (command_line->GetSwitchValueASCII (switches::kCsvFields), ',', &fields);
+			for (auto& field : fields) {
+				if (!field.empty())
+					config_.csv_fields.emplace_back (field);
+			}
+		}
 /* Input stream */
 		if (command_line->HasSwitch (switches::kInputPath))
 			config_.input_path = command_line->GetSwitchValueASCII (switches::kInputPath);
+		if (command_line->HasSwitch (switches::kFollow))
+			config_.follow = true;
+		if (command_line->HasSwitch (switches::kReplay))
+			config_.replay_endpoint = command_line->GetSwitchValueASCII (switches::kReplay);
+		if (command_line->HasSwitch (switches::kReplaySpeed))
+			config_.replay_speed = std::max (0.0, std::atof (command_line->GetSwitchValueASCII (switches::kReplaySpeed).c_str()));
+		if (command_line->HasSwitch (switches::kInspect))
+			config_.inspect = true;
+		if (command_line->HasSwitch (switches::kInspectTop))
+			config_.inspect_top = std::max (1, std::atoi (command_line->GetSwitchValueASCII (switches::kInspectTop).c_str()));
+		if (command_line->HasSwitch (switches::kCompact))
+			config_.compact = true;
+		if (command_line->HasSwitch (switches::kCompactLevel))
+			config_.compact_level = std::max (1, std::atoi (command_line->GetSwitchValueASCII (switches::kCompactLevel).c_str()));
 /* Run-time limit */
 		if (command_line->HasSwitch (switches::kTimeLimit))
 			config_.time_limit = command_line->GetSwitchValueASCII (switches::kTimeLimit);
+/* Timestamps */
+		if (command_line->HasSwitch (switches::kClockSource))
+			config_.clock_source = command_line->GetSwitchValueASCII (switches::kClockSource);
 
 		LOG(INFO) << config_;
 
+/* Clock service */
+		if (config_.clock_source != "realtime" && config_.clock_source != "tsc") {
+			LOG(ERROR) << "Unsupported clock source \"" << config_.clock_source << "\".";
+			return false;
+		}
+		clock_service_t::Init (config_.clock_source == "tsc");
+
+/* Offline modes, without input files would otherwise start capturing. */
+		if (config_.inspect || config_.compact) {
+			std::vector<std::string> paths;
+			chromium::SplitString (config_.input_path, ',', &paths);
+			if (paths.end() == std::find_if (paths.begin(), paths.end(), [] (const std::string& path) { return !path.empty(); })) {
+				LOG(ERROR) << (config_.inspect ? "--inspect" : "--compact") << " requires archives in --input-path.";
+				return false;
+			}
+		}
+
+/* Archive durability */
+		fsync_policy_t fsync_policy = FSYNC_NONE;
+		if (config_.fsync_policy == "interval") {
+			fsync_policy = FSYNC_INTERVAL;
+		} else if (config_.fsync_policy == "rotate") {
+			fsync_policy = FSYNC_ROTATE;
+		} else if (config_.fsync_policy != "none") {
+			LOG(ERROR) << "Unsupported fsync policy \"" << config_.fsync_policy << "\".";
+			return false;
+		}
+
+/* Archive compression dictionary */
+		if (!config_.dictionary_path.empty() &&
+		    !file_util::ReadFileToString (config_.dictionary_path, &dictionary_))
+		{
+			LOG(ERROR) << "Cannot read dictionary \"" << config_.dictionary_path << "\".";
+			return false;
+		}
+
+/* Tracing uses the clock service for timestamps. */
+		trace_t::SetThreadName ("main");
+		if (!config_.trace_path.empty())
+			trace_t::Start (config_.trace_buffer_size);
+
 /* RFA context. */
 		rfa_.reset (new rfa_t (config_));
 		if (!(bool)rfa_ || !rfa_->Init())
@@ -230,21 +498,31 @@ torikuru::torikuru_t::Init ()
 		{
 /* Archive stream */
 			if (!config_.output_path.empty()) {
-				LOG(INFO) << "Appending to output file \"" << config_.output_path << "\".";
-				output_fd_ = open (config_.output_path.c_str(),
-						O_WRONLY | O_CREAT | O_TRUNC | O_LARGEFILE,
-						S_IREAD | S_IWRITE);
-				if (-1 == output_fd_) {
-					LOG(ERROR) << "Failed to open file \"" << config_.output_path << "\".";
+				LOG(INFO) << "Writing output file \"" << config_.output_path << "\", replacing any existing content.";
+				writer_.reset (new archive_writer_t());
+/* With a dictionary Zstandard at its fastest level replaces zlib. */
+				if (!dictionary_.empty()) {
+					writer_->set_codec (ARCHIVE_CODEC_ZSTD);
+					writer_->set_dictionary (dictionary_);
+				}
+				if (!writer_->Open (config_.output_path, 1 /* best speed */) ||
+				    !writer_->Start (config_.flush_interval, fsync_policy))
+					return false;
+			}
+/* Inline extraction, columns given apart from --fields which projects what is
+ * recorded.  Columns outside a projection stay blank.
+ */
+			if (!config_.csv_path.empty()) {
+				if (config_.csv_fields.empty()) {
+					LOG(ERROR) << "Exporting during capture requires the column list in --csv-fields.";
 					return false;
 				}
-				output_stream_ = new google::protobuf::io::FileOutputStream (output_fd_);
-				google::protobuf::io::GzipOutputStream::Options options;
-				options.format = google::protobuf::io::GzipOutputStream::ZLIB;
-				options.compression_level = 1;	/* best speed */
-				gzip_stream_ = new google::protobuf::io::GzipOutputStream (output_stream_, options);
-				coded_stream_ = new google::protobuf::io::CodedOutputStream (gzip_stream_);
-//				coded_stream_ = new google::protobuf::io::CodedOutputStream (output_stream_);
+				std::vector<std::string> services;
+				for (const auto& session_config : config_.sessions)
+					services.emplace_back (session_config.service_name);
+				etl_.reset (new etl_stage_t());
+				if (!etl_->Start (config_.csv_path, services, config_.csv_fields))
+					return false;
 			}
 /* Prepare for sync state */
 			std::function<void()> f0 = [this] {
@@ -258,30 +536,105 @@ torikuru::torikuru_t::Init ()
 			};
 
 /* RFA consumer. */
+			std::unordered_set<std::string> shm_names;
 			for (const auto& session_config : config_.sessions) {
-				auto consumer = std::make_shared<consumer_t> (session_config, rfa_, event_queue_, coded_stream_);
+				auto consumer = std::make_shared<consumer_t> (session_config, rfa_, event_queue_, writer_.get());
+				if ((bool)consumer) {
+					consumer->SetFieldProjection (config_.fields);
+					consumer->SetConflation (config_.conflate_interval > 0);
+					consumer->SetImageCache (config_.checkpoint_interval > 0);
+					consumer->SetExtraction (etl_.get());
+				}
+				if ((bool)consumer && !config_.shm_cache.empty()) {
+					std::vector<std::string> subst;
+					subst.emplace_back (session_config.service_name);
+					const std::string name = ReplaceStringPlaceholders (config_.shm_cache, subst, nullptr);
+/* Regions are truncated on create, sessions must not share one. */
+					if (!shm_names.emplace (name).second) {
+						LOG(ERROR) << "Shared cache \"" << name << "\" of service \"" << session_config.service_name << "\" is already used by another session, include $1 in --shm-cache.";
+						return false;
+					}
+/* Headroom for symbol list reloads, item ids are recycled. */
+					const uint32_t slot_count = std::max (static_cast<uint32_t> (config_.instruments.size() * 2), kMinimumShmSlotCount);
+					if (!consumer->SetSharedCache (name, slot_count, config_.shm_fields_per_slot))
+						LOG(WARNING) << "Continuing without shared cache \"" << name << "\".";
+				}
 				if (!(bool)consumer || !consumer->Init (config_.disable_update, config_.disable_refresh, !config_.terminate_on_sync, f0))
 					return false;
 				consumers_.emplace_back (consumer);
+/* Simulated event source in place of a RFA session. */
+				if (LowerCaseEqualsASCII (session_config.protocol, connections::kSIM)) {
+					std::unique_ptr<simulator_t> simulator (new simulator_t (session_config, consumer));
+					if (!simulator->Init (config_.instruments, dictionary_))
+						return false;
+					simulators_.emplace_back (std::move (simulator));
+				}
 			}
 
 /* Create state for subscribed RIC. */
+			for (auto& consumer : consumers_)
+				consumer->ReserveItemStreams (config_.instruments.size());
 			for (const auto& instrument : config_.instruments) {
 				for (auto& consumer : consumers_) {
-					auto stream = std::make_shared<subscription_stream_t> ();
-					if (!(bool)stream)
-						return false;
-					if (consumer->CreateItemStream (instrument.c_str(), stream))
-						streams_.emplace_back (stream);
-					else
+					if (!consumer->CreateItemStream (instrument.c_str()))
 						LOG(WARNING) << "Cannot create stream for \"" << instrument << "\".";
 				}
 				VLOG(1) << instrument;
 			}
+			{
+				size_t items = 0, bytes = 0;
+				for (const auto& consumer : consumers_) {
+					items += consumer->GetItemStreamCount();
+					bytes += consumer->GetDirectoryMemoryUsage();
+				}
+				LOG(INFO) << "Item directory: { "
+					  "\"items\": " << items <<
+					", \"bytes\": " << bytes <<
+					", \"bytesPerItem\": " << (items > 0 ? bytes / items : 0) <<
+					" }";
+			}
 
 /* Submit subscriptions */
 			for (auto consumer : consumers_)
 				consumer->Resubscribe();
+
+/* Follow changes to the symbol list */
+			if (!config_.symbol_path.empty()) {
+				symbol_set_.insert (config_.instruments.begin(), config_.instruments.end());
+				if (!WatchSymbolList())
+					LOG(WARNING) << "Symbol list changes will only be applied on SIGHUP.";
+			}
+
+/* Latency histogram dump on demand */
+			struct sigaction sa;
+			memset (&sa, 0, sizeof (sa));
+			sa.sa_handler = on_sigusr1;
+			sigemptyset (&sa.sa_mask);
+			sa.sa_flags = SA_RESTART;
+			if (-1 == sigaction (SIGUSR1, &sa, nullptr))
+				LOG(WARNING) << "sigaction: " << safe_strerror (errno);
+
+/* Local control socket */
+			if (!config_.control_path.empty()) {
+				control_.reset (new control_server_t());
+				if (!control_->Open (config_.control_path)) {
+					LOG(WARNING) << "Continuing without control socket.";
+					control_.reset();
+				}
+			}
+
+/* Performance counter export */
+			if (config_.metrics_port > 0 || !config_.stats_path.empty()) {
+				metrics_.reset (new metrics_t());
+				for (const auto& consumer : consumers_)
+					metrics_->AddSource (consumer->GetServiceName(), consumer->GetCumulativeStats(), CONSUMER_PC_MAX, &consumer_t::GetCounterName);
+				if ((bool)writer_)
+					metrics_->AddSource ("archive", writer_->GetCumulativeStats(), WRITER_PC_MAX, &archive_writer_t::GetCounterName);
+				if (!metrics_->Start (config_.metrics_interval, config_.metrics_port, config_.stats_path)) {
+					LOG(WARNING) << "Continuing without metrics export.";
+					metrics_.reset();
+				}
+			}
 		}
 
 	} catch (const rfa::common::InvalidUsageException& e) {
@@ -322,46 +675,520 @@ torikuru::torikuru_t::Run()
 		return EXIT_FAILURE;
 	}
 
+	int rc = EXIT_SUCCESS;
 	if (config_.input_path.empty()) {
 		LOG(INFO) << "Init complete, entering main loop.";
 		MainLoop();
 		LOG(INFO) << "Main loop terminated.";
+	} else if (config_.inspect) {
+		LOG(INFO) << "Init complete, inspecting pre-recorded streams.";
+		if (!Inspect())
+			rc = EXIT_FAILURE;
+		LOG(INFO) << "Inspection complete.";
+	} else if (config_.compact) {
+		LOG(INFO) << "Init complete, compacting pre-recorded streams.";
+		if (!Compact())
+			rc = EXIT_FAILURE;
+		LOG(INFO) << "Compaction complete.";
+	} else if (!config_.replay_endpoint.empty()) {
+		LOG(INFO) << "Init complete, replaying pre-recorded stream.";
+		Replay();
+		LOG(INFO) << "Replay complete.";
 	} else {
 		LOG(INFO) << "Init complete, procesing pre-recorded stream.";
 		Convert();
 		LOG(INFO) << "Processing complete.";
 	}
 	Clear();
-	return EXIT_SUCCESS;
+	return rc;
 }
 
+/* Events are dispatched in bursts between clock updates so that per-item
+ * bookkeeping reads the coarse clock instead of the system clock.
+ */
 void
 torikuru::torikuru_t::MainLoop()
 {
-	time_t now = time (nullptr);
+	clock_service_t::Update();
+	time_t now = clock_service_t::coarse_time();
 	time_t start_time = now;
 	time_t end_time = start_time + std::atoi (config_.time_limit.c_str());
+/* Wait no longer than the conflation interval for events. */
+	const long timeout = (config_.conflate_interval > 0) ? std::min (100L, static_cast<long> (config_.conflate_interval)) : 100L;
+	uint32_t last_flush = clock_service_t::coarse_milliseconds();
+	uint32_t last_checkpoint = clock_service_t::coarse_seconds();
 	while (event_queue_->isActive() && (now < end_time || end_time == start_time)) {
-		event_queue_->dispatch (100);
-		now = time (nullptr);
+/* ... or until the next simulated event is due. */
+		long wait = timeout;
+		for (const auto& simulator : simulators_)
+			wait = std::min (wait, simulator->GetWaitMs());
+		long remaining = event_queue_->dispatch (wait);
+/* The first dispatch includes idle wait, trace only the burst. */
+		if (remaining > 0) {
+			TRACE_EVENT("MainLoop.DispatchBurst");
+			for (unsigned burst = 1; remaining > 0 && burst < kMaxDispatchBurst; ++burst)
+				remaining = event_queue_->dispatch (rfa::common::Dispatchable::NoWait);
+		}
+		if (!simulators_.empty()) {
+			size_t done_count = 0;
+			for (auto& simulator : simulators_) {
+				simulator->Dispatch (kMaxDispatchBurst);
+				if (simulator->is_done())
+					++done_count;
+			}
+			if (done_count == simulators_.size()) {
+				LOG(INFO) << "All replays complete.";
+				break;
+			}
+		}
+		clock_service_t::Update();
+		if (config_.conflate_interval > 0 &&
+		    clock_service_t::coarse_milliseconds() - last_flush >= config_.conflate_interval)
+		{
+			TRACE_EVENT("MainLoop.FlushConflated");
+			for (auto& consumer : consumers_)
+				consumer->FlushConflatedUpdates();
+			last_flush = clock_service_t::coarse_milliseconds();
+		}
+		if (config_.checkpoint_interval > 0 && !is_checkpointing_ &&
+		    clock_service_t::coarse_seconds() - last_checkpoint >= config_.checkpoint_interval)
+		{
+			BeginCheckpoint();
+			last_checkpoint = clock_service_t::coarse_seconds();
+		}
+		if (is_checkpointing_) {
+			TRACE_EVENT("MainLoop.Checkpoint");
+			ContinueCheckpoint();
+		}
+		{
+			TRACE_EVENT("MainLoop.SymbolList");
+			CheckSymbolList();
+			ProcessPendingSymbols();
+		}
+		if (0 != g_dump_histograms) {
+			g_dump_histograms = 0;
+			DumpHistograms ("");
+		}
+		if ((bool)control_) {
+			TRACE_EVENT("MainLoop.Control");
+			control_->ProcessRequests (std::bind (&torikuru_t::OnControlRequest, this, std::placeholders::_1));
+		}
+		now = clock_service_t::coarse_time();
+	}
+
+/* Record updates still pending. */
+	if (config_.conflate_interval > 0) {
+		for (auto& consumer : consumers_)
+			consumer->FlushConflatedUpdates();
 	}
 
 	if (end_time != start_time)
 		LOG(INFO) << "Configured runtime elapsed, terminating ...";
 }
 
+/* Start a new archive segment with images of every item so that readers
+ * need not replay from the start of the file.  Pending conflated updates
+ * are recorded first as they are already reflected in the cache.
+ */
+void
+torikuru::torikuru_t::BeginCheckpoint()
+{
+	if (!(bool)writer_)
+		return;
+	for (auto& consumer : consumers_)
+		consumer->FlushConflatedUpdates();
+	struct timespec ts;
+	clock_service_t::GetRealTime (&ts);
+	if (!writer_->BeginSegment (ts.tv_sec))
+		return;
+	is_checkpointing_ = true;
+	checkpoint_consumer_ = consumers_.begin();
+	checkpoint_next_id_ = 0;
+}
+
+/* Images are spread over event loop iterations so that large directories
+ * do not stall dispatch, updates recorded in between are already in the
+ * cache of items not yet imaged.
+ */
+void
+torikuru::torikuru_t::ContinueCheckpoint()
+{
+	struct timespec ts;
+	clock_service_t::GetRealTime (&ts);
+	unsigned budget = kCheckpointBudget;
+	while (consumers_.end() != checkpoint_consumer_) {
+		if (!(*checkpoint_consumer_)->WriteCheckpoint (ts, &checkpoint_next_id_, &budget))
+			return;
+		++checkpoint_consumer_;
+		checkpoint_next_id_ = 0;
+	}
+	is_checkpointing_ = false;
+	VLOG(1) << "Checkpoint " << writer_->segment_count() << " written.";
+}
+
+static
+std::string
+JsonEscape (
+	const std::string& str
+	)
+{
+	std::string escaped;
+	escaped.reserve (str.size());
+	for (const char c : str) {
+		if ('"' == c || '\\' == c) {
+			escaped.push_back ('\\');
+			escaped.push_back (c);
+		} else if (static_cast<unsigned char> (c) < 0x20) {
+			escaped.append (chromium::StringPrintf ("\\u%04x", c));
+		} else {
+			escaped.push_back (c);
+		}
+	}
+	return escaped;
+}
+
+/* Control requests are a command word and optional argument, e.g.
+ * "item VOD.L", responses are one JSON object per line.
+ */
+std::string
+torikuru::torikuru_t::OnControlRequest (
+	const std::string& request
+	)
+{
+	std::string command, argument;
+	const std::string::size_type pos = request.find (' ');
+	command.assign (request, 0, pos);
+	if (std::string::npos != pos)
+		TrimWhitespaceASCII (request.substr (pos + 1), TRIM_ALL, &argument);
+
+	std::ostringstream oss;
+	if ("item" == command) {
+		if (argument.empty())
+			return "{ \"error\": \"item name required\" }";
+		oss << "{ \"item\": \"" << JsonEscape (argument) << "\", \"services\": [";
+		bool is_first = true;
+		for (const auto& consumer : consumers_) {
+			item_stream_t item_stream;
+			if (!consumer->GetItemStream (argument, &item_stream))
+				continue;
+			oss << (is_first ? " " : ", ") << "{ "
+				  "\"service\": \"" << JsonEscape (consumer->GetServiceName()) << "\""
+				", \"isClosed\": " << (item_stream.is_closed ? "true" : "false") <<
+				", \"msgCount\": " << item_stream.msg_count <<
+				", \"refreshReceived\": " << item_stream.refresh_received <<
+				", \"statusReceived\": " << item_stream.status_received <<
+				", \"updateReceived\": " << item_stream.update_received <<
+				", \"lastActivity\": " << clock_service_t::ToTime (item_stream.last_activity) <<
+				", \"lastRefresh\": " << (item_stream.refresh_received > 0 ? clock_service_t::ToTime (item_stream.last_refresh) : 0) <<
+				", \"lastUpdate\": " << (item_stream.update_received > 0 ? clock_service_t::ToTime (item_stream.last_update) : 0) <<
+				", \"lastStatus\": " << (item_stream.status_received > 0 ? clock_service_t::ToTime (item_stream.last_status) : 0) <<
+				" }";
+			is_first = false;
+		}
+		oss << " ] }";
+	} else if ("stats" == command) {
+		oss << "{ \"time\": " << clock_service_t::coarse_time() << ", \"services\": [";
+		bool is_first = true;
+		for (const auto& consumer : consumers_) {
+			oss << (is_first ? " " : ", ") << "{ \"service\": \"" << JsonEscape (consumer->GetServiceName()) << "\"";
+			for (unsigned i = 0; i < CONSUMER_PC_MAX; ++i)
+				oss << ", \"" << consumer_t::GetCounterName (i) << "\": " << consumer->GetCumulativeStat (i);
+			oss << " }";
+			is_first = false;
+		}
+		oss << " ] }";
+	} else if ("sync" == command) {
+		oss << "{ \"consumersInSync\": " << consumers_in_sync_ << ", \"services\": [";
+		bool is_first = true;
+		for (const auto& consumer : consumers_) {
+			oss << (is_first ? " " : ", ") << "{ "
+				  "\"service\": \"" << JsonEscape (consumer->GetServiceName()) << "\""
+				", \"items\": " << consumer->GetItemStreamCount() <<
+				", \"refreshed\": " << consumer->GetRefreshCount() <<
+				", \"inSync\": " << (consumer->IsInSync() ? "true" : "false") <<
+				", \"lastActivity\": " << clock_service_t::ToTime (consumer->GetLastActivity()) <<
+				" }";
+			is_first = false;
+		}
+		oss << " ], \"pendingSymbols\": " << pending_symbols_.size() << " }";
+	} else if ("writer" == command) {
+		if (!(bool)writer_)
+			return "{ \"error\": \"not recording\" }";
+		oss << "{ "
+			  "\"records\": " << writer_->record_count() <<
+			", \"bytes\": " << writer_->byte_count() <<
+			", \"compressedBytes\": " << writer_->compressed_byte_count() <<
+			", \"segments\": " << writer_->segment_count() <<
+			", \"queueBytes\": " << writer_->queue_byte_count();
+		for (unsigned i = 0; i < WRITER_PC_MAX; ++i)
+			oss << ", \"" << archive_writer_t::GetCounterName (i) << "\": " << writer_->GetCumulativeStats()[i].load();
+		oss << " }";
+	} else if ("histograms" == command) {
+		std::string graph;
+		chromium::StatisticsRecorder::WriteGraph (argument, &graph);
+		oss << "{ \"histograms\": \"" << JsonEscape (graph) << "\" }";
+	} else if ("trace" == command) {
+/* trace start | stop | write [path] */
+		std::string action, path;
+		const std::string::size_type space = argument.find (' ');
+		action.assign (argument, 0, space);
+		if (std::string::npos != space)
+			TrimWhitespaceASCII (argument.substr (space + 1), TRIM_ALL, &path);
+		if ("start" == action) {
+			trace_t::Start (config_.trace_buffer_size);
+		} else if ("stop" == action) {
+			trace_t::Stop();
+		} else if ("write" == action) {
+			if (path.empty())
+				path = config_.trace_path;
+			if (path.empty())
+				return "{ \"error\": \"trace path required\" }";
+			if (!trace_t::Write (path))
+				return "{ \"error\": \"failed to write trace\" }";
+		} else if (!action.empty()) {
+			return "{ \"error\": \"unknown trace action \\\"" + JsonEscape (action) + "\\\"\" }";
+		}
+		oss << "{ "
+			  "\"enabled\": " << (trace_t::is_enabled() ? "true" : "false") <<
+			", \"events\": " << trace_t::event_count() <<
+			", \"dropped\": " << trace_t::dropped_count() <<
+			" }";
+	} else if ("help" == command) {
+		oss << "{ \"commands\": [ \"item <name>\", \"stats\", \"sync\", \"writer\", \"histograms [query]\", \"trace [start|stop|write [path]]\", \"help\" ] }";
+	} else {
+		oss << "{ \"error\": \"unknown command \\\"" << JsonEscape (command) << "\\\"\" }";
+	}
+	return oss.str();
+}
+
+void
+torikuru::torikuru_t::DumpHistograms (
+	const std::string& query
+	)
+{
+	std::string graph;
+	chromium::StatisticsRecorder::WriteGraph (query, &graph);
+	LOG(INFO) << graph;
+}
+
+/* Reload the symbol list on SIGHUP or when the file is rewritten.  The
+ * parent directory is watched as editors and deployment tools commonly
+ * replace the file by rename.
+ */
+bool
+torikuru::torikuru_t::WatchSymbolList()
+{
+	struct sigaction sa;
+	memset (&sa, 0, sizeof (sa));
+	sa.sa_handler = on_sighup;
+	sigemptyset (&sa.sa_mask);
+	sa.sa_flags = SA_RESTART;
+	if (-1 == sigaction (SIGHUP, &sa, nullptr)) {
+		LOG(WARNING) << "sigaction: " << safe_strerror (errno);
+	}
+
+	const std::string::size_type pos = config_.symbol_path.find_last_of ('/');
+	std::string directory;
+	if (std::string::npos == pos) {
+		directory.assign (".");
+		symbol_file_name_ = config_.symbol_path;
+	} else {
+		directory.assign (config_.symbol_path, 0, 0 == pos ? 1 : pos);
+		symbol_file_name_ = config_.symbol_path.substr (pos + 1);
+	}
+
+/* inotify_init1 is unavailable on RHEL5 kernels. */
+	inotify_fd_ = inotify_init();
+	if (-1 == inotify_fd_) {
+		LOG(WARNING) << "inotify_init: " << safe_strerror (errno);
+		return false;
+	}
+	const int flags = fcntl (inotify_fd_, F_GETFL, 0);
+	if (-1 == flags || -1 == fcntl (inotify_fd_, F_SETFL, flags | O_NONBLOCK)) {
+		LOG(WARNING) << "fcntl: " << safe_strerror (errno);
+		close (inotify_fd_), inotify_fd_ = -1;
+		return false;
+	}
+	if (-1 == inotify_add_watch (inotify_fd_, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO)) {
+		LOG(WARNING) << "inotify_add_watch: " << safe_strerror (errno);
+		close (inotify_fd_), inotify_fd_ = -1;
+		return false;
+	}
+	LOG(INFO) << "Watching symbol list \"" << config_.symbol_path << "\" for changes.";
+	return true;
+}
+
+/* Non-blocking check for a pending reload request.
+ */
+void
+torikuru::torikuru_t::CheckSymbolList()
+{
+	bool is_changed = false;
+	if (0 != g_reload_symbol_list) {
+		g_reload_symbol_list = 0;
+		LOG(INFO) << "SIGHUP received.";
+		is_changed = true;
+	}
+	if (-1 != inotify_fd_) {
+		char buf[4096] __attribute__ ((aligned (__alignof__ (struct inotify_event))));
+		ssize_t len;
+		while ((len = read (inotify_fd_, buf, sizeof (buf))) > 0) {
+			for (const char* p = buf; p < buf + len; ) {
+				const struct inotify_event* event = reinterpret_cast<const struct inotify_event*> (p);
+				if (event->len > 0 && symbol_file_name_ == event->name)
+					is_changed = true;
+				p += sizeof (struct inotify_event) + event->len;
+			}
+		}
+	}
+	if (is_changed && !config_.symbol_path.empty())
+		ReloadSymbolList();
+}
+
+/* Diff the new symbol list against each consumer directory and queue the
+ * differences for paced processing.  Symbols in both are left untouched.
+ */
+bool
+torikuru::torikuru_t::ReloadSymbolList()
+{
+	LOG(INFO) << "Reloading symbol list \"" << config_.symbol_path << "\".";
+	std::string contents;
+	if (!file_util::ReadFileToString (config_.symbol_path, &contents)) {
+		LOG(WARNING) << "Failed to read symbol list, retaining current subscriptions.";
+		return false;
+	}
+	std::vector<std::string> instruments;
+	chromium::SplitStringAlongWhitespace (contents, &instruments);
+/* A truncated file is more likely a partial write than intent. */
+	if (instruments.empty()) {
+		LOG(WARNING) << "Symbol list is empty, retaining current subscriptions.";
+		return false;
+	}
+	std::unordered_set<std::string> symbol_set (instruments.begin(), instruments.end());
+
+	std::unordered_set<std::string> changed;
+	std::vector<std::string> names;
+	for (const auto& consumer : consumers_) {
+		names.clear();
+		consumer->GetItemNames (&names);
+		for (const auto& name : names)
+			if (symbol_set.end() == symbol_set.find (name))
+				changed.emplace (name);
+		for (const auto& name : symbol_set)
+			if (!consumer->HasItemStream (name))
+				changed.emplace (name);
+	}
+
+	unsigned additions = 0, removals = 0;
+	for (const auto& name : changed)
+		if (symbol_set.end() != symbol_set.find (name))
+			++additions;
+		else
+			++removals;
+	LOG(INFO) << "Symbol list contains " << symbol_set.size() << " symbols, "
+		<< additions << " to open and " << removals << " to close.";
+
+	pending_symbols_.assign (changed.begin(), changed.end());
+	symbol_set_.swap (symbol_set);
+	config_.instruments.swap (instruments);
+	return true;
+}
+
+/* Open or close at most reload_batch_size item streams so that a large list
+ * change does not monopolise the event loop.  Each symbol is re-evaluated
+ * against the active set so repeated reloads converge.
+ */
+void
+torikuru::torikuru_t::ProcessPendingSymbols()
+{
+	if (pending_symbols_.empty())
+		return;
+
+	unsigned count = 0;
+	try {
+		while (!pending_symbols_.empty() && count < config_.reload_batch_size) {
+			const std::string symbol (pending_symbols_.front());
+			pending_symbols_.pop_front();
+			const bool is_wanted = symbol_set_.end() != symbol_set_.find (symbol);
+			for (auto& consumer : consumers_) {
+				const bool is_open = consumer->HasItemStream (symbol);
+				if (is_wanted && !is_open) {
+					if (!consumer->CreateItemStream (symbol.c_str()))
+						LOG(WARNING) << "Cannot create stream for \"" << symbol << "\".";
+					++count;
+				} else if (!is_wanted && is_open) {
+					consumer->DestroyItemStream (symbol.c_str());
+					++count;
+				}
+			}
+		}
+	} catch (const rfa::common::InvalidUsageException& e) {
+		LOG(ERROR) << "InvalidUsageException: { "
+			  "\"Severity\": \"" << internal::severity_string (e.getSeverity()) << "\""
+			", \"Classification\": \"" << internal::classification_string (e.getClassification()) << "\""
+			", \"StatusText\": \"" << e.getStatus().getStatusText() << "\" }";
+	}
+
+	if (pending_symbols_.empty()) {
+		size_t items = 0, bytes = 0;
+		for (const auto& consumer : consumers_) {
+			items += consumer->GetItemStreamCount();
+			bytes += consumer->GetDirectoryMemoryUsage();
+		}
+		LOG(INFO) << "Symbol list reload complete: { "
+			  "\"items\": " << items <<
+			", \"bytes\": " << bytes <<
+			" }";
+	}
+}
+
+/* Seconds since the epoch or ISO 8601 local time without fraction.
+ */
+static
+bool
+ParseTime (
+	const std::string& str,
+	time_t* tv_sec
+	)
+{
+	if (!str.empty() && str.end() == std::find_if (str.begin(), str.end(), [](char c) { return !isdigit (c); })) {
+		*tv_sec = static_cast<time_t> (std::atol (str.c_str()));
+		return true;
+	}
+	struct tm local_time = {0};
+	const char* end = strptime (str.c_str(), "%Y-%m-%dT%H:%M:%S", &local_time);
+	if (nullptr == end || '\0' != *end)
+		return false;
+	local_time.tm_isdst = -1;
+	*tv_sec = mktime (&local_time);
+	return -1 != *tv_sec;
+}
+
 void
 torikuru::torikuru_t::Convert()
 {
+/* A followed archive cannot be scanned for fields ahead of time. */
+	if (config_.follow && config_.fields.empty()) {
+		LOG(ERROR) << "Following an archive requires the column list in --fields.";
+		return;
+	}
 	LOG(INFO) << "Opening input file \"" << config_.input_path << "\".";
-	int input_fd = open (config_.input_path.c_str(),
-				O_RDONLY | O_LARGEFILE | O_NOATIME);
-	if (-1 == input_fd) {
-		LOG(ERROR) << "Failed to open file \"" << config_.input_path << "\".";
+	archive_reader_t reader;
+	reader.set_following (config_.follow);
+	reader.set_dictionary (dictionary_);
+	if (!reader.Open (config_.input_path))
 		return;
+
+/* Start from the nearest checkpoint. */
+	time_t start_time = 0;
+	if (!config_.start_time.empty()) {
+		if (!ParseTime (config_.start_time, &start_time)) {
+			LOG(ERROR) << "Invalid start time \"" << config_.start_time << "\".";
+			return;
+		}
 	}
 
-	uint32_t size;
+	bool is_valid;
 	archive::Marketfeed mfeed;
 	TibMsg msg;
 	TibField field;
@@ -383,33 +1210,28 @@ torikuru::torikuru_t::Convert()
 			symbol_set.emplace (instrument);
 	}
 
-	std::unordered_map<std::string, int> fid_map;
-	fid_map.emplace (std::string ("service"), 0);
-	fid_map.emplace (std::string ("symbol"), 0);
-	fid_map.emplace (std::string ("time"), 0);
-	fid_map.emplace (std::string ("type"), 0);
+	std::unique_ptr<csv_format_t> format;
 
+	if (config_.follow) {
+		format.reset (new csv_format_t (config_.fields));
+		const std::string header (format->Header());
+		for (const auto& service : service_map)
+			*service.second << header << std::endl;
+	} else {
 /* 1st pass - find unique FIDs */
-	{
-		lseek (input_fd, SEEK_SET, 0);
-		google::protobuf::io::FileInputStream input_stream (input_fd);
-		google::protobuf::io::GzipInputStream gzip_stream (&input_stream);
+		TRACE_EVENT("Convert.ScanFields");
+		reader.Seek (start_time);
+		const size_t start_segment = reader.segment();
 		std::unordered_set<std::string> fids;
 
-		size = 0;
-		while (true) {
-			google::protobuf::io::CodedInputStream coded_stream (&gzip_stream);
-			if (!coded_stream.ReadVarint32 (&size))
-				break;
-			const int limit = coded_stream.PushLimit (size);
-			const bool is_valid = mfeed.ParseFromCodedStream (&coded_stream);
-			coded_stream.PopLimit (limit);
-
+		while (reader.Read (&mfeed, &is_valid)) {
 /* filter on symbol name */
 			if (mfeed.has_item_name() &&
 			    !symbol_set.empty() &&
 			    symbol_set.end() == symbol_set.find (mfeed.item_name()))
 				continue;
+			if (mfeed.has_checkpoint() && mfeed.checkpoint() && start_segment != reader.segment())
+				continue;
 
 			if (is_valid &&
 			    msg.UnPack (const_cast<char*> (mfeed.packed_buffer().c_str()), mfeed.packed_buffer().size()) == TIBMSG_OK)
@@ -422,37 +1244,24 @@ torikuru::torikuru_t::Convert()
 			}
 		}
 
-		std::vector<std::string> columns (fids.size());
-		std::copy (fids.begin(), fids.end(), columns.begin());
-		int i = fid_map.size();
-		for (const auto& column : columns)
-			fid_map.emplace (column, i++);
+		std::vector<std::string> columns (fids.begin(), fids.end());
+		format.reset (new csv_format_t (columns));
 
+		const std::string header (format->Header());
 		for (const auto& service : service_map)
-			*service.second << "service,symbol,time,type," << JoinString (columns, ',') << std::endl;
+			*service.second << header << std::endl;
 		LOG(INFO) << fids.size() << " unique FIDs recorded.";
 	}
 
 /* 2nd pass - output CSVs */
 	{
-		lseek (input_fd, SEEK_SET, 0);
-		google::protobuf::io::FileInputStream input_stream (input_fd);
-		google::protobuf::io::GzipInputStream gzip_stream (&input_stream);
-		char buf[256];
-		timeval tv;
-		struct tm local_time = {0};
-		struct tm* tm_time = &local_time;
+		TRACE_EVENT("Convert.Export");
+		reader.Seek (start_time);
+		const size_t start_segment = reader.segment();
+		std::string row;
 		unsigned i = 0;
 
-		size = 0;
-		while (true) {
-			google::protobuf::io::CodedInputStream coded_stream (&gzip_stream);
-			if (!coded_stream.ReadVarint32 (&size))
-				break;
-			const int limit = coded_stream.PushLimit (size);
-			const bool is_valid = mfeed.ParseFromCodedStream (&coded_stream);
-			coded_stream.PopLimit (limit);
-
+		while (reader.Read (&mfeed, &is_valid)) {
 			LOG_IF(WARNING, mfeed.packed_buffer().size() == 0);
 			LOG_IF(WARNING, mfeed.packed_buffer().size() > 0xffff);
 
@@ -460,6 +1269,11 @@ torikuru::torikuru_t::Convert()
 			    !symbol_set.empty() &&
 			    symbol_set.end() == symbol_set.find (mfeed.item_name()))
 				continue;
+/* Checkpoint images of the start segment are the initial state of an
+ * extraction from --start-time, later ones repeat state already exported.
+ */
+			if (mfeed.has_checkpoint() && mfeed.checkpoint() && start_segment != reader.segment())
+				continue;
 
 			if (is_valid &&
 			    msg.UnPack (const_cast<char*> (mfeed.packed_buffer().c_str()), mfeed.packed_buffer().size()) == TIBMSG_OK)
@@ -476,97 +1290,425 @@ torikuru::torikuru_t::Convert()
 					LOG(WARNING) << "message type is blank";
 					continue;
 				}
-				std::vector<std::string> columns (fid_map.size());
-				columns[0] = mfeed.service_name();
-				columns[1] = mfeed.item_name();
-				{
-					std::ostringstream oss;
-					tv.tv_sec = mfeed.has_tv_sec() ? mfeed.tv_sec() : 0;
-					tv.tv_usec = mfeed.has_tv_usec() ? mfeed.tv_usec() : 0;
-					localtime_r (&tv.tv_sec, &local_time);
-					oss << std::setfill('0')
-				            << std::setw(4) << 1900 + tm_time->tm_year
-				            << '-'
-				            << std::setw(2) << 1 + tm_time->tm_mon
-				            << '-'
-				            << std::setw(2) << tm_time->tm_mday
-				            << 'T'
-				            << std::setw(2) << tm_time->tm_hour
-				            << ':'
-				            << std::setw(2) << tm_time->tm_min
-				            << ':'
-				            << std::setw(2) << tm_time->tm_sec
-				            << '.'
-				            << std::setw(6) << tv.tv_usec;
-					columns[2] = oss.str();
-				}
-				{
-					std::ostringstream oss;
-					oss << mfeed.message_type();
-					columns[3] = oss.str();
-				}
-				for (field.First (&msg); field.status == TIBMSG_OK; field.Next()) { 
-					name.assign (field.Name(), field.NameSize() == 0 ? 0 : strlen (field.Name()));
-			                memset (buf, 0, sizeof (buf));
-			                if (field.Convert (buf, sizeof (buf)) != TIBMSG_OK) continue;
-					const char* p = buf;
-					std::ostringstream oss;
-					bool has_comma = false;
-					while (*p) {
-						if (*p++ == ',') { 
-							has_comma = true;
-							break;
-						}
-					}
-					if (has_comma)
-						oss << '"' << buf << '"';
-					else
-						oss << buf;
-					auto it = fid_map.find (name);
-					if (it != fid_map.end())
-						columns[it->second] = oss.str();
-				}
+				format->FormatRow (mfeed, &msg, &row);
 
 				auto& fs = service_map[mfeed.service_name()];
-				*fs << JoinString (columns, ',') << std::endl;
+				*fs << row << std::endl;
 				++i;
 			}
 		}
 		LOG(INFO) << i << " records recorded.";
+		if (reader.damage_count() > 0) {
+			LOG(WARNING) << "Archive damage: { "
+				  "\"regions\": " << reader.damage_count() <<
+				", \"bytesSkipped\": " << reader.lost_byte_count() <<
+				", \"recordsLost\": " << reader.lost_record_count() <<
+				" }";
+		}
 	}
 }
 
+static
+uint64_t
+MonotonicNs()
+{
+	struct timespec ts;
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+	return static_cast<uint64_t> (ts.tv_sec) * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Last value cache of one replayed service. */
+struct replay_cache_t {
+	torikuru::shm_cache_t cache;
+	torikuru::field_names_t field_names;
+	std::unordered_map<std::string, torikuru::item_id_t> ids;
+};
+
+/* Records are re-emitted at their recorded offset from the first record
+ * divided by the replay speed.  Waits sleep in ppoll() serving subscribers
+ * until shortly before the due time and spin for the remainder, as a sleep
+ * alone wakes tens of microseconds late.  Lateness against the due time is
+ * recorded in Replay.Lateness.
+ */
+void
+torikuru::torikuru_t::Replay()
+{
+	LOG(INFO) << "Opening input file \"" << config_.input_path << "\".";
+	archive_reader_t reader;
+	reader.set_dictionary (dictionary_);
+	if (!reader.Open (config_.input_path))
+		return;
+
+/* Start from the nearest checkpoint. */
+	time_t start_time = 0;
+	if (!config_.start_time.empty()) {
+		if (!ParseTime (config_.start_time, &start_time)) {
+			LOG(ERROR) << "Invalid start time \"" << config_.start_time << "\".";
+			return;
+		}
+	}
+
+	std::unordered_set<std::string> symbol_set (config_.instruments.begin(), config_.instruments.end());
+	bool is_valid;
+	archive::Marketfeed mfeed;
+	TibMsg msg;
+
+/* Size shared caches for every replayed item. */
+	uint32_t slot_count = std::max (static_cast<uint32_t> (symbol_set.size()), kMinimumShmSlotCount);
+	if (!config_.shm_cache.empty() && symbol_set.empty()) {
+		TRACE_EVENT("Replay.ScanItems");
+		std::unordered_set<std::string> items;
+		reader.Seek (start_time);
+		while (reader.Read (&mfeed, &is_valid)) {
+			if (is_valid)
+				items.emplace (mfeed.item_name());
+		}
+		slot_count = std::max (static_cast<uint32_t> (items.size()), kMinimumShmSlotCount);
+	}
+	std::unordered_map<std::string, std::unique_ptr<replay_cache_t>> caches;
+	std::unordered_set<std::string> cache_names;
+
+	replay_server_t server;
+	if (!server.Open (config_.replay_endpoint))
+		return;
+	const bool is_paced = config_.replay_speed > 0;
+/* Unpaced replay runs at the pace of the slowest subscriber. */
+	server.set_blocking (!is_paced);
+
+	LOG(INFO) << "Waiting for a replay subscriber.";
+	const struct timespec no_wait = { 0, 0 }, idle_wait = { 0, 100000000 };
+	while (0 == server.client_count())
+		server.Poll (idle_wait);
+
+	uint64_t count = 0, lateness_sum = 0, max_lateness = 0;
+	uint64_t first_record_ns = 0, last_record_ns = 0;
+	uint64_t start_ns = MonotonicNs(), last_due = 0, last_report = start_ns;
+	bool is_started = false;
+	auto report = [&] (const char* title) {
+		const double seconds = (MonotonicNs() - start_ns) / 1e9;
+		const double span = (last_record_ns - first_record_ns) / 1e9;
+		LOG(INFO) << title << ": { "
+			  "\"records\": " << count <<
+			", \"seconds\": " << seconds <<
+			", \"recordsPerSecond\": " << (seconds > 0 ? static_cast<uint64_t> (count / seconds) : 0) <<
+			", \"targetRecordsPerSecond\": " << (is_paced && span > 0 ? static_cast<uint64_t> (count * config_.replay_speed / span) : 0) <<
+			", \"meanLatenessNs\": " << (is_paced && count > 0 ? lateness_sum / count : 0) <<
+			", \"maxLatenessNs\": " << max_lateness <<
+			", \"subscribers\": " << server.client_count() <<
+			" }";
+	};
+
+	reader.Seek (start_time);
+	const size_t start_segment = reader.segment();
+	while (reader.Read (&mfeed, &is_valid)) {
+		if (!is_valid)
+			continue;
+		if (!symbol_set.empty() &&
+		    symbol_set.end() == symbol_set.find (mfeed.item_name()))
+			continue;
+/* Checkpoint images of the start segment are the initial state and sent
+ * immediately, interleaved with the first updates as captures spread them
+ * out, later checkpoints were synthesized at capture and skipped.
+ */
+		const bool is_checkpoint = mfeed.has_checkpoint() && mfeed.checkpoint();
+		if (is_checkpoint && start_segment != reader.segment())
+			continue;
+		const uint64_t record_ns = static_cast<uint64_t> (mfeed.tv_sec()) * 1000000000ULL
+			+ (mfeed.has_tv_nsec() ? mfeed.tv_nsec() : mfeed.tv_usec() * 1000ULL);
+		if (!is_checkpoint) {
+			if (!is_started) {
+				is_started = true;
+				first_record_ns = record_ns;
+				start_ns = MonotonicNs();
+			}
+/* Records out of time order are sent immediately. */
+			if (is_paced && record_ns > first_record_ns) {
+				const uint64_t due = std::max (last_due, start_ns + static_cast<uint64_t> ((record_ns - first_record_ns) / config_.replay_speed));
+				last_due = due;
+				uint64_t now = MonotonicNs();
+/* Records already queued are due, send them before waiting. */
+				if (now < due)
+					server.FlushClients();
+				while (now + kReplaySpinNs < due) {
+					const uint64_t sleep_ns = due - now - kReplaySpinNs;
+					struct timespec timeout;
+					timeout.tv_sec = static_cast<time_t> (sleep_ns / 1000000000ULL);
+					timeout.tv_nsec = static_cast<long> (sleep_ns % 1000000000ULL);
+					server.Poll (timeout);
+					now = MonotonicNs();
+				}
+				while (now < due) {
+					__builtin_ia32_pause();
+					now = MonotonicNs();
+				}
+				const uint64_t lateness = now - due;
+				lateness_sum += lateness;
+				max_lateness = std::max (max_lateness, lateness);
+				CONCURRENT_HISTOGRAM_CUSTOM_COUNTS("Replay.Lateness",
+					lateness > 0x7fffffffULL ? 0x7fffffff : static_cast<int> (lateness), 1, 1000000000, 64);
+			}
+			last_record_ns = std::max (last_record_ns, record_ns);
+		}
+
+		server.Publish (mfeed);
+		if (!config_.shm_cache.empty() &&
+		    msg.UnPack (const_cast<char*> (mfeed.packed_buffer().c_str()), mfeed.packed_buffer().size()) == TIBMSG_OK)
+		{
+			auto it = caches.find (mfeed.service_name());
+			if (caches.end() == it) {
+				std::vector<std::string> subst;
+				subst.emplace_back (mfeed.service_name());
+				const std::string name = ReplaceStringPlaceholders (config_.shm_cache, subst, nullptr);
+				std::unique_ptr<replay_cache_t> cache (new replay_cache_t());
+				if (!cache_names.emplace (name).second)
+					LOG(WARNING) << "Shared cache \"" << name << "\" is already used by another service, continuing without for service \"" << mfeed.service_name() << "\".";
+				else if (!cache->cache.Create (name, mfeed.service_name(), slot_count, config_.shm_fields_per_slot))
+					LOG(WARNING) << "Continuing without shared cache \"" << name << "\".";
+				it = caches.emplace (mfeed.service_name(), std::move (cache)).first;
+			}
+			replay_cache_t& cache = *it->second;
+			const item_id_t id = cache.ids.emplace (mfeed.item_name(), static_cast<item_id_t> (cache.ids.size())).first->second;
+			struct timespec ts;
+			ts.tv_sec = static_cast<time_t> (record_ns / 1000000000ULL);
+			ts.tv_nsec = static_cast<long> (record_ns % 1000000000ULL);
+			cache.cache.Publish (id, mfeed.item_name().c_str(), mfeed.message_type(), ts, &msg, &cache.field_names,
+					     rfa::sessionLayer::MarketDataItemEvent::Image == mfeed.message_type());
+		}
+		if (0 == ++count % kReplayPollInterval) {
+			server.Poll (no_wait);
+			const uint64_t now = MonotonicNs();
+			if (now - last_report >= kReplayReportInterval * 1000000000ULL) {
+				report ("Replay progress");
+				last_report = now;
+			}
+		}
+	}
+	report ("Replay");
+}
+
+static
+std::string
+FormatInspectStats (
+	const std::string& path,
+	const torikuru::archive_stats_t& stats,
+	unsigned top_count
+	)
+{
+	std::ostringstream oss;
+	oss << "{ "
+		"\"path\": \"" << JsonEscape (path) << "\""
+		", \"files\": " << stats.file_count <<
+		", \"legacyFiles\": " << stats.legacy_count <<
+		", \"records\": " << stats.record_count <<
+		", \"invalid\": " << stats.invalid_count <<
+		", \"checkpoints\": " << stats.checkpoint_count <<
+		", \"messageTypes\": {";
+	bool is_first = true;
+	for (const auto& message_type : stats.message_types) {
+		const char* name = torikuru::MessageTypeName (message_type.first);
+		oss << (is_first ? " " : ", ") << "\"";
+		if (nullptr != name)
+			oss << name;
+		else
+			oss << message_type.first;
+		oss << "\": " << message_type.second;
+		is_first = false;
+	}
+	oss << " }, \"services\": {";
+	is_first = true;
+	for (const auto& service : stats.services) {
+		oss << (is_first ? " " : ", ") << "\"" << JsonEscape (service.first) << "\": " << service.second;
+		is_first = false;
+	}
+	oss << " }, \"symbols\": " << stats.symbols.size();
+	const double span = stats.record_count > 0 ? (stats.last_ns - stats.first_ns) / 1e9 : 0.0;
+	if (stats.record_count > 0) {
+		oss << ", \"firstTime\": " << chromium::StringPrintf ("%" PRIu64 ".%09" PRIu64, stats.first_ns / 1000000000ULL, stats.first_ns % 1000000000ULL)
+		    << ", \"lastTime\": " << chromium::StringPrintf ("%" PRIu64 ".%09" PRIu64, stats.last_ns / 1000000000ULL, stats.last_ns % 1000000000ULL);
+	}
+	oss << ", \"spanSeconds\": " << span <<
+		", \"topSymbols\": [";
+	is_first = true;
+	for (const auto& symbol : stats.TopSymbols (top_count)) {
+		oss << (is_first ? " " : ", ") << "{ "
+			"\"service\": \"" << JsonEscape (symbol.first.first) << "\""
+			", \"symbol\": \"" << JsonEscape (symbol.first.second) << "\""
+			", \"records\": " << symbol.second.record_count <<
+			", \"ratePerSecond\": " << (span > 0 ? symbol.second.record_count / span : 0.0) <<
+			", \"peakPerSecond\": " << symbol.second.peak_count <<
+			" }";
+		is_first = false;
+	}
+	oss << " ], \"payloadBytes\": { "
+		"\"min\": " << stats.PayloadPercentile (0.0) <<
+		", \"p50\": " << stats.PayloadPercentile (0.5) <<
+		", \"p90\": " << stats.PayloadPercentile (0.9) <<
+		", \"p99\": " << stats.PayloadPercentile (0.99) <<
+		", \"max\": " << stats.PayloadPercentile (1.0) <<
+		", \"mean\": " << (stats.record_count > 0 ? static_cast<double> (stats.payload_bytes) / stats.record_count : 0.0) <<
+		" }"
+		", \"fileBytes\": " << stats.file_bytes <<
+		", \"uncompressedBytes\": " << stats.uncompressed_bytes <<
+		", \"compressionRatio\": " << (stats.file_bytes > 0 ? static_cast<double> (stats.uncompressed_bytes) / stats.file_bytes : 0.0) <<
+		", \"damage\": { "
+			"\"regions\": " << stats.damage_count <<
+			", \"bytesSkipped\": " << stats.lost_byte_count <<
+			", \"recordsLost\": " << stats.lost_record_count <<
+		" }"
+		", \"scanSeconds\": " << stats.scan_seconds <<
+		", \"megabytesPerSecond\": " << (stats.scan_seconds > 0 ? stats.uncompressed_bytes / stats.scan_seconds / (1024 * 1024) : 0.0) <<
+		" }";
+	return oss.str();
+}
+
+/* Each archive is scanned whole by one thread, as blocks of a legacy archive
+ * cannot be found without decompressing everything before them.  Statistics
+ * per file are merged for the total.
+ */
+bool
+torikuru::torikuru_t::Inspect()
+{
+	std::vector<std::string> paths;
+	chromium::SplitString (config_.input_path, ',', &paths);
+	paths.erase (std::remove (paths.begin(), paths.end(), std::string()), paths.end());
+	if (paths.empty()) {
+		LOG(ERROR) << "No input files to inspect.";
+		return false;
+	}
+
+	std::vector<archive_stats_t> stats (paths.size());
+	std::unique_ptr<bool[]> is_open (new bool[paths.size()]());
+	std::atomic<size_t> next (0);
+	const size_t thread_count = std::min<size_t> (paths.size(), std::max (1u, boost::thread::hardware_concurrency()));
+	LOG(INFO) << "Inspecting " << paths.size() << " files on " << thread_count << " threads.";
+	boost::thread_group threads;
+	for (size_t i = 0; i < thread_count; ++i) {
+		threads.create_thread ([&]() {
+			for (size_t file = next++; file < paths.size(); file = next++)
+				is_open[file] = InspectArchive (paths[file], dictionary_, &stats[file]);
+		});
+	}
+	threads.join_all();
+
+	bool is_intact = true;
+	archive_stats_t total;
+	for (size_t file = 0; file < paths.size(); ++file) {
+		if (!is_open[file]) {
+			LOG(ERROR) << "Cannot inspect \"" << paths[file] << "\".";
+			is_intact = false;
+			continue;
+		}
+		LOG(INFO) << "Inspect: " << FormatInspectStats (paths[file], stats[file], config_.inspect_top);
+		if (stats[file].damage_count > 0 || stats[file].invalid_count > 0)
+			is_intact = false;
+		total.Merge (stats[file]);
+	}
+	if (paths.size() > 1)
+		LOG(INFO) << "Inspect total: " << FormatInspectStats ("", total, config_.inspect_top);
+	return is_intact;
+}
+
+/* Archives are compacted whole, one per thread at idle priority, so that
+ * capture on the same host keeps the CPU and disk.
+ */
+bool
+torikuru::torikuru_t::Compact()
+{
+	std::vector<std::string> paths;
+	chromium::SplitString (config_.input_path, ',', &paths);
+	paths.erase (std::remove (paths.begin(), paths.end(), std::string()), paths.end());
+	if (paths.empty()) {
+		LOG(ERROR) << "No input files to compact.";
+		return false;
+	}
+
+	std::vector<compact_result_t> results (paths.size());
+	std::unique_ptr<bool[]> is_compacted (new bool[paths.size()]());
+	std::atomic<size_t> next (0);
+	const size_t thread_count = std::min<size_t> (paths.size(), std::max (1u, boost::thread::hardware_concurrency()));
+	LOG(INFO) << "Compacting " << paths.size() << " files on " << thread_count << " threads at level " << config_.compact_level << ".";
+	boost::thread_group threads;
+	for (size_t i = 0; i < thread_count; ++i) {
+		threads.create_thread ([&]() {
+			LowerThreadPriority();
+			for (size_t file = next++; file < paths.size(); file = next++)
+				is_compacted[file] = CompactArchive (paths[file], config_.compact_level, dictionary_, &results[file]);
+		});
+	}
+	threads.join_all();
+
+	bool rc = true;
+	int64_t original_bytes = 0, compacted_bytes = 0;
+	for (size_t file = 0; file < paths.size(); ++file) {
+		const compact_result_t& result = results[file];
+		if (!is_compacted[file]) {
+			LOG(ERROR) << "Failed to compact \"" << paths[file] << "\", original kept.";
+			rc = false;
+			continue;
+		}
+		original_bytes += result.original_bytes;
+		compacted_bytes += result.compacted_bytes;
+		if (result.is_skipped)
+			continue;
+		LOG(INFO) << "Compact: { "
+			  "\"path\": \"" << JsonEscape (paths[file]) << "\""
+			", \"records\": " << result.record_count <<
+			", \"segments\": " << result.segment_count <<
+			", \"bytesBefore\": " << result.original_bytes <<
+			", \"bytesAfter\": " << result.compacted_bytes <<
+			", \"ratio\": " << (result.compacted_bytes > 0 ? static_cast<double> (result.original_bytes) / result.compacted_bytes : 0.0) <<
+			", \"compactSeconds\": " << result.compact_seconds <<
+			", \"verifySeconds\": " << result.verify_seconds <<
+			" }";
+	}
+	LOG(INFO) << "Compacted " << original_bytes << " bytes to " << compacted_bytes << " bytes.";
+	return rc;
+}
+
 void
 torikuru::torikuru_t::Clear()
 {
-/* Flush file streams */
-	if (nullptr != coded_stream_) {
-		delete coded_stream_;
-		coded_stream_ = nullptr;
+/* Simulated sources report throughput on release. */
+	simulators_.clear();
+
+/* Stop reading counters before consumers are released. */
+	if ((bool)metrics_) {
+		metrics_->Stop();
+		metrics_.reset();
 	}
-	if (nullptr != gzip_stream_) {
-		gzip_stream_->Close();
-		delete gzip_stream_;
-		gzip_stream_ = nullptr;
+
+/* Stop answering control requests before state is released. */
+	if ((bool)control_) {
+		control_->Close();
+		control_.reset();
 	}
-	if (nullptr != output_stream_) {
-		output_stream_->Close();
-		delete output_stream_;
-		output_stream_ = nullptr;
+
+/* Flush file streams */
+	if ((bool)writer_)
+		writer_->Close();
+	if ((bool)etl_) {
+		etl_->Stop();
+		etl_.reset();
 	}
-	if (output_fd_ != -1) {
-		close (output_fd_);
-		output_fd_ = -1;
-		LOG(INFO) << "Closed output file.";
+
+/* Final latency report including the closing flush. */
+	DumpHistograms ("");
+	if (!config_.trace_path.empty()) {
+		trace_t::Stop();
+		trace_t::Write (config_.trace_path);
+	}
+
+/* Stop watching symbol list. */
+	if (-1 != inotify_fd_) {
+		close (inotify_fd_);
+		inotify_fd_ = -1;
 	}
+	pending_symbols_.clear();
 
 /* Signal message pump thread to exit. */
 	if ((bool)event_queue_ && event_queue_->isActive())
 		event_queue_->deactivate();
 
-/* Purge subscription streams. */
-	streams_.clear();
-
 /* Release everything with an RFA dependency. */
 	consumers_.clear();
 	CHECK (log_.use_count() <= 1);
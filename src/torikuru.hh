@@ -6,6 +6,9 @@
 #define __TORIKURU_HH__
 
 #include <cstdint>
+#include <deque>
+#include <string>
+#include <unordered_set>
 
 /* Boost noncopyable base class */
 #include <boost/utility.hpp>
@@ -16,13 +19,13 @@
 /* RFA 7.2 */
 #include <rfa/rfa.hh>
 
-/* Protocol Buffers */
-#include <google/protobuf/io/zero_copy_stream_impl.h>
-#include <google/protobuf/io/coded_stream.h>
-#include <google/protobuf/io/gzip_stream.h>
-
+#include "archive_writer.hh"
 #include "config.hh"
 #include "consumer.hh"
+#include "control.hh"
+#include "etl_stage.hh"
+#include "metrics.hh"
+#include "simulator.hh"
 
 namespace logging
 {
@@ -37,15 +40,6 @@ namespace torikuru
 	class rfa_t;
 	class consumer_t;
 
-/* Basic example structure for application state of an item stream. */
-	class subscription_stream_t : public item_stream_t
-	{
-	public:
-		subscription_stream_t ()
-		{
-		}
-	};
-
 	class torikuru_t :
 		boost::noncopyable
 	{
@@ -68,9 +62,36 @@ namespace torikuru
 /* Run core event loop. */
 		void MainLoop();
 
+/* Archive checkpoint of every item image, started in a new segment and
+ * recorded a budget of images per event loop iteration.
+ */
+		void BeginCheckpoint();
+		void ContinueCheckpoint();
+
+/* Answer one control socket request line. */
+		std::string OnControlRequest (const std::string& request);
+
+/* Log latency histograms matching query, empty for all. */
+		void DumpHistograms (const std::string& query);
+
 /* ETL process. */
 		void Convert();
 
+/* Paced re-emission of the input archive to subscribers. */
+		void Replay();
+
+/* Statistics of each input archive, false if any is unreadable or damaged. */
+		bool Inspect();
+
+/* Rewrite of each input archive for retention, false if any fails. */
+		bool Compact();
+
+/* Live symbol list reload. */
+		bool WatchSymbolList();
+		void CheckSymbolList();
+		bool ReloadSymbolList();
+		void ProcessPendingSymbols();
+
 /* Application configuration. */
 		config_t config_;
 
@@ -86,18 +107,42 @@ namespace torikuru
 /* RFA consumer */
 		std::list<std::shared_ptr<consumer_t>> consumers_;
 		unsigned consumers_in_sync_;
-	
-/* Item stream. */
-		std::list<std::shared_ptr<subscription_stream_t>> streams_;
+
+/* Simulated event sources for sim:// sessions. */
+		std::vector<std::unique_ptr<simulator_t>> simulators_;
+
+/* Symbol list change notification via inotify on the containing directory. */
+		int inotify_fd_;
+		std::string symbol_file_name_;
+
+/* Active symbol set and symbols pending reconciliation against each
+ * consumer directory.
+ */
+		std::unordered_set<std::string> symbol_set_;
+		std::deque<std::string> pending_symbols_;
 
 /* Update fields. */
 		rfa::data::FieldList fields_;
 
-/* File streams */
-		int output_fd_;
-		google::protobuf::io::FileOutputStream* output_stream_;
-		google::protobuf::io::GzipOutputStream* gzip_stream_;
-		google::protobuf::io::CodedOutputStream* coded_stream_;
+/* Archive stream */
+		std::unique_ptr<archive_writer_t> writer_;
+
+/* Checkpoint in progress, next consumer and item id to record. */
+		bool is_checkpointing_;
+		std::list<std::shared_ptr<consumer_t>>::iterator checkpoint_consumer_;
+		item_id_t checkpoint_next_id_;
+
+/* Zstandard dictionary of archive blocks, empty for none. */
+		std::string dictionary_;
+
+/* Inline extraction */
+		std::unique_ptr<etl_stage_t> etl_;
+
+/* Control socket */
+		std::unique_ptr<control_server_t> control_;
+
+/* Performance counter export */
+		std::unique_ptr<metrics_t> metrics_;
 	};
 
 } /* namespace torikuru */
@@ -0,0 +1,254 @@
+/* Pipeline tracing.
+ */
+
+#include "trace.hh"
+
+#include <sys/syscall.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <memory>
+#include <vector>
+
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/locks.hpp>
+
+#include "chromium/logging.hh"
+#include "chromium/safe_strerror_posix.hh"
+#include "counter.hh"
+
+namespace
+{
+
+	struct trace_event_t
+	{
+		const char* name;
+		uint64_t start;
+/* Ticks, zero for instant events. */
+		uint64_t duration;
+		bool is_instant;
+	};
+
+/* Single writer, events are published by the release store of count.  The
+ * writer discards the events of an earlier session itself on its first
+ * event of a new one, readers skip buffers not yet in the current session.
+ */
+	struct trace_buffer_t
+	{
+		trace_buffer_t (size_t capacity_, uint32_t session_) :
+			tid (static_cast<pid_t> (syscall (SYS_gettid))),
+			session (session_),
+			thread_name (nullptr),
+			events (new trace_event_t[capacity_]),
+			capacity (capacity_),
+			count (0)
+		{
+		}
+
+		pid_t tid;
+		std::atomic<uint32_t> session;
+		std::atomic<const char*> thread_name;
+		std::unique_ptr<trace_event_t[]> events;
+		size_t capacity;
+		std::atomic<size_t> count;
+		torikuru::counter_t dropped;
+	};
+
+/* Buffers outlive their threads so that events can still be written out. */
+	boost::mutex g_buffers_lock;
+	std::vector<std::unique_ptr<trace_buffer_t>> g_buffers;
+	size_t g_buffer_size = 0;
+	uint64_t g_origin_ticks = 0;
+/* Incremented by each Start(). */
+	std::atomic<uint32_t> g_session (0);
+
+	thread_local trace_buffer_t* t_buffer = nullptr;
+	thread_local const char* t_thread_name = nullptr;
+
+	trace_buffer_t*
+	GetBuffer()
+	{
+		if (nullptr != t_buffer)
+			return t_buffer;
+		boost::lock_guard<boost::mutex> lock (g_buffers_lock);
+		t_buffer = new trace_buffer_t (g_buffer_size, g_session.load (std::memory_order_relaxed));
+		t_buffer->thread_name.store (t_thread_name, std::memory_order_relaxed);
+		g_buffers.emplace_back (t_buffer);
+		return t_buffer;
+	}
+
+	void
+	Append (
+		const char* name,
+		uint64_t start,
+		uint64_t duration,
+		bool is_instant
+		)
+	{
+		trace_buffer_t* buffer = GetBuffer();
+		const uint32_t session = g_session.load (std::memory_order_relaxed);
+		if (session != buffer->session.load (std::memory_order_relaxed)) {
+			buffer->count.store (0, std::memory_order_relaxed);
+			buffer->dropped.reset();
+			buffer->session.store (session, std::memory_order_release);
+		}
+		const size_t count = buffer->count.load (std::memory_order_relaxed);
+		if (count == buffer->capacity) {
+			buffer->dropped++;
+			return;
+		}
+		trace_event_t& event = buffer->events[count];
+		event.name = name;
+		event.start = start;
+		event.duration = duration;
+		event.is_instant = is_instant;
+		buffer->count.store (count + 1, std::memory_order_release);
+	}
+
+/* Buffer holds events of the current session, caller holds g_buffers_lock. */
+	bool
+	IsCurrent (
+		const trace_buffer_t& buffer
+		)
+	{
+		return g_session.load (std::memory_order_relaxed) == buffer.session.load (std::memory_order_acquire);
+	}
+
+} /* anonymous namespace */
+
+std::atomic<bool> torikuru::trace_t::enabled_ (false);
+
+void
+torikuru::trace_t::Start (
+	size_t buffer_size
+	)
+{
+	{
+		boost::lock_guard<boost::mutex> lock (g_buffers_lock);
+		if (0 == g_buffer_size)
+			g_buffer_size = std::max (size_t (1), buffer_size);
+		g_origin_ticks = clock_service_t::ReadTicks();
+		g_session.fetch_add (1, std::memory_order_relaxed);
+	}
+	enabled_.store (true, std::memory_order_release);
+	LOG(INFO) << "Tracing started, " << g_buffer_size << " events per thread.";
+}
+
+void
+torikuru::trace_t::Stop()
+{
+	enabled_.store (false, std::memory_order_relaxed);
+	LOG(INFO) << "Tracing stopped, " << event_count() << " events, " << dropped_count() << " dropped.";
+}
+
+void
+torikuru::trace_t::SetThreadName (
+	const char* name
+	)
+{
+	t_thread_name = name;
+	if (nullptr != t_buffer)
+		t_buffer->thread_name.store (name, std::memory_order_relaxed);
+}
+
+void
+torikuru::trace_t::AddCompleteEvent (
+	const char* name,
+	uint64_t start_ticks,
+	uint64_t end_ticks
+	)
+{
+	Append (name, start_ticks, end_ticks - start_ticks, false);
+}
+
+void
+torikuru::trace_t::AddInstantEvent (
+	const char* name
+	)
+{
+	Append (name, clock_service_t::ReadTicks(), 0, true);
+}
+
+uint64_t
+torikuru::trace_t::event_count()
+{
+	boost::lock_guard<boost::mutex> lock (g_buffers_lock);
+	uint64_t total = 0;
+	for (const auto& buffer : g_buffers)
+		if (IsCurrent (*buffer))
+			total += buffer->count.load (std::memory_order_acquire);
+	return total;
+}
+
+uint64_t
+torikuru::trace_t::dropped_count()
+{
+	boost::lock_guard<boost::mutex> lock (g_buffers_lock);
+	uint64_t total = 0;
+	for (const auto& buffer : g_buffers)
+		if (IsCurrent (*buffer))
+			total += buffer->dropped.load();
+	return total;
+}
+
+/* Timestamps are microseconds since tracing last started.
+ */
+bool
+torikuru::trace_t::Write (
+	const std::string& path
+	)
+{
+	FILE* fp = fopen (path.c_str(), "w");
+	if (nullptr == fp) {
+		LOG(ERROR) << "Trace file \"" << path << "\": " << safe_strerror (errno);
+		return false;
+	}
+	const pid_t pid = getpid();
+	uint64_t written = 0, dropped = 0;
+	bool is_first = true;
+	fputs ("{ \"displayTimeUnit\": \"ns\", \"traceEvents\": [", fp);
+	{
+		boost::lock_guard<boost::mutex> lock (g_buffers_lock);
+		for (const auto& buffer : g_buffers) {
+			if (!IsCurrent (*buffer))
+				continue;
+			const char* thread_name = buffer->thread_name.load (std::memory_order_relaxed);
+			if (nullptr != thread_name) {
+				fprintf (fp, "%s\n{ \"name\": \"thread_name\", \"ph\": \"M\", \"pid\": %d, \"tid\": %d, \"args\": { \"name\": \"%s\" } }",
+					is_first ? "" : ",", static_cast<int> (pid), static_cast<int> (buffer->tid), thread_name);
+				is_first = false;
+			}
+			const size_t count = buffer->count.load (std::memory_order_acquire);
+			for (size_t i = 0; i < count; ++i) {
+				const trace_event_t& event = buffer->events[i];
+/* Scope opened before a restart. */
+				if (event.start < g_origin_ticks)
+					continue;
+				const double ts = static_cast<double> (clock_service_t::TicksToNanoseconds (event.start - g_origin_ticks)) / 1000.0;
+				if (event.is_instant) {
+					fprintf (fp, "%s\n{ \"name\": \"%s\", \"cat\": \"torikuru\", \"ph\": \"i\", \"s\": \"t\", \"ts\": %.3f, \"pid\": %d, \"tid\": %d }",
+						is_first ? "" : ",", event.name, ts, static_cast<int> (pid), static_cast<int> (buffer->tid));
+				} else {
+					const double dur = static_cast<double> (clock_service_t::TicksToNanoseconds (event.duration)) / 1000.0;
+					fprintf (fp, "%s\n{ \"name\": \"%s\", \"cat\": \"torikuru\", \"ph\": \"X\", \"ts\": %.3f, \"dur\": %.3f, \"pid\": %d, \"tid\": %d }",
+						is_first ? "" : ",", event.name, ts, dur, static_cast<int> (pid), static_cast<int> (buffer->tid));
+				}
+				is_first = false;
+			}
+			written += count;
+			dropped += buffer->dropped.load();
+		}
+	}
+	fputs ("\n] }\n", fp);
+	if (0 != fclose (fp)) {
+		LOG(ERROR) << "Trace file \"" << path << "\": " << safe_strerror (errno);
+		return false;
+	}
+	LOG(INFO) << "Wrote " << written << " trace events to \"" << path << "\", " << dropped << " dropped.";
+	return true;
+}
+
+/* eof */
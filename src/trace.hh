@@ -0,0 +1,95 @@
+/* Pipeline tracing.
+ *
+ * Scoped TRACE_EVENT("name") records a complete event into a per-thread
+ * buffer, names must have static storage, e.g. string literals.  Buffers are
+ * fixed size and written only by their owning thread, events past capacity
+ * are dropped and counted rather than overwriting history.  When tracing is
+ * disabled a scope costs one test of a global flag.  Write() emits Chrome
+ * Trace Event Format JSON for chrome://tracing or Perfetto.
+ */
+
+#ifndef __TRACE_HH__
+#define __TRACE_HH__
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+#include "clock.hh"
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+
+#define TRACE_EVENT(name) \
+	torikuru::trace_scope_t TRACE_CONCAT(trace_scope_, __LINE__) (name)
+
+#define TRACE_EVENT_INSTANT(name) \
+	do { \
+		if (torikuru::trace_t::is_enabled()) \
+			torikuru::trace_t::AddInstantEvent (name); \
+	} while (0)
+
+namespace torikuru
+{
+
+	class trace_t
+	{
+	public:
+/* Begin recording, buffer_size events per thread are allocated on each
+ * thread's first event after the first Start().  Each Start() begins a new
+ * trace, events and drop counts of earlier ones are discarded.
+ */
+		static void Start (size_t buffer_size);
+		static void Stop();
+
+/* Write every event recorded so far, recording may continue meanwhile. */
+		static bool Write (const std::string& path);
+
+/* Label the calling thread in trace output. */
+		static void SetThreadName (const char* name);
+
+		static bool is_enabled() {
+			return enabled_.load (std::memory_order_relaxed);
+		}
+
+		static void AddCompleteEvent (const char* name, uint64_t start_ticks, uint64_t end_ticks);
+		static void AddInstantEvent (const char* name);
+
+/* Totals across all threads. */
+		static uint64_t event_count();
+		static uint64_t dropped_count();
+
+	private:
+		static std::atomic<bool> enabled_;
+	};
+
+	class trace_scope_t
+	{
+	public:
+		explicit trace_scope_t (const char* name) {
+			if (trace_t::is_enabled()) {
+				name_ = name;
+				start_ = clock_service_t::ReadTicks();
+			} else {
+				name_ = nullptr;
+			}
+		}
+		~trace_scope_t() {
+			if (nullptr != name_)
+				trace_t::AddCompleteEvent (name_, start_, clock_service_t::ReadTicks());
+		}
+
+	private:
+		trace_scope_t (const trace_scope_t&);
+		trace_scope_t& operator= (const trace_scope_t&);
+
+		const char* name_;
+		uint64_t start_;
+	};
+
+} /* namespace torikuru */
+
+#endif /* __TRACE_HH__ */
+
+/* eof */